@@ -122,6 +122,109 @@ static int msIO_installFastCGIRedirect()
 }
 
 #endif
+
+/************************************************************************/
+/*                   Request metrics (mapmetrics.c)                     */
+/************************************************************************/
+
+/* counts the bytes written to stdout by a request */
+typedef struct {
+  msIOContext target;
+  double bytes;
+} countingWriterObj;
+
+static int countingWrite(void *cbData, void *data, int byteCount) {
+  countingWriterObj *writer = (countingWriterObj *)cbData;
+  int written = writer->target.readWriteFunc(writer->target.cbData, data,
+                                             byteCount);
+  if (written > 0)
+    writer->bytes += written;
+  return written;
+}
+
+/* the name in names matching value, "other" if none does */
+static const char *knownName(const char *value, const char *const *names,
+                             int numnames) {
+  int i;
+  for (i = 0; i < numnames; i++) {
+    if (strcasecmp(value, names[i]) == 0)
+      return names[i];
+  }
+  return "other";
+}
+
+/*
+** "WMS GetMap", "OGCAPI collections", "mode=BROWSE"... The names label the
+** metrics totals, so values the client makes up are reported as "other".
+*/
+static void getRequestName(mapservObj *mapserv, char *name, size_t size) {
+  static const char *const services[] = {"WMS", "WFS", "WCS", "SOS"};
+  static const char *const requests[] = {
+      "GetCapabilities",  "GetMap",           "GetFeatureInfo",
+      "GetLegendGraphic", "DescribeLayer",    "GetStyles",
+      "GetFeature",       "DescribeFeatureType", "GetPropertyValue",
+      "ListStoredQueries", "DescribeStoredQueries", "DescribeCoverage",
+      "GetCoverage",      "GetObservation",   "DescribeSensor",
+      "capabilities",     "feature_info",     "map"};
+  static const char *const apis[] = {"api", "conformance"};
+  cgiRequestObj *request = mapserv->request;
+  const char *service = NULL, *req = NULL;
+  int i;
+
+  if (request->api_path != NULL && request->api_path_length > 1) {
+    /* api_path is map key, "ogcapi", "collections", id, "items", id */
+    static const char *const collections[] = {"collections", "collection",
+                                              "items", "item"};
+    const int n = request->api_path_length;
+    if (n == 2)
+      snprintf(name, size, "OGCAPI landing");
+    else if (strcmp(request->api_path[2], "collections") == 0)
+      snprintf(name, size, "OGCAPI %s", collections[MS_MIN(n - 3, 3)]);
+    else
+      snprintf(name, size, "OGCAPI %s",
+               knownName(request->api_path[2], apis,
+                         sizeof(apis) / sizeof(apis[0])));
+    return;
+  }
+  for (i = 0; i < request->NumParams; i++) {
+    if (strcasecmp(request->ParamNames[i], "SERVICE") == 0)
+      service = request->ParamValues[i];
+    else if (strcasecmp(request->ParamNames[i], "REQUEST") == 0)
+      req = request->ParamValues[i];
+  }
+  if (req)
+    snprintf(name, size, "%s%s%s",
+             service ? knownName(service, services,
+                                 sizeof(services) / sizeof(services[0]))
+                     : "",
+             service ? " " : "",
+             knownName(req, requests, sizeof(requests) / sizeof(requests[0])));
+  else
+    snprintf(name, size, "mode=%s", msCGIGetModeName(mapserv->Mode));
+}
+
+/* the Prometheus endpoint is only served to local clients, which requires
+ * REMOTE_ADDR to be set */
+static int isMetricsRequest(const char *endpoint) {
+  const char *path_info = getenv("PATH_INFO");
+  const char *remote_addr = getenv("REMOTE_ADDR");
+
+  if (!endpoint || !path_info || strcmp(path_info, endpoint) != 0)
+    return MS_FALSE;
+  if (!remote_addr || (strcmp(remote_addr, "127.0.0.1") != 0 &&
+                       strcmp(remote_addr, "::1") != 0))
+    return MS_FALSE;
+  return MS_TRUE;
+}
+
+static void writeMetrics(void) {
+  char *text = msMetricsGetPrometheusText();
+  msIO_setHeader("Content-Type", "text/plain; version=0.0.4");
+  msIO_sendHeaders();
+  msIO_fwrite(text, 1, strlen(text), stdout);
+  msFree(text);
+}
+
 /************************************************************************/
 /*                                main()                                */
 /************************************************************************/
@@ -131,6 +234,9 @@ int main(int argc, char *argv[]) {
   struct mstimeval requeststarttime, requestendtime;
   mapservObj *mapserv = NULL;
   configObj *config = NULL;
+  msMetricsObj *metrics = NULL;
+  countingWriterObj writer;
+  int status, cachehits = 0, cachemisses = 0;
 
   /*
   ** Process -v and -h command line arguments  first end exit. We want to avoid
@@ -257,6 +363,38 @@ int main(int argc, char *argv[]) {
     mapserv = msAllocMapServObj();
     mapserv->sendheaders = sendheaders; /* override the default if necessary
                                            (via command line -nh switch) */
+    status = MS_FAILURE;
+
+    if (isMetricsRequest(CPLGetConfigOption("MS_METRICS_ENDPOINT", NULL))) {
+      writeMetrics();
+      msFreeMapServObj(mapserv);
+#ifdef USE_FASTCGI
+      continue;
+#else
+      goto end_process;
+#endif
+    }
+
+    /* one JSON line per request to MS_METRICS_LOG and/or totals for the
+     * MS_METRICS_ENDPOINT, see mapmetrics.c */
+    if (CPLGetConfigOption("MS_METRICS_LOG", NULL) ||
+        CPLGetConfigOption("MS_METRICS_ENDPOINT", NULL)) {
+      const mapCacheStatsObj *stats = msCGIGetMapCacheStats();
+      msIOContext context;
+
+      metrics = msMetricsCreate();
+      cachehits = stats->hits;
+      cachemisses = stats->misses;
+
+      writer.target = *msIO_getHandler(stdout);
+      writer.bytes = 0;
+      context.label = writer.target.label;
+      context.write_channel = MS_TRUE;
+      context.readWriteFunc = countingWrite;
+      context.cbData = &writer;
+      msIO_installHandlers(msIO_getHandler(stdin), &context,
+                           msIO_getHandler(stderr));
+    }
 
     mapserv->request->NumParams =
         loadParams(mapserv->request, NULL, NULL, 0, NULL);
@@ -267,10 +405,18 @@ int main(int argc, char *argv[]) {
     }
 
     mapserv->map = msCGILoadMap(mapserv, config);
+    if (metrics) {
+      const mapCacheStatsObj *stats = msCGIGetMapCacheStats();
+      msMetricsAddCount(metrics, NULL, MS_METRIC_CACHE_HITS,
+                        stats->hits - cachehits);
+      msMetricsAddCount(metrics, NULL, MS_METRIC_CACHE_MISSES,
+                        stats->misses - cachemisses);
+    }
     if (!mapserv->map) {
       msCGIWriteError(mapserv);
       goto end_request;
     }
+    mapserv->map->metrics = metrics;
 
     if (mapserv->map->debug >= MS_DEBUGLEVEL_TUNING)
       msGettimeofday(&requeststarttime, NULL);
@@ -295,8 +441,25 @@ int main(int argc, char *argv[]) {
       msCGIWriteError(mapserv);
       goto end_request;
     }
+    status = MS_SUCCESS;
 
   end_request:
+    if (metrics) {
+      char name[128];
+
+      msIO_installHandlers(msIO_getHandler(stdin), &writer.target,
+                           msIO_getHandler(stderr));
+      msMetricsAddCount(metrics, NULL, MS_METRIC_BYTES_WRITTEN, writer.bytes);
+      getRequestName(mapserv, name, sizeof(name));
+      if (msMetricsEndRequest(metrics, name,
+                              mapserv->map ? mapserv->map->name : NULL,
+                              status) != MS_SUCCESS)
+        msWriteError(stderr);
+      if (mapserv->map)
+        mapserv->map->metrics = NULL;
+      msMetricsDestroy(metrics);
+      metrics = NULL;
+    }
     if (mapserv->map && mapserv->map->debug >= MS_DEBUGLEVEL_TUNING) {
       msGettimeofday(&requestendtime, NULL);
       msDebug("mapserv request processing time (msLoadMap not incl.): %.3fs\n",
@@ -309,15 +472,25 @@ int main(int argc, char *argv[]) {
     msResetErrorList();
     continue;
   } /* end fastcgi loop */
+#else
+end_process:
 #endif
 
   /* normal case, processing is complete */
   if (msGetGlobalDebugLevel() >= MS_DEBUGLEVEL_TUNING) {
+    const mapCacheStatsObj *stats = msCGIGetMapCacheStats();
     msGettimeofday(&execendtime, NULL);
     msDebug("mapserv total execution time: %.3fs\n",
             (execendtime.tv_sec + execendtime.tv_usec / 1.0e6) -
                 (execstarttime.tv_sec + execstarttime.tv_usec / 1.0e6));
+    if (stats->hits + stats->misses > 0)
+      msDebug("mapserv mapfile cache: %d hits, %d misses, parse time %.3fs, "
+              "copy time %.3fs\n",
+              stats->hits, stats->misses, stats->parse_time,
+              stats->copy_time);
   }
+  msCGIFreeMapCache();
+  msMetricsCleanup();
   msCleanup();
   msFreeConfig(config);
 
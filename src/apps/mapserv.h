@@ -42,6 +42,10 @@
 
 #include "../cgiutil.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /*
 ** Defines
 */
@@ -57,7 +61,21 @@
        ? MS_URL                                                                \
        : MS_FILE)
 
+/*
+** Counters for the per-process mapfile cache (MS_MAPFILE_CACHE)
+*/
+typedef struct {
+  int hits;
+  int misses;
+  double parse_time; /* seconds spent in msLoadMap() on cache misses */
+  double copy_time;  /* seconds spent copying cached maps on cache hits */
+} mapCacheStatsObj;
+
+MS_DLL_EXPORT const mapCacheStatsObj *msCGIGetMapCacheStats(void);
+MS_DLL_EXPORT void msCGIFreeMapCache(void);
+
 MS_DLL_EXPORT void msCGIWriteError(mapservObj *mapserv);
+MS_DLL_EXPORT const char *msCGIGetModeName(int mode);
 MS_DLL_EXPORT mapObj *msCGILoadMap(mapservObj *mapserv, configObj *context);
 int msCGISetMode(mapservObj *mapserv);
 int msCGILoadForm(mapservObj *mapserv);
@@ -72,4 +90,8 @@ MS_DLL_EXPORT int msCGIDispatchRequest(mapservObj *mapserv);
 MS_DLL_EXPORT int msCGIIsAPIRequest(mapservObj *mapserv);
 MS_DLL_EXPORT int msCGIDispatchAPIRequest(mapservObj *mapserv);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* MAPSERV_H */
@@ -0,0 +1,739 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Commandline utility replaying requests against a mapfile
+ *           in-process and reporting latency percentiles as JSON.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2024 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** The request file has one request per line, blank lines and lines starting
+** with # are ignored:
+**
+**   bbox minx miny maxx maxy [width height]
+**       draws the map with msDrawMap() and encodes it, like map2img
+**   [http://host/path]?SERVICE=WMS&REQUEST=GetMap&...
+**       a mapserv query string (any MAP parameter is ignored), dispatched
+**       like mapserv does, output is discarded
+**   http://host/path/ogcapi/collections/...?f=json
+**       an OGC API request, the path from /ogcapi on is used
+**
+** Every request is replayed -w times to warm up the caches, then -n times
+** for the measure. Latencies are aggregated by request type, and by layer
+** for the bbox requests (each layer drawn on its own with msDrawLayer(),
+** labels not rendered).
+**
+** The exit status is 1 if any of the requests failed.
+*/
+
+#include "../mapserver.h"
+#include "../maptime.h"
+#include "../mapio.h"
+#include "../cgiutil.h"
+#include "../mapserv-config.h"
+#include "mapserv.h"
+
+#include "cpl_conv.h"
+
+#include <limits.h>
+#include <math.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#define MSBENCH_MAP_KEY "MSBENCH"
+
+/* -------------------------------------------------------------------- */
+/*      Allocation counting, opt-in with -DWITH_MSBENCH_ALLOC_COUNT=ON  */
+/*      and glibc only: the allocation functions of the executable     */
+/*      take precedence over the ones of libc for the whole process,   */
+/*      including libmapserver and its dependencies. This does not mix */
+/*      with the sanitizers, which replace them too.                   */
+/* -------------------------------------------------------------------- */
+#ifdef MSBENCH_ALLOC_COUNT
+#ifndef __GLIBC__
+#error "MSBENCH_ALLOC_COUNT requires glibc"
+#endif
+static unsigned long allocation_count = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+  __atomic_add_fetch(&allocation_count, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  __atomic_add_fetch(&allocation_count, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  __atomic_add_fetch(&allocation_count, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+static unsigned long getAllocationCount(void) {
+  return __atomic_load_n(&allocation_count, __ATOMIC_RELAXED);
+}
+#else
+static unsigned long getAllocationCount(void) { return 0; }
+#endif
+
+enum { BENCH_DRAW, BENCH_CGI, BENCH_API };
+
+typedef struct {
+  int kind;
+  char *type; /* the name the statistics are aggregated under */
+  rectObj extent;
+  int width, height; /* 0 for the size of the mapfile */
+  char *query;       /* query string */
+  char **api_path;   /* path components from ogcapi on */
+  int api_path_length;
+} benchRequestObj;
+
+typedef struct {
+  char *name;
+  double *samples; /* milliseconds */
+  int numsamples;
+  int maxsamples;
+  int errors;
+  double bytes;       /* output bytes of all the samples */
+  double allocations; /* allocations made during all the samples */
+} benchStatObj;
+
+typedef struct {
+  benchStatObj *stats;
+  int numstats;
+} benchStatListObj;
+
+static double elapsedMs(const struct mstimeval *start,
+                        const struct mstimeval *end) {
+  return (end->tv_sec - start->tv_sec) * 1000.0 +
+         (end->tv_usec - start->tv_usec) / 1000.0;
+}
+
+static benchStatObj *getStat(benchStatListObj *list, const char *name) {
+  int i;
+  for (i = 0; i < list->numstats; i++) {
+    if (strcmp(list->stats[i].name, name) == 0)
+      return &(list->stats[i]);
+  }
+  list->stats = (benchStatObj *)msSmallRealloc(
+      list->stats, sizeof(benchStatObj) * (list->numstats + 1));
+  memset(&(list->stats[list->numstats]), 0, sizeof(benchStatObj));
+  list->stats[list->numstats].name = msStrdup(name);
+  return &(list->stats[list->numstats++]);
+}
+
+static void addSample(benchStatObj *stat, double ms, int status,
+                      double bytes, unsigned long allocations) {
+  if (status != MS_SUCCESS) {
+    stat->errors++;
+    return;
+  }
+  if (stat->numsamples == stat->maxsamples) {
+    stat->maxsamples = stat->maxsamples ? stat->maxsamples * 2 : 64;
+    stat->samples = (double *)msSmallRealloc(
+        stat->samples, sizeof(double) * stat->maxsamples);
+  }
+  stat->samples[stat->numsamples++] = ms;
+  stat->bytes += bytes;
+  stat->allocations += allocations;
+}
+
+static void freeStats(benchStatListObj *list) {
+  int i;
+  for (i = 0; i < list->numstats; i++) {
+    msFree(list->stats[i].name);
+    msFree(list->stats[i].samples);
+  }
+  msFree(list->stats);
+  list->stats = NULL;
+  list->numstats = 0;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+  const double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+/* nearest rank percentile of sorted samples */
+static double percentile(const double *samples, int n, double p) {
+  int rank = (int)ceil(p / 100.0 * n);
+  if (rank < 1)
+    rank = 1;
+  return samples[rank - 1];
+}
+
+static void writeJSONString(FILE *fp, const char *s) {
+  fputc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(fp, "\\u%04x", *s);
+    else
+      fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+static void writeStats(FILE *fp, const char *name, benchStatListObj *list) {
+  int i;
+
+  fprintf(fp, "  \"%s\": [", name);
+  for (i = 0; i < list->numstats; i++) {
+    benchStatObj *stat = &(list->stats[i]);
+    double sum = 0;
+    int j;
+
+    qsort(stat->samples, stat->numsamples, sizeof(double), compareDoubles);
+    for (j = 0; j < stat->numsamples; j++)
+      sum += stat->samples[j];
+
+    fprintf(fp, "%s\n    {\"name\": ", i > 0 ? "," : "");
+    writeJSONString(fp, stat->name);
+    fprintf(fp, ", \"count\": %d, \"errors\": %d", stat->numsamples,
+            stat->errors);
+    if (stat->numsamples > 0) {
+      fprintf(fp,
+              ", \"mean_ms\": %.3f, \"min_ms\": %.3f, \"p50_ms\": %.3f, "
+              "\"p95_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, "
+              "\"mean_bytes\": %.0f",
+              sum / stat->numsamples, stat->samples[0],
+              percentile(stat->samples, stat->numsamples, 50),
+              percentile(stat->samples, stat->numsamples, 95),
+              percentile(stat->samples, stat->numsamples, 99),
+              stat->samples[stat->numsamples - 1],
+              stat->bytes / stat->numsamples);
+#ifdef MSBENCH_ALLOC_COUNT
+      fprintf(fp, ", \"mean_allocations\": %.0f",
+              stat->allocations / stat->numsamples);
+#endif
+    }
+    fprintf(fp, "}");
+  }
+  fprintf(fp, "%s]", list->numstats > 0 ? "\n  " : "");
+}
+
+/************************************************************************/
+/*                          Request parsing                             */
+/************************************************************************/
+
+static const char *getQueryParam(char **names, char **values, int n,
+                                 const char *name) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (strcasecmp(names[i], name) == 0)
+      return values[i];
+  }
+  return NULL;
+}
+
+/* name of the statistics of a query string: "WMS GetMap", "mode=map"... */
+static char *getQueryType(const char *query) {
+  char *type = NULL;
+  char **params;
+  char **names, **values;
+  int numparams = 0, i;
+  const char *service, *request, *mode;
+
+  params = msStringSplit(query, '&', &numparams);
+  names = (char **)msSmallCalloc(numparams + 1, sizeof(char *));
+  values = (char **)msSmallCalloc(numparams + 1, sizeof(char *));
+  for (i = 0; i < numparams; i++) {
+    char *equal = strchr(params[i], '=');
+    names[i] = params[i];
+    values[i] = equal ? equal + 1 : (char *)"";
+    if (equal)
+      *equal = '\0';
+  }
+
+  service = getQueryParam(names, values, numparams, "SERVICE");
+  request = getQueryParam(names, values, numparams, "REQUEST");
+  mode = getQueryParam(names, values, numparams, "mode");
+  if (request) {
+    type = msStrdup(service ? service : "");
+    msStringToUpper(type);
+    if (*type)
+      type = msStringConcatenate(type, " ");
+    type = msStringConcatenate(type, request);
+  } else if (mode) {
+    type = msStrdup("mode=");
+    type = msStringConcatenate(type, mode);
+  } else {
+    type = msStrdup("cgi");
+  }
+
+  msFree(names);
+  msFree(values);
+  msFreeCharArray(params, numparams);
+  return type;
+}
+
+static char *getAPIType(char **path, int n) {
+  /* path[0] is ogcapi */
+  if (n <= 1)
+    return msStrdup("OGCAPI landing");
+  if (strcmp(path[1], "collections") == 0) {
+    if (n == 2)
+      return msStrdup("OGCAPI collections");
+    if (n == 3)
+      return msStrdup("OGCAPI collection");
+    if (n == 4)
+      return msStrdup("OGCAPI items");
+    return msStrdup("OGCAPI item");
+  }
+  return msStringConcatenate(msStrdup("OGCAPI "), path[1]);
+}
+
+static int parseRequest(char *line, benchRequestObj *req) {
+  char **tokens;
+  int numtokens = 0;
+
+  memset(req, 0, sizeof(benchRequestObj));
+
+  tokens = msStringSplitComplex(line, " \t", &numtokens, MS_HONOURSTRINGS);
+  if (numtokens > 0 && strcasecmp(tokens[0], "bbox") == 0) {
+    if (numtokens != 5 && numtokens != 7) {
+      msFreeCharArray(tokens, numtokens);
+      return MS_FAILURE;
+    }
+    req->kind = BENCH_DRAW;
+    req->type = msStrdup("draw");
+    req->extent.minx = atof(tokens[1]);
+    req->extent.miny = atof(tokens[2]);
+    req->extent.maxx = atof(tokens[3]);
+    req->extent.maxy = atof(tokens[4]);
+    if (numtokens == 7) {
+      req->width = atoi(tokens[5]);
+      req->height = atoi(tokens[6]);
+    }
+    msFreeCharArray(tokens, numtokens);
+    return MS_SUCCESS;
+  }
+  msFreeCharArray(tokens, numtokens);
+
+  {
+    char *url = msStrdup(line);
+    char *query = strchr(url, '?');
+    const char *api;
+
+    if (query)
+      *(query++) = '\0';
+    else if (strchr(url, '=') != NULL || strchr(url, '/') == NULL) {
+      query = url; /* a bare query string */
+    } else
+      query = url + strlen(url);
+
+    api = query != url ? strstr(url, "/ogcapi") : NULL;
+    if (api && (api[7] == '\0' || api[7] == '/')) {
+      int k, n = 0;
+      req->kind = BENCH_API;
+      req->api_path = msStringSplit(api + 1, '/', &(req->api_path_length));
+      /* drop the empty components, like msCGIIsAPIRequest() */
+      for (k = 0; k < req->api_path_length; k++) {
+        if (req->api_path[k][0] == '\0')
+          msFree(req->api_path[k]);
+        else
+          req->api_path[n++] = req->api_path[k];
+      }
+      req->api_path_length = n;
+      req->type = getAPIType(req->api_path, req->api_path_length);
+    } else {
+      req->kind = BENCH_CGI;
+      req->type = getQueryType(query);
+    }
+    req->query = msStrdup(query);
+    msFree(url);
+  }
+
+  return MS_SUCCESS;
+}
+
+static void freeRequest(benchRequestObj *req) {
+  msFree(req->type);
+  msFree(req->query);
+  msFreeCharArray(req->api_path, req->api_path_length);
+}
+
+/************************************************************************/
+/*                          Request execution                           */
+/************************************************************************/
+
+/* output is counted and discarded */
+static int countBytes(void *cbData, void *data, int byteCount) {
+  (void)data;
+  *(double *)cbData += byteCount;
+  return byteCount;
+}
+
+static int runCGIRequest(const benchRequestObj *req, configObj *config,
+                         double *bytes) {
+  mapservObj *mapserv = msAllocMapServObj();
+  cgiRequestObj *request = mapserv->request;
+  int maxparams = MS_DEFAULT_CGI_PARAMS;
+  char *query = msStrdup(req->query);
+  char *next = query;
+  msIOContext context;
+  int status, m = 0;
+
+  request->type = MS_GET_REQUEST;
+  while (*next != '\0') {
+    char *value, *name;
+    if (m + 1 >= maxparams) {
+      maxparams *= 2;
+      request->ParamNames = (char **)msSmallRealloc(
+          request->ParamNames, sizeof(char *) * maxparams);
+      request->ParamValues = (char **)msSmallRealloc(
+          request->ParamValues, sizeof(char *) * maxparams);
+    }
+    value = makeword(next, '&');
+    plustospace(value);
+    unescape_url(value);
+    name = makeword(value, '=');
+    if (strcasecmp(name, "map") == 0) {
+      msFree(name);
+      msFree(value);
+      continue;
+    }
+    request->ParamNames[m] = name;
+    request->ParamValues[m] = value;
+    m++;
+  }
+  msFree(query);
+
+  if (req->kind == BENCH_API) {
+    int i;
+    request->api_path =
+        (char **)msSmallMalloc(sizeof(char *) * (req->api_path_length + 1));
+    request->api_path[0] = msStrdup(MSBENCH_MAP_KEY);
+    for (i = 0; i < req->api_path_length; i++)
+      request->api_path[i + 1] = msStrdup(req->api_path[i]);
+    request->api_path_length = req->api_path_length + 1;
+  } else {
+    request->ParamNames[m] = msStrdup("map");
+    request->ParamValues[m] = msStrdup(MSBENCH_MAP_KEY);
+    m++;
+  }
+  request->NumParams = m;
+
+  memset(&context, 0, sizeof(context));
+  context.label = "msbench";
+  context.write_channel = MS_TRUE;
+  context.readWriteFunc = countBytes;
+  context.cbData = bytes;
+  msIO_installHandlers(NULL, &context, NULL);
+
+  mapserv->map = msCGILoadMap(mapserv, config);
+  if (!mapserv->map)
+    status = MS_FAILURE;
+  else if (req->kind == BENCH_API)
+    status = msCGIDispatchAPIRequest(mapserv);
+  else
+    status = msCGIDispatchRequest(mapserv);
+
+  msIO_resetHandlers();
+  msFreeMapServObj(mapserv);
+  return status;
+}
+
+static int runDrawRequest(mapObj *map, const benchRequestObj *req,
+                          double *bytes) {
+  imageObj *image;
+  unsigned char *buffer;
+  int size = 0;
+
+  map->extent = req->extent;
+  if (req->width > 0 && req->height > 0)
+    msMapSetSize(map, req->width, req->height);
+
+  image = msDrawMap(map, MS_FALSE);
+  if (!image)
+    return MS_FAILURE;
+
+  buffer = msSaveImageBuffer(image, &size, map->outputformat);
+  msFreeImage(image);
+  if (!buffer)
+    return MS_FAILURE;
+  msFree(buffer);
+  *bytes = size;
+  return MS_SUCCESS;
+}
+
+static void runDrawLayers(mapObj *map, const benchRequestObj *req,
+                          int iterations, benchStatListObj *layerstats) {
+  int i, j;
+
+  map->extent = req->extent;
+  if (req->width > 0 && req->height > 0)
+    msMapSetSize(map, req->width, req->height);
+
+  for (i = 0; i < map->numlayers; i++) {
+    layerObj *lp = GET_LAYER(map, map->layerorder[i]);
+
+    for (j = 0; j < iterations; j++) {
+      struct mstimeval start, end;
+      unsigned long allocations;
+      imageObj *image;
+      int status;
+
+      allocations = getAllocationCount();
+      msGettimeofday(&start, NULL);
+      image = msPrepareImage(map, MS_FALSE);
+      if (!image)
+        return;
+      if (!msLayerIsVisible(map, lp)) {
+        msFreeImage(image);
+        break;
+      }
+      status = msDrawLayer(map, lp, image);
+      msFreeImage(image);
+      msGettimeofday(&end, NULL);
+      allocations = getAllocationCount() - allocations;
+
+      addSample(getStat(layerstats, lp->name ? lp->name : "(null)"),
+                elapsedMs(&start, &end), status, 0, allocations);
+      msResetErrorList();
+    }
+  }
+}
+
+static void usage(void) {
+  fprintf(stdout,
+          "Syntax: msbench -m mapfile -r requestfile [-n iterations] "
+          "[-w warmup]\n"
+          "               [-o report.json] [-conf filename] [-nolayers]\n");
+  fprintf(stdout, "  -m mapfile: Map file to operate on - required\n");
+  fprintf(stdout, "  -r requestfile: requests to replay, one per line - "
+                  "required\n");
+  fprintf(stdout, "  -n iterations: measured runs of each request "
+                  "(default 10)\n");
+  fprintf(stdout, "  -w warmup: unmeasured runs of each request first "
+                  "(default 1)\n");
+  fprintf(stdout, "  -o report.json: output filename (stdout if not "
+                  "provided)\n");
+  fprintf(stdout,
+          "  -conf filename: filename of the MapServer configuration file.\n");
+  fprintf(stdout, "  -nolayers: skip the per layer timings of the bbox "
+                  "requests\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *mapfile = NULL, *requestfile = NULL, *outfile = NULL;
+  const char *config_filename = NULL;
+  int iterations = 10, warmup = 1, layers = MS_TRUE;
+  configObj *config;
+  mapObj *map;
+  benchRequestObj *requests = NULL;
+  int numrequests = 0, failed = MS_FALSE, i, j;
+  benchStatListObj requeststats = {NULL, 0}, layerstats = {NULL, 0};
+  struct mstimeval start, end;
+  VSILFILE *fp;
+  const char *line;
+  FILE *out;
+
+  if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-m") == 0 && i < argc - 1)
+      mapfile = argv[++i];
+    else if (strcmp(argv[i], "-r") == 0 && i < argc - 1)
+      requestfile = argv[++i];
+    else if (strcmp(argv[i], "-o") == 0 && i < argc - 1)
+      outfile = argv[++i];
+    else if (strcmp(argv[i], "-n") == 0 && i < argc - 1)
+      iterations = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-w") == 0 && i < argc - 1)
+      warmup = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-conf") == 0 && i < argc - 1)
+      config_filename = argv[++i];
+    else if (strcmp(argv[i], "-nolayers") == 0)
+      layers = MS_FALSE;
+    else {
+      usage();
+      exit(1);
+    }
+  }
+
+  if (!mapfile || !requestfile || iterations <= 0 || warmup < 0) {
+    usage();
+    exit(1);
+  }
+
+  if (msSetup() != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  /* Use PROJ_DATA/PROJ_LIB env vars if set */
+  msProjDataInitFromEnv();
+
+  /* Use MS_ERRORFILE and MS_DEBUGLEVEL env vars if set */
+  if (msDebugInitFromEnv() != MS_SUCCESS) {
+    msWriteError(stderr);
+    msCleanup();
+    exit(1);
+  }
+
+  config = msLoadConfig(config_filename);
+  if (!config) {
+    msWriteError(stderr);
+    msCleanup();
+    exit(1);
+  }
+  /* the service requests load the mapfile by this key, see msCGILoadMap() */
+  msInsertHashTable(&(config->maps), MSBENCH_MAP_KEY, mapfile);
+
+  map = msLoadMap(mapfile, NULL, config);
+  if (!map) {
+    msWriteError(stderr);
+    msFreeConfig(config);
+    msCleanup();
+    exit(1);
+  }
+  msApplyDefaultSubstitutions(map);
+
+  fp = VSIFOpenL(requestfile, "rb");
+  if (!fp) {
+    fprintf(stderr, "Unable to open %s.\n", requestfile);
+    msFreeMap(map);
+    msFreeConfig(config);
+    msCleanup();
+    exit(1);
+  }
+  while ((line = CPLReadLineL(fp)) != NULL) {
+    char *request = msStrdup(line);
+    msStringTrim(request);
+    if (request[0] != '\0' && request[0] != '#') {
+      requests = (benchRequestObj *)msSmallRealloc(
+          requests, sizeof(benchRequestObj) * (numrequests + 1));
+      if (parseRequest(request, &(requests[numrequests])) == MS_SUCCESS)
+        numrequests++;
+      else
+        fprintf(stderr, "Ignoring invalid request: %s\n", request);
+    }
+    msFree(request);
+  }
+  VSIFCloseL(fp);
+
+  msGettimeofday(&start, NULL);
+
+  for (i = 0; i < numrequests; i++) {
+    benchRequestObj *req = &(requests[i]);
+    benchStatObj *stat = getStat(&requeststats, req->type);
+
+    for (j = 0; j < warmup + iterations; j++) {
+      struct mstimeval reqstart, reqend;
+      unsigned long allocations;
+      double bytes = 0;
+      int status;
+
+      /* the counter is process wide, only the difference is per request */
+      allocations = getAllocationCount();
+      msGettimeofday(&reqstart, NULL);
+      if (req->kind == BENCH_DRAW)
+        status = runDrawRequest(map, req, &bytes);
+      else
+        status = runCGIRequest(req, config, &bytes);
+      msGettimeofday(&reqend, NULL);
+      allocations = getAllocationCount() - allocations;
+
+      if (status != MS_SUCCESS) {
+        if (j == 0) {
+          fprintf(stderr, "Request %d (%s) failed:\n", i + 1, req->type);
+          msWriteError(stderr);
+        }
+        failed = MS_TRUE;
+      }
+      msResetErrorList();
+
+      if (j >= warmup)
+        addSample(stat, elapsedMs(&reqstart, &reqend), status, bytes,
+                  allocations);
+    }
+
+    if (req->kind == BENCH_DRAW && layers)
+      runDrawLayers(map, req, iterations, &layerstats);
+  }
+
+  msGettimeofday(&end, NULL);
+
+  out = outfile ? fopen(outfile, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "Unable to create %s.\n", outfile);
+    out = stdout;
+  }
+
+  fprintf(out, "{\n  \"version\": ");
+  writeJSONString(out, msGetVersion());
+  fprintf(out, ",\n  \"mapfile\": ");
+  writeJSONString(out, mapfile);
+  fprintf(out, ",\n  \"requests_file\": ");
+  writeJSONString(out, requestfile);
+  fprintf(out,
+          ",\n  \"iterations\": %d,\n  \"warmup\": %d,\n"
+          "  \"total_s\": %.3f,\n",
+          iterations, warmup, elapsedMs(&start, &end) / 1000.0);
+  writeStats(out, "requests", &requeststats);
+  fprintf(out, ",\n");
+  writeStats(out, "layers", &layerstats);
+#ifndef _WIN32
+  {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+      const long maxrss_kb = (long)(usage.ru_maxrss / 1024);
+#else
+      const long maxrss_kb = (long)usage.ru_maxrss;
+#endif
+      fprintf(out, ",\n  \"peak_rss_kb\": %ld", maxrss_kb);
+    }
+  }
+#endif
+#ifdef MSBENCH_ALLOC_COUNT
+  fprintf(out, ",\n  \"allocations\": %lu", getAllocationCount());
+#endif
+  fprintf(out, "\n}\n");
+  if (out != stdout)
+    fclose(out);
+
+  for (i = 0; i < numrequests; i++)
+    freeRequest(&(requests[i]));
+  msFree(requests);
+  freeStats(&requeststats);
+  freeStats(&layerstats);
+  msFreeMap(map);
+  msFreeConfig(config);
+  msCleanup();
+  return failed ? 1 : 0;
+}
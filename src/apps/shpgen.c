@@ -0,0 +1,144 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Commandline utility to generate .shg generalized shapefile geometry.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2024 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "../mapserver.h"
+#include <string.h>
+
+char *AddFileSuffix(const char *Filename, const char *Suffix) {
+  char *pszFullname, *pszBasename;
+  int i;
+
+  /* -------------------------------------------------------------------- */
+  /*  Compute the base (layer) name.  If there is any extension     */
+  /*  on the passed in filename we will strip it off.         */
+  /* -------------------------------------------------------------------- */
+  pszBasename = (char *)msSmallMalloc(strlen(Filename) + 5);
+  strcpy(pszBasename, Filename);
+  for (i = (int)strlen(pszBasename) - 1;
+       i > 0 && pszBasename[i] != '.' && pszBasename[i] != '/' &&
+       pszBasename[i] != '\\';
+       i--) {
+  }
+
+  if (pszBasename[i] == '.')
+    pszBasename[i] = '\0';
+
+  pszFullname = (char *)msSmallMalloc(strlen(pszBasename) + 5);
+  sprintf(pszFullname, "%s%s", pszBasename, Suffix);
+
+  free(pszBasename);
+  return (pszFullname);
+}
+
+#define SHPGEN_DEFAULT_LEVELS 5
+
+int main(int argc, char *argv[]) {
+  shapefileObj shapefile;
+  double tolerances[MS_GENERALIZED_MAX_LEVELS];
+  int numlevels = 0;
+  char *filename;
+  int i, j, status;
+
+  if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  if (argc < 2) {
+    fprintf(stdout, "Syntax:\n");
+    fprintf(stdout, "    shpgen <shpfile> [<tolerance>...]\n");
+    fprintf(stdout, "Where:\n");
+    fprintf(stdout,
+            " <shpfile> is the name of the line or polygon .shp file.\n");
+    fprintf(stdout,
+            " <tolerance> (optional) are the simplification tolerances of\n");
+    fprintf(stdout,
+            "           the levels, in shapefile units, at most %d. The\n",
+            MS_GENERALIZED_MAX_LEVELS);
+    fprintf(stdout,
+            "           default is %d levels, from 1/256th to 1/65536th of\n",
+            SHPGEN_DEFAULT_LEVELS);
+    fprintf(stdout, "           the shapefile extent.\n");
+    fprintf(stdout,
+            "Maps with pixels at least as large as the tolerance of a level\n");
+    fprintf(stdout, "are drawn from that level of the %s file.\n\n",
+            MS_GENERALIZED_EXTENSION);
+    exit(0);
+  }
+
+  if (argc - 2 > MS_GENERALIZED_MAX_LEVELS) {
+    fprintf(stdout, "At most %d tolerances can be given.\n",
+            MS_GENERALIZED_MAX_LEVELS);
+    exit(1);
+  }
+
+  if (msShapefileOpen(&shapefile, "rb", argv[1], MS_TRUE) == -1) {
+    fprintf(stdout, "Error opening shapefile %s.\n", argv[1]);
+    exit(1);
+  }
+
+  if (argc > 2) {
+    for (i = 2; i < argc; i++)
+      tolerances[numlevels++] = atof(argv[i]);
+  } else {
+    const double size =
+        MS_MAX(shapefile.bounds.maxx - shapefile.bounds.minx,
+               shapefile.bounds.maxy - shapefile.bounds.miny);
+    for (i = 0; i < SHPGEN_DEFAULT_LEVELS; i++)
+      tolerances[numlevels++] = size / (65536 >> (2 * i));
+  }
+
+  /* levels by increasing tolerance */
+  for (i = 1; i < numlevels; i++) {
+    for (j = i; j > 0 && tolerances[j] < tolerances[j - 1]; j--) {
+      const double t = tolerances[j];
+      tolerances[j] = tolerances[j - 1];
+      tolerances[j - 1] = t;
+    }
+  }
+
+  filename = AddFileSuffix(argv[1], MS_GENERALIZED_EXTENSION);
+  printf("creating generalized geometry %s, tolerances", filename);
+  for (i = 0; i < numlevels; i++)
+    printf(" %g", tolerances[i]);
+  printf("\n");
+
+  status = msWriteGeneralizedShapes(&shapefile, filename, numlevels,
+                                    tolerances);
+  if (status != MS_SUCCESS)
+    msWriteError(stderr);
+
+  /*
+  ** Clean things up
+  */
+  free(filename);
+  msShapefileClose(&shapefile);
+
+  return (status == MS_SUCCESS ? 0 : 1);
+}
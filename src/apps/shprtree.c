@@ -0,0 +1,108 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Commandline utility to generate .qrt shapefile spatial indexes.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2024 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "../mapserver.h"
+#include "../maptree.h"
+#include <string.h>
+
+char *AddFileSuffix(const char *Filename, const char *Suffix) {
+  char *pszFullname, *pszBasename;
+  int i;
+
+  /* -------------------------------------------------------------------- */
+  /*  Compute the base (layer) name.  If there is any extension     */
+  /*  on the passed in filename we will strip it off.         */
+  /* -------------------------------------------------------------------- */
+  pszBasename = (char *)msSmallMalloc(strlen(Filename) + 5);
+  strcpy(pszBasename, Filename);
+  for (i = (int)strlen(pszBasename) - 1;
+       i > 0 && pszBasename[i] != '.' && pszBasename[i] != '/' &&
+       pszBasename[i] != '\\';
+       i--) {
+  }
+
+  if (pszBasename[i] == '.')
+    pszBasename[i] = '\0';
+
+  pszFullname = (char *)msSmallMalloc(strlen(pszBasename) + 5);
+  sprintf(pszFullname, "%s%s", pszBasename, Suffix);
+
+  free(pszBasename);
+  return (pszFullname);
+}
+
+int main(int argc, char *argv[]) {
+  shapefileObj shapefile;
+  int nodesize = MS_RTREE_DEFAULT_NODESIZE;
+  char *filename;
+  int status;
+
+  if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  if (argc < 2) {
+    fprintf(stdout, "Syntax:\n");
+    fprintf(stdout, "    shprtree <shpfile> [<node_size>]\n");
+    fprintf(stdout, "Where:\n");
+    fprintf(stdout, " <shpfile> is the name of the .shp file to index.\n");
+    fprintf(stdout,
+            " <node_size> (optional) is the number of entries per node of\n");
+    fprintf(stdout, "           the packed R-tree, default is %d.\n",
+            MS_RTREE_DEFAULT_NODESIZE);
+    fprintf(stdout,
+            "The %s index is used instead of a %s index when both exist.\n\n",
+            MS_RTREE_INDEX_EXTENSION, MS_INDEX_EXTENSION);
+    exit(0);
+  }
+
+  if (argc >= 3)
+    nodesize = atoi(argv[2]);
+
+  if (msShapefileOpen(&shapefile, "rb", argv[1], MS_TRUE) == -1) {
+    fprintf(stdout, "Error opening shapefile %s.\n", argv[1]);
+    exit(1);
+  }
+
+  filename = AddFileSuffix(argv[1], MS_RTREE_INDEX_EXTENSION);
+  printf("creating packed R-tree index %s\n", filename);
+
+  status = msWriteRTree(&shapefile, filename, nodesize);
+  if (status != MS_SUCCESS)
+    msWriteError(stderr);
+
+  /*
+  ** Clean things up
+  */
+  free(filename);
+  msShapefileClose(&shapefile);
+
+  return (status == MS_SUCCESS ? 0 : 1);
+}
@@ -118,12 +118,12 @@ int main(int argc, char **argv)
   /*  Skim over the list of shapes, printing all the vertices.  */
   /* -------------------------------------------------------------------- */
 
-  pos = ftell(qix->fp);
+  pos = msSHPDiskTreeTell(qix);
   j = 0;
 
   while (pos && j < 20) {
     j++;
-    /*      fprintf (stderr,"box %d, at %d pos \n", j, (int) ftell(qix));
+    /*      fprintf (stderr,"box %d, at %d pos \n", j, (int) msSHPDiskTreeTell(qix));
      */
 
     node = readTreeNode(qix);
@@ -138,7 +138,7 @@ int main(int argc, char **argv)
   }
 
   printf("read entire file now at quad box rec %d file pos %ld\n", j,
-         ftell(qix->fp));
+         msSHPDiskTreeTell(qix));
 
   j = qix->nShapes;
   msSHPDiskTreeClose(qix);
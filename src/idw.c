@@ -32,27 +32,145 @@
 #define EPSILON 0.000000001
 #include <time.h>
 
-void msIdw(float *xyz, int width, int height, int npoints,
-           interpolationProcessingParams *interpParams,
-           unsigned char *iValues) {
-  int i, j, index;
-  int radius = interpParams->radius;
-  float power = interpParams->power;
-  for (j = 0; j < height; j++) {
-    for (i = 0; i < width; i++) {
+#include "cpl_multiproc.h"
+
+/* smallest side, in pixels, of the buckets the samples are sorted into */
+#define IDW_MIN_BUCKET_SIZE 16
+
+typedef struct {
+  const float *xyz;
+  int width;
+  int radius;
+  double power;
+  int ipower; /* power as an integer, or 0 if pow() must be used */
+
+  /* samples bucketed on a regular grid of bucketsize pixels: the samples of
+   * bucket b are bucketpoints[bucketstart[b] .. bucketstart[b+1]-1] */
+  int bucketsize, ncols, nrows;
+  int *bucketstart;
+  int *bucketpoints;
+
+  unsigned char *iValues;
+  int firstrow, lastrow;
+} idwJobObj;
+
+static void idwBuildBuckets(idwJobObj *job, int npoints) {
+  int index, b, maxx = 0, maxy = 0;
+  int *fill;
+
+  for (index = 0; index < npoints; index++) {
+    maxx = MS_MAX(maxx, (int)job->xyz[index * 3]);
+    maxy = MS_MAX(maxy, (int)job->xyz[index * 3 + 1]);
+  }
+  job->bucketsize = MS_MAX(job->radius, IDW_MIN_BUCKET_SIZE);
+  job->ncols = maxx / job->bucketsize + 1;
+  job->nrows = maxy / job->bucketsize + 1;
+
+  job->bucketstart =
+      msSmallCalloc((size_t)job->ncols * job->nrows + 1, sizeof(int));
+  job->bucketpoints = msSmallMalloc((size_t)npoints * sizeof(int));
+  for (index = 0; index < npoints; index++) {
+    b = ((int)job->xyz[index * 3 + 1] / job->bucketsize) * job->ncols +
+        (int)job->xyz[index * 3] / job->bucketsize;
+    job->bucketstart[b + 1]++;
+  }
+  for (b = 0; b < job->ncols * job->nrows; b++)
+    job->bucketstart[b + 1] += job->bucketstart[b];
+
+  /* counting sort, keeps the original sample order inside each bucket */
+  fill = msSmallMalloc((size_t)job->ncols * job->nrows * sizeof(int));
+  memcpy(fill, job->bucketstart, (size_t)job->ncols * job->nrows * sizeof(int));
+  for (index = 0; index < npoints; index++) {
+    b = ((int)job->xyz[index * 3 + 1] / job->bucketsize) * job->ncols +
+        (int)job->xyz[index * 3] / job->bucketsize;
+    job->bucketpoints[fill[b]++] = index * 3;
+  }
+  free(fill);
+}
+
+static void idwRows(void *arg) {
+  const idwJobObj *job = (const idwJobObj *)arg;
+  const float *xyz = job->xyz;
+  int i, j, n, p, bx, by;
+  double radius2 = (double)job->radius * job->radius;
+
+  for (j = job->firstrow; j < job->lastrow; j++) {
+    int by0 = MS_MAX(0, (j - job->radius) / job->bucketsize);
+    int by1 = MS_MIN(job->nrows - 1, (j + job->radius) / job->bucketsize);
+    for (i = 0; i < job->width; i++) {
       double den = EPSILON, num = 0;
-      for (index = 0; index < npoints * 3; index += 3) {
-        double d = (xyz[index] - i) * (xyz[index] - i) +
-                   (xyz[index + 1] - j) * (xyz[index + 1] - j);
-        if (radius * radius > d) {
-          double w = 1.0 / (pow(d, power) + EPSILON);
-          num += w * xyz[index + 2];
-          den += w;
+      int bx0 = MS_MAX(0, (i - job->radius) / job->bucketsize);
+      int bx1 = MS_MIN(job->ncols - 1, (i + job->radius) / job->bucketsize);
+      for (by = by0; by <= by1; by++) {
+        for (bx = bx0; bx <= bx1; bx++) {
+          int b = by * job->ncols + bx;
+          for (p = job->bucketstart[b]; p < job->bucketstart[b + 1]; p++) {
+            int index = job->bucketpoints[p];
+            double d = (xyz[index] - i) * (xyz[index] - i) +
+                       (xyz[index + 1] - j) * (xyz[index + 1] - j);
+            if (radius2 > d) {
+              double w, dp;
+              if (job->ipower) {
+                dp = d;
+                for (n = 1; n < job->ipower; n++)
+                  dp *= d;
+              } else {
+                dp = pow(d, job->power);
+              }
+              w = 1.0 / (dp + EPSILON);
+              num += w * xyz[index + 2];
+              den += w;
+            }
+          }
         }
       }
-      iValues[j * width + i] = num / den;
+      job->iValues[j * job->width + i] = num / den;
+    }
+  }
+}
+
+void msIdw(float *xyz, int width, int height, int npoints,
+           interpolationProcessingParams *interpParams,
+           unsigned char *iValues) {
+  idwJobObj job;
+  int t, nthreads = MS_MAX(1, MS_MIN(interpParams->num_threads, height));
+
+  memset(&job, 0, sizeof(job));
+  job.xyz = xyz;
+  job.width = width;
+  job.radius = abs(interpParams->radius);
+  job.power = interpParams->power;
+  if (job.power >= 1 && job.power <= 8 && job.power == (int)job.power)
+    job.ipower = (int)job.power;
+  job.iValues = iValues;
+  idwBuildBuckets(&job, npoints);
+
+  if (nthreads == 1) {
+    job.firstrow = 0;
+    job.lastrow = height;
+    idwRows(&job);
+  } else {
+    idwJobObj *jobs = msSmallMalloc(nthreads * sizeof(idwJobObj));
+    CPLJoinableThread **threads =
+        msSmallCalloc(nthreads, sizeof(CPLJoinableThread *));
+    for (t = 0; t < nthreads; t++) {
+      jobs[t] = job;
+      jobs[t].firstrow = (int)((size_t)height * t / nthreads);
+      jobs[t].lastrow = (int)((size_t)height * (t + 1) / nthreads);
+      threads[t] = CPLCreateJoinableThread(idwRows, &jobs[t]);
+      if (!threads[t]) /* fall back to doing the rows ourselves */
+        idwRows(&jobs[t]);
+    }
+    for (t = 0; t < nthreads; t++) {
+      if (threads[t])
+        CPLJoinThread(threads[t]);
     }
+    free(threads);
+    free(jobs);
   }
+
+  free(job.bucketstart);
+  free(job.bucketpoints);
 }
 
 void msIdwProcessing(layerObj *layer,
@@ -72,6 +190,17 @@ void msIdwProcessing(layerObj *layer,
     interpParams->radius = MAX(layer->map->width, layer->map->height);
   }
 
+  interpParamsProcessing = msLayerGetProcessingKey(layer, "IDW_NUM_THREADS");
+  if (interpParamsProcessing && !strcasecmp(interpParamsProcessing, "ALL_CPUS")) {
+    interpParams->num_threads = CPLGetNumCPUs();
+  } else if (interpParamsProcessing) {
+    interpParams->num_threads = atoi(interpParamsProcessing);
+  } else {
+    interpParams->num_threads = 1;
+  }
+  interpParams->num_threads = MS_MAX(
+      1, MS_MIN(interpParams->num_threads, MS_INTERPOLATION_MAX_THREADS));
+
   interpParamsProcessing =
       msLayerGetProcessingKey(layer, "IDW_COMPUTE_BORDERS");
   if (interpParamsProcessing && strcasecmp(interpParamsProcessing, "OFF")) {
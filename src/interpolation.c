@@ -44,8 +44,6 @@ void msKernelDensityProcessing(layerObj *layer,
 /******************************************************************************
  * kernel density.
  ******************************************************************************/
-void msIdw(float *xyz, int width, int height, int npoints,
-           interpolationProcessingParams *interpParams, unsigned char *iValues);
 void msIdwProcessing(layerObj *layer,
                      interpolationProcessingParams *interpParams);
 
@@ -32,48 +32,145 @@
 
 #include "gdal.h"
 
-static void gaussian_blur(float *values, int width, int height, int radius) {
-  float *tmp = (float *)msSmallMalloc(sizeof(float) * width * height);
+#include "cpl_multiproc.h"
+
+typedef struct {
+  float *values; /* input of the row pass, output of the column pass */
+  float *tmp;    /* output of the row pass */
+  unsigned char *rowhasdata; /* rows of tmp that are not all zero */
+  const float *kernel;
+  int width, height, radius;
+  int firstrow, lastrow;
+} blurJobObj;
+
+/*
+** Horizontal pass. Every non zero sample is spread over its neighbours, which
+** skips the (usually many) empty pixels of a density grid and keeps the inner
+** loop on contiguous memory so that it can be vectorized.
+*/
+static void blurRows(void *arg) {
+  blurJobObj *job = (blurJobObj *)arg;
+  const int width = job->width, radius = job->radius;
+  int x, y, i;
+
+  for (y = job->firstrow; y < job->lastrow; y++) {
+    const float *src = job->values + (size_t)width * y;
+    float *dst = job->tmp + (size_t)width * y;
+    int hasdata = 0;
+
+    memset(dst, 0, sizeof(float) * width);
+    for (x = 0; x < width; x++) {
+      const float v = src[x];
+      int x0, x1;
+      const float *k;
+      float *d;
+      if (v == 0)
+        continue;
+      hasdata = 1;
+      x0 = MS_MAX(0, x - radius);
+      x1 = MS_MIN(width - 1, x + radius);
+      k = job->kernel + (x0 - x + radius);
+      d = dst + x0;
+      for (i = 0; i <= x1 - x0; i++)
+        d[i] += v * k[i];
+    }
+    job->rowhasdata[y] = hasdata;
+  }
+}
+
+/*
+** Vertical pass, computed a whole output row at a time as a weighted sum of
+** the rows of the horizontal pass so that memory is also read row-wise.
+*/
+static void blurColumns(void *arg) {
+  blurJobObj *job = (blurJobObj *)arg;
+  const int width = job->width, height = job->height, radius = job->radius;
+  int x, y, i;
+
+  for (y = job->firstrow; y < job->lastrow; y++) {
+    float *dst = job->values + (size_t)width * y;
+    const int i0 = MS_MAX(0, radius - y);
+    const int i1 = MS_MIN(2 * radius, height - 1 - y + radius);
+
+    memset(dst, 0, sizeof(float) * width);
+    for (i = i0; i <= i1; i++) {
+      const int sy = y + i - radius;
+      const float k = job->kernel[i];
+      const float *src = job->tmp + (size_t)width * sy;
+      if (!job->rowhasdata[sy])
+        continue;
+      for (x = 0; x < width; x++)
+        dst[x] += k * src[x];
+    }
+  }
+}
+
+static void runBlurJobs(CPLThreadFunc pfnPass, blurJobObj *job, int nthreads) {
+  int t;
+
+  if (nthreads == 1) {
+    job->firstrow = 0;
+    job->lastrow = job->height;
+    pfnPass(job);
+  } else {
+    blurJobObj *jobs = msSmallMalloc(nthreads * sizeof(blurJobObj));
+    CPLJoinableThread **threads =
+        msSmallCalloc(nthreads, sizeof(CPLJoinableThread *));
+    for (t = 0; t < nthreads; t++) {
+      jobs[t] = *job;
+      jobs[t].firstrow = (int)((size_t)job->height * t / nthreads);
+      jobs[t].lastrow = (int)((size_t)job->height * (t + 1) / nthreads);
+      threads[t] = CPLCreateJoinableThread(pfnPass, &jobs[t]);
+      if (!threads[t]) /* fall back to doing the rows ourselves */
+        pfnPass(&jobs[t]);
+    }
+    for (t = 0; t < nthreads; t++) {
+      if (threads[t])
+        CPLJoinThread(threads[t]);
+    }
+    free(threads);
+    free(jobs);
+  }
+}
+
+/*
+** Separable gaussian blur of a width x height grid, in place. Pixels outside
+** of the grid are taken as zero, so the borders are blurred too.
+*/
+void msGaussianBlur(float *values, int width, int height, int radius,
+                    int num_threads) {
+  blurJobObj job;
   int length = radius * 2 + 1;
-  float *kernel = (float *)msSmallMalloc(length * sizeof(float));
   float sigma = radius / 3.0;
   float a = 1.0 / sqrt(2.0 * M_PI * sigma * sigma);
   float den = 2.0 * sigma * sigma;
-  int i, x, y;
+  float *kernel;
+  int i, nthreads = MS_MAX(1, MS_MIN(num_threads, height));
 
+  if (radius <= 0 || width <= 0 || height <= 0)
+    return;
+
+  kernel = (float *)msSmallMalloc(length * sizeof(float));
   for (i = 0; i < length; i++) {
     float x = i - radius;
     float v = a * exp(-(x * x) / den);
     kernel[i] = v;
   }
-  memset(tmp, 0, sizeof(float) * width * height);
-
-  for (y = 0; y < height; y++) {
-    float *src_row = values + width * y;
-    float *dst_row = tmp + width * y;
 
-    for (x = radius; x < width - radius; x++) {
-      float accum = 0;
-      for (i = 0; i < length; i++) {
-        accum += src_row[x + i - radius] * kernel[i];
-      }
-      dst_row[x] = accum;
-    }
-  }
+  memset(&job, 0, sizeof(job));
+  job.values = values;
+  job.tmp = (float *)msSmallMalloc(sizeof(float) * width * height);
+  job.rowhasdata = (unsigned char *)msSmallMalloc(height);
+  job.kernel = kernel;
+  job.width = width;
+  job.height = height;
+  job.radius = radius;
 
-  for (x = 0; x < width; x++) {
-    float *src_col = tmp + x;
-    float *dst_col = values + x;
+  runBlurJobs(blurRows, &job, nthreads);
+  runBlurJobs(blurColumns, &job, nthreads);
 
-    for (y = radius; y < height - radius; y++) {
-      float accum = 0;
-      for (i = 0; i < length; i++) {
-        accum += src_col[width * (y + i - radius)] * kernel[i];
-      }
-      dst_col[y * width] = accum;
-    }
-  }
-  free(tmp);
+  free(job.tmp);
+  free(job.rowhasdata);
   free(kernel);
 }
 
@@ -87,6 +184,18 @@ void msKernelDensityProcessing(layerObj *layer,
     interpParams->radius = 10;
   }
 
+  interpParamsProcessing =
+      msLayerGetProcessingKey(layer, "KERNELDENSITY_NUM_THREADS");
+  if (interpParamsProcessing && !strcasecmp(interpParamsProcessing, "ALL_CPUS")) {
+    interpParams->num_threads = CPLGetNumCPUs();
+  } else if (interpParamsProcessing) {
+    interpParams->num_threads = atoi(interpParamsProcessing);
+  } else {
+    interpParams->num_threads = 1;
+  }
+  interpParams->num_threads = MS_MAX(
+      1, MS_MIN(interpParams->num_threads, MS_INTERPOLATION_MAX_THREADS));
+
   interpParamsProcessing =
       msLayerGetProcessingKey(layer, "KERNELDENSITY_COMPUTE_BORDERS");
   if (interpParamsProcessing && strcasecmp(interpParamsProcessing, "OFF")) {
@@ -119,7 +228,7 @@ void msKernelDensity(imageObj *image, float *values, int width, int height,
   float normalization_scale = interpParams->normalization_scale;
   int expand_searchrect = interpParams->expand_searchrect;
 
-  gaussian_blur(values, width, height, radius);
+  msGaussianBlur(values, width, height, radius, interpParams->num_threads);
 
   if (normalization_scale == 0.0) { /* auto normalization */
     for (j = radius; j < height - radius; j++) {
@@ -0,0 +1,148 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Arena allocator for the memory of the shapes read by a layer.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2024 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** A bump allocator: memory is carved out of large blocks and is never freed
+** individually, the whole arena is reset or destroyed at once.
+**
+** msDrawVectorLayer() gives an arena to the layer it draws. Drivers that
+** support it read the geometry and attributes of the shapes returned by
+** msLayerNextShape() from it, and mark the shape with shape->arena. The
+** arena is reset every time a new shape is read, so it only ever holds the
+** current shape, and is destroyed by msLayerClose().
+**
+** The functions of mapprimitive.c that free or grow the parts of a shape
+** know about shape->arena, and move the parts they grow to the heap.
+** msCopyShape() always copies to the heap, so the shapes that outlive the
+** current one (query results, the line cache of msDrawVectorLayer()...)
+** never point into the arena.
+*/
+
+#include "mapserver.h"
+
+#include <stdint.h>
+
+#define MS_ARENA_DEFAULT_BLOCKSIZE (64 * 1024)
+#define MS_ARENA_ALIGNMENT 16
+
+typedef struct msArenaBlock {
+  struct msArenaBlock *next; /* previous, smaller, block */
+  size_t size;               /* usable size, after the header */
+  size_t used;
+} msArenaBlock;
+
+/* keep the data of a block aligned */
+#define MS_ARENA_HEADER_SIZE                                                   \
+  ((sizeof(msArenaBlock) + MS_ARENA_ALIGNMENT - 1) &                           \
+   ~(size_t)(MS_ARENA_ALIGNMENT - 1))
+#define MS_ARENA_BLOCK_DATA(block) ((char *)(block) + MS_ARENA_HEADER_SIZE)
+
+struct msArenaObj {
+  msArenaBlock *block; /* current block, the older ones are chained to it */
+  size_t blocksize;    /* size of the first block */
+};
+
+msArenaObj *msArenaCreate(size_t blocksize) {
+  msArenaObj *arena = (msArenaObj *)msSmallCalloc(1, sizeof(msArenaObj));
+  arena->blocksize = blocksize > 0 ? blocksize : MS_ARENA_DEFAULT_BLOCKSIZE;
+  return arena;
+}
+
+static void msArenaFreeBlocks(msArenaBlock *block) {
+  while (block) {
+    msArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+}
+
+void msArenaDestroy(msArenaObj *arena) {
+  if (!arena)
+    return;
+  msArenaFreeBlocks(arena->block);
+  free(arena);
+}
+
+/*
+** Forget everything allocated so far. Only the last block, the largest, is
+** kept, so that an arena used for shapes of similar sizes settles down to
+** a single block and no allocation at all.
+*/
+void msArenaReset(msArenaObj *arena) {
+  if (!arena || !arena->block)
+    return;
+  msArenaFreeBlocks(arena->block->next);
+  arena->block->next = NULL;
+  arena->block->used = 0;
+}
+
+void *msArenaAlloc(msArenaObj *arena, size_t size) {
+  msArenaBlock *block = arena->block;
+  void *ptr;
+
+  size = (size + MS_ARENA_ALIGNMENT - 1) & ~(size_t)(MS_ARENA_ALIGNMENT - 1);
+  if (size == 0)
+    size = MS_ARENA_ALIGNMENT;
+
+  if (!block || block->size - block->used < size) {
+    /* grow geometrically, so that the number of blocks stays small */
+    size_t blocksize = block ? block->size * 2 : arena->blocksize;
+    while (blocksize < size)
+      blocksize *= 2;
+    block = (msArenaBlock *)msSmallMalloc(MS_ARENA_HEADER_SIZE + blocksize);
+    block->next = arena->block;
+    block->size = blocksize;
+    block->used = 0;
+    arena->block = block;
+  }
+
+  ptr = MS_ARENA_BLOCK_DATA(block) + block->used;
+  block->used += size;
+  return ptr;
+}
+
+char *msArenaStrdup(msArenaObj *arena, const char *s) {
+  const size_t len = strlen(s) + 1;
+  char *copy = (char *)msArenaAlloc(arena, len);
+  memcpy(copy, s, len);
+  return copy;
+}
+
+int msArenaOwns(const msArenaObj *arena, const void *ptr) {
+  const msArenaBlock *block;
+
+  if (!arena || !ptr)
+    return MS_FALSE;
+  for (block = arena->block; block; block = block->next) {
+    const uintptr_t start = (uintptr_t)MS_ARENA_BLOCK_DATA(block);
+    if ((uintptr_t)ptr >= start && (uintptr_t)ptr < start + block->size)
+      return MS_TRUE;
+  }
+  return MS_FALSE;
+}
@@ -0,0 +1,404 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Hash index of the classes of a layer keyed on CLASSITEM values.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2024 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** msShapeGetNextClass() tries the classes of a layer one after the other.
+** For layers with many classes on a CLASSITEM, such as land use or road
+** categories with a string or list expression each, that is as many string
+** compares per feature.
+**
+** Instead, the first time a layer with enough classes is classified, the
+** classes are sorted out once:
+** - those that can't apply at the current scale, or are deleted, are dropped.
+** - MS_STRING and MS_LIST classes go in hash tables from the value(s) they
+**   match to the (ascending) positions of the classes.
+** - classes with an empty expression, which match anything, are listed
+**   apart.
+** - the others (logical expressions, regexes...) are listed apart too, and
+**   evaluated as usual.
+** Looking up a feature is then a hash lookup of its CLASSITEM value, and the
+** evaluation of the "other" classes that come before the first class found,
+** so the first match is the same as with the linear search.
+**
+** The index is kept in layer->classindex until msLayerClose(), and rebuilt
+** if the scale or the class group change in between. The classes can also be
+** edited between two draws (mapscript, SLD, runtime substitutions...), or a
+** class group allocated at the address of the previous one: at its first use
+** after each msLayerWhichShapes(), the index is checked against a hash of the
+** CLASSITEM, class group and class expressions it was built from.
+*/
+
+#include "mapserver.h"
+
+#include <limits.h>
+
+/* below this number of classes, the linear search is as fast */
+#define MS_CLASS_INDEX_MIN_CLASSES 8
+
+typedef struct {
+  char *key;
+  unsigned long long hash;
+  int *positions; /* of the classes matching key, ascending */
+  int numpositions;
+} classIndexEntry;
+
+typedef struct {
+  classIndexEntry *entries; /* open addressing, NULL keys are free */
+  int size;                 /* a power of 2 */
+  int count;
+  int insensitive; /* keys compared like strcasecmp() */
+} classIndexTable;
+
+typedef struct {
+  int *positions;
+  int count;
+} classIndexList;
+
+struct msClassIndexObj {
+  /* what the index was built for */
+  double scaledenom;
+  const int *classgroup;
+  int numclasses;
+  unsigned long long signature; /* see classIndexSignature() */
+  int checked; /* signature checked since the last msLayerWhichShapes() */
+
+  classIndexTable exact, insensitive; /* MS_STRING and MS_LIST classes */
+  classIndexList wildcards;           /* classes matching any feature */
+  classIndexList others;              /* classes to evaluate one by one */
+};
+
+static classIndexEntry *classIndexFind(const classIndexTable *table,
+                                       const char *key,
+                                       unsigned long long hash) {
+  int slot;
+  if (table->count == 0)
+    return NULL;
+  for (slot = (int)(hash & (table->size - 1)); table->entries[slot].key;
+       slot = (slot + 1) & (table->size - 1)) {
+    classIndexEntry *entry = &(table->entries[slot]);
+    if (entry->hash == hash &&
+        (table->insensitive ? strcasecmp(entry->key, key)
+                            : strcmp(entry->key, key)) == 0)
+      return entry;
+  }
+  return NULL;
+}
+
+static void classIndexListAdd(int **positions, int *count, int position) {
+  /* a list expression may give the same value twice */
+  if (*count > 0 && (*positions)[*count - 1] == position)
+    return;
+  *positions =
+      (int *)msSmallRealloc(*positions, sizeof(int) * (*count + 1));
+  (*positions)[(*count)++] = position;
+}
+
+static void classIndexAdd(classIndexTable *table, const char *key,
+                          size_t keylen, int position) {
+  char *keycopy = (char *)msSmallMalloc(keylen + 1);
+  classIndexEntry *entry;
+  unsigned long long hash;
+  int slot;
+
+  memcpy(keycopy, key, keylen);
+  keycopy[keylen] = '\0';
+  hash = msFNVHashString(MS_HASH_INIT, keycopy, table->insensitive);
+
+  entry = classIndexFind(table, keycopy, hash);
+  if (entry) {
+    msFree(keycopy);
+    classIndexListAdd(&(entry->positions), &(entry->numpositions), position);
+    return;
+  }
+
+  /* keep the table at most half full */
+  if ((table->count + 1) * 2 > table->size) {
+    classIndexEntry *old = table->entries;
+    int oldsize = table->size, i;
+    table->size = oldsize ? oldsize * 2 : 64;
+    table->entries = (classIndexEntry *)msSmallCalloc(table->size,
+                                                      sizeof(classIndexEntry));
+    for (i = 0; i < oldsize; i++) {
+      if (!old[i].key)
+        continue;
+      for (slot = (int)(old[i].hash & (table->size - 1));
+           table->entries[slot].key; slot = (slot + 1) & (table->size - 1))
+        ;
+      table->entries[slot] = old[i];
+    }
+    msFree(old);
+  }
+
+  for (slot = (int)(hash & (table->size - 1)); table->entries[slot].key;
+       slot = (slot + 1) & (table->size - 1))
+    ;
+  entry = &(table->entries[slot]);
+  entry->key = keycopy;
+  entry->hash = hash;
+  classIndexListAdd(&(entry->positions), &(entry->numpositions), position);
+  table->count++;
+}
+
+static void classIndexFreeTable(classIndexTable *table) {
+  int i;
+  for (i = 0; i < table->size; i++) {
+    msFree(table->entries[i].key);
+    msFree(table->entries[i].positions);
+  }
+  msFree(table->entries);
+}
+
+/*
+** Has the index checked against the classes of its layer at its next use.
+*/
+void msClassIndexRecheck(msClassIndexObj *index) {
+  if (index)
+    index->checked = MS_FALSE;
+}
+
+void msClassIndexFree(msClassIndexObj *index) {
+  if (!index)
+    return;
+  classIndexFreeTable(&(index->exact));
+  classIndexFreeTable(&(index->insensitive));
+  msFree(index->wildcards.positions);
+  msFree(index->others.positions);
+  msFree(index);
+}
+
+/* index of the first of the ascending positions that is >= start */
+static int classIndexLowerBound(const int *positions, int count, int start) {
+  int lo = 0, hi = count;
+  while (lo < hi) {
+    const int mid = (lo + hi) / 2;
+    if (positions[mid] < start)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* first of the ascending positions that is >= start, or INT_MAX */
+static int classIndexFirstFrom(const int *positions, int count, int start) {
+  const int i = classIndexLowerBound(positions, count, start);
+  return i < count ? positions[i] : INT_MAX;
+}
+
+/* the class at position i of the loop of msShapeGetNextClass() */
+#define CLASS_AT(classgroup, i) ((classgroup) ? (classgroup)[i] : (i))
+
+/* hash of everything classIndexBuild() reads, apart from the scale */
+static unsigned long long classIndexSignature(layerObj *layer,
+                                              const int *classgroup,
+                                              int numclasses) {
+  unsigned long long hash = MS_HASH_INIT;
+  int i;
+
+  hash = msFNVHashString(hash, layer->classitem, MS_FALSE);
+  hash = msFNVHashBytes(hash, &(layer->numclasses), sizeof(int));
+  for (i = 0; i < numclasses; i++) {
+    const int iclass = CLASS_AT(classgroup, i);
+    classObj *c;
+    int values[4];
+
+    hash = msFNVHashBytes(hash, &iclass, sizeof(int));
+    if (iclass < 0 || iclass >= layer->numclasses)
+      continue;
+    c = layer->class[iclass];
+    values[0] = c->status;
+    values[1] = c->expression.type;
+    values[2] = c->expression.flags;
+    values[3] = c->expression.native_string != NULL;
+    hash = msFNVHashBytes(hash, values, sizeof(values));
+    hash = msFNVHashBytes(hash, &(c->minscaledenom), sizeof(double));
+    hash = msFNVHashBytes(hash, &(c->maxscaledenom), sizeof(double));
+    /* the terminating nul keeps "a","bc" apart from "ab","c" */
+    hash = msFNVHashString(hash, c->expression.string, MS_FALSE);
+    hash = msFNVHashBytes(hash, "", 1);
+  }
+  return hash;
+}
+
+static msClassIndexObj *classIndexBuild(layerObj *layer, mapObj *map,
+                                        const int *classgroup,
+                                        int numclasses) {
+  msClassIndexObj *index =
+      (msClassIndexObj *)msSmallCalloc(1, sizeof(msClassIndexObj));
+  int i;
+
+  index->scaledenom = map->scaledenom;
+  index->classgroup = classgroup;
+  index->numclasses = numclasses;
+  index->signature = classIndexSignature(layer, classgroup, numclasses);
+  index->checked = MS_TRUE;
+  index->insensitive.insensitive = MS_TRUE;
+
+  for (i = 0; i < numclasses; i++) {
+    const int iclass = CLASS_AT(classgroup, i);
+    classObj *c;
+    expressionObj *expression;
+
+    if (iclass < 0 || iclass >= layer->numclasses)
+      continue;
+    c = layer->class[iclass];
+    if (c->status == MS_DELETE)
+      continue;
+    if (map->scaledenom > 0) {
+      if (c->maxscaledenom > 0 && map->scaledenom > c->maxscaledenom)
+        continue;
+      if (c->minscaledenom > 0 && map->scaledenom <= c->minscaledenom)
+        continue;
+    }
+
+    /* sorted out like msEvalExpression() does */
+    expression = &(c->expression);
+    if (MS_STRING_IS_NULL_OR_EMPTY(expression->string) ||
+        expression->native_string != NULL) {
+      classIndexListAdd(&(index->wildcards.positions),
+                        &(index->wildcards.count), i);
+    } else if (expression->type == MS_STRING) {
+      classIndexAdd(expression->flags & MS_EXP_INSENSITIVE
+                        ? &(index->insensitive)
+                        : &(index->exact),
+                    expression->string, strlen(expression->string), i);
+    } else if (expression->type == MS_LIST) {
+      const char *start = expression->string, *end;
+      while ((end = strchr(start, ',')) != NULL) {
+        classIndexAdd(&(index->exact), start, end - start, i);
+        start = end + 1;
+      }
+      classIndexAdd(&(index->exact), start, strlen(start), i);
+    } else {
+      classIndexListAdd(&(index->others.positions), &(index->others.count), i);
+    }
+  }
+
+  return index;
+}
+
+static int classFitsShape(layerObj *layer, mapObj *map, shapeObj *shape,
+                          int iclass) {
+  if ((shape->type == MS_SHAPE_LINE || shape->type == MS_SHAPE_POLYGON) &&
+      layer->class[iclass]->minfeaturesize > 0) {
+    const double minfeaturesize =
+        Pix2LayerGeoref(map, layer, layer->class[iclass]->minfeaturesize);
+    return msShapeCheckSize(shape, minfeaturesize);
+  }
+  return MS_TRUE;
+}
+
+/*
+** Looks up the class of shape that msShapeGetNextClass() would find, with
+** the index of the layer, building it if needed. Returns MS_FALSE if the
+** layer isn't indexed and the caller has to search the classes itself.
+*/
+int msClassIndexGetNextClass(layerObj *layer, mapObj *map, shapeObj *shape,
+                             int currentclass, const int *classgroup,
+                             int numclasses, int *classindex) {
+  msClassIndexObj *index = layer->classindex;
+  const classIndexEntry *exact = NULL, *insensitive = NULL;
+  int start = currentclass + 1;
+
+  if (numclasses < MS_CLASS_INDEX_MIN_CLASSES)
+    return MS_FALSE;
+
+  if (index && (index->scaledenom != map->scaledenom ||
+                index->classgroup != classgroup ||
+                index->numclasses != numclasses ||
+                (!index->checked &&
+                 index->signature !=
+                     classIndexSignature(layer, classgroup, numclasses)))) {
+    msClassIndexFree(index);
+    index = layer->classindex = NULL;
+  }
+  if (!index)
+    index = layer->classindex =
+        classIndexBuild(layer, map, classgroup, numclasses);
+  index->checked = MS_TRUE;
+
+  if (index->exact.count > 0 || index->insensitive.count > 0) {
+    /* let msEvalExpression() report a missing or bad CLASSITEM */
+    if (layer->classitemindex < 0 ||
+        layer->classitemindex >= layer->numitems ||
+        layer->classitemindex >= shape->numvalues)
+      return MS_FALSE;
+    const char *value = shape->values[layer->classitemindex];
+    exact = classIndexFind(&(index->exact), value,
+                           msFNVHashString(MS_HASH_INIT, value, MS_FALSE));
+    insensitive =
+        classIndexFind(&(index->insensitive), value,
+                       msFNVHashString(MS_HASH_INIT, value, MS_TRUE));
+  }
+
+  while (1) {
+    int best, iclass, i;
+
+    best = classIndexFirstFrom(index->wildcards.positions,
+                               index->wildcards.count, start);
+    if (exact)
+      best = MS_MIN(best, classIndexFirstFrom(exact->positions,
+                                              exact->numpositions, start));
+    if (insensitive)
+      best = MS_MIN(best, classIndexFirstFrom(insensitive->positions,
+                                              insensitive->numpositions,
+                                              start));
+
+    /* the classes that can't be looked up, in order, up to the one found */
+    for (i = classIndexLowerBound(index->others.positions,
+                                  index->others.count, start);
+         i < index->others.count && index->others.positions[i] < best; i++) {
+      iclass = CLASS_AT(classgroup, index->others.positions[i]);
+      if (classFitsShape(layer, map, shape, iclass) &&
+          msEvalExpression(layer, shape, &(layer->class[iclass]->expression),
+                           layer->classitemindex) == MS_TRUE)
+        break;
+    }
+
+    if (i < index->others.count && index->others.positions[i] < best) {
+      best = index->others.positions[i];
+    } else {
+      if (best == INT_MAX) {
+        *classindex = -1;
+        return MS_TRUE;
+      }
+      iclass = CLASS_AT(classgroup, best);
+      if (!classFitsShape(layer, map, shape, iclass)) {
+        start = best + 1;
+        continue;
+      }
+    }
+
+    if (layer->class[iclass]->isfallback && currentclass != -1)
+      *classindex = -1; /* see msShapeGetNextClass() */
+    else
+      *classindex = iclass;
+    return MS_TRUE;
+  }
+}
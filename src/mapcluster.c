@@ -32,6 +32,11 @@
 /* $Id$ */
 #include <assert.h>
 #include "mapserver.h"
+#include "mapthread.h"
+
+#include "cpl_conv.h"
+
+#include <sys/stat.h>
 
 #ifdef USE_CLUSTER_PLUGIN
 #define USE_CLUSTER_EXTERNAL
@@ -66,6 +71,7 @@ typedef int (*clusterCompareRegionFunc)(clusterInfo *current,
 /* cluster algorithm */
 #define MSCLUSTER_ALGORITHM_FULL 0
 #define MSCLUSTER_ALGORITHM_SIMPLE 1
+#define MSCLUSTER_ALGORITHM_GRID 2
 
 /* cluster data */
 struct cluster_info {
@@ -282,9 +288,12 @@ static clusterInfo *clusterInfoCreate(msClusterLayerInfo *layerinfo) {
   feature->group = NULL;
   feature->node = NULL;
   feature->siblings = NULL;
-  feature->index = layerinfo->numFeatures;
   feature->filter = -1; /* not yet calculated */
-  ++layerinfo->numFeatures;
+  if (layerinfo) {
+    feature->index = layerinfo->numFeatures;
+    ++layerinfo->numFeatures;
+  } else
+    feature->index = -1; /* held by the result cache */
   return feature;
 }
 
@@ -302,7 +311,8 @@ static void clusterInfoDestroyList(msClusterLayerInfo *layerinfo,
     msFreeShape(&s->shape);
     msFree(s->group);
     msFree(s);
-    --layerinfo->numFeatures;
+    if (layerinfo)
+      --layerinfo->numFeatures;
     s = next;
   }
 }
@@ -913,6 +923,376 @@ static int collectClusterShapes2(layerObj *layer, msClusterLayerInfo *layerinfo,
           !node->subnode[2] && !node->subnode[3]);
 }
 
+/* grid cell of the GRID algorithm, holding a single cluster */
+typedef struct {
+  double cx, cy; /* position of the cell in cell units */
+  unsigned long long hash;
+  clusterInfo *base;
+  clusterInfo *last; /* last sibling, keeps the siblings in reading order */
+} clusterGridCell;
+
+typedef struct {
+  clusterGridCell *cells; /* in the order of their creation */
+  int numcells;
+  int maxcells;
+  int *slots;   /* index of the cell, -1 if free */
+  int numslots; /* a power of 2 */
+} clusterGrid;
+
+static unsigned long long clusterGridHash(double cx, double cy,
+                                          const char *group) {
+  double pos[2];
+
+  pos[0] = cx;
+  pos[1] = cy;
+  return msFNVHashString(msFNVHashBytes(MS_HASH_INIT, pos, sizeof(pos)), group,
+                         MS_TRUE);
+}
+
+/* assign the shape to the cluster of its grid cell, or start a new one */
+static void clusterGridAddShape(clusterGrid *grid, clusterInfo *current,
+                                double cellWidth, double cellHeight) {
+  /* adding 0.0 turns -0.0 into 0.0, which must hash the same */
+  const double cx =
+      (cellWidth > 0 ? floor(current->x / cellWidth) : current->x) + 0.0;
+  const double cy =
+      (cellHeight > 0 ? floor(current->y / cellHeight) : current->y) + 0.0;
+  const unsigned long long hash = clusterGridHash(cx, cy, current->group);
+  clusterGridCell *cell;
+  unsigned int i, mask;
+  int n;
+
+  if (2 * (grid->numcells + 1) > grid->numslots) {
+    /* keep the table at most half full */
+    msFree(grid->slots);
+    grid->numslots = grid->numslots ? grid->numslots * 2 : 1024;
+    grid->slots = (int *)msSmallMalloc(sizeof(int) * grid->numslots);
+    memset(grid->slots, -1, sizeof(int) * grid->numslots);
+    mask = grid->numslots - 1;
+    for (n = 0; n < grid->numcells; n++) {
+      for (i = (unsigned int)(grid->cells[n].hash & mask); grid->slots[i] >= 0;
+           i = (i + 1) & mask)
+        ;
+      grid->slots[i] = n;
+    }
+  }
+
+  mask = grid->numslots - 1;
+  for (i = (unsigned int)(hash & mask); grid->slots[i] >= 0;
+       i = (i + 1) & mask) {
+    cell = &grid->cells[grid->slots[i]];
+    if (cell->hash != hash || cell->cx != cx || cell->cy != cy)
+      continue;
+    if (cell->base->group ? !current->group ||
+                                !EQUAL(cell->base->group, current->group)
+                          : current->group != NULL)
+      continue;
+
+    /* join the cluster of this cell, the average is completed later */
+    ++cell->base->numsiblings;
+    cell->base->avgx += current->x;
+    cell->base->avgy += current->y;
+    if (cell->last)
+      cell->last->next = current;
+    else
+      cell->base->siblings = current;
+    cell->last = current;
+    return;
+  }
+
+  if (grid->numcells == grid->maxcells) {
+    grid->maxcells = grid->maxcells ? grid->maxcells * 2 : 1024;
+    grid->cells = (clusterGridCell *)msSmallRealloc(
+        grid->cells, sizeof(clusterGridCell) * grid->maxcells);
+  }
+  grid->slots[i] = grid->numcells;
+  cell = &grid->cells[grid->numcells++];
+  cell->cx = cx;
+  cell->cy = cy;
+  cell->hash = hash;
+  cell->base = current;
+  cell->last = NULL;
+}
+
+/* add a single shape to the finalized or to the filtered list */
+static clusterInfo **clusterGridFinalizeShape(msClusterLayerInfo *layerinfo,
+                                              clusterInfo **tail,
+                                              clusterInfo *s) {
+  if (s->filter) {
+    *tail = s;
+    ++layerinfo->numFinalized;
+    return &s->next;
+  }
+  /* this shape is filtered */
+  s->next = layerinfo->filtered;
+  layerinfo->filtered = s;
+  ++layerinfo->numFiltered;
+  return tail;
+}
+
+/* collect the clusters of the grid in the order of their creation */
+static void clusterGridFinalize(layerObj *layer, msClusterLayerInfo *layerinfo,
+                                clusterGrid *grid) {
+  clusterInfo **tail = &layerinfo->finalized;
+  clusterInfo *base, *s, *next;
+  int n;
+
+  for (n = 0; n < grid->numcells; n++) {
+    base = grid->cells[n].base;
+    base->next = NULL;
+    base->avgx /= base->numsiblings + 1;
+    base->avgy /= base->numsiblings + 1;
+
+    InitShapeAttributes(layer, base);
+    if (layer->cluster.filter.string != NULL)
+      base->filter =
+          msClusterEvaluateFilter(&layer->cluster.filter, &base->shape);
+
+    if (base->filter == 0 && base->siblings) {
+      /* like with the other algorithms the filtered shape is removed, and its
+       * siblings are returned as individual shapes */
+      s = base->siblings;
+      base->siblings = NULL;
+      base->numsiblings = 0;
+      base->avgx = base->x;
+      base->avgy = base->y;
+      InitShapeAttributes(layer, base);
+      tail = clusterGridFinalizeShape(layerinfo, tail, base);
+      while (s) {
+        next = s->next;
+        s->next = NULL;
+        InitShapeAttributes(layer, s);
+        s->filter = msClusterEvaluateFilter(&layer->cluster.filter, &s->shape);
+        tail = clusterGridFinalizeShape(layerinfo, tail, s);
+        s = next;
+      }
+      continue;
+    }
+
+    for (s = base->siblings; s; s = s->next) {
+      UpdateShapeAttributes(layer, base, s);
+      /* setting the average position to the cluster position */
+      s->avgx = base->avgx;
+      s->avgy = base->avgy;
+    }
+
+    tail = clusterGridFinalizeShape(layerinfo, tail, base);
+    if (base->filter && base->siblings &&
+        layerinfo->get_all_shapes == MS_TRUE) {
+      /* insert the siblings into the finalization list */
+      *tail = base->siblings;
+      base->siblings = NULL;
+      while (*tail)
+        tail = &(*tail)->next;
+    }
+  }
+
+  msFree(grid->cells);
+  msFree(grid->slots);
+  grid->cells = NULL;
+  grid->slots = NULL;
+  grid->numcells = grid->maxcells = grid->numslots = 0;
+}
+
+/*
+** When MS_CLUSTER_CACHE is set to a number of entries, the clusters built
+** with the GRID algorithm are kept per process and reused by the requests of
+** the same tile extent and zoom level (cell size). Only the layers reading a
+** file are cached, an entry is dropped when the file is modified.
+*/
+typedef struct {
+  char *key; /* source layer, cluster settings and items */
+  rectObj searchrect;
+  double cellWidth, cellHeight;
+  time_t mtime;
+  clusterInfo *finalized;
+  int numFinalized;
+} clusterCacheEntry;
+
+static clusterCacheEntry *clusterCache = NULL;
+static msLRUCacheObj clusterCacheLRU; /* size 0 until allocated */
+
+/* deep copy of a cluster list, the copies are not counted by a NULL layerinfo
+ */
+static clusterInfo *clusterInfoCopyList(msClusterLayerInfo *layerinfo,
+                                        clusterInfo *src) {
+  clusterInfo *list = NULL;
+  clusterInfo **tail = &list;
+  clusterInfo *s;
+
+  for (; src; src = src->next) {
+    s = clusterInfoCreate(layerinfo);
+    msCopyShape(&src->shape, &s->shape);
+    s->x = src->x;
+    s->y = src->y;
+    s->avgx = src->avgx;
+    s->avgy = src->avgy;
+    s->varx = src->varx;
+    s->vary = src->vary;
+    s->bounds = src->bounds;
+    s->numsiblings = src->numsiblings;
+    s->filter = src->filter;
+    s->group = src->group ? msStrdup(src->group) : NULL;
+    s->siblings = clusterInfoCopyList(layerinfo, src->siblings);
+    *tail = s;
+    tail = &s->next;
+  }
+  return list;
+}
+
+/* modification time of the file read by the layer, 0 if there is none */
+static time_t clusterSourceMtime(layerObj *layer) {
+  char szPath[MS_MAXPATHLEN];
+  struct stat stat_buf;
+  const char *name = NULL;
+
+  if (layer->connectiontype == MS_SHAPEFILE)
+    name = layer->data;
+  else if (layer->connectiontype == MS_OGR)
+    name = layer->connection;
+  if (!name || !layer->map ||
+      !msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, name))
+    return 0;
+
+  if (stat(szPath, &stat_buf) == 0)
+    return stat_buf.st_mtime;
+  if (layer->connectiontype == MS_SHAPEFILE &&
+      strlen(szPath) + 4 < sizeof(szPath)) {
+    strcat(szPath, ".shp");
+    if (stat(szPath, &stat_buf) == 0)
+      return stat_buf.st_mtime;
+  }
+  return 0;
+}
+
+static char *clusterCacheKeyAdd(char *key, const char *value) {
+  key = msStringConcatenate(key, value ? value : "");
+  return msStringConcatenate(key, "\n");
+}
+
+/* identifies the source and the settings the clusters are built from */
+static char *clusterCacheKey(layerObj *layer, msClusterLayerInfo *layerinfo,
+                             int isQuery) {
+  layerObj *srcLayer = &layerinfo->srcLayer;
+  char *key = NULL;
+  char *projection;
+  int i;
+
+  key = clusterCacheKeyAdd(key, layer->map->mappath);
+  key = clusterCacheKeyAdd(key, layer->map->shapepath);
+  key = clusterCacheKeyAdd(key, layer->name);
+  /* the search rectangle is in the coordinates of the layer, but the same
+   * extent of another map projection covers other cells, and the features
+   * are reprojected from the one of the source layer */
+  projection = msGetProjectionString(&layer->map->projection);
+  key = clusterCacheKeyAdd(key, projection);
+  msFree(projection);
+  projection = msGetProjectionString(&srcLayer->projection);
+  key = clusterCacheKeyAdd(key, projection);
+  msFree(projection);
+  key = clusterCacheKeyAdd(key, srcLayer->data);
+  key = clusterCacheKeyAdd(key, srcLayer->connection);
+  key = clusterCacheKeyAdd(key, srcLayer->filteritem);
+  key = clusterCacheKeyAdd(key, srcLayer->filter.string);
+  key = clusterCacheKeyAdd(key, layer->cluster.group.string);
+  key = clusterCacheKeyAdd(key, layer->cluster.filter.string);
+  key = clusterCacheKeyAdd(key, layerinfo->get_all_shapes ? "all" : "");
+  key = clusterCacheKeyAdd(key, isQuery ? "query" : "");
+  for (i = 0; i < layer->numitems; i++)
+    key = clusterCacheKeyAdd(key, layer->items[i]);
+  return key;
+}
+
+/* restores the clusters from the cache, returns MS_TRUE if found */
+static int clusterCacheGet(msClusterLayerInfo *layerinfo, const char *key,
+                           const rectObj *searchrect, double cellWidth,
+                           double cellHeight, time_t mtime) {
+  clusterCacheEntry *entry;
+  int i, found = MS_FALSE;
+
+  msAcquireLock(TLOCK_CLUSTER);
+  for (i = 0; i < clusterCacheLRU.size; i++) {
+    entry = &clusterCache[i];
+    if (entry->key && entry->mtime == mtime &&
+        entry->cellWidth == cellWidth && entry->cellHeight == cellHeight &&
+        memcmp(&entry->searchrect, searchrect, sizeof(rectObj)) == 0 &&
+        strcmp(entry->key, key) == 0) {
+      layerinfo->finalized = clusterInfoCopyList(layerinfo, entry->finalized);
+      layerinfo->numFinalized = entry->numFinalized;
+      msLRUCacheTouch(&clusterCacheLRU, i);
+      found = MS_TRUE;
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_CLUSTER);
+  return found;
+}
+
+/* keeps a copy of the freshly built clusters, takes over the key */
+static void clusterCachePut(msClusterLayerInfo *layerinfo, char *key,
+                            const rectObj *searchrect, double cellWidth,
+                            double cellHeight, time_t mtime) {
+  const int size = atoi(CPLGetConfigOption("MS_CLUSTER_CACHE", "0"));
+  clusterCacheEntry evicted;
+  clusterCacheEntry *entry;
+  clusterInfo *finalized;
+  int i, slot = -1;
+
+  if (size <= 0) {
+    msFree(key);
+    return;
+  }
+  finalized = clusterInfoCopyList(NULL, layerinfo->finalized);
+
+  msAcquireLock(TLOCK_CLUSTER);
+  if (!clusterCache) {
+    clusterCache =
+        (clusterCacheEntry *)msSmallCalloc(size, sizeof(clusterCacheEntry));
+    msLRUCacheInit(&clusterCacheLRU, size);
+  }
+  /* the same extent of an older file, or else a free slot or the least
+   * recently used one */
+  for (i = 0; i < clusterCacheLRU.size; i++) {
+    entry = &clusterCache[i];
+    if (entry->key && entry->cellWidth == cellWidth &&
+        entry->cellHeight == cellHeight &&
+        memcmp(&entry->searchrect, searchrect, sizeof(rectObj)) == 0 &&
+        strcmp(entry->key, key) == 0) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0)
+    slot = msLRUCacheSlot(&clusterCacheLRU, NULL, NULL);
+  entry = &clusterCache[slot];
+  evicted = *entry;
+  entry->key = key;
+  entry->searchrect = *searchrect;
+  entry->cellWidth = cellWidth;
+  entry->cellHeight = cellHeight;
+  entry->mtime = mtime;
+  msLRUCacheTouch(&clusterCacheLRU, slot);
+  entry->finalized = finalized;
+  entry->numFinalized = layerinfo->numFinalized;
+  msReleaseLock(TLOCK_CLUSTER);
+
+  msFree(evicted.key);
+  clusterInfoDestroyList(NULL, evicted.finalized);
+}
+
+void msClusterCacheCleanup(void) {
+  int i;
+  msAcquireLock(TLOCK_CLUSTER);
+  for (i = 0; i < clusterCacheLRU.size; i++) {
+    msFree(clusterCache[i].key);
+    clusterInfoDestroyList(NULL, clusterCache[i].finalized);
+  }
+  msFree(clusterCache);
+  clusterCache = NULL;
+  msLRUCacheFree(&clusterCacheLRU);
+  msReleaseLock(TLOCK_CLUSTER);
+}
+
 int selectClusterShape(layerObj *layer, long shapeindex) {
   int i;
   clusterInfo *current;
@@ -1025,6 +1405,10 @@ int RebuildClusters(layerObj *layer, int isQuery) {
   clusterInfo *current;
   int depth;
   const char *pszProcessing;
+  clusterGrid grid;
+  double gridCellWidth = 0, gridCellHeight = 0;
+  char *cacheKey = NULL;
+  time_t cacheMtime = 0;
 #ifdef USE_CLUSTER_EXTERNAL
   int layerIndex;
 #endif
@@ -1055,6 +1439,8 @@ int RebuildClusters(layerObj *layer, int isQuery) {
   pszProcessing = msLayerGetProcessingKey(layer, "CLUSTER_ALGORITHM");
   if (pszProcessing && !strncasecmp(pszProcessing, "SIMPLE", 6))
     layerinfo->algorithm = MSCLUSTER_ALGORITHM_SIMPLE;
+  else if (pszProcessing && !strncasecmp(pszProcessing, "GRID", 4))
+    layerinfo->algorithm = MSCLUSTER_ALGORITHM_GRID;
   else
     layerinfo->algorithm = MSCLUSTER_ALGORITHM_FULL;
 
@@ -1145,6 +1531,42 @@ int RebuildClusters(layerObj *layer, int isQuery) {
   searchrect.miny -= layer->cluster.buffer * cellSizeY;
   searchrect.maxy += layer->cluster.buffer * cellSizeY;
 
+  if (layerinfo->algorithm == MSCLUSTER_ALGORITHM_GRID) {
+    /* the cells are as large as the clustering region and aligned to the
+     * origin, so that the neighbouring tiles of a zoom level share them */
+    gridCellWidth = 2 * maxDistanceX;
+    gridCellHeight = 2 * maxDistanceY;
+    memset(&grid, 0, sizeof(grid));
+
+    /* query whole cells: a cell cut by the edge of the tile would otherwise
+     * be clustered from a part of its shapes, and differently in the
+     * neighbouring tile */
+    if (gridCellWidth > 0) {
+      searchrect.minx = floor(searchrect.minx / gridCellWidth) * gridCellWidth;
+      searchrect.maxx =
+          (floor(searchrect.maxx / gridCellWidth) + 1) * gridCellWidth;
+    }
+    if (gridCellHeight > 0) {
+      searchrect.miny =
+          floor(searchrect.miny / gridCellHeight) * gridCellHeight;
+      searchrect.maxy =
+          (floor(searchrect.maxy / gridCellHeight) + 1) * gridCellHeight;
+    }
+
+    if (atoi(CPLGetConfigOption("MS_CLUSTER_CACHE", "0")) > 0 &&
+        (cacheMtime = clusterSourceMtime(&layerinfo->srcLayer)) != 0) {
+      cacheKey = clusterCacheKey(layer, layerinfo, isQuery);
+      if (clusterCacheGet(layerinfo, cacheKey, &searchrect, gridCellWidth,
+                          gridCellHeight, cacheMtime)) {
+        if (layer->debug >= MS_DEBUGLEVEL_VVV)
+          msDebug("Clusters restored from the cache.\n");
+        msFree(cacheKey);
+        layerinfo->current = layerinfo->finalized;
+        return MS_SUCCESS;
+      }
+    }
+  }
+
   /* create the root node */
   if (layerinfo->root)
     clusterTreeNodeDestroy(layerinfo, layerinfo->root);
@@ -1156,15 +1578,19 @@ int RebuildClusters(layerObj *layer, int isQuery) {
   status = msLayerWhichShapes(srcLayer, searchrect, isQuery);
   if (status == MS_DONE) {
     /* no overlap */
+    msFree(cacheKey);
     return MS_SUCCESS;
   } else if (status != MS_SUCCESS) {
+    msFree(cacheKey);
     return MS_FAILURE;
   }
 
   /* step through the source shapes and populate the quadtree with the tentative
    * clusters */
-  if ((current = clusterInfoCreate(layerinfo)) == NULL)
+  if ((current = clusterInfoCreate(layerinfo)) == NULL) {
+    msFree(cacheKey);
     return MS_FAILURE;
+  }
 
 #if defined(USE_CLUSTER_EXTERNAL)
   if (srcLayer->transform == MS_TRUE && srcLayer->project &&
@@ -1239,6 +1665,9 @@ int RebuildClusters(layerObj *layer, int isQuery) {
           return MS_FAILURE;
         }
       }
+    } else if (layerinfo->algorithm == MSCLUSTER_ALGORITHM_GRID) {
+      /* a single pass, each shape joins the cluster of its cell */
+      clusterGridAddShape(&grid, current, gridCellWidth, gridCellHeight);
     }
 
     if ((current = clusterInfoCreate(layerinfo)) == NULL) {
@@ -1407,6 +1836,11 @@ int RebuildClusters(layerObj *layer, int isQuery) {
 
     /* collecting the shapes of the cluster */
     collectClusterShapes2(layer, layerinfo, layerinfo->root);
+  } else if (layerinfo->algorithm == MSCLUSTER_ALGORITHM_GRID) {
+    clusterGridFinalize(layer, layerinfo, &grid);
+    if (cacheKey)
+      clusterCachePut(layerinfo, cacheKey, &searchrect, gridCellWidth,
+                      gridCellHeight, cacheMtime);
   }
 
   /* set the pointer to the first shape */
@@ -1173,6 +1173,8 @@ int msCopyMap(mapObj *dst, const mapObj *src) {
 
   /* msCopyLabelCache(&(dst->labelcache), &(src->labelcache)); */
   MS_COPYRECT(&(dst->extent), &(src->extent));
+  MS_COPYRECT(&(dst->saved_extent), &(src->saved_extent));
+  MS_COPYSTELEM(gt);
 
   MS_COPYSTELEM(cellsize);
   MS_COPYSTELEM(units);
@@ -1181,6 +1183,7 @@ int msCopyMap(mapObj *dst, const mapObj *src) {
   MS_COPYSTELEM(resolution);
   MS_COPYSTRING(dst->shapepath, src->shapepath);
   MS_COPYSTRING(dst->mappath, src->mappath);
+  MS_COPYSTRING(dst->mapfile, src->mapfile);
   MS_COPYSTELEM(sldurl);
 
   MS_COPYCOLOR(&(dst->imagecolor), &(src->imagecolor));
@@ -1260,6 +1263,9 @@ int msCopyMap(mapObj *dst, const mapObj *src) {
       MS_SUCCESS)
     return MS_FAILURE;
 
+  /* read-only reference, owned by the caller of msLoadMap() */
+  MS_COPYSTELEM(config);
+
   return MS_SUCCESS;
 }
 
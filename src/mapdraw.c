@@ -300,14 +300,11 @@ static int msCompositeRasterBuffer(mapObj *map, imageObj *img,
 }
 
 /*
- * Generic function to render the map file.
- * The type of the image created is based on the imagetype parameter in the map
- * file.
- *
- * mapObj *map - map object loaded in MapScript or via a mapfile to use
- * int querymap - is this map the result of a query operation, MS_TRUE|MS_FALSE
+ * Body of msDrawMap(). Layers handled by parallel (may be NULL) are merged
+ * from the images drawn by the worker threads instead of being drawn here.
  */
-imageObj *msDrawMap(mapObj *map, int querymap) {
+static imageObj *msDrawMapInternal(mapObj *map, int querymap,
+                                   parallelDrawObj *parallel) {
   int i;
   layerObj *lp = NULL;
   int status = MS_FAILURE;
@@ -326,14 +323,6 @@ imageObj *msDrawMap(mapObj *map, int querymap) {
   if (map->debug >= MS_DEBUGLEVEL_TUNING)
     msGettimeofday(&mapstarttime, NULL);
 
-  if (querymap) { /* use queryMapObj image dimensions */
-    if (map->querymap.width > 0 && map->querymap.width <= map->maxsize)
-      map->width = map->querymap.width;
-    if (map->querymap.height > 0 && map->querymap.height <= map->maxsize)
-      map->height = map->querymap.height;
-  }
-
-  msApplyMapConfigOptions(map);
   image = msPrepareImage(map, MS_TRUE);
 
   if (!image) {
@@ -504,6 +493,9 @@ imageObj *msDrawMap(mapObj *map, int querymap) {
       } else { /* Default case: anything but WMS layers */
         if (querymap)
           status = msDrawQueryLayer(map, lp, image);
+        else if (msDrawLayersParallelHandlesLayer(parallel, map->layerorder[i]))
+          status = msDrawLayersParallelMerge(parallel, map, map->layerorder[i],
+                                             image);
         else
           status = msDrawLayer(map, lp, image);
         if (status == MS_FAILURE) {
@@ -713,6 +705,36 @@ imageObj *msDrawMap(mapObj *map, int querymap) {
   return (image);
 }
 
+/*
+ * Generic function to render the map file.
+ * The type of the image created is based on the imagetype parameter in the map
+ * file.
+ *
+ * mapObj *map - map object loaded in MapScript or via a mapfile to use
+ * int querymap - is this map the result of a query operation, MS_TRUE|MS_FALSE
+ */
+imageObj *msDrawMap(mapObj *map, int querymap) {
+  parallelDrawObj *parallel;
+  imageObj *image;
+
+  if (querymap) { /* use queryMapObj image dimensions */
+    if (map->querymap.width > 0 && map->querymap.width <= map->maxsize)
+      map->width = map->querymap.width;
+    if (map->querymap.height > 0 && map->querymap.height <= map->maxsize)
+      map->height = map->querymap.height;
+  }
+
+  msApplyMapConfigOptions(map);
+
+  /* with MS_DRAW_THREADS set, independent layers are drawn ahead by worker
+   * threads and merged in by msDrawMapInternal() */
+  parallel = msDrawLayersParallelStart(map, querymap);
+  image = msDrawMapInternal(map, querymap, parallel);
+  msDrawLayersParallelFree(parallel);
+
+  return image;
+}
+
 /*
  * Test whether a layer should be drawn or not in the current map view and
  * at the current scale.
@@ -826,10 +848,8 @@ int msLayerIsVisible(mapObj *map, layerObj *layer) {
    ((layer)->compositer->next || (layer)->compositor->opacity < 100 ||         \
     (layer)->compositor->compop != MS_COMPOP_SRC_OVER ||                       \
     (layer)->compositer->filter))
-/*
- * Generic function to render a layer object.
- */
-int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image) {
+static int msDrawLayerInternal(mapObj *map, layerObj *layer,
+                               imageObj *image) {
   imageObj *image_draw = image;
   outputFormatObj *altFormat = NULL;
   int retcode = MS_SUCCESS;
@@ -1090,6 +1110,22 @@ int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image) {
   return (retcode);
 }
 
+/*
+ * Generic function to render a layer object.
+ */
+int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image) {
+  double starttime;
+  int status;
+
+  if (!map->metrics || !msLayerIsVisible(map, layer))
+    return msDrawLayerInternal(map, layer, image);
+
+  starttime = msMetricsNow();
+  status = msDrawLayerInternal(map, layer, image);
+  msMetricsAddSpan(map->metrics, layer, MS_METRIC_LAYER_DRAW, starttime);
+  return status;
+}
+
 int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image) {
   int status, retcode = MS_SUCCESS;
   int drawmode = MS_DRAWMODE_FEATURES;
@@ -1126,6 +1162,11 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image) {
   if (status != MS_SUCCESS)
     return MS_FAILURE;
 
+  /* drivers that support it read the shapes into this arena, which only ever
+   * holds the current shape and is freed by msLayerClose() */
+  if (!layer->arena)
+    layer->arena = msArenaCreate(0);
+
   /* build item list. STYLEITEM javascript needs the shape attributes */
   if (layer->styleitem && (STARTS_WITH_CI(layer->styleitem, "javascript://") ||
                            STARTS_WITH_CI(layer->styleitem, "sld://"))) {
@@ -1177,12 +1218,18 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image) {
     searchrect.maxy = map->height - 1;
   }
 
+  /* the shapes drawn at a small scale may come from the .shg */
+  if (layer->connectiontype == MS_SHAPEFILE)
+    msSHPLayerUseGeneralizedForNextWhichShapes(layer, MS_TRUE);
+
   status = msLayerWhichShapes(layer, searchrect, MS_FALSE);
 
   if (layer->connectiontype == MS_UVRASTER) {
     msUVRASTERLayerUseMapExtentAndProjectionForNextWhichShapes(layer, NULL);
   } else if (layer->connectiontype == MS_RASTER_LABEL) {
     msRasterLabelLayerUseMapExtentAndProjectionForNextWhichShapes(layer, NULL);
+  } else if (layer->connectiontype == MS_SHAPEFILE) {
+    msSHPLayerUseGeneralizedForNextWhichShapes(layer, MS_FALSE);
   }
 
   if (status == MS_DONE) { /* no overlap */
@@ -1227,6 +1274,22 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image) {
     return MS_FAILURE;
   }
 
+  /* opt-in approximate reprojection of the vertices, interpolated on a grid
+   * over the search rectangle with an error below the given pixel count */
+  reprojectionObj *approxReprojector = NULL;
+  const char *approxstr = msLayerGetProcessingKey(layer, "APPROX_REPROJECTION");
+  if (approxstr && atof(approxstr) > 0 && layer->project &&
+      layer->transform == MS_TRUE) {
+    approxReprojector = msLayerGetReprojectorToMap(layer, map);
+    if (approxReprojector &&
+        msProjectInitApproxGrid(approxReprojector, searchrect,
+                                atof(approxstr) * map->cellsize) != MS_SUCCESS)
+      approxReprojector = NULL;
+    if (layer->debug >= MS_DEBUGLEVEL_V)
+      msDebug("msDrawVectorLayer(): %s approximate reprojection grid.\n",
+              approxReprojector ? "Using an" : "Unable to build an");
+  }
+
   /* step through the target shapes and their classes */
   msInitShape(&shape);
   int classindex = -1;
@@ -1280,6 +1343,8 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image) {
       break;
     }
     featuresdrawn++;
+    if (map->metrics)
+      msMetricsAddCount(map->metrics, layer, MS_METRIC_FEATURES_DRAWN, 1);
 
     cache = MS_FALSE;
     if (layer->type == MS_LAYER_LINE &&
@@ -1417,6 +1482,7 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image) {
         MS_MAX(maxnumstyles, layer->class[shape.classindex] -> numstyles);
   }
   msFreeShape(&shape);
+  msProjectFreeApproxGrid(approxReprojector);
 
   if (classgroup)
     msFree(classgroup);
@@ -3439,7 +3505,7 @@ static int getLabelPositionFromString(char *pszString) {
     return MS_CC;
 }
 
-int msDrawLabelCache(mapObj *map, imageObj *image) {
+static int msDrawLabelCacheInternal(mapObj *map, imageObj *image) {
   int nReturnVal = MS_SUCCESS;
   struct mstimeval starttime = {0}, endtime = {0};
 
@@ -4189,6 +4255,19 @@ int msDrawLabelCache(mapObj *map, imageObj *image) {
   return nReturnVal;
 }
 
+int msDrawLabelCache(mapObj *map, imageObj *image) {
+  double starttime;
+  int status;
+
+  if (!map->metrics)
+    return msDrawLabelCacheInternal(map, image);
+
+  starttime = msMetricsNow();
+  status = msDrawLabelCacheInternal(map, image);
+  msMetricsAddSpan(map->metrics, NULL, MS_METRIC_LABELCACHE, starttime);
+  return status;
+}
+
 /**
  * Generic function to tell the underline device that layer
  * drawing is stating
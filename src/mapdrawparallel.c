@@ -0,0 +1,585 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Concurrent rendering of independent vector layers for
+ *           msDrawMap(), enabled with the MS_DRAW_THREADS config option.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2024 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+** A mapObj is not safe to share between threads (projection contexts,
+** layer state, symbol caches...), so every worker thread gets its own copy
+** of the map, taken before msPrepareImage() so that it goes through exactly
+** the same preparation as the original. Each eligible layer is drawn by a
+** worker into a transparent image of its own, and the labels it adds to the
+** worker's label cache are moved aside.
+**
+** Once all the workers are done, msDrawMap() walks the layers in their usual
+** order: the images of the layers drawn in parallel are merged into the map
+** image and their labels are appended to the map label cache, exactly where
+** the serial code would have drawn them, so layer stacking and label
+** priorities are unchanged.
+**
+** The worker threads themselves are not started for each map: they are
+** kept in a process wide pool, grown on demand up to the largest number of
+** workers a map asked for, and only stopped by msDrawParallelCleanup().
+*/
+
+#include "mapserver.h"
+#include "mapthread.h"
+#include "fontcache.h"
+
+#ifdef USE_THREAD
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+#endif
+
+typedef struct {
+  int layerindex;
+  int status;
+  char *errormsg;
+  imageObj *image; /* transparent image the layer was drawn into */
+  labelCacheSlotObj slots[MS_MAX_LABEL_PRIORITY]; /* labels of the layer */
+} parallelDrawTaskObj;
+
+typedef struct parallelDrawWorkerObj parallelDrawWorkerObj;
+struct parallelDrawWorkerObj {
+  parallelDrawObj *pd;
+  mapObj *map;                 /* private copy of the map */
+  parallelDrawWorkerObj *next; /* in the queue of the thread pool */
+};
+
+struct parallelDrawObj {
+  int numtasks;
+  parallelDrawTaskObj *tasks;
+  int nexttask;
+
+  int numworkers;
+  parallelDrawWorkerObj *workers;
+  int numrunning; /* workers not done yet, guarded by the pool mutex */
+#ifdef USE_THREAD
+  CPLCond *done;  /* signalled when numrunning drops to 0 */
+#endif
+
+  int *tasklookup; /* layer index -> task index, or -1 */
+
+  msMetricsObj *metrics; /* of the map, where those of the workers go */
+};
+
+#ifdef USE_THREAD
+
+/*
+** Layers are drawn in parallel only when doing so cannot be told apart from
+** drawing them in sequence: plain vector layers that neither depend on the
+** content of the map image nor on other layers.
+*/
+static int layerCanBeDrawnInParallel(mapObj *map, layerObj *layer) {
+  int i;
+
+  if (layer->status != MS_ON && layer->status != MS_DEFAULT)
+    return MS_FALSE;
+  if (layer->type != MS_LAYER_POINT && layer->type != MS_LAYER_LINE &&
+      layer->type != MS_LAYER_POLYGON)
+    return MS_FALSE;
+  if (layer->connectiontype == MS_WMS || layer->connectiontype == MS_WFS)
+    return MS_FALSE; /* downloaded ahead by msDrawMap() */
+  if (layer->postlabelcache || layer->mask)
+    return MS_FALSE;
+  if (layer->compositer &&
+      (layer->compositer->next || layer->compositer->filter ||
+       layer->compositer->comp_op != MS_COMPOP_SRC_OVER))
+    return MS_FALSE;
+  if (msLayerGetProcessingKey(layer, "FORCE_DRAW_LABEL_CACHE") ||
+      msLayerGetProcessingKey(layer, "RENDERER"))
+    return MS_FALSE;
+
+  /* layers used as a mask are drawn on demand by the masked layer */
+  if (layer->name) {
+    for (i = 0; i < map->numlayers; i++) {
+      if (GET_LAYER(map, i)->mask &&
+          strcasecmp(GET_LAYER(map, i)->mask, layer->name) == 0)
+        return MS_FALSE;
+    }
+  }
+
+  return MS_TRUE;
+}
+
+/* take ownership of the labels a layer added to the worker's label cache */
+static void moveLabelCache(parallelDrawTaskObj *task, labelCacheObj *cache) {
+  int p;
+  for (p = 0; p < MS_MAX_LABEL_PRIORITY; p++) {
+    labelCacheSlotObj *slot = &(cache->slots[p]);
+    task->slots[p] = *slot;
+    slot->labels = NULL;
+    slot->markers = NULL;
+    slot->markergrid = NULL;
+    msInitLabelCacheSlot(slot);
+  }
+}
+
+static void parallelDrawWorker(void *arg) {
+  parallelDrawWorkerObj *worker = (parallelDrawWorkerObj *)arg;
+  parallelDrawObj *pd = worker->pd;
+  mapObj *map = worker->map;
+  imageObj *image;
+
+  /* brings the copy in the same state as the original map */
+  image = msPrepareImage(map, MS_TRUE);
+  if (image)
+    msFreeImage(image);
+
+  while (1) {
+    parallelDrawTaskObj *task;
+
+    msAcquireLock(TLOCK_DRAW);
+    task = (pd->nexttask < pd->numtasks) ? &(pd->tasks[pd->nexttask++]) : NULL;
+    msReleaseLock(TLOCK_DRAW);
+    if (!task)
+      break;
+
+    if (!image) {
+      task->status = MS_FAILURE;
+      task->errormsg = msGetErrorString("\n");
+      continue;
+    }
+
+    task->image = msImageCreate(map->width, map->height, map->outputformat,
+                                map->web.imagepath, map->web.imageurl,
+                                map->resolution, map->defresolution, NULL);
+    if (!task->image) {
+      task->status = MS_FAILURE;
+      task->errormsg = msGetErrorString("\n");
+      continue;
+    }
+    task->image->map = map;
+
+    task->status =
+        msDrawLayer(map, GET_LAYER(map, task->layerindex), task->image);
+    if (task->status != MS_SUCCESS)
+      task->errormsg = msGetErrorString("\n");
+    moveLabelCache(task, &(map->labelcache));
+  }
+}
+
+/*
+** Thread pool. The pool threads wait on poolCond for workers to be queued,
+** run them, and signal the done condition of the parallelDrawObj once its
+** last worker is finished.
+*/
+static CPLMutex *poolMutex = NULL;
+static CPLCond *poolCond = NULL;
+static CPLJoinableThread **poolThreads = NULL;
+static int poolNumThreads = 0;
+static parallelDrawWorkerObj *poolHead = NULL, *poolTail = NULL;
+static int poolStopping = MS_FALSE;
+
+static void drawThreadPoolMain(void *arg) {
+  (void)arg;
+  CPLAcquireMutex(poolMutex, 1000.0);
+  while (1) {
+    parallelDrawWorkerObj *worker;
+    parallelDrawObj *pd;
+
+    while (!poolHead && !poolStopping)
+      CPLCondWait(poolCond, poolMutex);
+    if (!poolHead)
+      break; /* stopping */
+    worker = poolHead;
+    poolHead = worker->next;
+    if (!poolHead)
+      poolTail = NULL;
+    CPLReleaseMutex(poolMutex);
+
+    pd = worker->pd;
+    parallelDrawWorker(worker);
+    /* errors are per thread and were copied to the tasks, do not leave them
+     * behind for the next worker. The inline fallback of
+     * msDrawLayersParallelStart() keeps the errors of the caller. */
+    msResetErrorList();
+
+    CPLAcquireMutex(poolMutex, 1000.0);
+    /* pd may be freed as soon as the mutex is released */
+    if (--pd->numrunning == 0)
+      CPLCondBroadcast(pd->done);
+  }
+  CPLReleaseMutex(poolMutex);
+}
+
+/* queue the workers of pd, returns MS_FAILURE if no pool thread could be
+ * started */
+static int drawThreadPoolSubmit(parallelDrawObj *pd) {
+  int i;
+
+  if (!CPLCreateOrAcquireMutex(&poolMutex, 1000.0))
+    return MS_FAILURE;
+  if (!poolCond)
+    poolCond = CPLCreateCond();
+  if (!poolCond || !(pd->done = CPLCreateCond())) {
+    CPLReleaseMutex(poolMutex);
+    return MS_FAILURE;
+  }
+
+  if (poolNumThreads < pd->numworkers) {
+    poolThreads = (CPLJoinableThread **)msSmallRealloc(
+        poolThreads, pd->numworkers * sizeof(CPLJoinableThread *));
+    while (poolNumThreads < pd->numworkers) {
+      CPLJoinableThread *thread =
+          CPLCreateJoinableThread(drawThreadPoolMain, NULL);
+      if (!thread)
+        break;
+      poolThreads[poolNumThreads++] = thread;
+    }
+  }
+  if (poolNumThreads == 0) {
+    CPLReleaseMutex(poolMutex);
+    return MS_FAILURE;
+  }
+
+  /* with fewer threads than workers, the queue is simply drained slower */
+  for (i = 0; i < pd->numworkers; i++) {
+    parallelDrawWorkerObj *worker = &(pd->workers[i]);
+    worker->next = NULL;
+    if (poolTail)
+      poolTail->next = worker;
+    else
+      poolHead = worker;
+    poolTail = worker;
+  }
+  pd->numrunning = pd->numworkers;
+  CPLCondBroadcast(poolCond);
+  CPLReleaseMutex(poolMutex);
+  return MS_SUCCESS;
+}
+
+#endif /* USE_THREAD */
+
+/*
+** Stop the threads of the pool, called from msCleanup().
+*/
+void msDrawParallelCleanup(void) {
+#ifdef USE_THREAD
+  int i;
+  if (!poolMutex)
+    return;
+
+  CPLAcquireMutex(poolMutex, 1000.0);
+  poolStopping = MS_TRUE;
+  CPLCondBroadcast(poolCond);
+  CPLReleaseMutex(poolMutex);
+
+  for (i = 0; i < poolNumThreads; i++)
+    CPLJoinThread(poolThreads[i]);
+  msFree(poolThreads);
+  poolThreads = NULL;
+  poolNumThreads = 0;
+  poolStopping = MS_FALSE;
+
+  CPLDestroyCond(poolCond);
+  poolCond = NULL;
+  CPLDestroyMutex(poolMutex);
+  poolMutex = NULL;
+#endif
+}
+
+/*
+** Copy the map for the workers and start drawing the eligible layers.
+** Must be called before msPrepareImage(). Returns NULL if the layers are to
+** be drawn sequentially.
+*/
+parallelDrawObj *msDrawLayersParallelStart(mapObj *map, int querymap) {
+#ifdef USE_THREAD
+  parallelDrawObj *pd;
+  const char *value;
+  int i, numthreads;
+  rendererVTableObj *renderer;
+
+  value = CPLGetConfigOption("MS_DRAW_THREADS", NULL);
+  if (!value)
+    return NULL;
+  numthreads = atoi(value);
+  if (numthreads < 2 || querymap)
+    return NULL;
+
+  /* the per layer images are merged as raw pixel buffers */
+  if (!map->outputformat || !MS_RENDERER_PLUGIN(map->outputformat))
+    return NULL;
+  msInitializeRendererVTable(map->outputformat);
+  renderer = map->outputformat->vtable;
+  if (!renderer || !renderer->supports_pixel_buffer ||
+      !renderer->mergeRasterBuffer || !renderer->getRasterBufferHandle)
+    return NULL;
+
+  pd = (parallelDrawObj *)msSmallCalloc(1, sizeof(parallelDrawObj));
+  pd->tasks = (parallelDrawTaskObj *)msSmallCalloc(map->numlayers,
+                                                   sizeof(parallelDrawTaskObj));
+  pd->tasklookup = (int *)msSmallMalloc(map->numlayers * sizeof(int));
+  for (i = 0; i < map->numlayers; i++)
+    pd->tasklookup[i] = -1;
+
+  /* queue the tasks in drawing order so that they complete roughly in the
+   * order they are merged */
+  for (i = 0; i < map->numlayers; i++) {
+    int layerindex = map->layerorder[i];
+    if (layerindex == -1 ||
+        !layerCanBeDrawnInParallel(map, GET_LAYER(map, layerindex)))
+      continue;
+    pd->tasklookup[layerindex] = pd->numtasks;
+    pd->tasks[pd->numtasks++].layerindex = layerindex;
+  }
+
+  if (pd->numtasks < 2) {
+    msDrawLayersParallelFree(pd);
+    return NULL;
+  }
+
+  numthreads = MS_MIN(numthreads, pd->numtasks);
+  pd->workers = (parallelDrawWorkerObj *)msSmallCalloc(
+      numthreads, sizeof(parallelDrawWorkerObj));
+  for (i = 0; i < numthreads; i++) {
+    parallelDrawWorkerObj *worker = &(pd->workers[i]);
+    worker->pd = pd;
+    worker->map = msNewMapObj();
+    if (!worker->map || msCopyMap(worker->map, map) != MS_SUCCESS ||
+        !worker->map->outputformat ||
+        worker->map->outputformat->renderer != map->outputformat->renderer) {
+      if (worker->map)
+        msFreeMap(worker->map);
+      worker->map = NULL;
+      break;
+    }
+    /* a msMetricsObj is not shared between threads */
+    if (map->metrics)
+      worker->map->metrics = msMetricsCreate();
+    pd->numworkers++;
+  }
+  pd->metrics = map->metrics;
+  if (pd->numworkers == 0) {
+    msDrawLayersParallelFree(pd);
+    return NULL;
+  }
+
+  if (map->debug >= MS_DEBUGLEVEL_TUNING)
+    msDebug("msDrawLayersParallelStart(): drawing %d layers with %d threads\n",
+            pd->numtasks, pd->numworkers);
+
+  /* if the pool cannot be used, the layers are drawn by this thread */
+  if (drawThreadPoolSubmit(pd) != MS_SUCCESS) {
+    for (i = 0; i < pd->numworkers; i++)
+      parallelDrawWorker(&(pd->workers[i]));
+  }
+
+  return pd;
+#else
+  (void)map;
+  (void)querymap;
+  return NULL;
+#endif
+}
+
+/*
+** Wait for all the layers to be drawn.
+*/
+void msDrawLayersParallelWait(parallelDrawObj *pd) {
+#ifdef USE_THREAD
+  if (!pd->done)
+    return; /* drawn by this thread */
+  CPLAcquireMutex(poolMutex, 1000.0);
+  while (pd->numrunning > 0)
+    CPLCondWait(pd->done, poolMutex);
+  CPLReleaseMutex(poolMutex);
+#else
+  (void)pd;
+#endif
+}
+
+/*
+** Returns MS_TRUE if the layer is drawn by msDrawLayersParallelMerge().
+*/
+int msDrawLayersParallelHandlesLayer(parallelDrawObj *pd, int layerindex) {
+  return pd && pd->tasklookup[layerindex] != -1;
+}
+
+/* make a label reference the map's own labelObj instead of the worker's */
+static labelObj *rebindLabel(mapObj *map, mapObj *workermap, int layerindex,
+                             int classindex, labelObj *label) {
+  classObj *workerclass = GET_CLASS(workermap, layerindex, classindex);
+  labelObj *newlabel = NULL;
+  int k;
+
+  for (k = 0; k < workerclass->numlabels; k++) {
+    if (workerclass->labels[k] == label) {
+      newlabel = GET_CLASS(map, layerindex, classindex)->labels[k];
+      MS_REFCNT_INCR(newlabel);
+      break;
+    }
+  }
+  if (!newlabel) {
+    if (label->refcount == 1)
+      return label; /* private copy, it simply changes owner */
+    newlabel = (labelObj *)msSmallMalloc(sizeof(labelObj));
+    initLabel(newlabel);
+    msCopyLabel(newlabel, label);
+  }
+  if (freeLabel(label) == MS_SUCCESS)
+    free(label);
+  return newlabel;
+}
+
+/* glyphs laid out by a worker come from that thread's font cache */
+static void rebindTextPath(mapObj *map, textPathObj *tp) {
+  int g;
+  for (g = 0; g < tp->numglyphs; g++) {
+    glyphObj *glyph = &(tp->glyphs[g]);
+    face_element *face;
+    if (!glyph->face || !glyph->glyph)
+      continue;
+    face = msGetFontFace(glyph->face->font, &(map->fontset));
+    if (!face)
+      continue;
+    glyph->glyph = msGetGlyphByIndex(face, glyph->glyph->key.size,
+                                     glyph->glyph->key.codepoint);
+    glyph->face = face;
+  }
+}
+
+static void mergeLabelCache(mapObj *map, mapObj *workermap,
+                            parallelDrawTaskObj *task) {
+  int p, l, t;
+  for (p = 0; p < MS_MAX_LABEL_PRIORITY; p++) {
+    labelCacheSlotObj *src = &(task->slots[p]);
+    labelCacheSlotObj *dst = &(map->labelcache.slots[p]);
+    int labeloffset = dst->numlabels, markeroffset = dst->nummarkers;
+
+    if (dst->numlabels + src->numlabels > dst->cachesize) {
+      dst->cachesize = dst->numlabels + src->numlabels;
+      dst->labels = (labelCacheMemberObj *)msSmallRealloc(
+          dst->labels, sizeof(labelCacheMemberObj) * dst->cachesize);
+    }
+    for (l = 0; l < src->numlabels; l++) {
+      labelCacheMemberObj *cachePtr = &(dst->labels[dst->numlabels++]);
+      *cachePtr = src->labels[l];
+      if (cachePtr->markerid != -1)
+        cachePtr->markerid += markeroffset;
+      for (t = 0; t < cachePtr->numtextsymbols; t++) {
+        textSymbolObj *ts = cachePtr->textsymbols[t];
+        ts->label = rebindLabel(map, workermap, cachePtr->layerindex,
+                                cachePtr->classindex, ts->label);
+        if (ts->textpath)
+          rebindTextPath(map, ts->textpath);
+      }
+    }
+
+    if (dst->nummarkers + src->nummarkers > dst->markercachesize) {
+      dst->markercachesize = dst->nummarkers + src->nummarkers;
+      dst->markers = (markerCacheMemberObj *)msSmallRealloc(
+          dst->markers, sizeof(markerCacheMemberObj) * dst->markercachesize);
+    }
+    for (l = 0; l < src->nummarkers; l++) {
+      markerCacheMemberObj *markerPtr = &(dst->markers[dst->nummarkers++]);
+      *markerPtr = src->markers[l];
+      markerPtr->id += labeloffset;
+    }
+
+    /* the members now belong to the map label cache */
+    msFree(src->labels);
+    msFree(src->markers);
+    msFreeLabelCacheGrid(src->markergrid);
+    memset(src, 0, sizeof(*src));
+  }
+}
+
+/*
+** Merge a layer drawn by a worker into the map image and label cache, in
+** place of msDrawLayer().
+*/
+int msDrawLayersParallelMerge(parallelDrawObj *pd, mapObj *map,
+                              int layerindex, imageObj *image) {
+  parallelDrawTaskObj *task = &(pd->tasks[pd->tasklookup[layerindex]]);
+  layerObj *layer = GET_LAYER(map, layerindex);
+  rendererVTableObj *renderer = MS_IMAGE_RENDERER(image);
+  mapObj *workermap;
+  rasterBufferObj rb;
+  int status;
+
+  msDrawLayersParallelWait(pd);
+
+  if (task->status != MS_SUCCESS) {
+    msSetError(MS_IMGERR, "%s", "msDrawLayersParallelMerge()",
+               task->errormsg ? task->errormsg : "Failed to draw layer.");
+    return MS_FAILURE;
+  }
+
+  workermap = task->image->map;
+  mergeLabelCache(map, workermap, task);
+
+  msImageStartLayer(map, layer, image);
+  memset(&rb, 0, sizeof(rasterBufferObj));
+  status = MS_IMAGE_RENDERER(task->image)
+               ->getRasterBufferHandle(task->image, &rb);
+  if (status == MS_SUCCESS)
+    status = renderer->mergeRasterBuffer(image, &rb, 1.0, 0, 0, 0, 0,
+                                         rb.width, rb.height);
+  msImageEndLayer(map, layer, image);
+
+  msFreeImage(task->image);
+  task->image = NULL;
+  return status;
+}
+
+/*
+** Wait for the workers and release everything, including the labels and
+** images of the layers that were not merged.
+*/
+void msDrawLayersParallelFree(parallelDrawObj *pd) {
+  int i, p;
+  if (!pd)
+    return;
+
+  msDrawLayersParallelWait(pd);
+
+  for (i = 0; i < pd->numtasks; i++) {
+    parallelDrawTaskObj *task = &(pd->tasks[i]);
+    for (p = 0; p < MS_MAX_LABEL_PRIORITY; p++)
+      msFreeLabelCacheSlot(&(task->slots[p]));
+    if (task->image)
+      msFreeImage(task->image);
+    msFree(task->errormsg);
+  }
+  for (i = 0; i < pd->numworkers; i++) {
+    msMetricsMerge(pd->metrics, pd->workers[i].map->metrics);
+    msMetricsDestroy(pd->workers[i].map->metrics);
+    msFreeMap(pd->workers[i].map);
+  }
+
+#ifdef USE_THREAD
+  if (pd->done)
+    CPLDestroyCond(pd->done);
+#endif
+  msFree(pd->workers);
+  msFree(pd->tasks);
+  msFree(pd->tasklookup);
+  msFree(pd);
+}
@@ -0,0 +1,637 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Compilation of logical expressions (FILTER, CLASS and LABEL
+ *           EXPRESSION) into a compact stack program that can be evaluated
+ *           per feature without going through the yacc parser.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2024 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** The compiler accepts the subset of the mapparser.y grammar that is common
+** in FILTER and CLASS EXPRESSION blocks: number and string literals, [item]
+** bindings, arithmetic (+ - * / ^), length(), comparisons (including IN and
+** regular expressions against a literal pattern) and AND/OR/NOT. Anything
+** else (time values, geometry functions, string building functions...) is
+** rejected at compile time and msEvalExpression() keeps using yyparse() for
+** that expression. The semantics below mirror the grammar actions exactly.
+*/
+
+#include "mapserver.h"
+
+#define EXPR_MAX_STACK 64
+
+enum exprType {
+  EXPR_TYPE_INVALID = -1,
+  EXPR_TYPE_LOGICAL,
+  EXPR_TYPE_NUMBER,
+  EXPR_TYPE_STRING
+};
+
+enum exprOpcode {
+  EXPR_OP_PUSH_NUMBER, /* number and boolean literals */
+  EXPR_OP_PUSH_STRING,
+  EXPR_OP_BIND_NUMBER, /* [item] */
+  EXPR_OP_BIND_STRING, /* "[item]" */
+  EXPR_OP_ADD,
+  EXPR_OP_SUB,
+  EXPR_OP_MUL,
+  EXPR_OP_DIV,
+  EXPR_OP_POW,
+  EXPR_OP_LENGTH,
+  EXPR_OP_NUM_EQ,
+  EXPR_OP_NUM_NE,
+  EXPR_OP_NUM_GT,
+  EXPR_OP_NUM_LT,
+  EXPR_OP_NUM_GE,
+  EXPR_OP_NUM_LE,
+  EXPR_OP_NUM_IN,
+  EXPR_OP_STR_EQ,
+  EXPR_OP_STR_NE,
+  EXPR_OP_STR_GT,
+  EXPR_OP_STR_LT,
+  EXPR_OP_STR_GE,
+  EXPR_OP_STR_LE,
+  EXPR_OP_STR_IEQ,
+  EXPR_OP_STR_IN,
+  EXPR_OP_STR_RE,
+  EXPR_OP_AND,
+  EXPR_OP_OR,
+  EXPR_OP_NOT
+};
+
+typedef struct {
+  int op;
+  double number;   /* EXPR_OP_PUSH_NUMBER */
+  const char *str; /* EXPR_OP_PUSH_STRING, points into the token list */
+  int index;       /* item index for bindings, regex index for EXPR_OP_STR_RE */
+} exprInstructionObj;
+
+struct exprProgram {
+  exprInstructionObj *code;
+  int numcode;
+  int maxcode;
+  int type; /* type of the value left on the stack */
+
+  ms_regex_t *regexes;
+  int *regex_status; /* MS_TRUE if regexes[i] compiled successfully */
+  int numregexes;
+
+  /* compile time bookkeeping */
+  tokenListNodeObjPtr token;
+  int depth;
+  int maxdepth;
+};
+
+typedef union {
+  double number; /* also holds logical values, 0 or 1 */
+  const char *str;
+} exprValueObj;
+
+static int compileOr(struct exprProgram *program);
+
+static int emit(struct exprProgram *program, int op, int stackdelta) {
+  exprInstructionObj *instr;
+
+  if (program->numcode == program->maxcode) {
+    program->maxcode = program->maxcode ? program->maxcode * 2 : 16;
+    program->code = (exprInstructionObj *)msSmallRealloc(
+        program->code, program->maxcode * sizeof(exprInstructionObj));
+  }
+  instr = &program->code[program->numcode++];
+  memset(instr, 0, sizeof(*instr));
+  instr->op = op;
+
+  program->depth += stackdelta;
+  if (program->depth > program->maxdepth)
+    program->maxdepth = program->depth;
+
+  return program->numcode - 1;
+}
+
+static int currentToken(struct exprProgram *program) {
+  return program->token ? program->token->token : 0;
+}
+
+static void nextToken(struct exprProgram *program) {
+  if (program->token)
+    program->token = program->token->next;
+}
+
+static int expectToken(struct exprProgram *program, int token) {
+  if (currentToken(program) != token)
+    return MS_FALSE;
+  nextToken(program);
+  return MS_TRUE;
+}
+
+/* primary: literal | binding | ( expression ) | length ( string ) */
+static int compilePrimary(struct exprProgram *program) {
+  tokenListNodeObjPtr token = program->token;
+  int type, i;
+
+  switch (currentToken(program)) {
+  case MS_TOKEN_LITERAL_NUMBER:
+  case MS_TOKEN_LITERAL_BOOLEAN:
+    i = emit(program, EXPR_OP_PUSH_NUMBER, 1);
+    if (token->token == MS_TOKEN_LITERAL_BOOLEAN) {
+      program->code[i].number = (int)token->tokenval.dblval;
+      type = EXPR_TYPE_LOGICAL;
+    } else {
+      program->code[i].number = token->tokenval.dblval;
+      type = EXPR_TYPE_NUMBER;
+    }
+    nextToken(program);
+    return type;
+  case MS_TOKEN_LITERAL_STRING:
+    i = emit(program, EXPR_OP_PUSH_STRING, 1);
+    program->code[i].str = token->tokenval.strval;
+    nextToken(program);
+    return EXPR_TYPE_STRING;
+  case MS_TOKEN_BINDING_DOUBLE:
+  case MS_TOKEN_BINDING_INTEGER:
+  case MS_TOKEN_BINDING_STRING:
+    if (token->tokenval.bindval.index < 0)
+      return EXPR_TYPE_INVALID;
+    if (token->token == MS_TOKEN_BINDING_STRING) {
+      i = emit(program, EXPR_OP_BIND_STRING, 1);
+      type = EXPR_TYPE_STRING;
+    } else {
+      i = emit(program, EXPR_OP_BIND_NUMBER, 1);
+      type = EXPR_TYPE_NUMBER;
+    }
+    program->code[i].index = token->tokenval.bindval.index;
+    nextToken(program);
+    return type;
+  case '(':
+    nextToken(program);
+    type = compileOr(program);
+    if (type == EXPR_TYPE_INVALID || !expectToken(program, ')'))
+      return EXPR_TYPE_INVALID;
+    return type;
+  case MS_TOKEN_FUNCTION_LENGTH:
+    nextToken(program);
+    if (!expectToken(program, '(') || compileOr(program) != EXPR_TYPE_STRING ||
+        !expectToken(program, ')'))
+      return EXPR_TYPE_INVALID;
+    emit(program, EXPR_OP_LENGTH, 0);
+    return EXPR_TYPE_NUMBER;
+  default:
+    return EXPR_TYPE_INVALID;
+  }
+}
+
+/* power: primary [ ^ power ], right associative */
+static int compilePower(struct exprProgram *program) {
+  int type = compilePrimary(program);
+
+  if (type == EXPR_TYPE_INVALID || currentToken(program) != '^')
+    return type;
+  nextToken(program);
+  if (type != EXPR_TYPE_NUMBER || compilePower(program) != EXPR_TYPE_NUMBER)
+    return EXPR_TYPE_INVALID;
+  emit(program, EXPR_OP_POW, -1);
+  return EXPR_TYPE_NUMBER;
+}
+
+/* multiplicative: power { (*|/) power } */
+static int compileMultiplicative(struct exprProgram *program) {
+  int type = compilePower(program);
+
+  while (type != EXPR_TYPE_INVALID &&
+         (currentToken(program) == '*' || currentToken(program) == '/')) {
+    int op = (currentToken(program) == '*') ? EXPR_OP_MUL : EXPR_OP_DIV;
+    nextToken(program);
+    if (type != EXPR_TYPE_NUMBER || compilePower(program) != EXPR_TYPE_NUMBER)
+      return EXPR_TYPE_INVALID;
+    emit(program, op, -1);
+  }
+  return type;
+}
+
+/* additive: multiplicative { (+|-) multiplicative }, numbers only */
+static int compileAdditive(struct exprProgram *program) {
+  int type = compileMultiplicative(program);
+
+  while (type != EXPR_TYPE_INVALID &&
+         (currentToken(program) == '+' || currentToken(program) == '-')) {
+    int op = (currentToken(program) == '+') ? EXPR_OP_ADD : EXPR_OP_SUB;
+    nextToken(program);
+    if (type != EXPR_TYPE_NUMBER ||
+        compileMultiplicative(program) != EXPR_TYPE_NUMBER)
+      return EXPR_TYPE_INVALID;
+    emit(program, op, -1);
+  }
+  return type;
+}
+
+/* comparison: additive [ op additive ] */
+static int compileComparison(struct exprProgram *program) {
+  int token, ltype, rtype, op = -1;
+  tokenListNodeObjPtr rhs;
+
+  ltype = compileAdditive(program);
+  if (ltype == EXPR_TYPE_INVALID)
+    return ltype;
+
+  token = currentToken(program);
+  if (token < MS_TOKEN_COMPARISON_EQ || token > MS_TOKEN_COMPARISON_IN)
+    return ltype;
+  nextToken(program);
+
+  rhs = program->token;
+  rtype = compileAdditive(program);
+
+  if (ltype == EXPR_TYPE_NUMBER && rtype == EXPR_TYPE_NUMBER) {
+    switch (token) {
+    case MS_TOKEN_COMPARISON_EQ:
+    case MS_TOKEN_COMPARISON_IEQ:
+      op = EXPR_OP_NUM_EQ;
+      break;
+    case MS_TOKEN_COMPARISON_NE:
+      op = EXPR_OP_NUM_NE;
+      break;
+    case MS_TOKEN_COMPARISON_GT:
+      op = EXPR_OP_NUM_GT;
+      break;
+    case MS_TOKEN_COMPARISON_LT:
+      op = EXPR_OP_NUM_LT;
+      break;
+    case MS_TOKEN_COMPARISON_GE:
+      op = EXPR_OP_NUM_GE;
+      break;
+    case MS_TOKEN_COMPARISON_LE:
+      op = EXPR_OP_NUM_LE;
+      break;
+    }
+  } else if (ltype == EXPR_TYPE_NUMBER && rtype == EXPR_TYPE_STRING) {
+    if (token == MS_TOKEN_COMPARISON_IN)
+      op = EXPR_OP_NUM_IN;
+  } else if (ltype == EXPR_TYPE_STRING && rtype == EXPR_TYPE_STRING) {
+    switch (token) {
+    case MS_TOKEN_COMPARISON_EQ:
+      op = EXPR_OP_STR_EQ;
+      break;
+    case MS_TOKEN_COMPARISON_NE:
+      op = EXPR_OP_STR_NE;
+      break;
+    case MS_TOKEN_COMPARISON_GT:
+      op = EXPR_OP_STR_GT;
+      break;
+    case MS_TOKEN_COMPARISON_LT:
+      op = EXPR_OP_STR_LT;
+      break;
+    case MS_TOKEN_COMPARISON_GE:
+      op = EXPR_OP_STR_GE;
+      break;
+    case MS_TOKEN_COMPARISON_LE:
+      op = EXPR_OP_STR_LE;
+      break;
+    case MS_TOKEN_COMPARISON_IEQ:
+      op = EXPR_OP_STR_IEQ;
+      break;
+    case MS_TOKEN_COMPARISON_IN:
+      op = EXPR_OP_STR_IN;
+      break;
+    case MS_TOKEN_COMPARISON_RE:
+    case MS_TOKEN_COMPARISON_IRE: {
+      /* only literal patterns, compiled once here instead of per feature */
+      int flags = MS_REG_EXTENDED | MS_REG_NOSUB;
+      int n = program->numregexes;
+      if (rhs->token != MS_TOKEN_LITERAL_STRING ||
+          program->code[program->numcode - 1].op != EXPR_OP_PUSH_STRING)
+        return EXPR_TYPE_INVALID;
+      if (token == MS_TOKEN_COMPARISON_IRE)
+        flags |= MS_REG_ICASE;
+      program->regexes = (ms_regex_t *)msSmallRealloc(
+          program->regexes, (n + 1) * sizeof(ms_regex_t));
+      program->regex_status =
+          (int *)msSmallRealloc(program->regex_status, (n + 1) * sizeof(int));
+      program->regex_status[n] =
+          (ms_regcomp(&program->regexes[n], rhs->tokenval.strval, flags) == 0)
+              ? MS_TRUE
+              : MS_FALSE;
+      program->numregexes++;
+      op = EXPR_OP_STR_RE;
+      break;
+    }
+    }
+  } else if (ltype == EXPR_TYPE_LOGICAL && rtype == EXPR_TYPE_LOGICAL) {
+    if (token == MS_TOKEN_COMPARISON_EQ)
+      op = EXPR_OP_NUM_EQ;
+  }
+
+  if (op < 0)
+    return EXPR_TYPE_INVALID;
+  emit(program, op, -1);
+  if (op == EXPR_OP_STR_RE)
+    program->code[program->numcode - 1].index = program->numregexes - 1;
+
+  /* comparisons don't chain in a way we want to mimic, e.g. a = b = c */
+  token = currentToken(program);
+  if (token >= MS_TOKEN_COMPARISON_EQ && token <= MS_TOKEN_COMPARISON_IN)
+    return EXPR_TYPE_INVALID;
+
+  return EXPR_TYPE_LOGICAL;
+}
+
+/* not: NOT not | comparison */
+static int compileNot(struct exprProgram *program) {
+  int type;
+
+  if (currentToken(program) != MS_TOKEN_LOGICAL_NOT)
+    return compileComparison(program);
+
+  nextToken(program);
+  type = compileNot(program);
+  if (type != EXPR_TYPE_LOGICAL && type != EXPR_TYPE_NUMBER)
+    return EXPR_TYPE_INVALID;
+  emit(program, EXPR_OP_NOT, 0);
+  return EXPR_TYPE_LOGICAL;
+}
+
+/* and: not { AND not }, operands are logical or numeric */
+static int compileAnd(struct exprProgram *program) {
+  int type = compileNot(program);
+
+  while (type != EXPR_TYPE_INVALID &&
+         currentToken(program) == MS_TOKEN_LOGICAL_AND) {
+    nextToken(program);
+    if (type == EXPR_TYPE_STRING)
+      return EXPR_TYPE_INVALID;
+    type = compileNot(program);
+    if (type != EXPR_TYPE_LOGICAL && type != EXPR_TYPE_NUMBER)
+      return EXPR_TYPE_INVALID;
+    emit(program, EXPR_OP_AND, -1);
+    type = EXPR_TYPE_LOGICAL;
+  }
+  return type;
+}
+
+/* or: and { OR and } */
+static int compileOr(struct exprProgram *program) {
+  int type = compileAnd(program);
+
+  while (type != EXPR_TYPE_INVALID &&
+         currentToken(program) == MS_TOKEN_LOGICAL_OR) {
+    nextToken(program);
+    if (type == EXPR_TYPE_STRING)
+      return EXPR_TYPE_INVALID;
+    type = compileAnd(program);
+    if (type != EXPR_TYPE_LOGICAL && type != EXPR_TYPE_NUMBER)
+      return EXPR_TYPE_INVALID;
+    emit(program, EXPR_OP_OR, -1);
+    type = EXPR_TYPE_LOGICAL;
+  }
+  return type;
+}
+
+static void freeProgram(struct exprProgram *program) {
+  int i;
+
+  if (!program)
+    return;
+  for (i = 0; i < program->numregexes; i++) {
+    if (program->regex_status[i])
+      ms_regfree(&program->regexes[i]);
+  }
+  msFree(program->regexes);
+  msFree(program->regex_status);
+  msFree(program->code);
+  msFree(program);
+}
+
+void msFreeCompiledExpression(expressionObj *expression) {
+  if (!expression)
+    return;
+  freeProgram(expression->program);
+  expression->program = NULL;
+}
+
+/*
+** Compile the token list of a tokenized MS_EXPRESSION. Returns MS_SUCCESS if
+** the expression can be evaluated by msEvalCompiledExpression(), MS_FAILURE
+** (without setting an error) if it has to go through the parser.
+*/
+int msCompileExpression(expressionObj *expression) {
+  struct exprProgram *program;
+
+  msFreeCompiledExpression(expression);
+
+  if (expression->type != MS_EXPRESSION || expression->tokens == NULL ||
+      expression->native_string != NULL)
+    return MS_FAILURE;
+
+  program = (struct exprProgram *)msSmallCalloc(1, sizeof(struct exprProgram));
+  program->token = expression->tokens;
+  program->type = compileOr(program);
+
+  if (program->type == EXPR_TYPE_INVALID || program->token != NULL ||
+      program->maxdepth > EXPR_MAX_STACK) {
+    freeProgram(program);
+    return MS_FAILURE;
+  }
+
+  program->token = NULL;
+  expression->program = program;
+  return MS_SUCCESS;
+}
+
+static int stringInList(const char *value, const char *list) {
+  size_t value_len = strlen(value);
+  const char *start = list, *end;
+
+  while ((end = strchr(start, ',')) != NULL) {
+    if ((size_t)(end - start) == value_len &&
+        strncmp(start, value, value_len) == 0)
+      return MS_TRUE;
+    start = end + 1;
+  }
+  return strcmp(start, value) == 0 ? MS_TRUE : MS_FALSE;
+}
+
+static int numberInList(double value, const char *list) {
+  const char *start = list, *end;
+
+  /* atof() stops at the comma, no need to split the list */
+  while ((end = strchr(start, ',')) != NULL) {
+    if (value == atof(start))
+      return MS_TRUE;
+    start = end + 1;
+  }
+  return value == atof(start) ? MS_TRUE : MS_FALSE;
+}
+
+/*
+** Evaluate a compiled expression against a shape. Returns MS_FAILURE when
+** the program cannot produce the same result as the parser (missing values,
+** division by zero...), in which case the caller falls back to yyparse() so
+** that errors are reported exactly as before.
+*/
+int msEvalCompiledExpression(const expressionObj *expression,
+                             const shapeObj *shape, int *result) {
+  const struct exprProgram *program = expression->program;
+  exprValueObj stack[EXPR_MAX_STACK];
+  int sp = -1, i;
+
+  if (!program || !shape)
+    return MS_FAILURE;
+
+  for (i = 0; i < program->numcode; i++) {
+    const exprInstructionObj *instr = &program->code[i];
+
+    switch (instr->op) {
+    case EXPR_OP_PUSH_NUMBER:
+      stack[++sp].number = instr->number;
+      break;
+    case EXPR_OP_PUSH_STRING:
+      stack[++sp].str = instr->str;
+      break;
+    case EXPR_OP_BIND_NUMBER:
+    case EXPR_OP_BIND_STRING:
+      if (instr->index >= shape->numvalues || !shape->values[instr->index])
+        return MS_FAILURE;
+      if (instr->op == EXPR_OP_BIND_NUMBER)
+        stack[++sp].number = atof(shape->values[instr->index]);
+      else
+        stack[++sp].str = shape->values[instr->index];
+      break;
+    case EXPR_OP_ADD:
+      sp--;
+      stack[sp].number += stack[sp + 1].number;
+      break;
+    case EXPR_OP_SUB:
+      sp--;
+      stack[sp].number -= stack[sp + 1].number;
+      break;
+    case EXPR_OP_MUL:
+      sp--;
+      stack[sp].number *= stack[sp + 1].number;
+      break;
+    case EXPR_OP_DIV:
+      sp--;
+      if (stack[sp + 1].number == 0.0)
+        return MS_FAILURE; /* let the parser report the error */
+      stack[sp].number /= stack[sp + 1].number;
+      break;
+    case EXPR_OP_POW:
+      sp--;
+      stack[sp].number = pow(stack[sp].number, stack[sp + 1].number);
+      break;
+    case EXPR_OP_LENGTH:
+      stack[sp].number = strlen(stack[sp].str);
+      break;
+    case EXPR_OP_NUM_EQ:
+      sp--;
+      stack[sp].number = (stack[sp].number == stack[sp + 1].number);
+      break;
+    case EXPR_OP_NUM_NE:
+      sp--;
+      stack[sp].number = (stack[sp].number != stack[sp + 1].number);
+      break;
+    case EXPR_OP_NUM_GT:
+      sp--;
+      stack[sp].number = (stack[sp].number > stack[sp + 1].number);
+      break;
+    case EXPR_OP_NUM_LT:
+      sp--;
+      stack[sp].number = (stack[sp].number < stack[sp + 1].number);
+      break;
+    case EXPR_OP_NUM_GE:
+      sp--;
+      stack[sp].number = (stack[sp].number >= stack[sp + 1].number);
+      break;
+    case EXPR_OP_NUM_LE:
+      sp--;
+      stack[sp].number = (stack[sp].number <= stack[sp + 1].number);
+      break;
+    case EXPR_OP_NUM_IN:
+      sp--;
+      stack[sp].number = numberInList(stack[sp].number, stack[sp + 1].str);
+      break;
+    case EXPR_OP_STR_EQ:
+      sp--;
+      stack[sp].number = (strcmp(stack[sp].str, stack[sp + 1].str) == 0);
+      break;
+    case EXPR_OP_STR_NE:
+      sp--;
+      stack[sp].number = (strcmp(stack[sp].str, stack[sp + 1].str) != 0);
+      break;
+    case EXPR_OP_STR_GT:
+      sp--;
+      stack[sp].number = (strcmp(stack[sp].str, stack[sp + 1].str) > 0);
+      break;
+    case EXPR_OP_STR_LT:
+      sp--;
+      stack[sp].number = (strcmp(stack[sp].str, stack[sp + 1].str) < 0);
+      break;
+    case EXPR_OP_STR_GE:
+      sp--;
+      stack[sp].number = (strcmp(stack[sp].str, stack[sp + 1].str) >= 0);
+      break;
+    case EXPR_OP_STR_LE:
+      sp--;
+      stack[sp].number = (strcmp(stack[sp].str, stack[sp + 1].str) <= 0);
+      break;
+    case EXPR_OP_STR_IEQ:
+      sp--;
+      stack[sp].number = (strcasecmp(stack[sp].str, stack[sp + 1].str) == 0);
+      break;
+    case EXPR_OP_STR_IN:
+      sp--;
+      stack[sp].number = stringInList(stack[sp].str, stack[sp + 1].str);
+      break;
+    case EXPR_OP_STR_RE:
+      sp--;
+      if (MS_STRING_IS_NULL_OR_EMPTY(stack[sp].str) ||
+          !program->regex_status[instr->index])
+        stack[sp].number = MS_FALSE;
+      else
+        stack[sp].number = (ms_regexec(&program->regexes[instr->index],
+                                       stack[sp].str, 0, NULL, 0) == 0);
+      break;
+    case EXPR_OP_AND:
+      sp--;
+      stack[sp].number =
+          (stack[sp].number != 0 && stack[sp + 1].number != 0);
+      break;
+    case EXPR_OP_OR:
+      sp--;
+      stack[sp].number =
+          (stack[sp].number != 0 || stack[sp + 1].number != 0);
+      break;
+    case EXPR_OP_NOT:
+      stack[sp].number = (stack[sp].number == 0);
+      break;
+    }
+  }
+
+  if (program->type == EXPR_TYPE_STRING)
+    *result = MS_TRUE; /* a string is never NULL here */
+  else
+    *result = (stack[sp].number != 0) ? MS_TRUE : MS_FALSE;
+
+  return MS_SUCCESS;
+}
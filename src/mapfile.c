@@ -1425,15 +1425,6 @@ int msLoadProjectionStringEPSG(projectionObj *p, const char *value) {
   msFreeProjectionExceptContext(p);
 
   p->gt.need_geotransform = MS_FALSE;
-#ifdef USE_PROJ_FASTPATHS
-  if (strcasestr(value, "epsg:4326")) {
-    p->wellknownprojection = wkp_lonlat;
-  } else if (strcasestr(value, "epsg:3857")) {
-    p->wellknownprojection = wkp_gmerc;
-  } else {
-    p->wellknownprojection = wkp_none;
-  }
-#endif
 
   if (msLoadProjectionStringEPSGLike(p, value, "EPSG:", MS_TRUE) == 0) {
     return msProcessProjection(p);
@@ -2274,6 +2265,8 @@ void msFreeExpressionTokens(expressionObj *exp) {
   if (!exp)
     return;
 
+  msFreeCompiledExpression(exp);
+
   if (exp->tokens) {
     node = exp->tokens;
     while (node != NULL) {
@@ -3936,6 +3929,8 @@ int initLayer(layerObj *layer, mapObj *map) {
   layer->project = MS_TRUE;
   layer->reprojectorLayerToMap = NULL;
   layer->reprojectorMapToLayer = NULL;
+  layer->arena = NULL;
+  layer->classindex = NULL;
 
   initCluster(&layer->cluster);
 
@@ -4082,6 +4077,8 @@ int freeLayer(layerObj *layer) {
 
   msProjectDestroyReprojector(layer->reprojectorLayerToMap);
   msProjectDestroyReprojector(layer->reprojectorMapToLayer);
+  msArenaDestroy(layer->arena);
+  msClassIndexFree(layer->classindex);
   msFreeProjection(&(layer->projection));
   msFreeExpression(&layer->_geomtransform);
 
@@ -6213,6 +6210,7 @@ int initMap(mapObj *map) {
   map->cellsize = 0;
   map->shapepath = NULL;
   map->mappath = NULL;
+  map->mapfile = NULL;
   map->sldurl = NULL;
 
   MS_INIT_COLOR(map->imagecolor, 255, 255, 255, 255); /* white */
@@ -6277,6 +6275,8 @@ int initMap(mapObj *map) {
   /* Encryption key information - see mapcrypto.c */
   map->encryption_key_loaded = MS_FALSE;
 
+  map->metrics = NULL;
+
   msInitQuery(&(map->query));
 
 #ifdef USE_V8_MAPSCRIPT
@@ -6369,6 +6369,10 @@ int msFreeLabelCacheSlot(labelCacheSlotObj *cacheslot) {
   cacheslot->markercachesize = 0;
   cacheslot->nummarkers = 0;
 
+  msFreeLabelCacheGrid(cacheslot->markergrid);
+  cacheslot->markergrid = NULL;
+  cacheslot->numindexedmarkers = 0;
+
   return (MS_SUCCESS);
 }
 
@@ -6382,6 +6386,9 @@ int msFreeLabelCache(labelCacheObj *cache) {
 
   cache->num_allocated_rendered_members = cache->num_rendered_members = 0;
   msFree(cache->rendered_text_symbols);
+  cache->rendered_text_symbols = NULL;
+  msFreeLabelCacheGrid(cache->rendered_grid);
+  cache->rendered_grid = NULL;
 
   return MS_SUCCESS;
 }
@@ -6408,6 +6415,8 @@ int msInitLabelCacheSlot(labelCacheSlotObj *cacheslot) {
 
   cacheslot->markercachesize = MS_LABELCACHEINITSIZE;
   cacheslot->nummarkers = 0;
+  cacheslot->markergrid = NULL;
+  cacheslot->numindexedmarkers = 0;
 
   return (MS_SUCCESS);
 }
@@ -6422,6 +6431,7 @@ int msInitLabelCache(labelCacheObj *cache) {
   cache->gutter = 0;
   cache->num_allocated_rendered_members = cache->num_rendered_members = 0;
   cache->rendered_text_symbols = NULL;
+  cache->rendered_grid = NULL;
 
   return MS_SUCCESS;
 }
@@ -7036,6 +7046,7 @@ mapObj *msLoadMap(const char *filename, const char *new_mappath,
     map->mappath = msStrdup(msBuildPath(szPath, szCWDPath, path));
     free(path);
   }
+  map->mapfile = msStrdup(msBuildPath(szPath, szCWDPath, filename));
 
   msyybasepath = map->mappath; /* for INCLUDEs */
 
@@ -68,6 +68,9 @@ void msGDALCleanup(void)
   if (bGDALInitialized) {
     int iRepeat = 5;
 
+    /* the datasets kept by MS_RASTER_DATASET_CACHE go first */
+    msRasterDatasetCacheCleanup();
+
     /*
     ** Cleanup any unreferenced but open datasets as will tend
     ** to exist due to deferred close requests.  We are careful
@@ -301,10 +301,10 @@ int msGeomTransformShape(mapObj *map, layerObj *layer, shapeObj *shape) {
     tmpshp = p.result.shpval;
 
     for (i = 0; i < shape->numlines; i++)
-      free(shape->line[i].point);
+      msShapeFreeMemory(shape, shape->line[i].point);
     shape->numlines = 0;
     if (shape->line)
-      free(shape->line);
+      msShapeFreeMemory(shape, shape->line);
     shape->line = NULL;
     shape->type = tmpshp->type; /* might have been a change (e.g. centerline) */
 
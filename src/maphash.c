@@ -244,3 +244,61 @@ const char *msNextKeyFromHashTable(const hashTableObj *table,
 
   return NULL;
 }
+
+unsigned long long msFNVHashBytes(unsigned long long hash, const void *data,
+                                  size_t size) {
+  const unsigned char *p = (const unsigned char *)data;
+  size_t i;
+
+  for (i = 0; i < size; i++) {
+    hash ^= p[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+unsigned long long msFNVHashString(unsigned long long hash, const char *str,
+                                   int insensitive) {
+  for (; str && *str; str++) {
+    hash ^= insensitive ? (unsigned char)tolower((unsigned char)*str)
+                        : (unsigned char)*str;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+void msLRUCacheInit(msLRUCacheObj *cache, int size) {
+  cache->size = size;
+  cache->clock = 0;
+  cache->lastused =
+      (unsigned long long *)msSmallCalloc(size, sizeof(unsigned long long));
+}
+
+void msLRUCacheFree(msLRUCacheObj *cache) {
+  msFree(cache->lastused);
+  cache->lastused = NULL;
+  cache->size = 0;
+  cache->clock = 0;
+}
+
+void msLRUCacheTouch(msLRUCacheObj *cache, int slot) {
+  cache->lastused[slot] = ++cache->clock;
+}
+
+void msLRUCacheRelease(msLRUCacheObj *cache, int slot) {
+  cache->lastused[slot] = 0;
+}
+
+int msLRUCacheSlot(const msLRUCacheObj *cache,
+                   int (*evictable)(int slot, void *arg), void *arg) {
+  int i, slot = -1;
+
+  for (i = 0; i < cache->size; i++) {
+    if (!cache->lastused[i])
+      return i;
+    if ((slot < 0 || cache->lastused[i] < cache->lastused[slot]) &&
+        (!evictable || evictable(i, arg)))
+      slot = i;
+  }
+  return slot;
+}
@@ -30,6 +30,8 @@
 #ifndef MAPHASH__H
 #define MAPHASH__H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -157,6 +159,55 @@ MS_DLL_EXPORT const char *msNextKeyFromHashTable(const hashTableObj *table,
 
 MS_DLL_EXPORT int msHashIsEmpty(const hashTableObj *table);
 
+/* msFNVHashBytes, msFNVHashString - FNV-1a hash of a buffer or string, chained
+ * from hash (MS_HASH_INIT for the first one). Used for the keys of the
+ * process and disk caches and the buckets of their lookup tables.
+ * ARGS:
+ *     hash - the hash so far
+ *     insensitive - hash str as if it were lower case
+ * RETURNS:
+ *     the updated hash
+ */
+#define MS_HASH_INIT 14695981039346656037ULL
+MS_DLL_EXPORT unsigned long long msFNVHashBytes(unsigned long long hash,
+                                               const void *data, size_t size);
+MS_DLL_EXPORT unsigned long long
+msFNVHashString(unsigned long long hash, const char *str, int insensitive);
+
+/* Slot bookkeeping of the fixed size caches kept per process (join tables,
+ * clusters, raster datasets...). The cache owns an array of size entries,
+ * guarded by its own lock, and this object tracks when each of them was
+ * last used.
+ */
+typedef struct {
+  int size;
+  unsigned long long clock;      /* 64 bits, it does not wrap around */
+  unsigned long long *lastused; /* 0 for a free slot */
+} msLRUCacheObj;
+
+/* msLRUCacheInit - allocate the bookkeeping of size free slots */
+MS_DLL_EXPORT void msLRUCacheInit(msLRUCacheObj *cache, int size);
+
+/* msLRUCacheFree - release the bookkeeping, not the entries */
+MS_DLL_EXPORT void msLRUCacheFree(msLRUCacheObj *cache);
+
+/* msLRUCacheTouch - mark slot as (re)used now */
+MS_DLL_EXPORT void msLRUCacheTouch(msLRUCacheObj *cache, int slot);
+
+/* msLRUCacheRelease - mark slot as free */
+MS_DLL_EXPORT void msLRUCacheRelease(msLRUCacheObj *cache, int slot);
+
+/* msLRUCacheSlot - pick the slot of a new entry
+ * ARGS:
+ *     evictable - if not NULL, tells whether the entry of an occupied slot
+ *                 may be replaced
+ * RETURNS:
+ *     a free slot, or else the least recently used evictable one, or -1
+ */
+MS_DLL_EXPORT int msLRUCacheSlot(const msLRUCacheObj *cache,
+                                 int (*evictable)(int slot, void *arg),
+                                 void *arg);
+
 #endif /*SWIG*/
 
 #ifdef __cplusplus
@@ -29,10 +29,14 @@
 
 #include "mapserver.h"
 #include <png.h>
+#include <zlib.h>
 #include <setjmp.h>
 #include <assert.h>
 #include <jpeglib.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+
+#include "cpl_multiproc.h"
 
 #ifdef USE_GIF
 #include <gif_lib.h>
@@ -60,6 +64,398 @@ static void png_flush_data(png_structp png_ptr) {
   /* do nothing */
 }
 
+/* PNG_FILTER value selecting a filter per row, see pngFilterRow() */
+#define MS_PNG_FILTER_ADAPTIVE -1
+
+/* a stripe of the PNG_THREADS encoder isn't worth a thread below this height */
+#define PNG_MIN_STRIPE_ROWS 64
+
+/* how PNG images are encoded, from the outputformat options */
+typedef struct {
+  int compression; /* zlib level, -1 for the zlib default */
+  int filter;      /* PNG_FILTER_VALUE_*, or MS_PNG_FILTER_ADAPTIVE */
+  int strategy;    /* zlib strategy */
+  int threads;     /* number of stripes encoded in parallel */
+} pngOptionsObj;
+
+static int getPNGOptions(outputFormatObj *format, pngOptionsObj *opts) {
+  const char *value;
+
+  opts->compression = -1;
+  value = msGetOutputFormatOption(format, "COMPRESSION", NULL);
+  if (value && *value) {
+    char *endptr;
+    opts->compression = strtol(value, &endptr, 10);
+    if (*endptr || opts->compression < -1 || opts->compression > 9) {
+      msSetError(MS_MISCERR,
+                 "failed to parse FORMATOPTION \"COMPRESSION=%s\", expecting "
+                 "integer from 0 to 9.",
+                 "saveAsPNG()", value);
+      return MS_FAILURE;
+    }
+  }
+
+  value = msGetOutputFormatOption(format, "PNG_FILTER", "NONE");
+  if (strcasecmp(value, "NONE") == 0)
+    opts->filter = PNG_FILTER_VALUE_NONE;
+  else if (strcasecmp(value, "SUB") == 0)
+    opts->filter = PNG_FILTER_VALUE_SUB;
+  else if (strcasecmp(value, "UP") == 0)
+    opts->filter = PNG_FILTER_VALUE_UP;
+  else if (strcasecmp(value, "AVERAGE") == 0)
+    opts->filter = PNG_FILTER_VALUE_AVG;
+  else if (strcasecmp(value, "PAETH") == 0)
+    opts->filter = PNG_FILTER_VALUE_PAETH;
+  else if (strcasecmp(value, "ADAPTIVE") == 0)
+    opts->filter = MS_PNG_FILTER_ADAPTIVE;
+  else {
+    msSetError(MS_MISCERR,
+               "failed to parse FORMATOPTION \"PNG_FILTER=%s\", expecting "
+               "NONE, SUB, UP, AVERAGE, PAETH or ADAPTIVE.",
+               "saveAsPNG()", value);
+    return MS_FAILURE;
+  }
+
+  value = msGetOutputFormatOption(format, "PNG_DEFLATE_STRATEGY", "DEFAULT");
+  if (strcasecmp(value, "DEFAULT") == 0)
+    opts->strategy = Z_DEFAULT_STRATEGY;
+  else if (strcasecmp(value, "FILTERED") == 0)
+    opts->strategy = Z_FILTERED;
+  else if (strcasecmp(value, "RLE") == 0)
+    opts->strategy = Z_RLE;
+  else {
+    msSetError(MS_MISCERR,
+               "failed to parse FORMATOPTION \"PNG_DEFLATE_STRATEGY=%s\", "
+               "expecting DEFAULT, FILTERED or RLE.",
+               "saveAsPNG()", value);
+    return MS_FAILURE;
+  }
+
+  value = msGetOutputFormatOption(format, "PNG_THREADS", "1");
+  if (strcasecmp(value, "ALL_CPUS") == 0)
+    opts->threads = CPLGetNumCPUs();
+  else
+    opts->threads = MS_MAX(1, atoi(value));
+
+  return MS_SUCCESS;
+}
+
+static void setPNGOptions(png_structp png_ptr, const pngOptionsObj *opts,
+                          int filter) {
+  static const int filter_masks[] = {PNG_FILTER_NONE, PNG_FILTER_SUB,
+                                     PNG_FILTER_UP, PNG_FILTER_AVG,
+                                     PNG_FILTER_PAETH};
+  png_set_compression_level(png_ptr, opts->compression);
+  png_set_compression_strategy(png_ptr, opts->strategy);
+  /* libpng picks among the allowed filters with the same heuristic as */
+  /* pngFilterRow() */
+  if (filter == MS_PNG_FILTER_ADAPTIVE)
+    png_set_filter(png_ptr, 0,
+                   PNG_FILTER_NONE | PNG_FILTER_SUB | PNG_FILTER_UP);
+  else
+    png_set_filter(png_ptr, 0, filter_masks[filter]);
+}
+
+/*
+** Filter one row of a PNG image into out, the filter type byte followed by
+** the filtered row. prev is the previous unfiltered row, all zeroes for the
+** first one, and bpp the number of bytes per complete pixel (at least 1).
+**
+** In adaptive mode, the row is filtered with None, Sub and Up, and the one
+** with the smallest sum of absolute values (taking bytes as signed) is kept,
+** the heuristic libpng uses. Average and Paeth are left out: they cost more
+** and seldom win on map imagery, made of flat areas and sharp edges.
+*/
+static void pngFilterRow(int filter, const unsigned char *row,
+                         const unsigned char *prev, size_t rowbytes, int bpp,
+                         unsigned char *out, unsigned char *scratch) {
+  size_t i;
+
+  if (filter == MS_PNG_FILTER_ADAPTIVE) {
+    unsigned char *sub = scratch, *up = scratch + rowbytes;
+    unsigned long sumnone = 0, sumsub = 0, sumup = 0;
+    for (i = 0; i < rowbytes; i++) {
+      sub[i] = row[i] - (i >= (size_t)bpp ? row[i - bpp] : 0);
+      up[i] = row[i] - prev[i];
+      sumnone += row[i] < 128 ? row[i] : 256 - row[i];
+      sumsub += sub[i] < 128 ? sub[i] : 256 - sub[i];
+      sumup += up[i] < 128 ? up[i] : 256 - up[i];
+    }
+    if (sumnone <= sumsub && sumnone <= sumup) {
+      out[0] = PNG_FILTER_VALUE_NONE;
+      memcpy(out + 1, row, rowbytes);
+    } else if (sumsub <= sumup) {
+      out[0] = PNG_FILTER_VALUE_SUB;
+      memcpy(out + 1, sub, rowbytes);
+    } else {
+      out[0] = PNG_FILTER_VALUE_UP;
+      memcpy(out + 1, up, rowbytes);
+    }
+    return;
+  }
+
+  out[0] = (unsigned char)filter;
+  out++;
+  switch (filter) {
+  case PNG_FILTER_VALUE_SUB:
+    for (i = 0; i < rowbytes; i++)
+      out[i] = row[i] - (i >= (size_t)bpp ? row[i - bpp] : 0);
+    break;
+  case PNG_FILTER_VALUE_UP:
+    for (i = 0; i < rowbytes; i++)
+      out[i] = row[i] - prev[i];
+    break;
+  case PNG_FILTER_VALUE_AVG:
+    for (i = 0; i < rowbytes; i++)
+      out[i] = row[i] -
+               (((i >= (size_t)bpp ? row[i - bpp] : 0) + prev[i]) >> 1);
+    break;
+  case PNG_FILTER_VALUE_PAETH:
+    for (i = 0; i < rowbytes; i++) {
+      const int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+      const int b = prev[i];
+      const int c = i >= (size_t)bpp ? prev[i - bpp] : 0;
+      const int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+      out[i] = row[i] - (pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+    }
+    break;
+  default:
+    memcpy(out, row, rowbytes);
+  }
+}
+
+/*
+** Encoder for FORMATOPTION "PNG_THREADS": the image is split in stripes of
+** rows that are filtered and deflated in parallel. Each stripe is a raw
+** deflate stream ended by a sync flush (the last one by the final block), so
+** that their concatenation, between a zlib header and the combined adler32
+** of the stripes, is a valid zlib stream. Matches can't reach across
+** stripes, which costs a little compression.
+*/
+typedef void (*pngRowFunc)(rasterBufferObj *rb, unsigned row,
+                           unsigned char *out, int sample_depth);
+
+typedef struct {
+  rasterBufferObj *rb;
+  pngRowFunc getRow;
+  int sample_depth;
+  size_t rowbytes;
+  int bpp;
+  const pngOptionsObj *opts;
+  int filter;
+  unsigned firstrow, lastrow;
+  int last;
+
+  unsigned char *data; /* deflated stripe */
+  size_t size, capacity;
+  uLong adler;
+  int status;
+} pngStripeJobObj;
+
+static int pngStripeDeflate(pngStripeJobObj *job, z_stream *z, int flush) {
+  int ret;
+  do {
+    if (z->avail_out == 0) {
+      job->capacity *= 2;
+      job->data = (unsigned char *)msSmallRealloc(job->data, job->capacity);
+      z->next_out = job->data + job->size;
+      z->avail_out = (uInt)(job->capacity - job->size);
+    }
+    ret = deflate(z, flush);
+    job->size = job->capacity - z->avail_out;
+    if (ret == Z_STREAM_ERROR)
+      return MS_FAILURE;
+  } while (z->avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+  return MS_SUCCESS;
+}
+
+static void pngEncodeStripe(void *arg) {
+  pngStripeJobObj *job = (pngStripeJobObj *)arg;
+  const size_t rowbytes = job->rowbytes;
+  unsigned char *row = (unsigned char *)msSmallMalloc(rowbytes);
+  unsigned char *prev = (unsigned char *)msSmallCalloc(1, rowbytes);
+  unsigned char *filtered = (unsigned char *)msSmallMalloc(rowbytes + 1);
+  unsigned char *scratch = (unsigned char *)msSmallMalloc(2 * rowbytes);
+  z_stream z;
+
+  job->status = MS_FAILURE;
+  job->adler = adler32(0L, Z_NULL, 0);
+  memset(&z, 0, sizeof(z));
+  if (deflateInit2(&z, job->opts->compression, Z_DEFLATED, -15, 8,
+                   job->opts->strategy) != Z_OK)
+    goto end;
+
+  job->capacity = deflateBound(&z, (uLong)((job->lastrow - job->firstrow) *
+                                           (rowbytes + 1))) +
+                  64;
+  job->data = (unsigned char *)msSmallMalloc(job->capacity);
+  job->size = 0;
+  z.next_out = job->data;
+  z.avail_out = (uInt)job->capacity;
+
+  if (job->firstrow > 0)
+    job->getRow(job->rb, job->firstrow - 1, prev, job->sample_depth);
+  for (unsigned y = job->firstrow; y < job->lastrow; y++) {
+    unsigned char *tmp;
+    job->getRow(job->rb, y, row, job->sample_depth);
+    pngFilterRow(job->filter, row, prev, rowbytes, job->bpp, filtered,
+                 scratch);
+    job->adler = adler32(job->adler, filtered, (uInt)(rowbytes + 1));
+    z.next_in = filtered;
+    z.avail_in = (uInt)(rowbytes + 1);
+    if (pngStripeDeflate(job, &z, Z_NO_FLUSH) != MS_SUCCESS)
+      goto end;
+    tmp = prev;
+    prev = row;
+    row = tmp;
+  }
+  if (pngStripeDeflate(job, &z, job->last ? Z_FINISH : Z_SYNC_FLUSH) ==
+      MS_SUCCESS)
+    job->status = MS_SUCCESS;
+
+end:
+  deflateEnd(&z);
+  free(row);
+  free(prev);
+  free(filtered);
+  free(scratch);
+}
+
+static void pngWrite(streamInfo *info, const void *data, size_t length) {
+  if (length == 0)
+    return;
+  if (info->fp)
+    msIO_fwrite(data, length, 1, info->fp);
+  else
+    msBufferAppend(info->buffer, (void *)data, length);
+}
+
+static void pngPutUint32(unsigned char *p, unsigned long v) {
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+static void pngWriteChunk(streamInfo *info, const char *type,
+                          const unsigned char *data, size_t length) {
+  unsigned char header[8], crc[4];
+  uLong crcvalue;
+
+  pngPutUint32(header, length);
+  memcpy(header + 4, type, 4);
+  crcvalue = crc32(0L, header + 4, 4);
+  if (length)
+    crcvalue = crc32(crcvalue, data, (uInt)length);
+  pngPutUint32(crc, crcvalue);
+  pngWrite(info, header, 8);
+  pngWrite(info, data, length);
+  pngWrite(info, crc, 4);
+}
+
+static int savePNGStriped(rasterBufferObj *rb, streamInfo *info,
+                          const pngOptionsObj *opts, int filter,
+                          pngRowFunc getRow, int sample_depth, int color_type,
+                          const rgbPixel *plte, int num_plte,
+                          const unsigned char *trns, int num_trns) {
+  static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  const int channels = color_type == PNG_COLOR_TYPE_RGB_ALPHA ? 4
+                       : color_type == PNG_COLOR_TYPE_RGB     ? 3
+                                                              : 1;
+  const int nstripes = MS_MAX(
+      1, MS_MIN(opts->threads, (int)rb->height / PNG_MIN_STRIPE_ROWS));
+  unsigned char ihdr[13], zheader[2], ztrailer[4];
+  pngStripeJobObj *jobs;
+  CPLJoinableThread **threads;
+  uLong adler;
+  int level, t, status = MS_SUCCESS;
+
+  jobs = (pngStripeJobObj *)msSmallCalloc(nstripes, sizeof(pngStripeJobObj));
+  threads = (CPLJoinableThread **)msSmallCalloc(nstripes,
+                                                sizeof(CPLJoinableThread *));
+  for (t = 0; t < nstripes; t++) {
+    jobs[t].rb = rb;
+    jobs[t].getRow = getRow;
+    jobs[t].sample_depth = sample_depth;
+    jobs[t].rowbytes = ((size_t)rb->width * channels * sample_depth + 7) / 8;
+    jobs[t].bpp = MS_MAX(1, channels * sample_depth / 8);
+    jobs[t].opts = opts;
+    jobs[t].filter = filter;
+    jobs[t].firstrow = (unsigned)((size_t)rb->height * t / nstripes);
+    jobs[t].lastrow = (unsigned)((size_t)rb->height * (t + 1) / nstripes);
+    jobs[t].last = t == nstripes - 1;
+    if (t > 0)
+      threads[t] = CPLCreateJoinableThread(pngEncodeStripe, &jobs[t]);
+  }
+  pngEncodeStripe(&jobs[0]);
+  for (t = 1; t < nstripes; t++) {
+    if (threads[t])
+      CPLJoinThread(threads[t]);
+    else /* fall back to doing the stripe ourselves */
+      pngEncodeStripe(&jobs[t]);
+  }
+
+  for (t = 0; t < nstripes; t++) {
+    if (jobs[t].status != MS_SUCCESS) {
+      msSetError(MS_MISCERR, "failed to deflate PNG image data",
+                 "saveAsPNG()");
+      status = MS_FAILURE;
+    }
+  }
+
+  if (status == MS_SUCCESS) {
+    pngWrite(info, signature, 8);
+    pngPutUint32(ihdr, rb->width);
+    pngPutUint32(ihdr + 4, rb->height);
+    ihdr[8] = (unsigned char)sample_depth;
+    ihdr[9] = (unsigned char)color_type;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0; /* deflate, adaptive, no interlace */
+    pngWriteChunk(info, "IHDR", ihdr, 13);
+    if (plte) {
+      unsigned char rgb[256 * 3];
+      for (t = 0; t < num_plte; t++) {
+        rgb[t * 3] = plte[t].r;
+        rgb[t * 3 + 1] = plte[t].g;
+        rgb[t * 3 + 2] = plte[t].b;
+      }
+      pngWriteChunk(info, "PLTE", rgb, num_plte * 3);
+      if (num_trns)
+        pngWriteChunk(info, "tRNS", trns, num_trns);
+    }
+
+    /* zlib header with the level hint, checksummed as RFC 1950 asks */
+    level = opts->compression < 0 ? 6 : opts->compression;
+    zheader[0] = 0x78;
+    zheader[1] = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+    zheader[1] += 31 - (zheader[0] * 256 + zheader[1]) % 31;
+    pngWriteChunk(info, "IDAT", zheader, 2);
+
+    adler = jobs[0].adler;
+    for (t = 0; t < nstripes; t++) {
+      size_t offset = 0;
+      if (t > 0)
+        adler = adler32_combine(
+            adler, jobs[t].adler,
+            (z_off_t)((jobs[t].lastrow - jobs[t].firstrow) *
+                      (jobs[t].rowbytes + 1)));
+      while (offset < jobs[t].size) {
+        const size_t length = MS_MIN(jobs[t].size - offset, 1 << 20);
+        pngWriteChunk(info, "IDAT", jobs[t].data + offset, length);
+        offset += length;
+      }
+    }
+    pngPutUint32(ztrailer, adler);
+    pngWriteChunk(info, "IDAT", ztrailer, 4);
+    pngWriteChunk(info, "IEND", NULL, 0);
+  }
+
+  for (t = 0; t < nstripes; t++)
+    free(jobs[t].data);
+  free(jobs);
+  free(threads);
+  return status;
+}
+
 typedef struct {
   struct jpeg_destination_mgr pub;
   unsigned char *data;
@@ -315,22 +711,58 @@ int remapPaletteForPNG(rasterBufferObj *rb, rgbPixel *rgb, unsigned char *a,
   return MS_SUCCESS;
 }
 
-int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression) {
+/* a row of palette indexes, packed MSB first below 8 bits per sample */
+static void palettePNGRow(rasterBufferObj *rb, unsigned row, unsigned char *out,
+                          int sample_depth) {
+  const unsigned char *pixels = &(rb->data.palette.pixels[row * rb->width]);
+  if (sample_depth == 8) {
+    memcpy(out, pixels, rb->width);
+  } else {
+    const int per_byte = 8 / sample_depth;
+    memset(out, 0, (rb->width + per_byte - 1) / per_byte);
+    for (unsigned col = 0; col < rb->width; col++)
+      out[col / per_byte] |=
+          pixels[col] << (8 - sample_depth * (col % per_byte + 1));
+  }
+}
+
+int savePalettePNG(rasterBufferObj *rb, streamInfo *info,
+                   const pngOptionsObj *opts) {
   png_infop info_ptr;
   rgbPixel rgb[256];
   unsigned char a[256];
   int num_a;
   int sample_depth;
-  png_structp png_ptr =
-      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  /* rows of indexes don't predict each other: unless a specific filter is */
+  /* asked for, don't waste time on them */
+  const int filter =
+      opts->filter == MS_PNG_FILTER_ADAPTIVE ? PNG_FILTER_VALUE_NONE
+                                             : opts->filter;
+  png_structp png_ptr;
 
   assert(rb->type == MS_BUFFER_BYTE_PALETTE);
 
+  if (rb->data.palette.num_entries <= 2)
+    sample_depth = 1;
+  else if (rb->data.palette.num_entries <= 4)
+    sample_depth = 2;
+  else if (rb->data.palette.num_entries <= 16)
+    sample_depth = 4;
+  else
+    sample_depth = 8;
+
+  remapPaletteForPNG(rb, rgb, a, &num_a);
+
+  if (opts->threads > 1)
+    return savePNGStriped(rb, info, opts, filter, palettePNGRow, sample_depth,
+                          PNG_COLOR_TYPE_PALETTE, rgb,
+                          rb->data.palette.num_entries, a, num_a);
+
+  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
   if (!png_ptr)
     return (MS_FAILURE);
 
-  png_set_compression_level(png_ptr, compression);
-  png_set_filter(png_ptr, 0, PNG_FILTER_NONE);
+  setPNGOptions(png_ptr, opts, filter);
 
   info_ptr = png_create_info_struct(png_ptr);
   if (!info_ptr) {
@@ -347,21 +779,10 @@ int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression) {
   else
     png_set_write_fn(png_ptr, info, png_write_data_to_buffer, png_flush_data);
 
-  if (rb->data.palette.num_entries <= 2)
-    sample_depth = 1;
-  else if (rb->data.palette.num_entries <= 4)
-    sample_depth = 2;
-  else if (rb->data.palette.num_entries <= 16)
-    sample_depth = 4;
-  else
-    sample_depth = 8;
-
   png_set_IHDR(png_ptr, info_ptr, rb->width, rb->height, sample_depth,
                PNG_COLOR_TYPE_PALETTE, 0, PNG_COMPRESSION_TYPE_DEFAULT,
                PNG_FILTER_TYPE_DEFAULT);
 
-  remapPaletteForPNG(rb, rgb, a, &num_a);
-
   png_set_PLTE(png_ptr, info_ptr, (png_colorp)(rgb),
                rb->data.palette.num_entries);
   if (num_a)
@@ -379,6 +800,48 @@ int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression) {
   return MS_SUCCESS;
 }
 
+/*
+** A row of RGB or RGBA samples, with the premultiplied colors of the buffer
+** converted back to straight alpha.
+*/
+static void rgbaPNGRow(rasterBufferObj *rb, unsigned row, unsigned char *out,
+                       int sample_depth) {
+  const unsigned char *a, *r, *g, *b;
+  (void)sample_depth;
+  r = rb->data.rgba.r + row * rb->data.rgba.row_step;
+  g = rb->data.rgba.g + row * rb->data.rgba.row_step;
+  b = rb->data.rgba.b + row * rb->data.rgba.row_step;
+  if (rb->data.rgba.a) {
+    a = rb->data.rgba.a + row * rb->data.rgba.row_step;
+    for (unsigned col = 0; col < rb->width; col++) {
+      if (*a) {
+        double da = *a / 255.0;
+        out[0] = *r / da;
+        out[1] = *g / da;
+        out[2] = *b / da;
+        out[3] = *a;
+      } else {
+        out[0] = out[1] = out[2] = out[3] = 0;
+      }
+      out += 4;
+      a += rb->data.rgba.pixel_step;
+      r += rb->data.rgba.pixel_step;
+      g += rb->data.rgba.pixel_step;
+      b += rb->data.rgba.pixel_step;
+    }
+  } else {
+    for (unsigned col = 0; col < rb->width; col++) {
+      out[0] = *r;
+      out[1] = *g;
+      out[2] = *b;
+      out += 3;
+      r += rb->data.rgba.pixel_step;
+      g += rb->data.rgba.pixel_step;
+      b += rb->data.rgba.pixel_step;
+    }
+  }
+}
+
 int readPalette(const char *palette, rgbaPixel *entries, unsigned int *nEntries,
                 int useAlpha) {
   FILE *stream = NULL;
@@ -434,26 +897,62 @@ int readPalette(const char *palette, rgbaPixel *entries, unsigned int *nEntries,
   return MS_SUCCESS;
 }
 
+/*
+** Key under which FORMATOPTION "QUANTIZE_REUSE_PALETTE=ON" shares a computed
+** palette between requests: the mapfile, the output format, the number of
+** colors and the layers visible at the current scale. The modification time
+** of the mapfile is returned in mtime. Returns NULL when the option is off or
+** there is no map to build a key from.
+*/
+static char *getPaletteReuseKey(mapObj *map, outputFormatObj *format,
+                                time_t *mtime) {
+  const char *reuse =
+      msGetOutputFormatOption(format, "QUANTIZE_REUSE_PALETTE", NULL);
+  char *key = NULL;
+  int i;
+
+  if (!map || !reuse ||
+      (strcasecmp(reuse, "on") != 0 && strcasecmp(reuse, "yes") != 0 &&
+       strcasecmp(reuse, "true") != 0))
+    return NULL;
+
+  *mtime = 0;
+  if (map->mapfile) {
+    struct stat stat_buf;
+    if (stat(map->mapfile, &stat_buf) == 0)
+      *mtime = stat_buf.st_mtime;
+    key = msStringConcatenate(key, map->mapfile);
+  } else {
+    /* loaded from a string, the name tells maps apart */
+    key = msStringConcatenate(key, map->mappath ? map->mappath : "");
+  }
+  key = msStringConcatenate(key, "|");
+  key = msStringConcatenate(key, map->name ? map->name : "");
+  key = msStringConcatenate(key, "|");
+  key = msStringConcatenate(key, format->name ? format->name : "");
+  key = msStringConcatenate(key, "|");
+  key = msStringConcatenate(
+      key, msGetOutputFormatOption(format, "QUANTIZE_COLORS", "256"));
+  for (i = 0; i < map->numlayers; i++) {
+    layerObj *layer = GET_LAYER(map, map->layerorder[i]);
+    if (msLayerIsVisible(map, layer)) {
+      key = msStringConcatenate(key, "|");
+      key = msStringConcatenate(key, layer->name ? layer->name : "");
+    }
+  }
+  return key;
+}
+
 int saveAsPNG(mapObj *map, rasterBufferObj *rb, streamInfo *info,
               outputFormatObj *format) {
   int force_pc256 = MS_FALSE;
   int force_palette = MS_FALSE;
 
-  const char *force_string, *zlib_compression;
-  int compression = -1;
+  const char *force_string;
+  pngOptionsObj opts;
 
-  zlib_compression = msGetOutputFormatOption(format, "COMPRESSION", NULL);
-  if (zlib_compression && *zlib_compression) {
-    char *endptr;
-    compression = strtol(zlib_compression, &endptr, 10);
-    if (*endptr || compression < -1 || compression > 9) {
-      msSetError(MS_MISCERR,
-                 "failed to parse FORMATOPTION \"COMPRESSION=%s\", expecting "
-                 "integer from 0 to 9.",
-                 "saveAsPNG()", zlib_compression);
-      return MS_FAILURE;
-    }
-  }
+  if (getPNGOptions(format, &opts) != MS_SUCCESS)
+    return MS_FAILURE;
 
   force_string = msGetOutputFormatOption(format, "QUANTIZE_FORCE", NULL);
   if (force_string && (strcasecmp(force_string, "on") == 0 ||
@@ -480,12 +979,29 @@ int saveAsPNG(mapObj *map, rasterBufferObj *rb, streamInfo *info,
     qrb.data.palette.scaling_maxval = 255;
     int ret;
     if (force_pc256) {
-      qrb.data.palette.palette = palette;
-      qrb.data.palette.num_entries =
+      time_t mtime;
+      char *reuseKey = getPaletteReuseKey(map, format, &mtime);
+      unsigned int colorsWanted =
           atoi(msGetOutputFormatOption(format, "QUANTIZE_COLORS", "256"));
-      ret = msQuantizeRasterBuffer(rb, &(qrb.data.palette.num_entries),
-                                   qrb.data.palette.palette, NULL, 0,
-                                   &qrb.data.palette.scaling_maxval);
+      qrb.data.palette.palette = palette;
+      qrb.data.palette.num_entries = colorsWanted;
+      if (reuseKey &&
+          msPaletteCacheGet(reuseKey, mtime, qrb.data.palette.palette,
+                            &(qrb.data.palette.num_entries))) {
+        ret = MS_SUCCESS;
+      } else {
+        ret = msQuantizeRasterBuffer(rb, &(qrb.data.palette.num_entries),
+                                     qrb.data.palette.palette, NULL, 0,
+                                     &qrb.data.palette.scaling_maxval);
+        /* a palette with fewer colors than wanted only fits this image, and */
+        /* one scaled down along with the pixels can't be applied to others */
+        if (ret == MS_SUCCESS && reuseKey &&
+            qrb.data.palette.num_entries == colorsWanted &&
+            qrb.data.palette.scaling_maxval == 255)
+          msPaletteCacheSet(reuseKey, mtime, qrb.data.palette.palette,
+                            qrb.data.palette.num_entries);
+      }
+      msFree(reuseKey);
     } else {
       unsigned colorsWanted = (unsigned)atoi(
           msGetOutputFormatOption(format, "QUANTIZE_COLORS", "0"));
@@ -522,22 +1038,30 @@ int saveAsPNG(mapObj *map, rasterBufferObj *rb, streamInfo *info,
     }
     if (ret != MS_FAILURE) {
       msClassifyRasterBuffer(rb, &qrb);
-      ret = savePalettePNG(&qrb, info, compression);
+      ret = savePalettePNG(&qrb, info, &opts);
     }
     msFree(qrb.data.palette.pixels);
     return ret;
   } else if (rb->type == MS_BUFFER_BYTE_RGBA) {
     png_infop info_ptr;
     int color_type;
-    unsigned int *rowdata;
-    png_structp png_ptr =
-        png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    unsigned char *rowdata;
+    png_structp png_ptr;
+
+    if (rb->data.rgba.a)
+      color_type = PNG_COLOR_TYPE_RGB_ALPHA;
+    else
+      color_type = PNG_COLOR_TYPE_RGB;
+
+    if (opts.threads > 1)
+      return savePNGStriped(rb, info, &opts, opts.filter, rgbaPNGRow, 8,
+                            color_type, NULL, 0, NULL, 0);
 
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr)
       return (MS_FAILURE);
 
-    png_set_compression_level(png_ptr, compression);
-    png_set_filter(png_ptr, 0, PNG_FILTER_NONE);
+    setPNGOptions(png_ptr, &opts, opts.filter);
 
     info_ptr = png_create_info_struct(png_ptr);
     if (!info_ptr) {
@@ -554,59 +1078,15 @@ int saveAsPNG(mapObj *map, rasterBufferObj *rb, streamInfo *info,
     else
       png_set_write_fn(png_ptr, info, png_write_data_to_buffer, png_flush_data);
 
-    if (rb->data.rgba.a)
-      color_type = PNG_COLOR_TYPE_RGB_ALPHA;
-    else
-      color_type = PNG_COLOR_TYPE_RGB;
-
     png_set_IHDR(png_ptr, info_ptr, rb->width, rb->height, 8, color_type,
                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
                  PNG_FILTER_TYPE_DEFAULT);
 
     png_write_info(png_ptr, info_ptr);
 
-    if (!rb->data.rgba.a && rb->data.rgba.pixel_step == 4)
-      png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
-
-    rowdata = (unsigned int *)malloc(rb->width * sizeof(unsigned int));
+    rowdata = (unsigned char *)malloc(rb->width * 4);
     for (unsigned row = 0; row < rb->height; row++) {
-      unsigned int *pixptr = rowdata;
-      unsigned char *a, *r, *g, *b;
-      r = rb->data.rgba.r + row * rb->data.rgba.row_step;
-      g = rb->data.rgba.g + row * rb->data.rgba.row_step;
-      b = rb->data.rgba.b + row * rb->data.rgba.row_step;
-      if (rb->data.rgba.a) {
-        a = rb->data.rgba.a + row * rb->data.rgba.row_step;
-        for (unsigned col = 0; col < rb->width; col++) {
-          if (*a) {
-            double da = *a / 255.0;
-            unsigned char *pix = (unsigned char *)pixptr;
-            pix[0] = *r / da;
-            pix[1] = *g / da;
-            pix[2] = *b / da;
-            pix[3] = *a;
-          } else {
-            *pixptr = 0;
-          }
-          pixptr++;
-          a += rb->data.rgba.pixel_step;
-          r += rb->data.rgba.pixel_step;
-          g += rb->data.rgba.pixel_step;
-          b += rb->data.rgba.pixel_step;
-        }
-      } else {
-        for (unsigned col = 0; col < rb->width; col++) {
-          unsigned char *pix = (unsigned char *)pixptr;
-          pix[0] = *r;
-          pix[1] = *g;
-          pix[2] = *b;
-          pixptr++;
-          r += rb->data.rgba.pixel_step;
-          g += rb->data.rgba.pixel_step;
-          b += rb->data.rgba.pixel_step;
-        }
-      }
-
+      rgbaPNGRow(rb, row, rowdata, 8);
       png_write_row(png_ptr, (png_bytep)rowdata);
     }
     png_write_end(png_ptr, info_ptr);
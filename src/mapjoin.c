@@ -28,6 +28,11 @@
  ****************************************************************************/
 
 #include "mapserver.h"
+#include "mapthread.h"
+
+#include "cpl_conv.h"
+
+#include <sys/stat.h>
 
 #define ROW_ALLOCATION_SIZE 10
 
@@ -149,16 +154,266 @@ int msJoinClose(joinObj *join) {
   return MS_FAILURE;
 }
 
+/*
+** The rows of a CSV or XBase join table, indexed on the "to" column so that
+** msCSVJoinNext() and msDBFJoinNext() go straight to the rows joining a
+** feature instead of scanning the whole table for each one. CSV tables are
+** loaded entirely, for XBase tables only the "to" values are read and the
+** joined records are read from the file.
+**
+** When MS_JOIN_CACHE is set to a number of tables, the tables outlive the
+** request that loaded them: they are kept by file, "to" column and version
+** of the file, and shared by the joins (read-only, under a reference count)
+** until they are replaced by a newer one or evicted.
+*/
+
+/* a table rewritten within the second of its mtime has at least a new size
+ * or record count */
+typedef struct {
+  time_t mtime;
+  off_t size;
+  int numrecords; /* XBase only, -1 otherwise */
+} joinTableVersionObj;
+
+typedef struct {
+  char *path;
+  joinTableVersionObj version;
+  int connectiontype, toindex;
+  int refcount;
+
+  int numrows, numitems;
+  char ***rows; /* CSV only */
+  char **keys;  /* the "to" value of every row, owned for XBase tables */
+  int *slots;   /* first row of each distinct key, -1 if free */
+  int numslots; /* a power of 2 */
+  int *next;    /* next row with the same key, or -1 */
+} joinTableObj;
+
+/* first row of the table with key in the "to" column, or -1 */
+static int joinTableFind(const joinTableObj *table, const char *key) {
+  int slot;
+  for (slot = (int)(msFNVHashString(MS_HASH_INIT, key, MS_FALSE) &
+                   (table->numslots - 1));
+       table->slots[slot] != -1; slot = (slot + 1) & (table->numslots - 1)) {
+    if (strcmp(table->keys[table->slots[slot]], key) == 0)
+      return table->slots[slot];
+  }
+  return -1;
+}
+
+static void joinTableIndex(joinTableObj *table) {
+  int i;
+
+  table->numslots = 16;
+  while (table->numslots < table->numrows * 2)
+    table->numslots *= 2;
+  table->slots = (int *)msSmallMalloc(table->numslots * sizeof(int));
+  for (i = 0; i < table->numslots; i++)
+    table->slots[i] = -1;
+  table->next = (int *)msSmallMalloc((table->numrows + 1) * sizeof(int));
+
+  /* from the last row, so that the rows of a key are chained in order */
+  for (i = table->numrows - 1; i >= 0; i--) {
+    int slot;
+    for (slot = (int)(msFNVHashString(MS_HASH_INIT, table->keys[i], MS_FALSE) &
+                      (table->numslots - 1));
+         table->slots[slot] != -1 &&
+         strcmp(table->keys[table->slots[slot]], table->keys[i]) != 0;
+         slot = (slot + 1) & (table->numslots - 1))
+      ;
+    table->next[i] = table->slots[slot];
+    table->slots[slot] = i;
+  }
+}
+
+static void joinTableFree(joinTableObj *table) {
+  int i;
+  if (!table)
+    return;
+  if (table->rows) {
+    for (i = 0; i < table->numrows; i++)
+      msFreeCharArray(table->rows[i], table->numitems);
+    free(table->rows);
+  } else if (table->keys) {
+    for (i = 0; i < table->numrows; i++)
+      free(table->keys[i]);
+  }
+  free(table->keys);
+  free(table->slots);
+  free(table->next);
+  free(table->path);
+  free(table);
+}
+
+static joinTableObj **joinCache = NULL;
+static msLRUCacheObj joinCacheLRU; /* size 0 until joinCache is allocated */
+
+/*
+** Returns the cached table for path, or NULL. The table is referenced on
+** behalf of the caller, who gives it back with joinTableRelease(). The
+** caller sets version->numrecords, the rest of version is filled in from the
+** file (mtime 0 when the cache is disabled or the file is missing).
+*/
+static joinTableObj *joinTableFromCache(const char *path, int connectiontype,
+                                        int toindex,
+                                        joinTableVersionObj *version) {
+  struct stat stat_buf;
+  joinTableObj *table = NULL;
+  int i;
+
+  version->mtime = 0;
+  version->size = 0;
+  if (atoi(CPLGetConfigOption("MS_JOIN_CACHE", "0")) <= 0 ||
+      stat(path, &stat_buf) != 0)
+    return NULL;
+  version->mtime = stat_buf.st_mtime;
+  version->size = stat_buf.st_size;
+
+  msAcquireLock(TLOCK_JOIN);
+  for (i = 0; i < joinCacheLRU.size; i++) {
+    if (joinCache[i] && joinCache[i]->connectiontype == connectiontype &&
+        joinCache[i]->toindex == toindex &&
+        joinCache[i]->version.mtime == version->mtime &&
+        joinCache[i]->version.size == version->size &&
+        joinCache[i]->version.numrecords == version->numrecords &&
+        strcmp(joinCache[i]->path, path) == 0) {
+      table = joinCache[i];
+      table->refcount++;
+      msLRUCacheTouch(&joinCacheLRU, i);
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_JOIN);
+  return table;
+}
+
+/* keeps a freshly loaded table in the cache, if it is enabled */
+static void joinTableToCache(joinTableObj *table, const char *path,
+                             int connectiontype, int toindex,
+                             const joinTableVersionObj *version) {
+  const int size = atoi(CPLGetConfigOption("MS_JOIN_CACHE", "0"));
+  joinTableObj *evicted = NULL;
+  int i, slot = -1;
+
+  table->connectiontype = connectiontype;
+  table->toindex = toindex;
+  table->refcount = 1;
+  if (size <= 0 || version->mtime == 0)
+    return;
+  table->path = msStrdup(path);
+  table->version = *version;
+
+  msAcquireLock(TLOCK_JOIN);
+  if (!joinCache) {
+    joinCache = (joinTableObj **)msSmallCalloc(size, sizeof(joinTableObj *));
+    msLRUCacheInit(&joinCacheLRU, size);
+  }
+  /* an older version of the table, or else a free slot or the least
+   * recently used one */
+  for (i = 0; i < joinCacheLRU.size; i++) {
+    if (joinCache[i] && joinCache[i]->connectiontype == connectiontype &&
+        joinCache[i]->toindex == toindex &&
+        strcmp(joinCache[i]->path, path) == 0) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0)
+    slot = msLRUCacheSlot(&joinCacheLRU, NULL, NULL);
+  if (joinCache[slot] && --joinCache[slot]->refcount == 0)
+    evicted = joinCache[slot];
+  joinCache[slot] = table;
+  table->refcount++; /* held by the cache */
+  msLRUCacheTouch(&joinCacheLRU, slot);
+  msReleaseLock(TLOCK_JOIN);
+
+  joinTableFree(evicted);
+}
+
+static void joinTableRelease(joinTableObj *table) {
+  int unused;
+  if (!table)
+    return;
+  msAcquireLock(TLOCK_JOIN);
+  unused = --table->refcount == 0;
+  msReleaseLock(TLOCK_JOIN);
+  if (unused)
+    joinTableFree(table);
+}
+
+void msJoinCacheCleanup(void) {
+  int i;
+  msAcquireLock(TLOCK_JOIN);
+  for (i = 0; i < joinCacheLRU.size; i++) {
+    if (joinCache[i] && --joinCache[i]->refcount == 0)
+      joinTableFree(joinCache[i]);
+  }
+  free(joinCache);
+  joinCache = NULL;
+  msLRUCacheFree(&joinCacheLRU);
+  msReleaseLock(TLOCK_JOIN);
+}
+
 /*  */
 /* XBASE join functions */
 /*  */
 typedef struct {
   DBFHandle hDBF;
   int fromindex, toindex;
-  char *target;
-  int nextrecord;
+  joinTableObj *table; /* the "to" values of the records */
+  int nextrecord;      /* -1 when done, JOIN_NOT_PREPARED before */
 } msDBFJoinInfo;
 
+#define JOIN_NOT_PREPARED -2
+
+/*
+** The file msDBFOpen() actually opened for path: a .shp or .shx extension
+** is swapped for .dbf (.DBF when upper case), and .DBF is tried when there
+** is no .dbf. Its version is the one that keys the join cache.
+*/
+static const char *msDBFJoinFilename(char *dbfpath, const char *path) {
+  const size_t len = strlen(path);
+  struct stat stat_buf;
+
+  strlcpy(dbfpath, path, MS_MAXPATHLEN);
+  if (len < 4 || len >= MS_MAXPATHLEN)
+    return dbfpath;
+  if (strcmp(path + len - 4, ".shp") == 0 ||
+      strcmp(path + len - 4, ".shx") == 0)
+    strcpy(dbfpath + len - 4, ".dbf");
+  else if (strcmp(path + len - 4, ".SHP") == 0 ||
+           strcmp(path + len - 4, ".SHX") == 0)
+    strcpy(dbfpath + len - 4, ".DBF");
+  if (strcmp(dbfpath + len - 4, ".dbf") == 0 && stat(dbfpath, &stat_buf) != 0)
+    strcpy(dbfpath + len - 4, ".DBF");
+  return dbfpath;
+}
+
+static joinTableObj *msDBFJoinLoadTable(DBFHandle hDBF, const char *path,
+                                        int toindex) {
+  char szDBFPath[MS_MAXPATHLEN];
+  joinTableObj *table;
+  joinTableVersionObj version;
+  int i;
+
+  path = msDBFJoinFilename(szDBFPath, path);
+  version.numrecords = msDBFGetRecordCount(hDBF);
+  if ((table = joinTableFromCache(path, MS_DB_XBASE, toindex, &version)))
+    return table;
+
+  table = (joinTableObj *)msSmallCalloc(1, sizeof(joinTableObj));
+  table->numrows = msDBFGetRecordCount(hDBF);
+  table->numitems = msDBFGetFieldCount(hDBF);
+  table->keys = (char **)msSmallMalloc((table->numrows + 1) * sizeof(char *));
+  for (i = 0; i < table->numrows; i++) {
+    const char *key = msDBFReadStringAttribute(hDBF, i, toindex);
+    table->keys[i] = msStrdup(key ? key : "");
+  }
+  joinTableIndex(table);
+  joinTableToCache(table, path, MS_DB_XBASE, toindex, &version);
+  return table;
+}
+
 int msDBFJoinConnect(layerObj *layer, joinObj *join) {
   int i;
   char szPath[MS_MAXPATHLEN];
@@ -179,8 +434,8 @@ int msDBFJoinConnect(layerObj *layer, joinObj *join) {
   }
 
   /* initialize any members that won't get set later on in this function */
-  joininfo->target = NULL;
-  joininfo->nextrecord = 0;
+  joininfo->table = NULL;
+  joininfo->nextrecord = JOIN_NOT_PREPARED;
 
   join->joininfo = joininfo;
 
@@ -218,6 +473,10 @@ int msDBFJoinConnect(layerObj *layer, joinObj *join) {
     return (MS_FAILURE);
   }
 
+  /* index the records on the "to" item */
+  joininfo->table =
+      msDBFJoinLoadTable(joininfo->hDBF, szPath, joininfo->toindex);
+
   /* finally store away the item names in the XBase table */
   join->numitems = msDBFGetFieldCount(joininfo->hDBF);
   join->items = msDBFGetItems(joininfo->hDBF);
@@ -248,17 +507,15 @@ int msDBFJoinPrepare(joinObj *join, shapeObj *shape) {
     return (MS_FAILURE);
   }
 
-  joininfo->nextrecord = 0; /* starting with the first record */
-
-  if (joininfo->target)
-    free(joininfo->target); /* clear last target */
-  joininfo->target = msStrdup(shape->values[joininfo->fromindex]);
+  /* starting with the first matching record */
+  joininfo->nextrecord =
+      joinTableFind(joininfo->table, shape->values[joininfo->fromindex]);
 
   return (MS_SUCCESS);
 }
 
 int msDBFJoinNext(joinObj *join) {
-  int i, n;
+  int i;
   msDBFJoinInfo *joininfo = join->joininfo;
 
   if (!joininfo) {
@@ -267,7 +524,7 @@ int msDBFJoinNext(joinObj *join) {
     return (MS_FAILURE);
   }
 
-  if (!joininfo->target) {
+  if (joininfo->nextrecord == JOIN_NOT_PREPARED) {
     msSetError(MS_JOINERR, "No target specified, run msDBFJoinPrepare() first.",
                "msDBFJoinNext()");
     return (MS_FAILURE);
@@ -279,16 +536,9 @@ int msDBFJoinNext(joinObj *join) {
     join->values = NULL;
   }
 
-  n = msDBFGetRecordCount(joininfo->hDBF);
+  i = joininfo->nextrecord;
 
-  for (i = joininfo->nextrecord; i < n; i++) { /* find a match */
-    if (strcmp(joininfo->target, msDBFReadStringAttribute(joininfo->hDBF, i,
-                                                          joininfo->toindex)) ==
-        0)
-      break;
-  }
-
-  if (i == n) { /* unable to do the join */
+  if (i == -1) { /* unable to do the join */
     if ((join->values = (char **)malloc(sizeof(char *) * join->numitems)) ==
         NULL) {
       msSetError(MS_MEMERR, NULL, "msDBFJoinNext()");
@@ -297,15 +547,14 @@ int msDBFJoinNext(joinObj *join) {
     for (i = 0; i < join->numitems; i++)
       join->values[i] = msStrdup("\0"); /* initialize to zero length strings */
 
-    joininfo->nextrecord = n;
     return (MS_DONE);
   }
 
   if ((join->values = msDBFGetValues(joininfo->hDBF, i)) == NULL)
     return (MS_FAILURE);
 
-  joininfo->nextrecord =
-      i + 1; /* so we know where to start looking next time through */
+  /* so we know where to look next time through */
+  joininfo->nextrecord = joininfo->table->next[i];
 
   return (MS_SUCCESS);
 }
@@ -318,8 +567,7 @@ int msDBFJoinClose(joinObj *join) {
 
   if (joininfo->hDBF)
     msDBFClose(joininfo->hDBF);
-  if (joininfo->target)
-    free(joininfo->target);
+  joinTableRelease(joininfo->table);
   free(joininfo);
   joininfo = NULL;
 
@@ -331,18 +579,61 @@ int msDBFJoinClose(joinObj *join) {
 /*  */
 typedef struct {
   int fromindex, toindex;
-  char *target;
-  char ***rows;
-  int numrows;
-  int nextrow;
+  joinTableObj *table;
+  int nextrow; /* -1 when done */
 } msCSVJoinInfo;
 
+static joinTableObj *msCSVJoinLoadTable(const char *path, int toindex) {
+  joinTableObj *table;
+  FILE *stream;
+  char buffer[MS_BUFFER_LENGTH];
+  joinTableVersionObj version;
+  int i;
+
+  version.numrecords = -1;
+  if ((table = joinTableFromCache(path, MS_DB_CSV, toindex, &version)))
+    return table;
+
+  if ((stream = fopen(path, "r")) == NULL) {
+    msSetError(MS_IOERR, "(%s)", "msCSVJoinConnect()", path);
+    return NULL;
+  }
+
+  table = (joinTableObj *)msSmallCalloc(1, sizeof(joinTableObj));
+
+  /* once through to get the number of rows */
+  while (fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL)
+    table->numrows++;
+  rewind(stream);
+
+  table->rows =
+      (char ***)msSmallCalloc(table->numrows + 1, sizeof(char **));
+  table->keys = (char **)msSmallMalloc((table->numrows + 1) * sizeof(char *));
+
+  /* load the rows */
+  i = 0;
+  while (i < table->numrows && fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL) {
+    int numitems;
+    msStringTrimEOL(buffer);
+    table->rows[i] =
+        msStringSplitComplex(buffer, ",", &numitems, MS_ALLOWEMPTYTOKENS);
+    table->numitems = numitems;
+    table->keys[i] = toindex < numitems ? table->rows[i][toindex] : "";
+    i++;
+  }
+  table->numrows = i;
+  fclose(stream);
+
+  joinTableIndex(table);
+  joinTableToCache(table, path, MS_DB_CSV, toindex, &version);
+  return table;
+}
+
 int msCSVJoinConnect(layerObj *layer, joinObj *join) {
   int i;
   FILE *stream;
   char szPath[MS_MAXPATHLEN];
   msCSVJoinInfo *joininfo;
-  char buffer[MS_BUFFER_LENGTH];
 
   if (join->joininfo)
     return (MS_SUCCESS); /* already open */
@@ -357,12 +648,12 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join) {
   }
 
   /* initialize any members that won't get set later on in this function */
-  joininfo->target = NULL;
-  joininfo->nextrow = 0;
+  joininfo->table = NULL;
+  joininfo->nextrow = -1;
 
   join->joininfo = joininfo;
 
-  /* open the CSV file */
+  /* find the CSV file */
   if ((stream = fopen(msBuildPath3(szPath, layer->map->mappath,
                                    layer->map->shapepath, join->table),
                       "r")) == NULL) {
@@ -372,28 +663,6 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join) {
       return (MS_FAILURE);
     }
   }
-
-  /* once through to get the number of rows */
-  joininfo->numrows = 0;
-  while (fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL)
-    joininfo->numrows++;
-  rewind(stream);
-
-  if ((joininfo->rows =
-           (char ***)malloc(joininfo->numrows * sizeof(char **))) == NULL) {
-    fclose(stream);
-    msSetError(MS_MEMERR, "Error allocating rows.", "msCSVJoinConnect()");
-    return (MS_FAILURE);
-  }
-
-  /* load the rows */
-  i = 0;
-  while (fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL) {
-    msStringTrimEOL(buffer);
-    joininfo->rows[i] = msStringSplitComplex(buffer, ",", &(join->numitems),
-                                             MS_ALLOWEMPTYTOKENS);
-    i++;
-  }
   fclose(stream);
 
   /* get "from" item index   */
@@ -412,7 +681,19 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join) {
 
   /* get "to" index (for now the user tells us which column, 1..n) */
   joininfo->toindex = atoi(join->to) - 1;
-  if (joininfo->toindex < 0 || joininfo->toindex > join->numitems) {
+  if (joininfo->toindex < 0) {
+    msSetError(MS_JOINERR, "Invalid column index %s.", "msCSVJoinConnect()",
+               join->to);
+    return (MS_FAILURE);
+  }
+
+  /* load the rows, indexed on the "to" column */
+  if ((joininfo->table = msCSVJoinLoadTable(szPath, joininfo->toindex)) ==
+      NULL)
+    return (MS_FAILURE);
+  join->numitems = joininfo->table->numitems;
+
+  if (joininfo->toindex >= join->numitems) {
     msSetError(MS_JOINERR, "Invalid column index %s.", "msCSVJoinConnect()",
                join->to);
     return (MS_FAILURE);
@@ -454,11 +735,9 @@ int msCSVJoinPrepare(joinObj *join, shapeObj *shape) {
     return (MS_FAILURE);
   }
 
-  joininfo->nextrow = 0; /* starting with the first record */
-
-  if (joininfo->target)
-    free(joininfo->target); /* clear last target */
-  joininfo->target = msStrdup(shape->values[joininfo->fromindex]);
+  /* starting with the first matching row */
+  joininfo->nextrow =
+      joinTableFind(joininfo->table, shape->values[joininfo->fromindex]);
 
   return (MS_SUCCESS);
 }
@@ -479,10 +758,7 @@ int msCSVJoinNext(joinObj *join) {
     join->values = NULL;
   }
 
-  for (i = joininfo->nextrow; i < joininfo->numrows; i++) { /* find a match */
-    if (strcmp(joininfo->target, joininfo->rows[i][joininfo->toindex]) == 0)
-      break;
-  }
+  i = joininfo->nextrow;
 
   if ((join->values = (char **)malloc(sizeof(char *) * join->numitems)) ==
       NULL) {
@@ -490,35 +766,29 @@ int msCSVJoinNext(joinObj *join) {
     return (MS_FAILURE);
   }
 
-  if (i == joininfo->numrows) { /* unable to do the join     */
+  if (i == -1) { /* unable to do the join     */
     for (j = 0; j < join->numitems; j++)
       join->values[j] = msStrdup("\0"); /* initialize to zero length strings */
 
-    joininfo->nextrow = joininfo->numrows;
     return (MS_DONE);
   }
 
   for (j = 0; j < join->numitems; j++)
-    join->values[j] = msStrdup(joininfo->rows[i][j]);
+    join->values[j] = msStrdup(joininfo->table->rows[i][j]);
 
-  joininfo->nextrow =
-      i + 1; /* so we know where to start looking next time through */
+  /* so we know where to look next time through */
+  joininfo->nextrow = joininfo->table->next[i];
 
   return (MS_SUCCESS);
 }
 
 int msCSVJoinClose(joinObj *join) {
-  int i;
   msCSVJoinInfo *joininfo = join->joininfo;
 
   if (!joininfo)
     return (MS_SUCCESS); /* already closed */
 
-  for (i = 0; i < joininfo->numrows; i++)
-    msFreeCharArray(joininfo->rows[i], join->numitems);
-  free(joininfo->rows);
-  if (joininfo->target)
-    free(joininfo->target);
+  joinTableRelease(joininfo->table);
   free(joininfo);
   joininfo = NULL;
 
@@ -662,7 +662,170 @@ static int labelInImage(int width, int height, lineObj *lpoly, rectObj *bounds,
   return (MS_TRUE);
 }
 
+/*
+** Uniform grid over the image used to restrict the collision tests to the
+** rendered labels and markers lying near a candidate label. Each cell holds
+** the indices of the items whose bounds touch it. Bounds falling outside of
+** the image are clamped to the border cells, so a query never misses an
+** item it would overlap.
+**
+** msSetLabelCacheGridLinear() replaces the grid by a scan of all the items,
+** the reference the grid is compared against by the tests and benchmarks.
+*/
+#define MS_LABELCACHE_GRID_CELLSIZE 64
+
+static int labelCacheGridLinear = MS_FALSE;
+
+/* For the unit tests and benchmarks only: not thread safe, affects the grids
+ * created afterwards. */
+void msSetLabelCacheGridLinear(int linear) { labelCacheGridLinear = linear; }
+
+typedef struct {
+  int *ids;
+  int numids;
+  int size;
+} labelCacheGridCellObj;
+
+struct labelCacheGridObj {
+  int ncols, nrows;
+  labelCacheGridCellObj *cells;
+  int linear;   /* queries return all the items */
+  int numitems; /* highest item index + 1 */
+
+  /* per-query deduplication of items spanning several cells */
+  int *stamps;
+  int numstamps;
+  int stamp;
+
+  int *result;
+  int resultsize;
+};
+
+static struct labelCacheGridObj *labelCacheGridCreate(int width,
+                                                      int height) {
+  struct labelCacheGridObj *grid = msSmallCalloc(1, sizeof(*grid));
+  grid->ncols = MS_MAX(1, (width + MS_LABELCACHE_GRID_CELLSIZE - 1) /
+                              MS_LABELCACHE_GRID_CELLSIZE);
+  grid->nrows = MS_MAX(1, (height + MS_LABELCACHE_GRID_CELLSIZE - 1) /
+                              MS_LABELCACHE_GRID_CELLSIZE);
+  grid->cells = msSmallCalloc((size_t)grid->ncols * grid->nrows,
+                              sizeof(labelCacheGridCellObj));
+  grid->linear = labelCacheGridLinear;
+  return grid;
+}
+
+void msFreeLabelCacheGrid(struct labelCacheGridObj *grid) {
+  int i;
+  if (!grid)
+    return;
+  for (i = 0; i < grid->ncols * grid->nrows; i++)
+    msFree(grid->cells[i].ids);
+  msFree(grid->cells);
+  msFree(grid->stamps);
+  msFree(grid->result);
+  msFree(grid);
+}
+
+static int labelCacheGridCoord(double v, int n) {
+  v = floor(v / MS_LABELCACHE_GRID_CELLSIZE);
+  if (!(v >= 0)) /* also catches NaN */
+    return 0;
+  if (v >= n)
+    return n - 1;
+  return (int)v;
+}
+
+static void labelCacheGridInsert(struct labelCacheGridObj *grid,
+                                 const rectObj *r, int id) {
+  int x, y;
+  int x0 = labelCacheGridCoord(r->minx, grid->ncols);
+  int x1 = labelCacheGridCoord(r->maxx, grid->ncols);
+  int y0 = labelCacheGridCoord(r->miny, grid->nrows);
+  int y1 = labelCacheGridCoord(r->maxy, grid->nrows);
+
+  if (id >= grid->numitems)
+    grid->numitems = id + 1;
+
+  for (y = y0; y <= y1 && !grid->linear; y++) {
+    for (x = x0; x <= x1; x++) {
+      labelCacheGridCellObj *cell = &grid->cells[y * grid->ncols + x];
+      if (cell->numids == cell->size) {
+        cell->size = cell->size ? cell->size * 2 : 8;
+        cell->ids = msSmallRealloc(cell->ids, cell->size * sizeof(int));
+      }
+      cell->ids[cell->numids++] = id;
+    }
+  }
+
+  if (id >= grid->numstamps) {
+    int n = MS_MAX(id + 1, grid->numstamps * 2);
+    grid->stamps = msSmallRealloc(grid->stamps, n * sizeof(int));
+    memset(grid->stamps + grid->numstamps, 0,
+           (n - grid->numstamps) * sizeof(int));
+    grid->numstamps = n;
+  }
+}
+
+/* returns the number of distinct items whose cells overlap those of r, their
+ * indices are stored in grid->result */
+static int labelCacheGridQuery(struct labelCacheGridObj *grid,
+                               const rectObj *r) {
+  int x, y, i, n = 0;
+  int x0 = labelCacheGridCoord(r->minx, grid->ncols);
+  int x1 = labelCacheGridCoord(r->maxx, grid->ncols);
+  int y0 = labelCacheGridCoord(r->miny, grid->nrows);
+  int y1 = labelCacheGridCoord(r->maxy, grid->nrows);
+
+  if (grid->linear) {
+    if (grid->resultsize < grid->numitems) {
+      grid->resultsize = grid->numitems;
+      grid->result =
+          msSmallRealloc(grid->result, grid->resultsize * sizeof(int));
+    }
+    for (i = 0; i < grid->numitems; i++)
+      grid->result[i] = i;
+    return grid->numitems;
+  }
+
+  if (++grid->stamp == INT_MAX) {
+    memset(grid->stamps, 0, grid->numstamps * sizeof(int));
+    grid->stamp = 1;
+  }
+
+  for (y = y0; y <= y1; y++) {
+    for (x = x0; x <= x1; x++) {
+      labelCacheGridCellObj *cell = &grid->cells[y * grid->ncols + x];
+      for (i = 0; i < cell->numids; i++) {
+        int id = cell->ids[i];
+        if (grid->stamps[id] == grid->stamp)
+          continue;
+        grid->stamps[id] = grid->stamp;
+        if (n == grid->resultsize) {
+          grid->resultsize = grid->resultsize ? grid->resultsize * 2 : 64;
+          grid->result =
+              msSmallRealloc(grid->result, grid->resultsize * sizeof(int));
+        }
+        grid->result[n++] = id;
+      }
+    }
+  }
+  return n;
+}
+
+/* make sure all the markers of a cache slot are present in its grid */
+static struct labelCacheGridObj *getMarkerGrid(mapObj *map,
+                                               labelCacheSlotObj *slot) {
+  if (!slot->markergrid)
+    slot->markergrid = labelCacheGridCreate(map->width, map->height);
+  for (; slot->numindexedmarkers < slot->nummarkers; slot->numindexedmarkers++)
+    labelCacheGridInsert(slot->markergrid,
+                         &slot->markers[slot->numindexedmarkers].bounds,
+                         slot->numindexedmarkers);
+  return slot->markergrid;
+}
+
 void insertRenderedLabelMember(mapObj *map, labelCacheMemberObj *cachePtr) {
+  rectObj extent = cachePtr->bbox;
   if (map->labelcache.num_rendered_members ==
       map->labelcache.num_allocated_rendered_members) {
     if (map->labelcache.num_rendered_members == 0) {
@@ -675,6 +838,17 @@ void insertRenderedLabelMember(mapObj *map, labelCacheMemberObj *cachePtr) {
                        map->labelcache.num_allocated_rendered_members *
                            sizeof(labelCacheMemberObj *));
   }
+
+  /* the leader line is tested independently of the label bbox, so index the
+   * member by the union of both */
+  if (cachePtr->leaderline && cachePtr->leaderbbox)
+    msMergeRect(&extent, cachePtr->leaderbbox);
+  if (!map->labelcache.rendered_grid)
+    map->labelcache.rendered_grid =
+        labelCacheGridCreate(map->width, map->height);
+  labelCacheGridInsert(map->labelcache.rendered_grid, &extent,
+                       map->labelcache.num_rendered_members);
+
   map->labelcache
       .rendered_text_symbols[map->labelcache.num_rendered_members++] = cachePtr;
 }
@@ -721,14 +895,20 @@ static inline int testSegmentLabelBBoxIntersection(const rectObj *leaderbbox,
 }
 
 int msTestLabelCacheLeaderCollision(mapObj *map, pointObj *lp1, pointObj *lp2) {
-  int p;
+  int p, numcandidates;
   rectObj leaderbbox;
   leaderbbox.minx = MS_MIN(lp1->x, lp2->x);
   leaderbbox.maxx = MS_MAX(lp1->x, lp2->x);
   leaderbbox.miny = MS_MIN(lp1->y, lp2->y);
   leaderbbox.maxy = MS_MAX(lp1->y, lp2->y);
-  for (p = 0; p < map->labelcache.num_rendered_members; p++) {
-    labelCacheMemberObj *curCachePtr = map->labelcache.rendered_text_symbols[p];
+  if (!map->labelcache.rendered_grid)
+    return MS_TRUE; /* nothing rendered yet */
+  numcandidates =
+      labelCacheGridQuery(map->labelcache.rendered_grid, &leaderbbox);
+  for (p = 0; p < numcandidates; p++) {
+    labelCacheMemberObj *curCachePtr =
+        map->labelcache
+            .rendered_text_symbols[map->labelcache.rendered_grid->result[p]];
     if (msRectOverlap(&leaderbbox, &(curCachePtr->bbox))) {
       /* leaderbbox intersects with the curCachePtr's global bbox */
       int t;
@@ -782,7 +962,7 @@ int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr,
                                label_bounds *lb, int current_priority,
                                int current_label) {
   labelCacheObj *labelcache = &(map->labelcache);
-  int i, p, ll;
+  int i, p, ll, numcandidates;
 
   /*
    * Check against image bounds first
@@ -799,9 +979,15 @@ int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr,
   */
   for (p = current_priority; p < MS_MAX_LABEL_PRIORITY; p++) {
     labelCacheSlotObj *markerslot;
+    struct labelCacheGridObj *markergrid;
     markerslot = &(labelcache->slots[p]);
+    if (markerslot->nummarkers == 0)
+      continue;
+    markergrid = getMarkerGrid(map, markerslot);
+    numcandidates = labelCacheGridQuery(markergrid, &lb->bbox);
 
-    for (ll = 0; ll < markerslot->nummarkers; ll++) {
+    for (i = 0; i < numcandidates; i++) {
+      ll = markergrid->result[i];
       if (!(p == current_priority &&
             current_label ==
                 markerslot->markers[ll]
@@ -814,8 +1000,12 @@ int msTestLabelCacheCollisions(mapObj *map, labelCacheMemberObj *cachePtr,
     }
   }
 
-  for (p = 0; p < labelcache->num_rendered_members; p++) {
-    labelCacheMemberObj *curCachePtr = labelcache->rendered_text_symbols[p];
+  if (!labelcache->rendered_grid)
+    return MS_TRUE; /* nothing rendered yet */
+  numcandidates = labelCacheGridQuery(labelcache->rendered_grid, &lb->bbox);
+  for (p = 0; p < numcandidates; p++) {
+    labelCacheMemberObj *curCachePtr =
+        labelcache->rendered_text_symbols[labelcache->rendered_grid->result[p]];
     if (msRectOverlap(&curCachePtr->bbox, &lb->bbox)) {
       for (i = 0; i < curCachePtr->numtextsymbols; i++) {
         int j;
@@ -261,6 +261,13 @@ int msLayerOpen(layerObj *layer) {
       return rv;
   }
   cppcheck_assert(layer->vtable);
+  if (layer->map && layer->map->metrics) {
+    const double starttime = msMetricsNow();
+    rv = layer->vtable->LayerOpen(layer);
+    msMetricsAddSpan(layer->map->metrics, layer, MS_METRIC_LAYER_OPEN,
+                     starttime);
+    return rv;
+  }
   return layer->vtable->LayerOpen(layer);
 }
 
@@ -319,6 +326,9 @@ int msLayerTranslateFilter(layerObj *layer, expressionObj *filter,
 ** connection type where this is feasible.
 */
 int msLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery) {
+  /* the classes may have been edited since the last shapes were classified */
+  msClassIndexRecheck(layer->classindex);
+
   if (!msLayerSupportsCommonFilters(layer))
     msLayerTranslateFilter(layer, &layer->filter, layer->filteritem);
 
@@ -328,6 +338,13 @@ int msLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery) {
       return rv;
   }
   cppcheck_assert(layer->vtable);
+  if (layer->map && layer->map->metrics) {
+    const double starttime = msMetricsNow();
+    const int rv = layer->vtable->LayerWhichShapes(layer, rect, isQuery);
+    msMetricsAddSpan(layer->map->metrics, layer, MS_METRIC_WHICHSHAPES,
+                     starttime);
+    return rv;
+  }
   return layer->vtable->LayerWhichShapes(layer, rect, isQuery);
 }
 
@@ -366,6 +383,10 @@ int msLayerNextShape(layerObj *layer, shapeObj *shape) {
 
   /* RFC 91: MapServer-based filtering is done at a more general level. */
   do {
+    /* the previous shape is gone, recycle the memory it used (maparena.c) */
+    if (layer->arena && !shape->arena)
+      msArenaReset(layer->arena);
+
     rv = layer->vtable->LayerNextShape(layer, shape);
     if (rv != MS_SUCCESS)
       return rv;
@@ -392,6 +413,10 @@ int msLayerNextShape(layerObj *layer, shapeObj *shape) {
       return rv;
   }
 
+  if (layer->map && layer->map->metrics)
+    msMetricsAddCount(layer->map->metrics, layer, MS_METRIC_FEATURES_FETCHED,
+                      1);
+
   return rv;
 }
 
@@ -497,6 +522,11 @@ void msLayerClose(layerObj *layer) {
     layer->vtable->LayerClose(layer);
   }
   msLayerRestoreFromScaletokens(layer);
+
+  msArenaDestroy(layer->arena);
+  layer->arena = NULL;
+  msClassIndexFree(layer->classindex);
+  layer->classindex = NULL;
 }
 
 /*
@@ -744,6 +774,9 @@ int msTokenizeExpression(expressionObj *expression, char **list,
   /* if(expression->type != MS_EXPRESSION && expression->type !=
    * MS_GEOMTRANSFORM_EXPRESSION) return MS_SUCCESS; */
 
+  /* the token list is about to change, any compiled form is stale */
+  msFreeCompiledExpression(expression);
+
   msAcquireLock(TLOCK_PARSER);
   msyystate = MS_TOKENIZE_EXPRESSION;
   msyystring = expression->string; /* the thing we're tokenizing */
@@ -910,9 +943,11 @@ static void buildLayerItemList(layerObj *layer) {
       continue;
 
     if (layer->class[i] -> expression.type ==
-                               MS_EXPRESSION) /* class expression */
+                               MS_EXPRESSION) { /* class expression */
       msTokenizeExpression(&(layer->class[i] -> expression), layer->items,
                            &(layer->numitems));
+      msCompileExpression(&(layer->class[i] -> expression));
+    }
 
     /* class styles (items, bindings, geomtransform) */
     for (j = 0; j < layer->class[i] -> numstyles; j++) {
@@ -972,9 +1007,11 @@ static void buildLayerItemList(layerObj *layer) {
       }
 
       /* label expression */
-      if (layer->class[i] -> labels[l] -> expression.type == MS_EXPRESSION)
+      if (layer->class[i] -> labels[l] -> expression.type == MS_EXPRESSION) {
         msTokenizeExpression(&(layer->class[i] -> labels[l] -> expression),
                              layer->items, &(layer->numitems));
+        msCompileExpression(&(layer->class[i] -> labels[l] -> expression));
+      }
 
       /* label text */
       if (layer->class[i] -> labels[l]
@@ -1001,8 +1038,10 @@ static void buildLayerItemList(layerObj *layer) {
   }
 
   /* layer filter */
-  if (layer->filter.type == MS_EXPRESSION)
+  if (layer->filter.type == MS_EXPRESSION) {
     msTokenizeExpression(&(layer->filter), layer->items, &(layer->numitems));
+    msCompileExpression(&(layer->filter));
+  }
 
   /* cluster expressions */
   if (layer->cluster.group.type == MS_EXPRESSION)
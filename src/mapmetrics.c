@@ -0,0 +1,473 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Per request timings and counters (layer open, whichshapes,
+ *           features fetched and drawn, label cache, encoding...).
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2024 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** The application attaches a msMetricsObj to map->metrics for the duration
+** of a request. The instrumented code only records anything when it is set,
+** so that the cost is a pointer test when metrics are not wanted:
+**
+**   double start = 0;
+**   if (map->metrics)
+**     start = msMetricsNow();
+**   ...
+**   if (map->metrics)
+**     msMetricsAddSpan(map->metrics, layer, MS_METRIC_WHICHSHAPES, start);
+**
+** Spans and counters recorded for a layer are also added to the request
+** totals. A msMetricsObj is used by a single thread: the workers of
+** mapdrawparallel.c get their own, merged into the map's one at the end.
+**
+** msMetricsEndRequest() writes the request as a JSON line to the file named
+** by the MS_METRICS_LOG configuration option, and adds it to the totals of
+** the process, which msMetricsGetPrometheusText() returns in the Prometheus
+** text exposition format (mapserv serves them on MS_METRICS_ENDPOINT).
+*/
+
+#include "mapserver.h"
+#include "maptime.h"
+#include "mapthread.h"
+
+#include "cpl_conv.h"
+
+static const char *const spanNames[MS_METRIC_NUMSPANS] = {
+    "layer_open", "whichshapes", "layer_draw", "labelcache", "encode"};
+static const char *const counterNames[MS_METRIC_NUMCOUNTERS] = {
+    "features_fetched", "features_drawn", "bytes_written",
+    "mapfile_cache_hits", "mapfile_cache_misses"};
+
+typedef struct {
+  char *name; /* NULL when nothing was recorded for the layer */
+  double spans[MS_METRIC_NUMSPANS];
+  double counters[MS_METRIC_NUMCOUNTERS];
+} metricsLayerObj;
+
+struct msMetricsObj {
+  double start;
+  double spans[MS_METRIC_NUMSPANS]; /* seconds */
+  double counters[MS_METRIC_NUMCOUNTERS];
+  metricsLayerObj *layers; /* by layer index */
+  int numlayers;
+};
+
+msMetricsObj *msMetricsCreate(void) {
+  msMetricsObj *metrics =
+      (msMetricsObj *)msSmallCalloc(1, sizeof(msMetricsObj));
+  metrics->start = msMetricsNow();
+  return metrics;
+}
+
+void msMetricsDestroy(msMetricsObj *metrics) {
+  int i;
+  if (!metrics)
+    return;
+  for (i = 0; i < metrics->numlayers; i++)
+    msFree(metrics->layers[i].name);
+  msFree(metrics->layers);
+  msFree(metrics);
+}
+
+double msMetricsNow(void) {
+  struct mstimeval tv;
+  msGettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1.0e6;
+}
+
+static metricsLayerObj *getLayer(msMetricsObj *metrics, int index,
+                                 const char *name) {
+  metricsLayerObj *ml;
+
+  if (index < 0)
+    return NULL;
+  if (index >= metrics->numlayers) {
+    metrics->layers = (metricsLayerObj *)msSmallRealloc(
+        metrics->layers, sizeof(metricsLayerObj) * (index + 1));
+    memset(metrics->layers + metrics->numlayers, 0,
+           sizeof(metricsLayerObj) * (index + 1 - metrics->numlayers));
+    metrics->numlayers = index + 1;
+  }
+  ml = &(metrics->layers[index]);
+  if (!ml->name)
+    ml->name = msStrdup(name ? name : "");
+  return ml;
+}
+
+void msMetricsAddSpan(msMetricsObj *metrics, const layerObj *layer,
+                      enum MS_METRIC_SPAN span, double start) {
+  double elapsed;
+  if (!metrics)
+    return;
+  elapsed = msMetricsNow() - start;
+  metrics->spans[span] += elapsed;
+  if (layer) {
+    metricsLayerObj *ml = getLayer(metrics, layer->index, layer->name);
+    if (ml)
+      ml->spans[span] += elapsed;
+  }
+}
+
+void msMetricsAddCount(msMetricsObj *metrics, const layerObj *layer,
+                       enum MS_METRIC_COUNTER counter, double value) {
+  if (!metrics)
+    return;
+  metrics->counters[counter] += value;
+  if (layer) {
+    metricsLayerObj *ml = getLayer(metrics, layer->index, layer->name);
+    if (ml)
+      ml->counters[counter] += value;
+  }
+}
+
+/*
+** Add the spans and counters of other to metrics, the start time of metrics
+** is kept.
+*/
+void msMetricsMerge(msMetricsObj *metrics, const msMetricsObj *other) {
+  int i, j;
+  if (!metrics || !other)
+    return;
+  for (j = 0; j < MS_METRIC_NUMSPANS; j++)
+    metrics->spans[j] += other->spans[j];
+  for (j = 0; j < MS_METRIC_NUMCOUNTERS; j++)
+    metrics->counters[j] += other->counters[j];
+  for (i = 0; i < other->numlayers; i++) {
+    const metricsLayerObj *src = &(other->layers[i]);
+    metricsLayerObj *dst;
+    if (!src->name)
+      continue;
+    dst = getLayer(metrics, i, src->name);
+    for (j = 0; j < MS_METRIC_NUMSPANS; j++)
+      dst->spans[j] += src->spans[j];
+    for (j = 0; j < MS_METRIC_NUMCOUNTERS; j++)
+      dst->counters[j] += src->counters[j];
+  }
+}
+
+/************************************************************************/
+/*                              Output                                  */
+/************************************************************************/
+
+static void appendf(msStringBuffer *sb, const char *format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  msStringBufferAppend(sb, buffer);
+}
+
+/* quoted for a JSON string or a Prometheus label value */
+static void appendQuoted(msStringBuffer *sb, const char *s) {
+  char buffer[8];
+  msStringBufferAppend(sb, "\"");
+  for (; s && *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      buffer[0] = '\\';
+      buffer[1] = *s;
+      buffer[2] = '\0';
+    } else if (*s == '\n') {
+      strcpy(buffer, "\\n");
+    } else if ((unsigned char)*s < 0x20) {
+      snprintf(buffer, sizeof(buffer), "\\u%04x", *s);
+    } else {
+      buffer[0] = *s;
+      buffer[1] = '\0';
+    }
+    msStringBufferAppend(sb, buffer);
+  }
+  msStringBufferAppend(sb, "\"");
+}
+
+static void appendValues(msStringBuffer *sb, const double *spans,
+                         const double *counters) {
+  int j;
+  for (j = 0; j < MS_METRIC_NUMSPANS; j++)
+    appendf(sb, ",\"%s_ms\":%.3f", spanNames[j], spans[j] * 1000.0);
+  for (j = 0; j < MS_METRIC_NUMCOUNTERS; j++)
+    appendf(sb, ",\"%s\":%.0f", counterNames[j], counters[j]);
+}
+
+/*
+** Returns the request as a single line JSON object, to be freed by the
+** caller. The duration runs from msMetricsCreate() to now.
+*/
+char *msMetricsToJSON(const msMetricsObj *metrics, const char *request,
+                      const char *mapname, int status) {
+  msStringBuffer *sb = msStringBufferAlloc();
+  char timestamp[32];
+  time_t now = time(NULL);
+  int i, first = MS_TRUE;
+
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  appendf(sb, "{\"time\":\"%s\",\"request\":", timestamp);
+  appendQuoted(sb, request);
+  msStringBufferAppend(sb, ",\"map\":");
+  appendQuoted(sb, mapname);
+  appendf(sb, ",\"status\":\"%s\",\"duration_ms\":%.3f",
+          status == MS_SUCCESS ? "ok" : "error",
+          (msMetricsNow() - metrics->start) * 1000.0);
+  appendValues(sb, metrics->spans, metrics->counters);
+
+  msStringBufferAppend(sb, ",\"layers\":[");
+  for (i = 0; i < metrics->numlayers; i++) {
+    const metricsLayerObj *ml = &(metrics->layers[i]);
+    if (!ml->name)
+      continue;
+    msStringBufferAppend(sb, first ? "{\"name\":" : ",{\"name\":");
+    appendQuoted(sb, ml->name);
+    appendValues(sb, ml->spans, ml->counters);
+    msStringBufferAppend(sb, "}");
+    first = MS_FALSE;
+  }
+  msStringBufferAppend(sb, "]}");
+
+  return msStringBufferReleaseStringAndFree(sb);
+}
+
+/* totals of the process, for msMetricsGetPrometheusText() */
+typedef struct {
+  char *request;
+  double count, errors, seconds;
+} metricsRequestTotalObj;
+
+typedef struct {
+  char *map, *layer;
+  double spans[MS_METRIC_NUMSPANS];
+  double counters[MS_METRIC_NUMCOUNTERS];
+} metricsLayerTotalObj;
+
+static metricsRequestTotalObj *requestTotals = NULL;
+static int numRequestTotals = 0;
+static metricsLayerTotalObj *layerTotals = NULL;
+static int numLayerTotals = 0;
+static double spanTotals[MS_METRIC_NUMSPANS];
+static double counterTotals[MS_METRIC_NUMCOUNTERS];
+
+static void addToTotals(const msMetricsObj *metrics, const char *request,
+                        const char *mapname, int status, double duration) {
+  metricsRequestTotalObj *rt = NULL;
+  int i, j, k;
+
+  for (i = 0; i < numRequestTotals; i++) {
+    if (strcmp(requestTotals[i].request, request) == 0) {
+      rt = &(requestTotals[i]);
+      break;
+    }
+  }
+  if (!rt) {
+    requestTotals = (metricsRequestTotalObj *)msSmallRealloc(
+        requestTotals, sizeof(metricsRequestTotalObj) * (numRequestTotals + 1));
+    rt = &(requestTotals[numRequestTotals++]);
+    memset(rt, 0, sizeof(*rt));
+    rt->request = msStrdup(request);
+  }
+  rt->count++;
+  if (status != MS_SUCCESS)
+    rt->errors++;
+  rt->seconds += duration;
+
+  for (j = 0; j < MS_METRIC_NUMSPANS; j++)
+    spanTotals[j] += metrics->spans[j];
+  for (j = 0; j < MS_METRIC_NUMCOUNTERS; j++)
+    counterTotals[j] += metrics->counters[j];
+
+  for (i = 0; i < metrics->numlayers; i++) {
+    const metricsLayerObj *ml = &(metrics->layers[i]);
+    metricsLayerTotalObj *lt = NULL;
+    if (!ml->name)
+      continue;
+    for (k = 0; k < numLayerTotals; k++) {
+      if (strcmp(layerTotals[k].layer, ml->name) == 0 &&
+          strcmp(layerTotals[k].map, mapname) == 0) {
+        lt = &(layerTotals[k]);
+        break;
+      }
+    }
+    if (!lt) {
+      layerTotals = (metricsLayerTotalObj *)msSmallRealloc(
+          layerTotals, sizeof(metricsLayerTotalObj) * (numLayerTotals + 1));
+      lt = &(layerTotals[numLayerTotals++]);
+      memset(lt, 0, sizeof(*lt));
+      lt->map = msStrdup(mapname);
+      lt->layer = msStrdup(ml->name);
+    }
+    for (j = 0; j < MS_METRIC_NUMSPANS; j++)
+      lt->spans[j] += ml->spans[j];
+    for (j = 0; j < MS_METRIC_NUMCOUNTERS; j++)
+      lt->counters[j] += ml->counters[j];
+  }
+}
+
+/*
+** Record the end of a request: log it to MS_METRICS_LOG and add it to the
+** process totals when MS_METRICS_ENDPOINT is set. request is a short
+** description like "WMS GetMap", taken from a fixed set of names since each
+** one gets its own totals.
+*/
+int msMetricsEndRequest(msMetricsObj *metrics, const char *request,
+                        const char *mapname, int status) {
+  const char *logfile = CPLGetConfigOption("MS_METRICS_LOG", NULL);
+  int retval = MS_SUCCESS;
+
+  if (!metrics)
+    return MS_SUCCESS;
+  if (!request)
+    request = "";
+  if (!mapname)
+    mapname = "";
+
+  if (CPLGetConfigOption("MS_METRICS_ENDPOINT", NULL)) {
+    msAcquireLock(TLOCK_METRICS);
+    addToTotals(metrics, request, mapname, status,
+                msMetricsNow() - metrics->start);
+    msReleaseLock(TLOCK_METRICS);
+  }
+
+  if (logfile) {
+    char *line = msMetricsToJSON(metrics, request, mapname, status);
+    FILE *fp = NULL;
+    if (strcmp(logfile, "stderr") == 0)
+      fp = stderr;
+    else
+      fp = fopen(logfile, "a");
+    if (fp) {
+      /* a single write per line so that processes can share the file */
+      line = msStringConcatenate(line, "\n");
+      fputs(line, fp);
+      if (fp != stderr)
+        fclose(fp);
+    } else {
+      msSetError(MS_IOERR, "Unable to open metrics log %s.",
+                 "msMetricsEndRequest()", logfile);
+      retval = MS_FAILURE;
+    }
+    msFree(line);
+  }
+
+  return retval;
+}
+
+static void appendHelp(msStringBuffer *sb, const char *name, const char *help) {
+  appendf(sb, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+}
+
+/*
+** Returns the totals of the requests ended so far by this process, in the
+** Prometheus text exposition format. To be freed by the caller.
+*/
+char *msMetricsGetPrometheusText(void) {
+  msStringBuffer *sb = msStringBufferAlloc();
+  char name[64];
+  int i, j;
+
+  msAcquireLock(TLOCK_METRICS);
+
+  appendHelp(sb, "mapserver_requests_total", "Requests handled.");
+  for (i = 0; i < numRequestTotals; i++) {
+    msStringBufferAppend(sb, "mapserver_requests_total{request=");
+    appendQuoted(sb, requestTotals[i].request);
+    appendf(sb, "} %.0f\n", requestTotals[i].count);
+  }
+  appendHelp(sb, "mapserver_request_errors_total", "Requests that failed.");
+  for (i = 0; i < numRequestTotals; i++) {
+    msStringBufferAppend(sb, "mapserver_request_errors_total{request=");
+    appendQuoted(sb, requestTotals[i].request);
+    appendf(sb, "} %.0f\n", requestTotals[i].errors);
+  }
+  appendHelp(sb, "mapserver_request_seconds_total",
+             "Time spent handling requests.");
+  for (i = 0; i < numRequestTotals; i++) {
+    msStringBufferAppend(sb, "mapserver_request_seconds_total{request=");
+    appendQuoted(sb, requestTotals[i].request);
+    appendf(sb, "} %.6f\n", requestTotals[i].seconds);
+  }
+
+  appendHelp(sb, "mapserver_span_seconds_total",
+             "Time spent by step, layer_draw includes layer_open and "
+             "whichshapes.");
+  for (j = 0; j < MS_METRIC_NUMSPANS; j++)
+    appendf(sb, "mapserver_span_seconds_total{span=\"%s\"} %.6f\n",
+            spanNames[j], spanTotals[j]);
+  for (j = 0; j < MS_METRIC_NUMCOUNTERS; j++) {
+    snprintf(name, sizeof(name), "mapserver_%s_total", counterNames[j]);
+    appendHelp(sb, name, "Total over all requests.");
+    appendf(sb, "%s %.0f\n", name, counterTotals[j]);
+  }
+
+  appendHelp(sb, "mapserver_layer_span_seconds_total",
+             "Time spent by layer and step.");
+  for (i = 0; i < numLayerTotals; i++) {
+    for (j = 0; j < MS_METRIC_NUMSPANS; j++) {
+      if (layerTotals[i].spans[j] == 0)
+        continue;
+      msStringBufferAppend(sb, "mapserver_layer_span_seconds_total{map=");
+      appendQuoted(sb, layerTotals[i].map);
+      msStringBufferAppend(sb, ",layer=");
+      appendQuoted(sb, layerTotals[i].layer);
+      appendf(sb, ",span=\"%s\"} %.6f\n", spanNames[j],
+              layerTotals[i].spans[j]);
+    }
+  }
+  for (j = MS_METRIC_FEATURES_FETCHED; j <= MS_METRIC_FEATURES_DRAWN; j++) {
+    snprintf(name, sizeof(name), "mapserver_layer_%s_total", counterNames[j]);
+    appendHelp(sb, name, "Total by layer.");
+    for (i = 0; i < numLayerTotals; i++) {
+      appendf(sb, "%s{map=", name);
+      appendQuoted(sb, layerTotals[i].map);
+      msStringBufferAppend(sb, ",layer=");
+      appendQuoted(sb, layerTotals[i].layer);
+      appendf(sb, "} %.0f\n", layerTotals[i].counters[j]);
+    }
+  }
+
+  msReleaseLock(TLOCK_METRICS);
+
+  return msStringBufferReleaseStringAndFree(sb);
+}
+
+void msMetricsCleanup(void) {
+  int i;
+
+  msAcquireLock(TLOCK_METRICS);
+  for (i = 0; i < numRequestTotals; i++)
+    msFree(requestTotals[i].request);
+  msFree(requestTotals);
+  requestTotals = NULL;
+  numRequestTotals = 0;
+  for (i = 0; i < numLayerTotals; i++) {
+    msFree(layerTotals[i].map);
+    msFree(layerTotals[i].layer);
+  }
+  msFree(layerTotals);
+  layerTotals = NULL;
+  numLayerTotals = 0;
+  memset(spanTotals, 0, sizeof(spanTotals));
+  memset(counterTotals, 0, sizeof(counterTotals));
+  msReleaseLock(TLOCK_METRICS);
+}
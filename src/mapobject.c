@@ -92,6 +92,7 @@ void msFreeMap(mapObj *map) {
   msFree(map->name);
   msFree(map->shapepath);
   msFree(map->mappath);
+  msFree(map->mapfile);
 
   msFreeProjection(&(map->projection));
   msFreeProjection(&(map->latlon));
@@ -87,36 +87,46 @@ typedef enum {
 } OGCAPIErrorType;
 
 /*
-** Returns a JSON object using and a description.
+** Returns the code and the HTTP status of an error type.
 */
-static void outputError(OGCAPIErrorType errorType,
-                        const std::string &description) {
+static const char *getErrorCode(OGCAPIErrorType errorType,
+                                const char **status) {
   const char *code = "";
-  const char *status = "";
+  *status = "";
   switch (errorType) {
   case OGCAPI_SERVER_ERROR: {
     code = "ServerError";
-    status = "500";
+    *status = "500";
     break;
   }
   case OGCAPI_CONFIG_ERROR: {
     code = "ConfigError";
-    status = "500";
+    *status = "500";
     break;
   }
   case OGCAPI_PARAM_ERROR: {
     code = "InvalidParameterValue";
-    status = "400";
+    *status = "400";
     break;
   }
   case OGCAPI_NOT_FOUND_ERROR: {
     code = "NotFound";
-    status = "404";
+    *status = "404";
     break;
   }
   }
 
-  json j = {{"code", code}, {"description", description}};
+  return code;
+}
+
+/*
+** Returns a JSON object using and a description.
+*/
+static void outputError(OGCAPIErrorType errorType,
+                        const std::string &description) {
+  const char *status;
+  json j = {{"code", getErrorCode(errorType, &status)},
+            {"description", description}};
 
   msIO_setHeader("Content-Type", "%s", OGCAPI_MIMETYPE_JSON);
   msIO_setHeader("Status", "%s", status);
@@ -906,6 +916,109 @@ static void outputJson(const json &j, const char *mimetype,
   msIO_printf("%s\n", js.c_str());
 }
 
+/*
+** GeoJSON items are written one by one as the query finds them, instead of
+** fetching them again from the result cache and building the whole
+** document first. See queryObj.result_callback.
+*/
+struct FeatureStream {
+  const std::map<std::string, std::string> *extraHeaders = NULL;
+  reprojectionObj *reprojector = NULL; // NULL if the query already did it
+  int geometry_precision = OGCAPI_DEFAULT_GEOMETRY_PRECISION;
+  bool outputCrsAxisInverted = false;
+
+  gmlItemListObj *items = NULL; // set with the first feature
+  gmlConstantListObj *constants = NULL;
+  bool started = false; // headers and features sent
+  OGCAPIErrorType errorType = OGCAPI_SERVER_ERROR;
+  std::string error;
+
+  ~FeatureStream() {
+    msGMLFreeItems(items);
+    msGMLFreeConstants(constants);
+  }
+
+  void start() {
+    msIO_setHeader("Content-Type", "%s", OGCAPI_MIMETYPE_GEOJSON);
+    for (const auto &kvp : *extraHeaders) {
+      msIO_setHeader(kvp.first.c_str(), "%s", kvp.second.c_str());
+    }
+    msIO_sendHeaders();
+    msIO_printf("{\"features\":[");
+    started = true;
+  }
+
+  // the rest of the collection, in the order json::dump() would write it
+  void finish(json &response) {
+    if (!started)
+      start();
+    response.erase("features");
+    std::string js;
+    try {
+      js = response.dump();
+    } catch (...) {
+      js = "{}";
+    }
+    msIO_printf("]%s%s\n", js.size() > 2 ? "," : "", js.c_str() + 1);
+  }
+
+  // the query failed after features were sent, close the collection with
+  // the error in place of the members that depend on the page
+  void abort() {
+    const char *status;
+    if (error.empty())
+      error = "Collection items query failed.";
+    json response = {
+        {"type", "FeatureCollection"},
+        {"error",
+         {{"code", getErrorCode(errorType, &status)}, {"description", error}}}};
+    finish(response);
+  }
+};
+
+static int streamFeature(layerObj *layer, shapeObj *shape, void *userdata) {
+  FeatureStream *stream = static_cast<FeatureStream *>(userdata);
+  std::string js;
+
+  if (!stream->items) {
+    // we piggyback on GML configuration
+    stream->items = msGMLGetItems(layer, "AG");
+    stream->constants = msGMLGetConstants(layer, "AG");
+    if (!stream->items || !stream->constants) {
+      stream->error = "Error fetching layer attribute metadata.";
+      return MS_FAILURE;
+    }
+  }
+
+  if (stream->reprojector &&
+      msProjectShapeEx(stream->reprojector, shape) != MS_SUCCESS) {
+    stream->error = "Error reprojecting feature.";
+    return MS_FAILURE;
+  }
+
+  try {
+    json feature = getFeature(layer, shape, stream->items, stream->constants,
+                              stream->geometry_precision,
+                              stream->outputCrsAxisInverted);
+    js = feature.dump();
+  } catch (const std::runtime_error &e) {
+    stream->error = "Error getting feature. " + std::string(e.what());
+    return MS_FAILURE;
+  } catch (...) {
+    stream->errorType = OGCAPI_CONFIG_ERROR;
+    stream->error = "Invalid UTF-8 data, check encoding.";
+    return MS_FAILURE;
+  }
+
+  if (stream->started) {
+    msIO_printf(",%s", js.c_str());
+  } else {
+    stream->start();
+    msIO_printf("%s", js.c_str());
+  }
+  return MS_SUCCESS;
+}
+
 static void outputTemplate(const char *directory, const char *filename,
                            const json &j, const char *mimetype) {
   std::string _directory(directory);
@@ -1137,6 +1250,9 @@ static int processCollectionItemsRequest(mapObj *map, cgiRequestObj *request,
 
   int numberMatched = 0;
 
+  FeatureStream stream;
+  bool streamed = false;
+
   // find the right layer
   for (i = 0; i < map->numlayers; i++) {
     if (strcmp(map->layers[i]->name, collectionId) == 0)
@@ -1356,8 +1472,34 @@ static int processCollectionItemsRequest(mapObj *map, cgiRequestObj *request,
         layer->startindex = 1 + offset;
       }
 
-      if (reprObjs.executeQuery(map) != MS_SUCCESS || !layer->resultcache) {
-        outputError(OGCAPI_NOT_FOUND_ERROR, "Collection items query failed.");
+      if (format == OGCAPIFormat::JSON) {
+        // shapes are projected to the output CRS by the query, unless the
+        // layer has no projection of its own
+        stream.extraHeaders = &extraHeaders;
+        if (layer->projection.numargs == 0)
+          stream.reprojector = reprObjs.reprojector;
+        stream.geometry_precision = getGeometryPrecision(map, layer);
+        stream.outputCrsAxisInverted = outputCrsAxisInverted;
+        map->query.result_callback = streamFeature;
+        map->query.result_callback_data = &stream;
+        streamed = true;
+      }
+
+      const int status = reprObjs.executeQuery(map);
+      map->query.result_callback = NULL;
+      map->query.result_callback_data = NULL;
+
+      if (status != MS_SUCCESS || !layer->resultcache) {
+        if (stream.started) {
+          // too late for an error document
+          stream.abort();
+          msDebug("processCollectionItemsRequest(): %s\n",
+                  stream.error.c_str());
+        } else if (!stream.error.empty()) {
+          outputError(stream.errorType, stream.error);
+        } else {
+          outputError(OGCAPI_NOT_FOUND_ERROR, "Collection items query failed.");
+        }
         return MS_SUCCESS;
       }
     }
@@ -1429,8 +1571,8 @@ static int processCollectionItemsRequest(mapObj *map, cgiRequestObj *request,
     msFree(id_encoded); // done
   }
 
-  // features (items)
-  {
+  // features (items), unless they have already been written
+  if (!streamed) {
     shapeObj shape;
     msInitShape(&shape);
 
@@ -1533,6 +1675,8 @@ static int processCollectionItemsRequest(mapObj *map, cgiRequestObj *request,
         map, request,
         format == OGCAPIFormat::JSON ? OGCAPIFormat::GeoJSON : format,
         OGCAPI_TEMPLATE_HTML_COLLECTION_ITEM, response, extraHeaders);
+  } else if (streamed) {
+    stream.finish(response);
   } else {
     outputResponse(
         map, request,
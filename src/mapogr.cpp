@@ -49,6 +49,19 @@
 // GDAL 1.x API
 #include "ogr_api.h"
 
+#if GDAL_VERSION_MAJOR > 3 ||                                                  \
+    (GDAL_VERSION_MAJOR == 3 && GDAL_VERSION_MINOR >= 6)
+#define MSOGR_USE_ARROW_STREAM
+#include "ogr_recordbatch.h"
+
+// Where the value of a layer item is found in the record batches
+typedef struct {
+  int nColumn; // index of the column in the batches, or -1 (FID)
+  int nWidth;
+  int nPrecision;
+} msOGRArrowItem;
+#endif
+
 typedef struct ms_ogr_file_info_t {
   char *pszFname;
   char *pszLayerDef;
@@ -82,6 +95,18 @@ typedef struct ms_ogr_file_info_t {
 
   char *pszWHERE;
 
+#ifdef MSOGR_USE_ARROW_STREAM
+  // Columnar reading, see msOGRFileStartArrowStream()
+  int nArrowState; // 0: not started, 1: streaming, -1: feature per feature
+  struct ArrowArrayStream sArrowStream;
+  struct ArrowSchema sArrowSchema;
+  struct ArrowArray sArrowBatch;
+  int64_t nArrowRow;
+  int nArrowFIDColumn;
+  int nArrowGeomColumn;
+  msOGRArrowItem *pasArrowItems;
+#endif
+
 } msOGRFileInfo;
 
 static int msOGRLayerIsOpen(layerObj *layer);
@@ -89,6 +114,9 @@ static int msOGRLayerInitItemInfo(layerObj *layer);
 static int msOGRLayerGetAutoStyle(mapObj *map, layerObj *layer, classObj *c,
                                   shapeObj *shape);
 static void msOGRCloseConnection(void *conn_handle);
+#ifdef MSOGR_USE_ARROW_STREAM
+static void msOGRFileReleaseArrowStream(msOGRFileInfo *psInfo);
+#endif
 
 /* ==================================================================
  * Geometry conversion functions
@@ -1673,6 +1701,9 @@ static int msOGRFileClose(layerObj *layer, msOGRFileInfo *psInfo) {
   CPLFree(psInfo->pszLayerDef);
 
   ACQUIRE_OGR_LOCK;
+#ifdef MSOGR_USE_ARROW_STREAM
+  msOGRFileReleaseArrowStream(psInfo);
+#endif
   if (psInfo->hLastFeature)
     OGR_F_Destroy(psInfo->hLastFeature);
 
@@ -2136,6 +2167,13 @@ static int msOGRFileWhichShapes(layerObj *layer, rectObj rect,
     return (MS_FAILURE);
   }
 
+#ifdef MSOGR_USE_ARROW_STREAM
+  // a new stream is started by the first msOGRFileNextShape() call
+  ACQUIRE_OGR_LOCK;
+  msOGRFileReleaseArrowStream(psInfo);
+  RELEASE_OGR_LOCK;
+#endif
+
   char *select = (psInfo->pszSelect) ? msStrdup(psInfo->pszSelect) : NULL;
   const rectObj rectInvalid = MS_INIT_INVALID_RECT;
   bool bIsValidRect = memcmp(&rect, &rectInvalid, sizeof(rect)) != 0;
@@ -2761,6 +2799,766 @@ static char **msOGRFileGetItems(layerObj *layer, msOGRFileInfo *psInfo) {
   return items;
 }
 
+#ifdef MSOGR_USE_ARROW_STREAM
+
+/* ==================================================================
+ * Columnar reading through the Arrow C stream interface
+ * ================================================================== */
+
+/**********************************************************************
+ *                     msOGRFileReleaseArrowStream()
+ *
+ * Release the record batches and the stream, and restore the fields
+ * that were ignored for the stream. The caller holds the OGR lock.
+ **********************************************************************/
+static void msOGRFileReleaseArrowStream(msOGRFileInfo *psInfo) {
+  if (psInfo->nArrowState == 1) {
+    if (psInfo->sArrowBatch.release)
+      psInfo->sArrowBatch.release(&psInfo->sArrowBatch);
+    if (psInfo->sArrowSchema.release)
+      psInfo->sArrowSchema.release(&psInfo->sArrowSchema);
+    if (psInfo->sArrowStream.release)
+      psInfo->sArrowStream.release(&psInfo->sArrowStream);
+    OGR_L_SetIgnoredFields(psInfo->hLayer, NULL);
+  }
+  memset(&psInfo->sArrowBatch, 0, sizeof(psInfo->sArrowBatch));
+  memset(&psInfo->sArrowSchema, 0, sizeof(psInfo->sArrowSchema));
+  memset(&psInfo->sArrowStream, 0, sizeof(psInfo->sArrowStream));
+  msFree(psInfo->pasArrowItems);
+  psInfo->pasArrowItems = NULL;
+  psInfo->nArrowState = 0;
+}
+
+static int msOGRArrowFindColumn(const struct ArrowSchema *psSchema,
+                                const char *pszName) {
+  for (int64_t i = 0; i < psSchema->n_children; i++) {
+    if (strcmp(psSchema->children[i]->name, pszName) == 0)
+      return (int)i;
+  }
+  return -1;
+}
+
+/**********************************************************************
+ *                     msOGRMarkFilterFields()
+ *
+ * Flag in abUsedFields the fields whose name is used as an identifier,
+ * quoted or not, in an OGR SQL filter. String literals are skipped, any
+ * other word matching a field name keeps that field, which at worst
+ * reads a field that was not needed.
+ **********************************************************************/
+static void msOGRMarkFilterFields(const char *pszFilter, OGRFeatureDefnH hDefn,
+                                  std::vector<bool> &abUsedFields) {
+  if (pszFilter == NULL)
+    return;
+
+  const char *pszIter = pszFilter;
+  while (*pszIter) {
+    std::string osName;
+    if (*pszIter == '\'' || *pszIter == '"') {
+      const char chQuote = *pszIter++;
+      while (*pszIter) {
+        if (*pszIter == chQuote) {
+          if (pszIter[1] != chQuote)
+            break;
+          pszIter++; // doubled quote
+        }
+        osName += *pszIter++;
+      }
+      if (*pszIter)
+        pszIter++;
+      if (chQuote == '\'')
+        continue;
+    } else if (isalnum((unsigned char)*pszIter) || *pszIter == '_' ||
+               (unsigned char)*pszIter >= 0x80) {
+      while (isalnum((unsigned char)*pszIter) || *pszIter == '_' ||
+             (unsigned char)*pszIter >= 0x80)
+        osName += *pszIter++;
+    } else {
+      pszIter++;
+      continue;
+    }
+
+    const int iField = OGR_FD_GetFieldIndex(hDefn, osName.c_str());
+    if (iField >= 0 && iField < (int)abUsedFields.size())
+      abUsedFields[iField] = true;
+  }
+}
+
+/**********************************************************************
+ *                     msOGRFileStartArrowStream()
+ *
+ * Switch the reading of a file to record batches when the layer asks
+ * for it with PROCESSING "OGR_ARROW_STREAM=YES" and all of its items are
+ * plain fields whose text value can be rebuilt from the batches exactly
+ * as OGR_F_GetFieldAsString() would. Fields that are not layer items are
+ * ignored so that the driver does not materialize them.
+ *
+ * Returns true if the stream is ready. The caller holds the OGR lock.
+ **********************************************************************/
+static bool msOGRFileStartArrowStream(layerObj *layer, msOGRFileInfo *psInfo) {
+  psInfo->nArrowState = -1;
+
+  const char *pszValue = msLayerGetProcessingKey(layer, "OGR_ARROW_STREAM");
+  if (pszValue == NULL || !CPLTestBool(pszValue))
+    return false;
+  if (layer->styleitem && strcasecmp(layer->styleitem, "AUTO") == 0)
+    return false; // needs the OGRFeature of the last shape
+  if (layer->numitems > 0 && !layer->iteminfo &&
+      msOGRLayerInitItemInfo(layer) != MS_SUCCESS)
+    return false;
+
+  OGRFeatureDefnH hDefn = OGR_L_GetLayerDefn(psInfo->hLayer);
+  if (OGR_FD_GetGeomFieldCount(hDefn) < 1)
+    return false;
+
+  const int *itemindexes = (const int *)layer->iteminfo;
+  std::vector<bool> abUsedFields(OGR_FD_GetFieldCount(hDefn), false);
+  for (int i = 0; i < layer->numitems; i++) {
+    if (itemindexes[i] == MSOGR_FID_INDEX)
+      continue;
+    if (itemindexes[i] < 0)
+      return false; // style string attributes
+    OGRFieldDefnH hField = OGR_FD_GetFieldDefn(hDefn, itemindexes[i]);
+    const OGRFieldSubType eSubType = OGR_Fld_GetSubType(hField);
+    switch (OGR_Fld_GetType(hField)) {
+    case OFTInteger:
+      if (eSubType != OFSTNone && eSubType != OFSTBoolean &&
+          eSubType != OFSTInt16)
+        return false;
+      break;
+    case OFTReal:
+      if (eSubType != OFSTNone)
+        return false;
+      break;
+    case OFTInteger64:
+    case OFTString:
+      break;
+    default:
+      return false; // dates, lists and binary values are formatted by OGR
+    }
+    abUsedFields[itemindexes[i]] = true;
+  }
+
+  // the attribute filter is evaluated by the driver on its own fields
+  msOGRMarkFilterFields(msLayerGetProcessingKey(layer, "NATIVE_FILTER"),
+                        hDefn, abUsedFields);
+  msOGRMarkFilterFields(psInfo->pszWHERE, hDefn, abUsedFields);
+
+  CPLStringList aosIgnored;
+  for (int i = 0; i < (int)abUsedFields.size(); i++) {
+    if (!abUsedFields[i])
+      aosIgnored.AddString(
+          OGR_Fld_GetNameRef(OGR_FD_GetFieldDefn(hDefn, i)));
+  }
+  aosIgnored.AddString("OGR_STYLE");
+  OGR_L_SetIgnoredFields(psInfo->hLayer, (const char **)aosIgnored.List());
+
+  CPLStringList aosOptions;
+  aosOptions.SetNameValue("INCLUDE_FID", "YES");
+  aosOptions.SetNameValue("GEOMETRY_ENCODING", "WKB");
+  memset(&psInfo->sArrowStream, 0, sizeof(psInfo->sArrowStream));
+  if (!OGR_L_GetArrowStream(psInfo->hLayer, &psInfo->sArrowStream,
+                            aosOptions.List())) {
+    OGR_L_SetIgnoredFields(psInfo->hLayer, NULL);
+    return false;
+  }
+  psInfo->nArrowState = 1;
+  psInfo->nArrowRow = 0;
+
+  // Map the layer items to the columns of the batches
+  struct ArrowSchema *psSchema = &psInfo->sArrowSchema;
+  bool bOK = psInfo->sArrowStream.get_schema(&psInfo->sArrowStream,
+                                             psSchema) == 0 &&
+             strcmp(psSchema->format, "+s") == 0;
+  if (bOK) {
+    const char *pszFID = OGR_L_GetFIDColumn(psInfo->hLayer);
+    const char *pszGeom =
+        OGR_GFld_GetNameRef(OGR_FD_GetGeomFieldDefn(hDefn, 0));
+    psInfo->nArrowFIDColumn = msOGRArrowFindColumn(
+        psSchema, pszFID && pszFID[0] ? pszFID : "OGC_FID");
+    psInfo->nArrowGeomColumn = msOGRArrowFindColumn(
+        psSchema, pszGeom && pszGeom[0] ? pszGeom : "wkb_geometry");
+    bOK = psInfo->nArrowFIDColumn >= 0 && psInfo->nArrowGeomColumn >= 0 &&
+          strcmp(psSchema->children[psInfo->nArrowFIDColumn]->format, "l") ==
+              0 &&
+          (strcmp(psSchema->children[psInfo->nArrowGeomColumn]->format,
+                  "z") == 0 ||
+           strcmp(psSchema->children[psInfo->nArrowGeomColumn]->format,
+                  "Z") == 0);
+  }
+
+  if (bOK && layer->numitems > 0) {
+    psInfo->pasArrowItems = (msOGRArrowItem *)msSmallCalloc(
+        layer->numitems, sizeof(msOGRArrowItem));
+    for (int i = 0; bOK && i < layer->numitems; i++) {
+      msOGRArrowItem *psItem = &psInfo->pasArrowItems[i];
+      if (itemindexes[i] == MSOGR_FID_INDEX) {
+        psItem->nColumn = -1;
+        continue;
+      }
+      OGRFieldDefnH hField = OGR_FD_GetFieldDefn(hDefn, itemindexes[i]);
+      psItem->nColumn =
+          msOGRArrowFindColumn(psSchema, OGR_Fld_GetNameRef(hField));
+      psItem->nWidth = OGR_Fld_GetWidth(hField);
+      psItem->nPrecision = OGR_Fld_GetPrecision(hField);
+      if (psItem->nColumn < 0) {
+        bOK = false;
+        break;
+      }
+      // the column types that msOGRArrowGetValue() knows
+      const char *pszFormat = psSchema->children[psItem->nColumn]->format;
+      switch (OGR_Fld_GetType(hField)) {
+      case OFTInteger:
+        bOK = strcmp(pszFormat, "i") == 0 || strcmp(pszFormat, "s") == 0 ||
+              strcmp(pszFormat, "b") == 0;
+        break;
+      case OFTInteger64:
+        bOK = strcmp(pszFormat, "l") == 0;
+        break;
+      case OFTReal:
+        bOK = strcmp(pszFormat, "g") == 0;
+        break;
+      default:
+        bOK = strcmp(pszFormat, "u") == 0 || strcmp(pszFormat, "U") == 0;
+        break;
+      }
+    }
+  }
+
+  if (!bOK) {
+    if (layer->debug)
+      msDebug("msOGRFileStartArrowStream(): unexpected record batch layout, "
+              "reading features one by one.\n");
+    msOGRFileReleaseArrowStream(psInfo);
+    psInfo->nArrowState = -1;
+    return false;
+  }
+
+  // The last OGRFeature is not kept up to date while streaming
+  if (psInfo->hLastFeature) {
+    OGR_F_Destroy(psInfo->hLastFeature);
+    psInfo->hLastFeature = NULL;
+  }
+
+  if (layer->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msOGRFileStartArrowStream(): reading %s with record batches.\n",
+            layer->name ? layer->name : "(null)");
+  return true;
+}
+
+static inline bool msOGRArrowIsNull(const struct ArrowArray *psArray,
+                                    int64_t nIdx) {
+  const GByte *pabyValidity = (const GByte *)psArray->buffers[0];
+  return psArray->null_count != 0 && pabyValidity != NULL &&
+         (pabyValidity[nIdx / 8] & (1 << (nIdx % 8))) == 0;
+}
+
+/**********************************************************************
+ *                     msOGRArrowGetValue()
+ *
+ * Text value of row nIdx of a column, formatted like
+ * OGR_F_GetFieldAsString() does.
+ **********************************************************************/
+static char *msOGRArrowGetValue(const struct ArrowSchema *psSchema,
+                                const struct ArrowArray *psArray, int64_t nIdx,
+                                const msOGRArrowItem *psItem) {
+  nIdx += psArray->offset;
+  if (msOGRArrowIsNull(psArray, nIdx))
+    return msStrdup("");
+
+  const void *pData = psArray->buffers[1];
+  switch (psSchema->format[0]) {
+  case 'b':
+    return msStrdup(((const GByte *)pData)[nIdx / 8] & (1 << (nIdx % 8))
+                        ? "1"
+                        : "0");
+  case 's':
+    return msStrdup(CPLSPrintf("%d", ((const GInt16 *)pData)[nIdx]));
+  case 'i':
+    return msStrdup(CPLSPrintf("%d", ((const GInt32 *)pData)[nIdx]));
+  case 'l':
+    return msStrdup(
+        CPLSPrintf(CPL_FRMT_GIB, (GIntBig)((const GInt64 *)pData)[nIdx]));
+  case 'g': {
+    char szValue[64];
+    const double dfValue = ((const double *)pData)[nIdx];
+    if (psItem->nWidth != 0)
+      CPLsnprintf(szValue, sizeof(szValue), "%*.*f", psItem->nWidth,
+                  psItem->nPrecision, dfValue);
+    else
+      CPLsnprintf(szValue, sizeof(szValue), "%.15g", dfValue);
+    return msStrdup(szValue);
+  }
+  case 'u': {
+    const GInt32 *panOffsets = (const GInt32 *)pData;
+    const char *pszData = (const char *)psArray->buffers[2];
+    return msStrdup(
+        std::string(pszData + panOffsets[nIdx],
+                    (size_t)(panOffsets[nIdx + 1] - panOffsets[nIdx]))
+            .c_str());
+  }
+  case 'U': {
+    const GInt64 *panOffsets = (const GInt64 *)pData;
+    const char *pszData = (const char *)psArray->buffers[2];
+    return msStrdup(
+        std::string(pszData + panOffsets[nIdx],
+                    (size_t)(panOffsets[nIdx + 1] - panOffsets[nIdx]))
+            .c_str());
+  }
+  default:
+    return msStrdup("");
+  }
+}
+
+/* ------------------------------------------------------------------
+ * WKB decoding. The conversion rules are the ones of ogrGeomPoints()
+ * and ogrGeomLine(), applied straight to the WKB of the batches. The
+ * decoder gives up (returns false) on anything it does not know, like
+ * curves, and the caller then goes through an OGRGeometry.
+ * ------------------------------------------------------------------ */
+#define MSOGR_WKB_MAX_DEPTH 32
+
+typedef struct {
+  const GByte *pabyData;
+  size_t nSize;
+  size_t nPos;
+  // of the geometry being read
+  bool bSwap;
+  bool bHasZ;
+  bool bHasM;
+} msOGRWkbReader;
+
+static bool msOGRWkbReadUInt32(msOGRWkbReader *psReader, GUInt32 *pnValue) {
+  if (psReader->nSize - psReader->nPos < 4)
+    return false;
+  memcpy(pnValue, psReader->pabyData + psReader->nPos, 4);
+  if (psReader->bSwap)
+    CPL_SWAP32PTR(pnValue);
+  psReader->nPos += 4;
+  return true;
+}
+
+// Read the byte order and type of a geometry, returns the flat type or 0
+static int msOGRWkbReadHeader(msOGRWkbReader *psReader) {
+  if (psReader->nPos >= psReader->nSize)
+    return 0;
+  const GByte byOrder = psReader->pabyData[psReader->nPos++];
+  if (byOrder > 1)
+    return 0;
+#if CPL_IS_LSB
+  psReader->bSwap = byOrder == 0;
+#else
+  psReader->bSwap = byOrder == 1;
+#endif
+
+  GUInt32 nType;
+  if (!msOGRWkbReadUInt32(psReader, &nType))
+    return 0;
+  psReader->bHasZ = (nType & 0x80000000U) != 0;
+  psReader->bHasM = (nType & 0x40000000U) != 0;
+  nType &= 0x0fffffffU;
+  if (nType >= 3000 && nType < 4000) {
+    psReader->bHasZ = psReader->bHasM = true;
+    nType -= 3000;
+  } else if (nType >= 2000 && nType < 3000) {
+    psReader->bHasM = true;
+    nType -= 2000;
+  } else if (nType >= 1000 && nType < 2000) {
+    psReader->bHasZ = true;
+    nType -= 1000;
+  }
+  if (nType < wkbPoint || nType > wkbGeometryCollection)
+    return 0;
+  return (int)nType;
+}
+
+// Append nPoints points to psPoints, z is 0 for 2D geometries
+static bool msOGRWkbReadPoints(msOGRWkbReader *psReader, GUInt32 nPoints,
+                               pointObj *psPoints) {
+  const int nDims = 2 + psReader->bHasZ + psReader->bHasM;
+  if ((psReader->nSize - psReader->nPos) / (8 * nDims) < nPoints)
+    return false;
+  for (GUInt32 i = 0; i < nPoints; i++) {
+    double adfCoords[4] = {0, 0, 0, 0};
+    memcpy(adfCoords, psReader->pabyData + psReader->nPos, 8 * nDims);
+    psReader->nPos += 8 * nDims;
+    if (psReader->bSwap) {
+      for (int k = 0; k < nDims; k++)
+        CPL_SWAPDOUBLE(&adfCoords[k]);
+    }
+    psPoints[i].x = adfCoords[0];
+    psPoints[i].y = adfCoords[1];
+    psPoints[i].z = psReader->bHasZ ? adfCoords[2] : 0.0;
+    psPoints[i].m = 0.0;
+  }
+  return true;
+}
+
+static bool msOGRWkbSkipPoints(msOGRWkbReader *psReader, GUInt32 nPoints) {
+  const int nDims = 2 + psReader->bHasZ + psReader->bHasM;
+  if ((psReader->nSize - psReader->nPos) / (8 * nDims) < nPoints)
+    return false;
+  psReader->nPos += (size_t)8 * nDims * nPoints;
+  return true;
+}
+
+// Sanity check of a point or part count against the remaining bytes
+static bool msOGRWkbReadCount(msOGRWkbReader *psReader, GUInt32 *pnCount) {
+  return msOGRWkbReadUInt32(psReader, pnCount) &&
+         *pnCount <= (psReader->nSize - psReader->nPos) / 4 + 1;
+}
+
+static void msOGRWkbAddBounds(shapeObj *outshp, const pointObj *psPoint,
+                              bool bFirst) {
+  if (bFirst) {
+    outshp->bounds.minx = outshp->bounds.maxx = psPoint->x;
+    outshp->bounds.miny = outshp->bounds.maxy = psPoint->y;
+  } else {
+    if (psPoint->x < outshp->bounds.minx)
+      outshp->bounds.minx = psPoint->x;
+    if (psPoint->x > outshp->bounds.maxx)
+      outshp->bounds.maxx = psPoint->x;
+    if (psPoint->y < outshp->bounds.miny)
+      outshp->bounds.miny = psPoint->y;
+    if (psPoint->y > outshp->bounds.maxy)
+      outshp->bounds.maxy = psPoint->y;
+  }
+}
+
+// Same as ogrGeomPoints(): every vertex goes into a single line
+static bool msOGRWkbPointsToShape(msOGRWkbReader *psReader, shapeObj *outshp,
+                                  int nDepth) {
+  const int nType = msOGRWkbReadHeader(psReader);
+  GUInt32 nCount = 1;
+
+  if (nType == 0 || nDepth > MSOGR_WKB_MAX_DEPTH)
+    return false;
+
+  if (nType == wkbPolygon || nType == wkbMultiLineString ||
+      nType == wkbMultiPolygon || nType == wkbGeometryCollection) {
+    if (!msOGRWkbReadCount(psReader, &nCount))
+      return false;
+    for (GUInt32 i = 0; i < nCount; i++) {
+      if (nType == wkbPolygon) {
+        // rings have no header, add their vertices like a linestring's
+        GUInt32 nPoints;
+        if (!msOGRWkbReadCount(psReader, &nPoints))
+          return false;
+        if (outshp->numlines == 0) {
+          lineObj newline = {0, NULL};
+          msAddLine(outshp, &newline);
+        }
+        lineObj *line = outshp->line + outshp->numlines - 1;
+        line->point = (pointObj *)msSmallRealloc(
+            line->point, sizeof(pointObj) * (line->numpoints + nPoints + 1));
+        if (!msOGRWkbReadPoints(psReader, nPoints,
+                                line->point + line->numpoints))
+          return false;
+        for (GUInt32 j = 0; j < nPoints; j++, line->numpoints++)
+          msOGRWkbAddBounds(outshp, &line->point[line->numpoints],
+                            line->numpoints == 0);
+        outshp->type = MS_SHAPE_POINT;
+      } else if (!msOGRWkbPointsToShape(psReader, outshp, nDepth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  if (nType != wkbPoint && !msOGRWkbReadCount(psReader, &nCount))
+    return false;
+
+  if (outshp->numlines == 0) {
+    lineObj newline = {0, NULL};
+    msAddLine(outshp, &newline);
+  }
+  lineObj *line = outshp->line + outshp->numlines - 1;
+  line->point = (pointObj *)msSmallRealloc(
+      line->point, sizeof(pointObj) * (line->numpoints + nCount + 1));
+
+  if (nType == wkbMultiPoint) {
+    msOGRWkbReader sPoint = *psReader;
+    for (GUInt32 i = 0; i < nCount; i++) {
+      if (msOGRWkbReadHeader(&sPoint) != wkbPoint ||
+          !msOGRWkbReadPoints(&sPoint, 1, line->point + line->numpoints + i))
+        return false;
+    }
+    psReader->nPos = sPoint.nPos;
+  } else if (!msOGRWkbReadPoints(psReader, nCount,
+                                 line->point + line->numpoints)) {
+    return false;
+  }
+
+  for (GUInt32 j = 0; j < nCount; j++, line->numpoints++) {
+    const pointObj *psPoint = &line->point[line->numpoints];
+    // POINT EMPTY, let OGR decide what it is worth
+    if (CPLIsNan(psPoint->x) || CPLIsNan(psPoint->y))
+      return false;
+    msOGRWkbAddBounds(outshp, psPoint, line->numpoints == 0);
+  }
+  outshp->type = MS_SHAPE_POINT;
+  return true;
+}
+
+// Same as the lineString case of ogrGeomLine(), for a linestring or a ring
+static bool msOGRWkbAddLine(msOGRWkbReader *psReader, shapeObj *outshp,
+                            int bCloseRings) {
+  GUInt32 nPoints;
+  if (!msOGRWkbReadCount(psReader, &nPoints))
+    return false;
+  if (nPoints < 2)
+    return msOGRWkbSkipPoints(psReader, nPoints);
+
+  if (outshp->type == MS_SHAPE_NULL)
+    outshp->type = MS_SHAPE_LINE;
+
+  lineObj line = {0, NULL};
+  line.point = (pointObj *)msSmallMalloc(sizeof(pointObj) * (nPoints + 1));
+  if (!msOGRWkbReadPoints(psReader, nPoints, line.point)) {
+    free(line.point);
+    return false;
+  }
+  for (GUInt32 j = 0; j < nPoints; j++)
+    msOGRWkbAddBounds(outshp, &line.point[j], j == 0 && outshp->numlines == 0);
+  line.numpoints = nPoints;
+
+  if (bCloseRings && (line.point[line.numpoints - 1].x != line.point[0].x ||
+                      line.point[line.numpoints - 1].y != line.point[0].y)) {
+    line.point[line.numpoints] = line.point[0];
+    line.numpoints++;
+  }
+
+  msAddLineDirectly(outshp, &line);
+  return true;
+}
+
+// Same as ogrGeomLine(): one line per part, points are dropped
+static bool msOGRWkbLinesToShape(msOGRWkbReader *psReader, shapeObj *outshp,
+                                 int bCloseRings, int nDepth) {
+  const int nType = msOGRWkbReadHeader(psReader);
+  GUInt32 nCount;
+
+  if (nType == 0 || nDepth > MSOGR_WKB_MAX_DEPTH)
+    return false;
+
+  switch (nType) {
+  case wkbPoint:
+    return msOGRWkbSkipPoints(psReader, 1);
+  case wkbLineString:
+    return msOGRWkbAddLine(psReader, outshp, bCloseRings);
+  case wkbPolygon:
+    if (outshp->type == MS_SHAPE_NULL)
+      outshp->type = MS_SHAPE_POLYGON;
+    if (!msOGRWkbReadCount(psReader, &nCount))
+      return false;
+    for (GUInt32 i = 0; i < nCount; i++) {
+      if (!msOGRWkbAddLine(psReader, outshp, bCloseRings))
+        return false;
+    }
+    return true;
+  default: // multi geometries and collections
+    if (!msOGRWkbReadCount(psReader, &nCount))
+      return false;
+    for (GUInt32 i = 0; i < nCount; i++) {
+      if (!msOGRWkbLinesToShape(psReader, outshp, bCloseRings, nDepth + 1))
+        return false;
+    }
+    return true;
+  }
+}
+
+/**********************************************************************
+ *                     msOGRWkbToShape()
+ *
+ * WKB counterpart of ogrConvertGeometry(). Returns false if the WKB must
+ * be converted through an OGRGeometry instead, the shape geometry is
+ * then left partially filled.
+ **********************************************************************/
+static bool msOGRWkbToShape(const GByte *pabyData, size_t nSize,
+                            shapeObj *outshp, enum MS_LAYER_TYPE layertype) {
+  msOGRWkbReader sReader;
+  memset(&sReader, 0, sizeof(sReader));
+  sReader.pabyData = pabyData;
+  sReader.nSize = nSize;
+
+  switch (layertype) {
+  case MS_LAYER_POINT:
+    return msOGRWkbPointsToShape(&sReader, outshp, 0);
+  case MS_LAYER_LINE:
+    if (!msOGRWkbLinesToShape(&sReader, outshp, MS_FALSE, 0))
+      return false;
+    if (outshp->type != MS_SHAPE_LINE && outshp->type != MS_SHAPE_POLYGON)
+      outshp->type = MS_SHAPE_NULL; // Incompatible type for this layer
+    return true;
+  case MS_LAYER_POLYGON:
+    if (!msOGRWkbLinesToShape(&sReader, outshp, MS_TRUE, 0))
+      return false;
+    if (outshp->type != MS_SHAPE_POLYGON)
+      outshp->type = MS_SHAPE_NULL; // Incompatible type for this layer
+    return true;
+  case MS_LAYER_CHART:
+  case MS_LAYER_QUERY: {
+    // real feature type, points for (multi)points with no measures
+    msOGRWkbReader sHeader = sReader;
+    const int nType = msOGRWkbReadHeader(&sHeader);
+    if ((nType == wkbPoint || nType == wkbMultiPoint) && !sHeader.bHasM)
+      return msOGRWkbPointsToShape(&sReader, outshp, 0);
+    return msOGRWkbLinesToShape(&sReader, outshp, MS_FALSE, 0);
+  }
+  default:
+    return false;
+  }
+}
+
+/**********************************************************************
+ *                     msOGRFileNextShapeArrow()
+ *
+ * msOGRFileNextShape() for a file read with record batches. The caller
+ * holds the OGR lock.
+ **********************************************************************/
+static int msOGRFileNextShapeArrow(layerObj *layer, shapeObj *shape,
+                                   msOGRFileInfo *psInfo) {
+  struct ArrowArray *psBatch = &psInfo->sArrowBatch;
+  const struct ArrowSchema *psSchema = &psInfo->sArrowSchema;
+
+  if (psInfo->nArrowState == 2)
+    return MS_DONE;
+
+  while (true) {
+    if (psBatch->release == NULL || psInfo->nArrowRow >= psBatch->length) {
+      if (psBatch->release)
+        psBatch->release(psBatch);
+      memset(psBatch, 0, sizeof(*psBatch));
+
+      if (psInfo->sArrowStream.get_next(&psInfo->sArrowStream, psBatch) != 0 ||
+          (psBatch->release != NULL &&
+           psBatch->n_children != psSchema->n_children)) {
+        const char *pszError =
+            psInfo->sArrowStream.get_last_error(&psInfo->sArrowStream);
+        msSetError(MS_OGRERR, "Failed to read a record batch: %s",
+                   "msOGRFileNextShape()",
+                   pszError ? pszError : "unexpected layout");
+        msOGRFileReleaseArrowStream(psInfo);
+        psInfo->nArrowState = 2;
+        return MS_FAILURE;
+      }
+      if (psBatch->release == NULL) {
+        psInfo->last_record_index_read = -1;
+        msOGRFileReleaseArrowStream(psInfo);
+        psInfo->nArrowState = 2;
+        if (layer->debug >= MS_DEBUGLEVEL_VV)
+          msDebug("msOGRFileNextShape: Returning MS_DONE (no more shapes)\n");
+        return MS_DONE;
+      }
+      psInfo->nArrowRow = 0;
+      continue;
+    }
+
+    const int64_t nIdx = psBatch->offset + psInfo->nArrowRow++;
+    psInfo->last_record_index_read++;
+
+    const struct ArrowArray *psFID = psBatch->children[psInfo->nArrowFIDColumn];
+    const GInt64 nFID =
+        ((const GInt64 *)psFID->buffers[1])[nIdx + psFID->offset];
+
+    // Geometry
+    const struct ArrowArray *psGeom =
+        psBatch->children[psInfo->nArrowGeomColumn];
+    const int64_t nGeomIdx = nIdx + psGeom->offset;
+    if (!msOGRArrowIsNull(psGeom, nGeomIdx)) {
+      size_t nStart, nEnd;
+      if (psSchema->children[psInfo->nArrowGeomColumn]->format[0] == 'z') {
+        nStart = ((const GInt32 *)psGeom->buffers[1])[nGeomIdx];
+        nEnd = ((const GInt32 *)psGeom->buffers[1])[nGeomIdx + 1];
+      } else {
+        nStart = ((const GInt64 *)psGeom->buffers[1])[nGeomIdx];
+        nEnd = ((const GInt64 *)psGeom->buffers[1])[nGeomIdx + 1];
+      }
+      const GByte *pabyWkb = (const GByte *)psGeom->buffers[2] + nStart;
+
+      if (!msOGRWkbToShape(pabyWkb, nEnd - nStart, shape, layer->type)) {
+        OGRGeometryH hGeom = NULL;
+        msFreeShape(shape);
+        shape->type = MS_SHAPE_NULL;
+        if (OGR_G_CreateFromWkb((unsigned char *)pabyWkb, NULL, &hGeom,
+                                (int)(nEnd - nStart)) == OGRERR_NONE) {
+          hGeom = OGR_G_ForceTo(
+              hGeom, OGR_GT_GetLinear(OGR_G_GetGeometryType(hGeom)), NULL);
+          const int nStatus = ogrConvertGeometry(hGeom, shape, layer->type);
+          OGR_G_DestroyGeometry(hGeom);
+          if (nStatus != MS_SUCCESS) {
+            msFreeShape(shape);
+            return MS_FAILURE; // Error message already produced.
+          }
+        }
+      }
+    }
+
+    if (shape->type == MS_SHAPE_NULL) {
+      if (layer->debug >= MS_DEBUGLEVEL_VVV)
+        msDebug("msOGRFileNextShape: Rejecting feature (shapeid = " CPL_FRMT_GIB
+                ", tileid=%d) of incompatible type for this layer (layer "
+                "type %d)\n",
+                (GIntBig)nFID, psInfo->nTileId, layer->type);
+      msFreeShape(shape);
+      shape->type = MS_SHAPE_NULL;
+      continue;
+    }
+
+    // Attributes
+    if (layer->numitems > 0) {
+      shape->values =
+          (char **)msSmallMalloc(sizeof(char *) * layer->numitems);
+      shape->numvalues = layer->numitems;
+      for (int i = 0; i < layer->numitems; i++) {
+        const int nColumn = psInfo->pasArrowItems[i].nColumn;
+        if (nColumn < 0)
+          shape->values[i] = msStrdup(CPLSPrintf(CPL_FRMT_GIB, (GIntBig)nFID));
+        else
+          shape->values[i] = msOGRArrowGetValue(
+              psSchema->children[nColumn], psBatch->children[nColumn], nIdx,
+              &psInfo->pasArrowItems[i]);
+      }
+    }
+
+    shape->index = (int)nFID;
+    shape->resultindex = psInfo->last_record_index_read;
+    shape->tileindex = psInfo->nTileId;
+
+    if (layer->debug >= MS_DEBUGLEVEL_VVV)
+      msDebug("msOGRFileNextShape: Returning shape=%ld, tile=%d\n",
+              shape->index, shape->tileindex);
+    return MS_SUCCESS;
+  }
+}
+
+#endif /* MSOGR_USE_ARROW_STREAM */
+
+/**********************************************************************
+ *                     msOGRWkbGeometryToShape()
+ *
+ * Decode a WKB geometry the way the record batches are read, for the
+ * unit tests. Returns MS_FAILURE if the geometry would be converted
+ * through an OGRGeometry instead.
+ **********************************************************************/
+int msOGRWkbGeometryToShape(const unsigned char *pabyWkb, size_t nSize,
+                            shapeObj *psShape, int nLayerType) {
+#ifdef MSOGR_USE_ARROW_STREAM
+  if (msOGRWkbToShape(pabyWkb, nSize, psShape, (enum MS_LAYER_TYPE)nLayerType))
+    return MS_SUCCESS;
+  msSetError(MS_OGRERR, "WKB geometry not handled by the decoder.",
+             "msOGRWkbGeometryToShape()");
+#else
+  (void)pabyWkb;
+  (void)nSize;
+  (void)psShape;
+  (void)nLayerType;
+  msSetError(MS_OGRERR, "WKB decoding requires GDAL 3.6 or later.",
+             "msOGRWkbGeometryToShape()");
+#endif
+  return MS_FAILURE;
+}
+
 /**********************************************************************
  *                     msOGRFileNextShape()
  *
@@ -2787,6 +3585,15 @@ static int msOGRFileNextShape(layerObj *layer, shapeObj *shape,
   shape->type = MS_SHAPE_NULL;
 
   ACQUIRE_OGR_LOCK;
+#ifdef MSOGR_USE_ARROW_STREAM
+  if (psInfo->nArrowState == 0)
+    msOGRFileStartArrowStream(layer, psInfo);
+  if (psInfo->nArrowState > 0) {
+    const int nStatus = msOGRFileNextShapeArrow(layer, shape, psInfo);
+    RELEASE_OGR_LOCK;
+    return nStatus;
+  }
+#endif
   while (shape->type == MS_SHAPE_NULL) {
     if (hFeature)
       OGR_F_Destroy(hFeature);
@@ -2910,6 +3717,14 @@ static int msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
   /* -------------------------------------------------------------------- */
   else {
     ACQUIRE_OGR_LOCK;
+#ifdef MSOGR_USE_ARROW_STREAM
+    if (psInfo->nArrowState > 0) {
+      // the stream moved the read position, start again from the beginning
+      msOGRFileReleaseArrowStream(psInfo);
+      psInfo->nArrowState = -1;
+      psInfo->last_record_index_read = -1;
+    }
+#endif
     if (record <= psInfo->last_record_index_read ||
         psInfo->last_record_index_read == -1) {
       OGR_L_ResetReading(psInfo->hLayer);
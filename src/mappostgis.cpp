@@ -52,6 +52,18 @@
 ** msPostGISNextShape reads a row, increments layerinfo->rownum, and returns
 ** MS_SUCCESS, until rownum reaches ntuples, and it returns MS_DONE instead.
 **
+** With PROCESSING "STREAMING=ON", non-query requests are sent with
+** PQsendQueryParams and read in single row (or, with libpq 17+, chunked)
+** mode: layerinfo->pgresult then only holds the current batch, starting at
+** row layerinfo->rowoffset, and msPostGISNextShape fetches the following
+** batch once it is exhausted.
+**
+** Layers on the same CONNECTION share the pooled PGconn, which can only run
+** one query at a time: the layer streaming on it is recorded as the instance
+** data of an event procedure, and its remaining rows are buffered before
+** another layer uses the connection. That layer then falls back to the
+** buffered query itself.
+**
 */
 
 /* required for MSVC */
@@ -64,6 +76,9 @@
 #include "maptime.h"
 #include "mappostgis.h"
 #include "mapows.h"
+#ifdef USE_POSTGIS
+#include "libpq-events.h"
+#endif
 
 #include <vector>
 
@@ -151,11 +166,178 @@ static msPostGISLayerInfo *msPostGISCreateLayerInfo(void) {
   return layerinfo;
 }
 
+/*
+** msPostGISStreamEventProc()
+**
+** No-op event procedure of the connections, only registered to attach the
+** layer streaming on it as instance data.
+*/
+static int msPostGISStreamEventProc(PGEventId evtId, void *evtInfo,
+                                    void *passThrough) {
+  (void)evtId;
+  (void)evtInfo;
+  (void)passThrough;
+  return 1;
+}
+
+static msPostGISLayerInfo *msPostGISGetStreamOwner(PGconn *pgconn) {
+  return (msPostGISLayerInfo *)PQinstanceData(pgconn,
+                                              msPostGISStreamEventProc);
+}
+
+static void msPostGISSetStreamOwner(PGconn *pgconn,
+                                    msPostGISLayerInfo *layerinfo) {
+  /* fails harmlessly once the procedure is registered on the connection */
+  PQregisterEventProc(pgconn, msPostGISStreamEventProc, "mapserver",
+                      nullptr);
+  PQsetInstanceData(pgconn, msPostGISStreamEventProc, layerinfo);
+}
+
+static void msPostGISEndStream(msPostGISLayerInfo *layerinfo) {
+  layerinfo->streaming = MS_FALSE;
+  if (msPostGISGetStreamOwner(layerinfo->pgconn) == layerinfo)
+    PQsetInstanceData(layerinfo->pgconn, msPostGISStreamEventProc, nullptr);
+}
+
+/*
+** msPostGISDrainStream()
+**
+** Abandon the rows of a streamed query that have not been read yet, so that
+** the connection can be used for the next query.
+*/
+static void msPostGISDrainStream(msPostGISLayerInfo *layerinfo) {
+  if (!layerinfo->streaming)
+    return;
+
+  PGcancel *cancel = PQgetCancel(layerinfo->pgconn);
+  if (cancel) {
+    char errbuf[256];
+    PQcancel(cancel, errbuf, sizeof(errbuf));
+    PQfreeCancel(cancel);
+  }
+
+  PGresult *pgresult;
+  while ((pgresult = PQgetResult(layerinfo->pgconn)) != nullptr)
+    PQclear(pgresult);
+  msPostGISEndStream(layerinfo);
+}
+
+/*
+** msPostGISBufferStream()
+**
+** Receive all the remaining rows of a streamed query into layerinfo->pgresult,
+** which the layer then reads as a buffered result set.
+*/
+static void msPostGISBufferStream(msPostGISLayerInfo *layerinfo) {
+  PGresult *rows = nullptr;
+  if (layerinfo->pgresult) {
+    rows = PQcopyResult(layerinfo->pgresult,
+                        PG_COPYRES_ATTRS | PG_COPYRES_TUPLES);
+    PQclear(layerinfo->pgresult);
+    layerinfo->pgresult = nullptr;
+  }
+
+  PGresult *pgresult;
+  while ((pgresult = PQgetResult(layerinfo->pgconn)) != nullptr) {
+    const ExecStatusType status = PQresultStatus(pgresult);
+    if (status == PGRES_SINGLE_TUPLE
+#ifdef LIBPQ_HAS_CHUNK_MODE
+        || status == PGRES_TUPLES_CHUNK
+#endif
+    ) {
+      if (!rows) {
+        rows = PQcopyResult(pgresult, PG_COPYRES_ATTRS | PG_COPYRES_TUPLES);
+      } else {
+        const int nrows = PQntuples(rows);
+        for (int i = 0; i < PQntuples(pgresult); i++) {
+          for (int j = 0; j < PQnfields(pgresult); j++) {
+            PQsetvalue(rows, nrows + i, j, PQgetvalue(pgresult, i, j),
+                       PQgetisnull(pgresult, i, j)
+                           ? -1
+                           : PQgetlength(pgresult, i, j));
+          }
+        }
+      }
+    } else if (status != PGRES_TUPLES_OK) {
+      msDebug("msPostGISBufferStream(): Error (%s) executing query: %s\n",
+              PQerrorMessage(layerinfo->pgconn), layerinfo->sql.c_str());
+      msSetError(MS_QUERYERR, "Error executing query. Check server logs",
+                 "msPostGISBufferStream()");
+    }
+    PQclear(pgresult);
+  }
+  layerinfo->pgresult = rows;
+  msPostGISEndStream(layerinfo);
+}
+
+/*
+** msPostGISClaimConnection()
+**
+** Make the connection of the layer available for a new query: abandon the
+** stream of the layer itself, and buffer the one of another layer sharing the
+** pooled connection. Returns MS_FALSE in the latter case.
+*/
+static int msPostGISClaimConnection(msPostGISLayerInfo *layerinfo) {
+  msPostGISDrainStream(layerinfo);
+
+  msPostGISLayerInfo *owner = msPostGISGetStreamOwner(layerinfo->pgconn);
+  if (owner == nullptr)
+    return MS_TRUE;
+  msPostGISBufferStream(owner);
+  return MS_FALSE;
+}
+
+/*
+** msPostGISFetchNextBatch()
+**
+** Replace layerinfo->pgresult by the next batch of rows of a streamed query.
+** Returns MS_DONE once all rows have been received.
+*/
+static int msPostGISFetchNextBatch(layerObj *layer) {
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
+
+  if (layerinfo->pgresult) {
+    layerinfo->rowoffset += PQntuples(layerinfo->pgresult);
+    PQclear(layerinfo->pgresult);
+    layerinfo->pgresult = nullptr;
+  }
+  if (!layerinfo->streaming)
+    return MS_DONE;
+
+  PGresult *pgresult = PQgetResult(layerinfo->pgconn);
+  if (!pgresult) {
+    msPostGISEndStream(layerinfo);
+    return MS_DONE;
+  }
+
+  const ExecStatusType status = PQresultStatus(pgresult);
+  if (status == PGRES_SINGLE_TUPLE
+#ifdef LIBPQ_HAS_CHUNK_MODE
+      || status == PGRES_TUPLES_CHUNK
+#endif
+  ) {
+    layerinfo->pgresult = pgresult;
+    return MS_SUCCESS;
+  }
+
+  /* PGRES_TUPLES_OK marks the end of the rows, anything else is an error */
+  if (status != PGRES_TUPLES_OK) {
+    msDebug("msPostGISFetchNextBatch(): Error (%s) executing query: %s\n",
+            PQerrorMessage(layerinfo->pgconn), layerinfo->sql.c_str());
+    msSetError(MS_QUERYERR, "Error executing query. Check server logs",
+               "msPostGISFetchNextBatch()");
+  }
+  PQclear(pgresult);
+  msPostGISDrainStream(layerinfo);
+  return (status == PGRES_TUPLES_OK) ? MS_DONE : MS_FAILURE;
+}
+
 /*
 ** msPostGISFreeLayerInfo()
 */
 static void msPostGISFreeLayerInfo(layerObj *layer) {
   msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
+  msPostGISDrainStream(layerinfo);
   if (layerinfo->pgresult)
     PQclear(layerinfo->pgresult);
   if (layerinfo->pgconn)
@@ -1204,6 +1386,10 @@ static int msPostGISParseData(layerObj *layer) {
     msDebug("msPostGISParseData called.\n");
   }
 
+  /* Every query path comes through here: free the connection first. */
+  if (!msPostGISClaimConnection(layerinfo))
+    layerinfo->shared_stream = MS_TRUE;
+
   if (!layer->data) {
     msSetError(
         MS_QUERYERR,
@@ -2158,12 +2344,12 @@ static int msPostGISReadShape(layerObj *layer, shapeObj *shape) {
 
   assert(layer->layerinfo != nullptr);
   msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
+  const int row = (int)(layerinfo->rownum - layerinfo->rowoffset);
 
   /* Retrieve the geometry. */
-  const char *wkbstr =
-      PQgetvalue(layerinfo->pgresult, layerinfo->rownum, layer->numitems);
+  const char *wkbstr = PQgetvalue(layerinfo->pgresult, row, layer->numitems);
   const int wkbstrlen =
-      PQgetlength(layerinfo->pgresult, layerinfo->rownum, layer->numitems);
+      PQgetlength(layerinfo->pgresult, row, layer->numitems);
 
   if (!wkbstr) {
     msSetError(MS_QUERYERR, "WKB returned is null!", "msPostGISReadShape()");
@@ -2270,9 +2456,9 @@ static int msPostGISReadShape(layerObj *layer, shapeObj *shape) {
 
     shape->values = (char **)msSmallMalloc(sizeof(char *) * layer->numitems);
     for (int t = 0; t < layer->numitems; t++) {
-      const int size = PQgetlength(layerinfo->pgresult, layerinfo->rownum, t);
-      const char *val = PQgetvalue(layerinfo->pgresult, layerinfo->rownum, t);
-      const int isnull = PQgetisnull(layerinfo->pgresult, layerinfo->rownum, t);
+      const int size = PQgetlength(layerinfo->pgresult, row, t);
+      const char *val = PQgetvalue(layerinfo->pgresult, row, t);
+      const int isnull = PQgetisnull(layerinfo->pgresult, row, t);
       if (isnull) {
         shape->values[t] = msStrdup("");
       } else {
@@ -2297,7 +2483,7 @@ static int msPostGISReadShape(layerObj *layer, shapeObj *shape) {
 
     /* layer->numitems is the geometry, layer->numitems+1 is the uid */
     const char *tmp =
-        PQgetvalue(layerinfo->pgresult, layerinfo->rownum, layer->numitems + 1);
+        PQgetvalue(layerinfo->pgresult, row, layer->numitems + 1);
     long uid = 0;
     if (tmp) {
       uid = strtol(tmp, nullptr, 10);
@@ -2456,6 +2642,9 @@ static int msPostGISLayerOpen(layerObj *layer) {
     }
   }
 
+  if (!msPostGISClaimConnection(layerinfo))
+    layerinfo->shared_stream = MS_TRUE;
+
   /* Get the PostGIS version number from the database */
   layerinfo->version = msPostGISRetrieveVersion(layerinfo->pgconn);
   if (layerinfo->version == MS_FAILURE) {
@@ -2477,6 +2666,16 @@ static int msPostGISLayerOpen(layerObj *layer) {
     msDebug("msPostGISLayerOpen: Forcing 2D geometries: %s.\n",
             (layerinfo->force2d) ? "yes" : "no");
 
+  const char *streaming_processing =
+      msLayerGetProcessingKey(layer, "STREAMING");
+  if (streaming_processing && !strcasecmp(streaming_processing, "on")) {
+    const char *batch_size =
+        msLayerGetProcessingKey(layer, "STREAMING_BATCH_SIZE");
+    layerinfo->stream_batch_size = batch_size ? atoi(batch_size) : 1000;
+    if (layerinfo->stream_batch_size <= 0)
+      layerinfo->stream_batch_size = 1;
+  }
+
   /* Save the layerinfo in the layerObj. */
   layer->layerinfo = (void *)layerinfo;
 
@@ -2672,6 +2871,48 @@ static int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect,
     msDebug("msPostGISLayerWhichShapes query: %s\n", strSQL.c_str());
   }
 
+  /*
+  ** Queries need random access to the result set (msPostGISLayerGetShape),
+  ** drawing only reads it forward so the rows can be streamed.
+  */
+  if (layerinfo->stream_batch_size > 0 && !isQuery &&
+      !layerinfo->shared_stream) {
+    const auto layer_bind_values = buildBindValues(layer);
+    if (!PQsendQueryParams(layerinfo->pgconn, strSQL.c_str(),
+                           static_cast<int>(layer_bind_values.size()), nullptr,
+                           layer_bind_values.empty()
+                               ? nullptr
+                               : layer_bind_values.data(),
+                           nullptr, nullptr, RESULTSET_TYPE)) {
+      msDebug("msPostGISLayerWhichShapes(): Error (%s) sending query: %s\n",
+              PQerrorMessage(layerinfo->pgconn), strSQL.c_str());
+      msSetError(MS_QUERYERR, "Error executing query. Check server logs",
+                 "msPostGISLayerWhichShapes()");
+      return MS_FAILURE;
+    }
+#ifdef LIBPQ_HAS_CHUNK_MODE
+    PQsetChunkedRowsMode(layerinfo->pgconn, layerinfo->stream_batch_size);
+#else
+    PQsetSingleRowMode(layerinfo->pgconn);
+#endif
+    if (layerinfo->pgresult)
+      PQclear(layerinfo->pgresult);
+    layerinfo->pgresult = nullptr;
+    layerinfo->sql = strSQL;
+    layerinfo->streaming = MS_TRUE;
+    msPostGISSetStreamOwner(layerinfo->pgconn, layerinfo);
+    layerinfo->rownum = 0;
+    layerinfo->rowoffset = 0;
+
+    if (layer->debug) {
+      msDebug("msPostGISLayerWhichShapes streaming results.\n");
+    }
+
+    /* Wait for the first batch so that SQL errors are reported here. */
+    return (msPostGISFetchNextBatch(layer) == MS_FAILURE) ? MS_FAILURE
+                                                           : MS_SUCCESS;
+  }
+
   PGresult *pgresult = runPQexecParamsWithBindSubstitution(
       layer, strSQL.c_str(), RESULTSET_TYPE);
 
@@ -2705,6 +2946,7 @@ static int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect,
   layerinfo->sql = strSQL;
 
   layerinfo->rownum = 0;
+  layerinfo->rowoffset = 0;
 
   return MS_SUCCESS;
 #else
@@ -2736,7 +2978,15 @@ static int msPostGISLayerNextShape(layerObj *layer, shapeObj *shape) {
   ** Roll through pgresult until we hit non-null shape (usually right away).
   */
   while (shape->type == MS_SHAPE_NULL) {
-    if (layerinfo->rownum < PQntuples(layerinfo->pgresult)) {
+    if (layerinfo->rownum - layerinfo->rowoffset ==
+            PQntuples(layerinfo->pgresult) &&
+        layerinfo->streaming) {
+      const int status = msPostGISFetchNextBatch(layer);
+      if (status != MS_SUCCESS)
+        return status;
+    }
+    if (layerinfo->rownum - layerinfo->rowoffset <
+        PQntuples(layerinfo->pgresult)) {
       /* Retrieve this shape, cursor access mode. */
       msPostGISReadShape(layer, shape);
       if (shape->type != MS_SHAPE_NULL) {
@@ -2923,6 +3173,7 @@ static int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape,
     }
 
     layerinfo->rownum = resultindex; /* Only return one result. */
+    layerinfo->rowoffset = 0;
 
     /* We don't know the shape type until we read the geometry. */
     shape->type = MS_SHAPE_NULL;
@@ -2983,6 +3234,7 @@ static int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape,
     layerinfo->sql = strSQL;
 
     layerinfo->rownum = 0; /* Only return one result. */
+    layerinfo->rowoffset = 0;
 
     /* We don't know the shape type until we read the geometry. */
     shape->type = MS_SHAPE_NULL;
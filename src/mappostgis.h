@@ -69,6 +69,12 @@ struct msPostGISLayerInfo {
   int version = 0;          /* PostGIS version of the database */
   int paging = 0;  /* Driver handling of pagination, enabled by default */
   int force2d = 0; /* Pass geometry through ST_Force2D */
+  int stream_batch_size = 0; /* Rows per batch when streaming draw queries,
+                                0 => buffer the whole result set */
+  int streaming = 0; /* Rows of the last query are still being received */
+  int shared_stream = 0; /* Another layer streamed on the pooled connection,
+                            draw queries are buffered */
+  long rowoffset = 0; /* Number of rows read before those in pgresult */
 };
 
 /*
@@ -105,6 +105,7 @@ void msInitShape(shapeObj *shape) {
   shape->tileindex = shape->index = shape->resultindex = -1;
 
   shape->scratch = MS_FALSE; /* not a temporary/scratch shape */
+  shape->arena = NULL;
 }
 
 int msCopyShape(const shapeObj *from, shapeObj *to) {
@@ -133,7 +134,7 @@ int msCopyShape(const shapeObj *from, shapeObj *to) {
 
   if (from->values) {
     if (to->values)
-      msFreeCharArray(to->values, to->numvalues);
+      msShapeFreeValues(to);
     to->values = (char **)msSmallMalloc(sizeof(char *) * from->numvalues);
     for (i = 0; i < from->numvalues; i++)
       to->values[i] = msStrdup(from->values[i]);
@@ -153,12 +154,12 @@ void msFreeShape(shapeObj *shape) {
     return; /* for safety */
 
   for (c = 0; c < shape->numlines; c++)
-    free(shape->line[c].point);
+    msShapeFreeMemory(shape, shape->line[c].point);
 
   if (shape->line)
-    free(shape->line);
+    msShapeFreeMemory(shape, shape->line);
   if (shape->values)
-    msFreeCharArray(shape->values, shape->numvalues);
+    msShapeFreeValues(shape);
   if (shape->text)
     free(shape->text);
 
@@ -169,6 +170,49 @@ void msFreeShape(shapeObj *shape) {
   msInitShape(shape); /* now reset */
 }
 
+/*
+** The parts of a shape (line and point arrays, values) may live in the
+** arena of the layer that read it, see maparena.c. These functions must be
+** used instead of malloc(), free() and realloc() for them.
+*/
+void *msShapeAllocMemory(shapeObj *shape, size_t size) {
+  if (shape->arena)
+    return msArenaAlloc(shape->arena, size);
+  return malloc(size);
+}
+
+void msShapeFreeMemory(shapeObj *shape, void *ptr) {
+  if (shape->arena && msArenaOwns(shape->arena, ptr))
+    return;
+  free(ptr);
+}
+
+/* Memory moved out of the arena ends up on the heap */
+void *msShapeReallocMemory(shapeObj *shape, void *ptr, size_t oldsize,
+                           size_t newsize) {
+  if (shape->arena && msArenaOwns(shape->arena, ptr)) {
+    void *newptr = malloc(newsize);
+    if (newptr)
+      memcpy(newptr, ptr, MS_MIN(oldsize, newsize));
+    return newptr;
+  }
+  return realloc(ptr, newsize);
+}
+
+void msShapeFreeValues(shapeObj *shape) {
+  int i;
+
+  if (!shape->arena) {
+    msFreeCharArray(shape->values, shape->numvalues);
+  } else if (shape->values) {
+    for (i = 0; i < shape->numvalues; i++)
+      msShapeFreeMemory(shape, shape->values[i]);
+    msShapeFreeMemory(shape, shape->values);
+  }
+  shape->values = NULL;
+  shape->numvalues = 0;
+}
+
 int msGetShapeRAMSize(shapeObj *shape) {
   int i;
   int size = 0;
@@ -200,7 +244,7 @@ void msShapeDeleteLine(shapeObj *shape, int line) {
     return;
   }
 
-  free(shape->line[line].point);
+  msShapeFreeMemory(shape, shape->line[line].point);
   if (line < shape->numlines - 1) {
     memmove(shape->line + line, shape->line + line + 1,
             sizeof(lineObj) * (shape->numlines - line - 1));
@@ -382,10 +426,11 @@ int msAddLineDirectly(shapeObj *p, lineObj *new_line) {
   if (p->numlines == 0) {
     p->line = (lineObj *)malloc(sizeof(lineObj));
   } else {
-    lineObj *newline =
-        (lineObj *)realloc(p->line, (p->numlines + 1) * sizeof(lineObj));
+    lineObj *newline = (lineObj *)msShapeReallocMemory(
+        p, p->line, p->numlines * sizeof(lineObj),
+        (p->numlines + 1) * sizeof(lineObj));
     if (!newline) {
-      free(p->line);
+      msShapeFreeMemory(p, p->line);
     }
     p->line = newline;
   }
@@ -598,8 +643,8 @@ void msClipPolylineRect(shapeObj *shape, rectObj rect) {
   }
 
   for (i = 0; i < shape->numlines; i++)
-    free(shape->line[i].point);
-  free(shape->line);
+    msShapeFreeMemory(shape, shape->line[i].point);
+  msShapeFreeMemory(shape, shape->line);
 
   shape->line = tmp.line;
   shape->numlines = tmp.numlines;
@@ -752,8 +797,8 @@ void msClipPolygonRect(shapeObj *shape, rectObj rect) {
   } /* next line */
 
   for (i = 0; i < shape->numlines; i++)
-    free(shape->line[i].point);
-  free(shape->line);
+    msShapeFreeMemory(shape, shape->line[i].point);
+  msShapeFreeMemory(shape, shape->line);
 
   shape->line = tmp.line;
   shape->numlines = tmp.numlines;
@@ -999,7 +1044,7 @@ void msTransformShapeSimplify(shapeObj *shape, rectObj extent,
   }
   if (!ok) {
     for (i = 0; i < shape->numlines; i++) {
-      free(shape->line[i].point);
+      msShapeFreeMemory(shape, shape->line[i].point);
     }
     shape->numlines = 0;
   }
@@ -76,6 +76,10 @@ typedef struct {
 #endif
 } lineObj;
 
+#ifndef SWIG
+typedef struct msArenaObj msArenaObj;
+#endif
+
 /**
 Each feature of a layer's data is a :class:`shapeObj`. Each part of the shape is
 a closed :class:`lineObj`.
@@ -87,6 +91,7 @@ typedef struct {
   char **values;
   void *geometry;
   void *renderer_cache;
+  msArenaObj *arena; /* where line, point and values may live, see maparena.c */
 #endif
 
 #ifdef SWIG
@@ -413,6 +413,13 @@ reprojectionObj *msProjectCreateReprojector(projectionObj *in,
       return NULL;
     }
     obj->pj = pj;
+
+    if (in->wellknownprojection == wkp_lonlat &&
+        out->wellknownprojection == wkp_gmerc)
+      obj->fastPath = FAST_PATH_LONLAT_TO_GMERC;
+    else if (in->wellknownprojection == wkp_gmerc &&
+             out->wellknownprojection == wkp_lonlat)
+      obj->fastPath = FAST_PATH_GMERC_TO_LONLAT;
   }
 
   /* nothing to do if the other coordinate system is also lat/long */
@@ -470,6 +477,7 @@ void msProjectDestroyReprojector(reprojectionObj *reprojector) {
     return;
   if (reprojector->bFreePJ)
     proj_destroy(reprojector->pj);
+  msProjectFreeApproxGrid(reprojector);
   msFreeShape(&(reprojector->splitShape));
   msFree(reprojector);
 }
@@ -689,10 +697,46 @@ static int _msProcessAutoProjection(projectionObj *p) {
   return (0);
 }
 
+/************************************************************************/
+/*                      msProjectionGetWellKnown()                      */
+/*                                                                      */
+/*      Recognize EPSG:4326 and EPSG:3857, for which reprojection can   */
+/*      be done analytically, without going through PROJ.              */
+/************************************************************************/
+static int msProjectionGetWellKnown(const projectionObj *p) {
+  const char *code;
+  int i;
+
+  if (p->numargs < 1)
+    return wkp_none;
+
+  /* extra arguments are only allowed if they don't change the CRS */
+  for (i = 1; i < p->numargs; i++) {
+    if (strstr(p->args[i], "epsgaxis=") == NULL)
+      return wkp_none;
+  }
+
+  code = p->args[0];
+  if (*code == '+')
+    code++;
+  if (strncasecmp(code, "init=", 5) == 0)
+    code += 5;
+  if (strncasecmp(code, "epsg:", 5) != 0)
+    return wkp_none;
+  code += 5;
+
+  if (strcmp(code, "4326") == 0)
+    return wkp_lonlat;
+  if (strcmp(code, "3857") == 0)
+    return wkp_gmerc;
+  return wkp_none;
+}
+
 int msProcessProjection(projectionObj *p) {
   assert(p->proj == NULL);
 
   p->generation_number++;
+  p->wellknownprojection = wkp_none;
 
   if (strcasecmp(p->args[0], "GEOGRAPHIC") == 0) {
     msSetError(MS_PROJERR,
@@ -806,15 +850,7 @@ int msProcessProjection(projectionObj *p) {
     free(args);
   }
 
-#ifdef USE_PROJ_FASTPATHS
-  if (strcasestr(p->args[0], "epsg:4326")) {
-    p->wellknownprojection = wkp_lonlat;
-  } else if (strcasestr(p->args[0], "epsg:3857")) {
-    p->wellknownprojection = wkp_gmerc;
-  } else {
-    p->wellknownprojection = wkp_none;
-  }
-#endif
+  p->wellknownprojection = msProjectionGetWellKnown(p);
 
   return (0);
 }
@@ -851,6 +887,54 @@ int msProjectPoint(projectionObj *in, projectionObj *out, pointObj *point) {
   return ret;
 }
 
+/************************************************************************/
+/*                        msApplyGeotransform()                         */
+/************************************************************************/
+static void msApplyGeotransform(const double *gt, pointObj *point) {
+  const double x_out = gt[0] + gt[1] * point->x + gt[2] * point->y;
+  const double y_out = gt[3] + gt[4] * point->x + gt[5] * point->y;
+
+  point->x = x_out;
+  point->y = y_out;
+}
+
+/************************************************************************/
+/*                        msProjectWebMercator()                        */
+/*                                                                      */
+/*      Analytic EPSG:4326 <-> EPSG:3857 transformation. It follows     */
+/*      what PROJ does for this pair (spherical mercator on the WGS84   */
+/*      semi-major axis, longitudes wrapped to [-180,180], failure at   */
+/*      the poles) so that results don't depend on the code path.       */
+/************************************************************************/
+#define MS_WEBMERC_RADIUS 6378137.0
+
+static double msAdjustLongitude(double lam) {
+  if (fabs(lam) < MS_PI + 1e-12)
+    return lam;
+  lam += MS_PI;
+  lam -= 2 * MS_PI * floor(lam / (2 * MS_PI));
+  return lam - MS_PI;
+}
+
+static int msProjectWebMercator(msProjectionFastPath fastPath, pointObj *point) {
+  if (fastPath == FAST_PATH_LONLAT_TO_GMERC) {
+    const double lam = point->x * MS_DEG_TO_RAD;
+    const double phi = point->y * MS_DEG_TO_RAD;
+    if (!(fabs(phi) < MS_PI2 - 1e-10) || !isfinite(lam))
+      return MS_FAILURE;
+    point->x = MS_WEBMERC_RADIUS * msAdjustLongitude(lam);
+    point->y = MS_WEBMERC_RADIUS * asinh(tan(phi));
+  } else {
+    const double x = point->x * (1.0 / MS_WEBMERC_RADIUS);
+    const double y = point->y * (1.0 / MS_WEBMERC_RADIUS);
+    if (!isfinite(x) || !isfinite(y))
+      return MS_FAILURE;
+    point->x = msAdjustLongitude(x) / MS_DEG_TO_RAD;
+    point->y = atan(sinh(y)) / MS_DEG_TO_RAD;
+  }
+  return MS_SUCCESS;
+}
+
 /************************************************************************/
 /*                           msProjectPointEx()                         */
 /************************************************************************/
@@ -858,19 +942,13 @@ int msProjectPointEx(reprojectionObj *reprojector, pointObj *point) {
   projectionObj *in = reprojector->in;
   projectionObj *out = reprojector->out;
 
-  if (in && in->gt.need_geotransform) {
-    double x_out, y_out;
-
-    x_out = in->gt.geotransform[0] + in->gt.geotransform[1] * point->x +
-            in->gt.geotransform[2] * point->y;
-    y_out = in->gt.geotransform[3] + in->gt.geotransform[4] * point->x +
-            in->gt.geotransform[5] * point->y;
+  if (in && in->gt.need_geotransform)
+    msApplyGeotransform(in->gt.geotransform, point);
 
-    point->x = x_out;
-    point->y = y_out;
-  }
-
-  if (reprojector->pj) {
+  if (reprojector->fastPath != FAST_PATH_NONE) {
+    if (msProjectWebMercator(reprojector->fastPath, point) != MS_SUCCESS)
+      return MS_FAILURE;
+  } else if (reprojector->pj) {
     PJ_COORD c;
     c.xyzt.x = point->x;
     c.xyzt.y = point->y;
@@ -884,19 +962,301 @@ int msProjectPointEx(reprojectionObj *reprojector, pointObj *point) {
     point->y = c.xyzt.y;
   }
 
-  if (out && out->gt.need_geotransform) {
-    double x_out, y_out;
+  if (out && out->gt.need_geotransform)
+    msApplyGeotransform(out->gt.invgeotransform, point);
+
+  return (MS_SUCCESS);
+}
+
+/************************************************************************/
+/*                        msProjectPointsExact()                        */
+/************************************************************************/
+#define PROJECT_POINTS_STACK_SIZE 64
+
+static int msProjectPointsExact(reprojectionObj *reprojector, int npoints,
+                                pointObj *points, int *status) {
+  projectionObj *in = reprojector->in;
+  projectionObj *out = reprojector->out;
+  double xy_stack[2 * PROJECT_POINTS_STACK_SIZE];
+  double *x = NULL, *y = NULL;
+  int i, ret = MS_SUCCESS;
+
+  if (npoints <= 0)
+    return MS_SUCCESS;
+
+  if (in && in->gt.need_geotransform) {
+    for (i = 0; i < npoints; i++)
+      msApplyGeotransform(in->gt.geotransform, points + i);
+  }
+
+  if (reprojector->fastPath == FAST_PATH_NONE && reprojector->pj) {
+    /* z and t are constants (arrays of length 1) for PROJ, like in
+     * msProjectPointEx() */
+    double z = 0, t = 0;
+
+    if (npoints <= PROJECT_POINTS_STACK_SIZE)
+      x = xy_stack;
+    else
+      x = (double *)msSmallMalloc(sizeof(double) * 2 * npoints);
+    y = x + npoints;
+    for (i = 0; i < npoints; i++) {
+      x[i] = points[i].x;
+      y[i] = points[i].y;
+    }
+    proj_trans_generic(reprojector->pj, PJ_FWD, x, sizeof(double), npoints, y,
+                       sizeof(double), npoints, &z, 0, 1, &t, 0, 1);
+  }
 
-    x_out = out->gt.invgeotransform[0] + out->gt.invgeotransform[1] * point->x +
-            out->gt.invgeotransform[2] * point->y;
-    y_out = out->gt.invgeotransform[3] + out->gt.invgeotransform[4] * point->x +
-            out->gt.invgeotransform[5] * point->y;
+  for (i = 0; i < npoints; i++) {
+    int point_status = MS_SUCCESS;
+
+    if (reprojector->fastPath != FAST_PATH_NONE) {
+      point_status = msProjectWebMercator(reprojector->fastPath, points + i);
+    } else if (x) {
+      if (x[i] == HUGE_VAL || y[i] == HUGE_VAL) {
+        point_status = MS_FAILURE;
+      } else {
+        points[i].x = x[i];
+        points[i].y = y[i];
+      }
+    }
 
-    point->x = x_out;
-    point->y = y_out;
+    if (point_status == MS_SUCCESS && out && out->gt.need_geotransform)
+      msApplyGeotransform(out->gt.invgeotransform, points + i);
+
+    if (point_status != MS_SUCCESS)
+      ret = MS_FAILURE;
+    if (status)
+      status[i] = point_status;
   }
 
-  return (MS_SUCCESS);
+  if (x != xy_stack)
+    msFree(x);
+
+  return ret;
+}
+
+/************************************************************************/
+/*                         Approximate reprojection                     */
+/*                                                                      */
+/*      A grid of exactly reprojected nodes over an extent of the       */
+/*      source coordinates, which is bilinearly interpolated for the    */
+/*      points that fall inside it. The grid is refined until the       */
+/*      interpolation error, checked at the cell centers and at the     */
+/*      middle of the cell edges, is below the tolerance. The points of */
+/*      the cells where it is not, or where a node fails to reproject,  */
+/*      are reprojected exactly.                                        */
+/************************************************************************/
+#define APPROX_GRID_MIN_SIZE 4
+#define APPROX_GRID_MAX_SIZE 64
+
+struct msApproxGridObj {
+  rectObj extent;  /* in source coordinates */
+  int size;        /* number of cells along each axis */
+  double dx, dy;   /* size of a cell */
+  pointObj *nodes; /* (size+1)*(size+1) reprojected nodes, row by row */
+  char *exact;     /* size*size flags, cells that must be reprojected exactly */
+};
+
+static int msApproxGridInterpolate(const msApproxGridObj *grid,
+                                   pointObj *point) {
+  const double fx = (point->x - grid->extent.minx) / grid->dx;
+  const double fy = (point->y - grid->extent.miny) / grid->dy;
+  const pointObj *n00, *n10, *n01, *n11;
+  double u, v;
+  int i, j;
+
+  if (!(fx >= 0 && fx <= grid->size && fy >= 0 && fy <= grid->size))
+    return MS_FAILURE;
+  i = MS_MIN((int)fx, grid->size - 1);
+  j = MS_MIN((int)fy, grid->size - 1);
+  if (grid->exact[j * grid->size + i])
+    return MS_FAILURE;
+
+  u = fx - i;
+  v = fy - j;
+  n00 = grid->nodes + j * (grid->size + 1) + i;
+  n10 = n00 + 1;
+  n01 = n00 + grid->size + 1;
+  n11 = n01 + 1;
+  point->x = (1 - v) * ((1 - u) * n00->x + u * n10->x) +
+             v * ((1 - u) * n01->x + u * n11->x);
+  point->y = (1 - v) * ((1 - u) * n00->y + u * n10->y) +
+             v * ((1 - u) * n01->y + u * n11->y);
+  return MS_SUCCESS;
+}
+
+/* Largest interpolation error in the cell of fine[] whose lower left node
+ * is c, checked at the middle of the edges and at the center of the cell */
+static double msApproxGridCellError(const pointObj *fine, int c, int width) {
+  const pointObj *n00 = fine + c, *n10 = n00 + 2;
+  const pointObj *n01 = n00 + 2 * width, *n11 = n01 + 2;
+  const pointObj *checked[5] = {n00 + 1, n01 + 1, n00 + width, n10 + width,
+                                n00 + width + 1};
+  const pointObj *corner1[5] = {n00, n01, n00, n10, n00};
+  const pointObj *corner2[5] = {n10, n11, n01, n11, n11};
+  double error = 0;
+  int k;
+
+  for (k = 0; k < 5; k++) {
+    double x = (corner1[k]->x + corner2[k]->x) / 2;
+    double y = (corner1[k]->y + corner2[k]->y) / 2;
+    if (k == 4) { /* the center, interpolated from the 4 corners */
+      x = (n00->x + n10->x + n01->x + n11->x) / 4;
+      y = (n00->y + n10->y + n01->y + n11->y) / 4;
+    }
+    error = MS_MAX(error, hypot(x - checked[k]->x, y - checked[k]->y));
+  }
+  return error;
+}
+
+/************************************************************************/
+/*                       msProjectInitApproxGrid()                      */
+/*                                                                      */
+/*      Build the approximation grid of a reprojector over extent, in   */
+/*      source coordinates, with a maximum error of tolerance, in       */
+/*      destination units. Returns MS_FAILURE if no grid could be       */
+/*      built, in which case points keep being reprojected exactly.     */
+/************************************************************************/
+int msProjectInitApproxGrid(reprojectionObj *reprojector, rectObj extent,
+                            double tolerance) {
+  msApproxGridObj *grid = NULL;
+  pointObj *fine = NULL;
+  int *fine_status = NULL;
+  char *exact = NULL;
+  int size, badcells = 0;
+
+  msProjectFreeApproxGrid(reprojector);
+
+  if (reprojector->pj == NULL || !(tolerance > 0) ||
+      !(extent.maxx > extent.minx) || !(extent.maxy > extent.miny))
+    return MS_FAILURE;
+
+  for (size = APPROX_GRID_MIN_SIZE;; size *= 2) {
+    /* the nodes of a grid twice as fine are the nodes of this grid plus
+     * the points where the interpolation error is checked */
+    const int width = 2 * size + 1;
+    int i, j;
+
+    fine = (pointObj *)msSmallRealloc(fine, sizeof(pointObj) * width * width);
+    fine_status =
+        (int *)msSmallRealloc(fine_status, sizeof(int) * width * width);
+    for (j = 0; j < width; j++) {
+      for (i = 0; i < width; i++) {
+        pointObj *point = fine + j * width + i;
+        point->x = extent.minx + (extent.maxx - extent.minx) * i / (width - 1);
+        point->y = extent.miny + (extent.maxy - extent.miny) * j / (width - 1);
+        point->z = point->m = 0;
+      }
+    }
+    msProjectPointsExact(reprojector, width * width, fine, fine_status);
+
+    exact = (char *)msSmallRealloc(exact, size * size);
+    badcells = 0;
+    for (j = 0; j < size; j++) {
+      for (i = 0; i < size; i++) {
+        const int c = 2 * j * width + 2 * i; /* lower left node of the cell */
+        int k, bad = MS_FALSE;
+
+        for (k = 0; k < 9 && !bad; k++)
+          bad = fine_status[c + (k / 3) * width + k % 3] != MS_SUCCESS;
+        /* half the tolerance, for the error between the checked points */
+        if (!bad)
+          bad = msApproxGridCellError(fine, c, width) > tolerance / 2;
+        exact[j * size + i] = bad;
+        badcells += bad;
+      }
+    }
+
+    if (badcells == 0 || size >= APPROX_GRID_MAX_SIZE)
+      break;
+  }
+
+  if (badcells < size * size) {
+    const int width = 2 * size + 1;
+    int i, j;
+
+    grid = (msApproxGridObj *)msSmallCalloc(1, sizeof(msApproxGridObj));
+    grid->extent = extent;
+    grid->size = size;
+    grid->dx = (extent.maxx - extent.minx) / size;
+    grid->dy = (extent.maxy - extent.miny) / size;
+    grid->exact = exact;
+    exact = NULL;
+    grid->nodes =
+        (pointObj *)msSmallMalloc(sizeof(pointObj) * (size + 1) * (size + 1));
+    for (j = 0; j <= size; j++) {
+      for (i = 0; i <= size; i++)
+        grid->nodes[j * (size + 1) + i] = fine[2 * j * width + 2 * i];
+    }
+  }
+
+  msFree(fine);
+  msFree(fine_status);
+  msFree(exact);
+
+  reprojector->approxGrid = grid;
+  return grid ? MS_SUCCESS : MS_FAILURE;
+}
+
+/************************************************************************/
+/*                       msProjectFreeApproxGrid()                      */
+/************************************************************************/
+void msProjectFreeApproxGrid(reprojectionObj *reprojector) {
+  if (!reprojector || !reprojector->approxGrid)
+    return;
+  msFree(reprojector->approxGrid->nodes);
+  msFree(reprojector->approxGrid->exact);
+  msFree(reprojector->approxGrid);
+  reprojector->approxGrid = NULL;
+}
+
+/************************************************************************/
+/*                          msProjectPointsEx()                         */
+/*                                                                      */
+/*      Same as calling msProjectPointEx() on each point, but all the   */
+/*      points go through PROJ in a single proj_trans_generic() call,   */
+/*      or are interpolated when the reprojector has an approximation   */
+/*      grid. The result of each point is stored in status[] if not     */
+/*      NULL. Returns MS_FAILURE if any of the points failed.           */
+/************************************************************************/
+int msProjectPointsEx(reprojectionObj *reprojector, int npoints,
+                      pointObj *points, int *status) {
+  const msApproxGridObj *grid = reprojector->approxGrid;
+  pointObj *missed;
+  int *missed_index, *missed_status;
+  int i, nmissed = 0, ret = MS_SUCCESS;
+
+  if (grid == NULL || npoints <= 0)
+    return msProjectPointsExact(reprojector, npoints, points, status);
+
+  missed_index = (int *)msSmallMalloc(sizeof(int) * npoints);
+  for (i = 0; i < npoints; i++) {
+    if (msApproxGridInterpolate(grid, points + i) == MS_SUCCESS) {
+      if (status)
+        status[i] = MS_SUCCESS;
+    } else {
+      missed_index[nmissed++] = i;
+    }
+  }
+
+  if (nmissed > 0) {
+    missed = (pointObj *)msSmallMalloc(sizeof(pointObj) * nmissed);
+    missed_status = (int *)msSmallMalloc(sizeof(int) * nmissed);
+    for (i = 0; i < nmissed; i++)
+      missed[i] = points[missed_index[i]];
+    ret = msProjectPointsExact(reprojector, nmissed, missed, missed_status);
+    for (i = 0; i < nmissed; i++) {
+      points[missed_index[i]] = missed[i];
+      if (status)
+        status[missed_index[i]] = missed_status[i];
+    }
+    msFree(missed);
+    msFree(missed_status);
+  }
+  msFree(missed_index);
+
+  return ret;
 }
 
 /************************************************************************/
@@ -1134,10 +1494,14 @@ int msProjectIsReprojectorStillValid(reprojectionObj *reprojector) {
 /*      For polygons, no splitting takes place, but over the horizon    */
 /*      points are clipped, and one segment is run from the fall        */
 /*      over the horizon point to the come back over the horizon point. */
+/*                                                                      */
+/*      projected[] and status[] may hold the line points already       */
+/*      reprojected by msProjectPointsEx(), or be NULL.                 */
 /************************************************************************/
 
 static int msProjectShapeLine(reprojectionObj *reprojector, shapeObj *shape,
-                              int line_index)
+                              int line_index, const pointObj *projected,
+                              const int *status)
 
 {
   int i;
@@ -1148,54 +1512,11 @@ static int msProjectShapeLine(reprojectionObj *reprojector, shapeObj *shape,
   int numpoints_in = line->numpoints;
   int line_alloc = numpoints_in;
   int wrap_test;
+  pointObj *projected_alloc = NULL;
+  int *status_alloc = NULL;
   projectionObj *in = reprojector->in;
   projectionObj *out = reprojector->out;
 
-#ifdef USE_PROJ_FASTPATHS
-#define MAXEXTENT 20037508.34
-#define M_PIby360 .0087266462599716479
-#define MAXEXTENTby180 111319.4907777777777777777
-#define p_x line->point[i].x
-#define p_y line->point[i].y
-  if (in->wellknownprojection == wkp_lonlat &&
-      out->wellknownprojection == wkp_gmerc) {
-    for (i = line->numpoints - 1; i >= 0; i--) {
-      p_x *= MAXEXTENTby180;
-      p_y = log(tan((90 + p_y) * M_PIby360)) * MS_RAD_TO_DEG;
-      p_y *= MAXEXTENTby180;
-      if (p_x > MAXEXTENT)
-        p_x = MAXEXTENT;
-      if (p_x < -MAXEXTENT)
-        p_x = -MAXEXTENT;
-      if (p_y > MAXEXTENT)
-        p_y = MAXEXTENT;
-      if (p_y < -MAXEXTENT)
-        p_y = -MAXEXTENT;
-    }
-    return MS_SUCCESS;
-  }
-  if (in->wellknownprojection == wkp_gmerc &&
-      out->wellknownprojection == wkp_lonlat) {
-    for (i = line->numpoints - 1; i >= 0; i--) {
-      if (p_x > MAXEXTENT)
-        p_x = MAXEXTENT;
-      else if (p_x < -MAXEXTENT)
-        p_x = -MAXEXTENT;
-      if (p_y > MAXEXTENT)
-        p_y = MAXEXTENT;
-      else if (p_y < -MAXEXTENT)
-        p_y = -MAXEXTENT;
-      p_x = (p_x / MAXEXTENT) * 180;
-      p_y = (p_y / MAXEXTENT) * 180;
-      p_y = MS_RAD_TO_DEG * (2 * atan(exp(p_y * MS_DEG_TO_RAD)) - MS_PI2);
-    }
-    msComputeBounds(shape); /* fixes bug 1586 */
-    return MS_SUCCESS;
-  }
-#undef p_x
-#undef p_y
-#endif
-
 #ifdef USE_GEOS
   int use_splitShape = MS_FALSE;
   int use_splitShape_check_intersects = MS_FALSE;
@@ -1233,9 +1554,8 @@ static int msProjectShapeLine(reprojectionObj *reprojector, shapeObj *shape,
 
     if (diff) {
       for (int j = 0; j < diff->numlines; j++) {
-        for (i = 0; i < diff->line[j].numpoints; i++) {
-          msProjectPointEx(reprojector, &(diff->line[j].point[i]));
-        }
+        msProjectPointsEx(reprojector, diff->line[j].numpoints,
+                          diff->line[j].point, NULL);
         if (j == 0) {
           line_out->numpoints = diff->line[j].numpoints;
           memcpy(line_out->point, diff->line[0].point,
@@ -1254,6 +1574,14 @@ static int msProjectShapeLine(reprojectionObj *reprojector, shapeObj *shape,
   wrap_test = out != NULL && out->proj != NULL && msProjIsGeographicCRS(out) &&
               !msProjIsGeographicCRS(in);
 
+  if (projected == NULL && numpoints_in > 0) {
+    projected = projected_alloc =
+        (pointObj *)msSmallMalloc(sizeof(pointObj) * numpoints_in);
+    status = status_alloc = (int *)msSmallMalloc(sizeof(int) * numpoints_in);
+    memcpy(projected_alloc, line->point, sizeof(pointObj) * numpoints_in);
+    msProjectPointsEx(reprojector, numpoints_in, projected_alloc, status_alloc);
+  }
+
   line->numpoints = 0;
 
   memset(&lastPoint, 0, sizeof(lastPoint));
@@ -1262,10 +1590,9 @@ static int msProjectShapeLine(reprojectionObj *reprojector, shapeObj *shape,
   /*      Loop over all input points in linestring.                       */
   /* -------------------------------------------------------------------- */
   for (i = 0; i < numpoints_in; i++) {
-    int ms_err;
-    wrkPoint = thisPoint = line->point[i];
-
-    ms_err = msProjectPointEx(reprojector, &wrkPoint);
+    int ms_err = status[i];
+    thisPoint = line->point[i];
+    wrkPoint = projected[i];
 
     /* -------------------------------------------------------------------- */
     /*      Apply wrap logic.                                               */
@@ -1403,11 +1730,25 @@ static int msProjectShapeLine(reprojectionObj *reprojector, shapeObj *shape,
   if (shape->type == MS_SHAPE_POLYGON && line_out->numpoints > 2 &&
       (line_out->point[0].x != line_out->point[line_out->numpoints - 1].x ||
        line_out->point[0].y != line_out->point[line_out->numpoints - 1].y)) {
-    /* make a copy because msAddPointToLine can realloc the array */
-    pointObj sFirstPoint = line_out->point[0];
-    msAddPointToLine(line_out, &sFirstPoint);
+    /* the points may live in the arena of the layer, see maparena.c */
+    line_out->point = (pointObj *)msShapeReallocMemory(
+        shape, line_out->point, sizeof(pointObj) * line_out->numpoints,
+        sizeof(pointObj) * (line_out->numpoints + 1));
+    if (!line_out->point) {
+      msSetError(MS_MEMERR, "Out of memory allocating %u bytes.",
+                 "msProjectShapeLine()",
+                 (unsigned int)(sizeof(pointObj) * (line_out->numpoints + 1)));
+      msFree(projected_alloc);
+      msFree(status_alloc);
+      return MS_FAILURE;
+    }
+    line_out->point[line_out->numpoints] = line_out->point[0];
+    line_out->numpoints++;
   }
 
+  msFree(projected_alloc);
+  msFree(status_alloc);
+
   return (MS_SUCCESS);
 }
 
@@ -1428,55 +1769,9 @@ int msProjectShape(projectionObj *in, projectionObj *out, shapeObj *shape) {
 /*                          msProjectShapeEx()                          */
 /************************************************************************/
 int msProjectShapeEx(reprojectionObj *reprojector, shapeObj *shape) {
-  int i;
-#ifdef USE_PROJ_FASTPATHS
-  int j;
-
-#define p_x shape->line[i].point[j].x
-#define p_y shape->line[i].point[j].y
-  if (in->wellknownprojection == wkp_lonlat &&
-      out->wellknownprojection == wkp_gmerc) {
-    for (i = shape->numlines - 1; i >= 0; i--) {
-      for (j = shape->line[i].numpoints - 1; j >= 0; j--) {
-        p_x *= MAXEXTENTby180;
-        p_y = log(tan((90 + p_y) * M_PIby360)) * MS_RAD_TO_DEG;
-        p_y *= MAXEXTENTby180;
-        if (p_x > MAXEXTENT)
-          p_x = MAXEXTENT;
-        else if (p_x < -MAXEXTENT)
-          p_x = -MAXEXTENT;
-        if (p_y > MAXEXTENT)
-          p_y = MAXEXTENT;
-        else if (p_y < -MAXEXTENT)
-          p_y = -MAXEXTENT;
-      }
-    }
-    msComputeBounds(shape); /* fixes bug 1586 */
-    return MS_SUCCESS;
-  }
-  if (in->wellknownprojection == wkp_gmerc &&
-      out->wellknownprojection == wkp_lonlat) {
-    for (i = shape->numlines - 1; i >= 0; i--) {
-      for (j = shape->line[i].numpoints - 1; j >= 0; j--) {
-        if (p_x > MAXEXTENT)
-          p_x = MAXEXTENT;
-        else if (p_x < -MAXEXTENT)
-          p_x = -MAXEXTENT;
-        if (p_y > MAXEXTENT)
-          p_y = MAXEXTENT;
-        else if (p_y < -MAXEXTENT)
-          p_y = -MAXEXTENT;
-        p_x = (p_x / MAXEXTENT) * 180;
-        p_y = (p_y / MAXEXTENT) * 180;
-        p_y = MS_RAD_TO_DEG * (2 * atan(exp(p_y * MS_DEG_TO_RAD)) - MS_PI2);
-      }
-    }
-    msComputeBounds(shape); /* fixes bug 1586 */
-    return MS_SUCCESS;
-  }
-#undef p_x
-#undef p_y
-#endif
+  int i, numpoints = 0, offset;
+  pointObj *projected = NULL;
+  int *status = NULL;
 
   if (shape->numlines == 0) {
     // don't attempt to project any NULL geometries
@@ -1485,14 +1780,37 @@ int msProjectShapeEx(reprojectionObj *reprojector, shapeObj *shape) {
     shape->type = MS_SHAPE_NULL;
     return MS_SUCCESS;
   } else {
+    if (shape->type == MS_SHAPE_LINE || shape->type == MS_SHAPE_POLYGON) {
+      /* reproject all the vertices of the shape at once, msProjectShapeLine()
+       * then only has to deal with the horizon and the dateline */
+      for (i = 0; i < shape->numlines; i++)
+        numpoints += shape->line[i].numpoints;
+      projected = (pointObj *)msSmallMalloc(sizeof(pointObj) *
+                                            MS_MAX(numpoints, 1));
+      status = (int *)msSmallMalloc(sizeof(int) * MS_MAX(numpoints, 1));
+      for (i = 0, offset = 0; i < shape->numlines; i++) {
+        memcpy(projected + offset, shape->line[i].point,
+               sizeof(pointObj) * shape->line[i].numpoints);
+        offset += shape->line[i].numpoints;
+      }
+      msProjectPointsEx(reprojector, numpoints, projected, status);
+    }
+
+    /* lines added by msProjectShapeLine() go at the end of the shape, so
+     * the offsets of the lines still to be processed don't change */
+    offset = numpoints;
     for (i = shape->numlines - 1; i >= 0; i--) {
       if (shape->type == MS_SHAPE_LINE || shape->type == MS_SHAPE_POLYGON) {
-        if (msProjectShapeLine(reprojector, shape, i) == MS_FAILURE)
+        offset -= shape->line[i].numpoints;
+        if (msProjectShapeLine(reprojector, shape, i, projected + offset,
+                               status + offset) == MS_FAILURE)
           msShapeDeleteLine(shape, i);
       } else if (msProjectLineEx(reprojector, shape->line + i) == MS_FAILURE) {
         msShapeDeleteLine(shape, i);
       }
     }
+    msFree(projected);
+    msFree(status);
 
     if (shape->numlines == 0) {
       msFreeShape(shape);
@@ -1532,38 +1850,42 @@ int msProjectLineEx(reprojectionObj *reprojector, lineObj *line) {
 
   if (be_careful) {
     pointObj startPoint, thisPoint; /* locations in projected space */
+    pointObj *points_in;
 
-    startPoint = line->point[0];
+    if (line->numpoints == 0)
+      return MS_SUCCESS;
+
+    /* the wrap test needs the points before reprojection */
+    points_in = (pointObj *)msSmallMalloc(sizeof(pointObj) * line->numpoints);
+    memcpy(points_in, line->point, sizeof(pointObj) * line->numpoints);
+    startPoint = points_in[0];
 
-    for (int i = 0; i < line->numpoints; i++) {
+    msProjectPointsEx(reprojector, line->numpoints, line->point, NULL);
+
+    for (int i = 1; i < line->numpoints; i++) {
       double dist;
 
-      thisPoint = line->point[i];
+      thisPoint = points_in[i];
 
       /*
       ** Read comments before msTestNeedWrap() to better understand
       ** this dateline wrapping logic.
       */
-      msProjectPointEx(reprojector, &(line->point[i]));
-      if (i > 0) {
-        dist = line->point[i].x - line->point[0].x;
-        if (fabs(dist) > 180.0) {
-          if (msTestNeedWrap(thisPoint, startPoint, line->point[0],
-                             reprojector)) {
-            if (dist > 0.0) {
-              line->point[i].x -= 360.0;
-            } else if (dist < 0.0) {
-              line->point[i].x += 360.0;
-            }
+      dist = line->point[i].x - line->point[0].x;
+      if (fabs(dist) > 180.0) {
+        if (msTestNeedWrap(thisPoint, startPoint, line->point[0],
+                           reprojector)) {
+          if (dist > 0.0) {
+            line->point[i].x -= 360.0;
+          } else if (dist < 0.0) {
+            line->point[i].x += 360.0;
           }
         }
       }
     }
+    msFree(points_in);
   } else {
-    for (int i = 0; i < line->numpoints; i++) {
-      if (msProjectPointEx(reprojector, &(line->point[i])) == MS_FAILURE)
-        return MS_FAILURE;
-    }
+    return msProjectPointsEx(reprojector, line->numpoints, line->point, NULL);
   }
 
   return (MS_SUCCESS);
@@ -1768,7 +2090,7 @@ int msProjectRectAsPolygon(reprojectionObj *reprojector, rectObj *rect) {
   /* -------------------------------------------------------------------- */
   /*      Attempt to reproject.                                           */
   /* -------------------------------------------------------------------- */
-  msProjectShapeLine(reprojector, &polygonObj, 0);
+  msProjectShapeLine(reprojector, &polygonObj, 0, NULL, NULL);
 
   /* If no points reprojected, try a grid sampling */
   if (polygonObj.numlines == 0 || polygonObj.line[0].numpoints == 0) {
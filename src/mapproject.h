@@ -44,6 +44,7 @@ extern "C" {
 #define wkp_gmerc 2
 
 typedef struct projectionContext projectionContext;
+typedef struct msApproxGridObj msApproxGridObj;
 
 #ifndef SWIG
 typedef enum {
@@ -52,6 +53,12 @@ typedef enum {
   LINE_CUTTING_FROM_POLAR = 1,
   LINE_CUTTING_FROM_LONGLAT_WRAP0 = 2
 } msLineCuttingCase;
+
+typedef enum {
+  FAST_PATH_NONE = 0,
+  FAST_PATH_LONLAT_TO_GMERC = 1,
+  FAST_PATH_GMERC_TO_LONLAT = 2
+} msProjectionFastPath;
 #endif
 
 /**
@@ -94,6 +101,8 @@ typedef struct {
   msLineCuttingCase lineCuttingCase;
   shapeObj splitShape;
   int bFreePJ;
+  msProjectionFastPath fastPath; /* analytic transformation replacing pj */
+  msApproxGridObj *approxGrid;   /* see msProjectInitApproxGrid() */
 #endif
   unsigned short generation_number_in;  ///< A counter that is incremented when
                                         ///< the input projectionObj changes
@@ -118,6 +127,11 @@ MS_DLL_EXPORT int msProjectPoint(projectionObj *in, projectionObj *out,
                                  pointObj *point); /* legacy interface */
 MS_DLL_EXPORT int msProjectPointEx(reprojectionObj *reprojector,
                                    pointObj *point);
+MS_DLL_EXPORT int msProjectPointsEx(reprojectionObj *reprojector, int npoints,
+                                    pointObj *points, int *status);
+MS_DLL_EXPORT int msProjectInitApproxGrid(reprojectionObj *reprojector,
+                                          rectObj extent, double tolerance);
+MS_DLL_EXPORT void msProjectFreeApproxGrid(reprojectionObj *reprojector);
 MS_DLL_EXPORT int msProjectShape(projectionObj *in, projectionObj *out,
                                  shapeObj *shape); /* legacy interface */
 MS_DLL_EXPORT int msProjectShapeEx(reprojectionObj *reprojector,
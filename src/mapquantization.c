@@ -45,6 +45,8 @@
  */
 
 #include "mapserver.h"
+#include "mapthread.h"
+#include <stddef.h>
 #include <stdlib.h>
 
 #define PAM_GETR(p) ((p).r)
@@ -75,14 +77,15 @@ struct acolorhist_item {
   int value;
 };
 
-typedef struct acolorhist_list_item *acolorhist_list;
-struct acolorhist_list_item {
-  struct acolorhist_item ch;
-  acolorhist_list next;
+/* open addressing table of the colors counted by pam_computeacolorhist() */
+typedef struct acolortable_item *acolortable;
+struct acolortable_item {
+  unsigned int acolor; /* packed rgbaPixel */
+  int value;           /* 0 for a free slot */
+  int order;           /* rank of the first occurrence of the color */
+  int hash;            /* pam_hashapixel() of the color */
 };
 
-typedef acolorhist_list *acolorhash_table;
-
 #define MAXCOLORS 32767
 
 #define LARGE_NORM
@@ -97,26 +100,14 @@ struct box {
 
 static acolorhist_vector mediancut(acolorhist_vector achv, int colors, int sum,
                                    unsigned char maxval, int newcolors);
-static int redcompare(const void *ch1, const void *ch2);
-static int greencompare(const void *ch1, const void *ch2);
-static int bluecompare(const void *ch1, const void *ch2);
-static int alphacompare(const void *ch1, const void *ch2);
-static int sumcompare(const void *b1, const void *b2);
-
-static acolorhist_vector pam_acolorhashtoacolorhist(acolorhash_table acht,
-                                                    int maxacolors);
+static void sortbycomponent(acolorhist_vector achv, int clrs,
+                            size_t component, acolorhist_vector tmp);
+static void sortboxes(box_vector bv, int boxes);
+
 static acolorhist_vector pam_computeacolorhist(rgbaPixel **apixels, int cols,
                                                int rows, int maxacolors,
                                                int *acolorsP);
-static acolorhash_table pam_computeacolorhash(rgbaPixel **apixels, int cols,
-                                              int rows, int maxacolors,
-                                              int *acolorsP);
-static acolorhash_table pam_allocacolorhash(void);
-static int pam_addtoacolorhash(acolorhash_table acht, rgbaPixel *acolorP,
-                               int value);
-static int pam_lookupacolor(acolorhash_table acht, rgbaPixel *acolorP);
 static void pam_freeacolorhist(acolorhist_vector achv);
-static void pam_freeacolorhash(acolorhash_table acht);
 
 /**
  * Compute a palette for the given RGBA rasterBuffer using a median cut
@@ -204,71 +195,214 @@ int msQuantizeRasterBuffer(rasterBufferObj *rb, unsigned int *reqcolors,
   return MS_SUCCESS;
 }
 
+static unsigned int pam_packapixel(const rgbaPixel *p) {
+  unsigned int v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/*
+** Index of the palette entry closest to p, the first one in case of a tie,
+** or -1 for an empty palette. The palette is given by component and padded
+** to 256 entries with colors farther than any real one, so that the loops
+** have a fixed trip count and the compiler can vectorize them.
+*/
+static int pam_nearestcolor(const int *pr, const int *pg, const int *pb,
+                            const int *pa, int n, const rgbaPixel *p) {
+  const int r = PAM_GETR(*p), g = PAM_GETG(*p), b = PAM_GETB(*p),
+            a = PAM_GETA(*p);
+  int dist[256];
+  int i, mindist = 2000000000;
+
+  if (n == 0)
+    return -1;
+  for (i = 0; i < 256; ++i)
+    dist[i] = (r - pr[i]) * (r - pr[i]) + (g - pg[i]) * (g - pg[i]) +
+              (b - pb[i]) * (b - pb[i]) + (a - pa[i]) * (a - pa[i]);
+  for (i = 0; i < 256; ++i)
+    mindist = MS_MIN(mindist, dist[i]);
+  for (i = 0; dist[i] != mindist; ++i)
+    ;
+  return i;
+}
+
+/*
+** Colors already matched by msClassifyRasterBuffer(): an open addressing
+** table of packed colors and palette indexes, grown to stay at most half full.
+*/
+typedef struct {
+  unsigned int *acolor;
+  int *ind; /* -2 for a free slot */
+  unsigned int size, used;
+} classifyCache;
+
+static void classifyCacheInit(classifyCache *cache, unsigned int size) {
+  unsigned int i;
+  cache->acolor = (unsigned int *)msSmallMalloc(size * sizeof(unsigned int));
+  cache->ind = (int *)msSmallMalloc(size * sizeof(int));
+  cache->size = size;
+  cache->used = 0;
+  for (i = 0; i < size; ++i)
+    cache->ind[i] = -2;
+}
+
+static unsigned int classifyCacheSlot(const classifyCache *cache,
+                                      unsigned int acolor) {
+  unsigned int slot = acolor * 2654435761U;
+  slot = (slot ^ (slot >> 16)) & (cache->size - 1);
+  while (cache->ind[slot] != -2 && cache->acolor[slot] != acolor)
+    slot = (slot + 1) & (cache->size - 1);
+  return slot;
+}
+
+static void classifyCacheAdd(classifyCache *cache, unsigned int slot,
+                             unsigned int acolor, int ind) {
+  cache->acolor[slot] = acolor;
+  cache->ind[slot] = ind;
+  if (++cache->used * 2 > cache->size) {
+    classifyCache grown;
+    unsigned int i;
+    classifyCacheInit(&grown, cache->size * 2);
+    for (i = 0; i < cache->size; ++i) {
+      if (cache->ind[i] != -2) {
+        slot = classifyCacheSlot(&grown, cache->acolor[i]);
+        grown.acolor[slot] = cache->acolor[i];
+        grown.ind[slot] = cache->ind[i];
+      }
+    }
+    grown.used = cache->used;
+    free(cache->acolor);
+    free(cache->ind);
+    *cache = grown;
+  }
+}
+
 int msClassifyRasterBuffer(rasterBufferObj *rb, rasterBufferObj *qrb) {
-  int ind;
-  unsigned char *outrow, *pQ;
-  rgbaPixel *pP;
-  acolorhash_table acht;
-  int usehash;
+  const int n = (int)qrb->data.palette.num_entries;
+  int pr[256], pg[256], pb[256], pa[256];
+  classifyCache cache;
+  int i;
+
   /*
    ** Step 4: map the colors in the image to their closest match in the
-   ** new colormap, and write 'em out.
+   ** new colormap, and write 'em out. Runs of the same color are common,
+   ** and the other colors already matched are remembered.
    */
-  acht = pam_allocacolorhash();
-  usehash = 1;
+  for (i = 0; i < n; ++i) {
+    pr[i] = PAM_GETR(qrb->data.palette.palette[i]);
+    pg[i] = PAM_GETG(qrb->data.palette.palette[i]);
+    pb[i] = PAM_GETB(qrb->data.palette.palette[i]);
+    pa[i] = PAM_GETA(qrb->data.palette.palette[i]);
+  }
+  for (; i < 256; ++i)
+    pr[i] = pg[i] = pb[i] = pa[i] = 1000;
+  classifyCacheInit(&cache, 1024);
 
   for (unsigned row = 0; row < qrb->height; ++row) {
-    outrow = &(qrb->data.palette.pixels[row * qrb->width]);
-    unsigned col = 0;
-    pP = (rgbaPixel *)(&(rb->data.rgba.pixels[row * rb->data.rgba.row_step]));
-    ;
-    pQ = outrow;
-    do {
-      /* Check hash table to see if we have already matched this color. */
-      ind = pam_lookupacolor(acht, pP);
-      if (ind == -1) {
-        /* No; search acolormap for closest match. */
-        int r1, g1, b1, a1, r2, g2, b2, a2;
-        long dist, newdist;
-
-        r1 = PAM_GETR(*pP);
-        g1 = PAM_GETG(*pP);
-        b1 = PAM_GETB(*pP);
-        a1 = PAM_GETA(*pP);
-        dist = 2000000000;
-        for (unsigned i = 0; i < qrb->data.palette.num_entries; ++i) {
-          r2 = PAM_GETR(qrb->data.palette.palette[i]);
-          g2 = PAM_GETG(qrb->data.palette.palette[i]);
-          b2 = PAM_GETB(qrb->data.palette.palette[i]);
-          a2 = PAM_GETA(qrb->data.palette.palette[i]);
-          /* GRR POSSIBLE BUG */
-          newdist = (r1 - r2) * (r1 - r2) + /* may overflow? */
-                    (g1 - g2) * (g1 - g2) + (b1 - b2) * (b1 - b2) +
-                    (a1 - a2) * (a1 - a2);
-          if (newdist < dist) {
-            ind = i;
-            dist = newdist;
-          }
-        }
-        if (usehash) {
-          if (pam_addtoacolorhash(acht, pP, ind) < 0) {
-            usehash = 0;
-          }
+    const rgbaPixel *pP =
+        (rgbaPixel *)(&(rb->data.rgba.pixels[row * rb->data.rgba.row_step]));
+    unsigned char *pQ = &(qrb->data.palette.pixels[row * qrb->width]);
+    unsigned int lastcolor = 0;
+    int ind = -2;
+
+    for (unsigned col = 0; col < rb->width; ++col, ++pP, ++pQ) {
+      const unsigned int acolor = pam_packapixel(pP);
+      if (ind == -2 || acolor != lastcolor) {
+        const unsigned int slot = classifyCacheSlot(&cache, acolor);
+        if (cache.ind[slot] != -2) {
+          ind = cache.ind[slot];
+        } else {
+          ind = pam_nearestcolor(pr, pg, pb, pa, n, pP);
+          classifyCacheAdd(&cache, slot, acolor, ind);
         }
+        lastcolor = acolor;
       }
-
-      /*          *pP = acolormap[ind].acolor;  */
       *pQ = (unsigned char)ind;
+    }
+  }
 
-      ++col;
-      ++pP;
-      ++pQ;
+  free(cache.acolor);
+  free(cache.ind);
+  return MS_SUCCESS;
+}
+
+/*
+** Palettes kept for QUANTIZE_REUSE_PALETTE, shared by all the requests of the
+** process. The key identifies the map, layers and output format the palette
+** was computed for (see saveAsPNG()); the least recently used entry is
+** replaced when the cache is full. An entry computed for another modification
+** time of the mapfile is stale and gets replaced by the next palette of its
+** key.
+*/
+#define PALETTE_CACHE_SIZE 32
+
+typedef struct {
+  char *key;
+  time_t mtime;
+  unsigned int num_entries;
+  rgbaPixel palette[256];
+} paletteCacheEntry;
+
+static paletteCacheEntry paletteCache[PALETTE_CACHE_SIZE];
+static msLRUCacheObj paletteCacheLRU; /* size 0 until allocated */
+
+int msPaletteCacheGet(const char *key, time_t mtime, rgbaPixel *palette,
+                      unsigned int *num_entries) {
+  int i, found = MS_FALSE;
+
+  msAcquireLock(TLOCK_PALETTE);
+  for (i = 0; i < paletteCacheLRU.size; i++) {
+    if (paletteCache[i].key && strcmp(paletteCache[i].key, key) == 0) {
+      if (paletteCache[i].mtime != mtime)
+        break;
+      memcpy(palette, paletteCache[i].palette,
+             paletteCache[i].num_entries * sizeof(rgbaPixel));
+      *num_entries = paletteCache[i].num_entries;
+      msLRUCacheTouch(&paletteCacheLRU, i);
+      found = MS_TRUE;
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_PALETTE);
+  return found;
+}
 
-    } while (col != rb->width);
+void msPaletteCacheSet(const char *key, time_t mtime,
+                       const rgbaPixel *palette, unsigned int num_entries) {
+  paletteCacheEntry *entry;
+  int i, slot = -1;
+
+  msAcquireLock(TLOCK_PALETTE);
+  if (paletteCacheLRU.size == 0)
+    msLRUCacheInit(&paletteCacheLRU, PALETTE_CACHE_SIZE);
+  /* another request may have stored it in the meantime */
+  for (i = 0; i < paletteCacheLRU.size; i++) {
+    if (paletteCache[i].key && strcmp(paletteCache[i].key, key) == 0)
+      slot = i;
+  }
+  if (slot < 0) {
+    slot = msLRUCacheSlot(&paletteCacheLRU, NULL, NULL);
+    msFree(paletteCache[slot].key);
+    paletteCache[slot].key = msStrdup(key);
   }
-  pam_freeacolorhash(acht);
+  entry = &(paletteCache[slot]);
+  memcpy(entry->palette, palette, num_entries * sizeof(rgbaPixel));
+  entry->num_entries = num_entries;
+  entry->mtime = mtime;
+  msLRUCacheTouch(&paletteCacheLRU, slot);
+  msReleaseLock(TLOCK_PALETTE);
+}
 
-  return MS_SUCCESS;
+void msPaletteCacheCleanup(void) {
+  int i;
+
+  msAcquireLock(TLOCK_PALETTE);
+  for (i = 0; i < PALETTE_CACHE_SIZE; i++) {
+    msFree(paletteCache[i].key);
+    paletteCache[i].key = NULL;
+  }
+  msLRUCacheFree(&paletteCacheLRU);
+  msReleaseLock(TLOCK_PALETTE);
 }
 
 /*
@@ -279,7 +413,7 @@ int msClassifyRasterBuffer(rasterBufferObj *rb, rasterBufferObj *qrb) {
 
 static acolorhist_vector mediancut(acolorhist_vector achv, int colors, int sum,
                                    unsigned char maxval, int newcolors) {
-  acolorhist_vector acolormap;
+  acolorhist_vector acolormap, tmp;
   box_vector bv;
   int bi, i;
   int boxes;
@@ -287,7 +421,9 @@ static acolorhist_vector mediancut(acolorhist_vector achv, int colors, int sum,
   bv = (box_vector)malloc(sizeof(struct box) * newcolors);
   acolormap =
       (acolorhist_vector)malloc(sizeof(struct acolorhist_item) * newcolors);
-  if (bv == (box_vector)0 || acolormap == (acolorhist_vector)0) {
+  tmp = (acolorhist_vector)malloc(sizeof(struct acolorhist_item) * colors);
+  if (bv == (box_vector)0 || acolormap == (acolorhist_vector)0 ||
+      tmp == (acolorhist_vector)0) {
     fprintf(stderr, "  out of memory allocating box vector\n");
     fflush(stderr);
     exit(6);
@@ -366,17 +502,13 @@ static acolorhist_vector mediancut(acolorhist_vector achv, int colors, int sum,
 #ifdef LARGE_NORM
     if (maxa - mina >= maxr - minr && maxa - mina >= maxg - ming &&
         maxa - mina >= maxb - minb)
-      qsort((char *)&(achv[indx]), clrs, sizeof(struct acolorhist_item),
-            alphacompare);
+      sortbycomponent(&(achv[indx]), clrs, offsetof(rgbaPixel, a), tmp);
     else if (maxr - minr >= maxg - ming && maxr - minr >= maxb - minb)
-      qsort((char *)&(achv[indx]), clrs, sizeof(struct acolorhist_item),
-            redcompare);
+      sortbycomponent(&(achv[indx]), clrs, offsetof(rgbaPixel, r), tmp);
     else if (maxg - ming >= maxb - minb)
-      qsort((char *)&(achv[indx]), clrs, sizeof(struct acolorhist_item),
-            greencompare);
+      sortbycomponent(&(achv[indx]), clrs, offsetof(rgbaPixel, g), tmp);
     else
-      qsort((char *)&(achv[indx]), clrs, sizeof(struct acolorhist_item),
-            bluecompare);
+      sortbycomponent(&(achv[indx]), clrs, offsetof(rgbaPixel, b), tmp);
 #endif /*LARGE_NORM*/
 #ifdef LARGE_LUM
     {
@@ -399,17 +531,13 @@ static acolorhist_vector mediancut(acolorhist_vector achv, int colors, int sum,
        */
 
       if (al >= rl && al >= gl && al >= bl)
-        qsort((char *)&(achv[indx]), clrs, sizeof(struct acolorhist_item),
-              alphacompare);
+        sortbycomponent(&(achv[indx]), clrs, offsetof(rgbaPixel, a), tmp);
       else if (rl >= gl && rl >= bl)
-        qsort((char *)&(achv[indx]), clrs, sizeof(struct acolorhist_item),
-              redcompare);
+        sortbycomponent(&(achv[indx]), clrs, offsetof(rgbaPixel, r), tmp);
       else if (gl >= bl)
-        qsort((char *)&(achv[indx]), clrs, sizeof(struct acolorhist_item),
-              greencompare);
+        sortbycomponent(&(achv[indx]), clrs, offsetof(rgbaPixel, g), tmp);
       else
-        qsort((char *)&(achv[indx]), clrs, sizeof(struct acolorhist_item),
-              bluecompare);
+        sortbycomponent(&(achv[indx]), clrs, offsetof(rgbaPixel, b), tmp);
     }
 #endif /*LARGE_LUM*/
 
@@ -434,7 +562,7 @@ static acolorhist_vector mediancut(acolorhist_vector achv, int colors, int sum,
     bv[boxes].colors = clrs - i;
     bv[boxes].sum = sm - lowersum;
     ++boxes;
-    qsort((char *)bv, boxes, sizeof(struct box), sumcompare);
+    sortboxes(bv, boxes);
   }
 
   /*
@@ -528,32 +656,44 @@ static acolorhist_vector mediancut(acolorhist_vector achv, int colors, int sum,
   /*
    ** All done.
    */
+  free(tmp);
   free(bv);
   return acolormap;
 }
 
-static int redcompare(const void *ch1, const void *ch2) {
-  return (int)PAM_GETR(((acolorhist_vector)ch1)->acolor) -
-         (int)PAM_GETR(((acolorhist_vector)ch2)->acolor);
-}
-
-static int greencompare(const void *ch1, const void *ch2) {
-  return (int)PAM_GETG(((acolorhist_vector)ch1)->acolor) -
-         (int)PAM_GETG(((acolorhist_vector)ch2)->acolor);
-}
+/*
+** Stable counting sort of the colors of a box on one of their components,
+** given by its offset in rgbaPixel. Stability keeps the palette the same as
+** with the stable merge sort behind glibc's qsort(), which was used before,
+** and makes it independent of the platform.
+*/
+static void sortbycomponent(acolorhist_vector achv, int clrs,
+                            size_t component, acolorhist_vector tmp) {
+  int count[257] = {0};
+  int i;
 
-static int bluecompare(const void *ch1, const void *ch2) {
-  return (int)PAM_GETB(((acolorhist_vector)ch1)->acolor) -
-         (int)PAM_GETB(((acolorhist_vector)ch2)->acolor);
+  for (i = 0; i < clrs; ++i)
+    ++count[((unsigned char *)&(achv[i].acolor))[component] + 1];
+  for (i = 1; i < 257; ++i)
+    count[i] += count[i - 1];
+  for (i = 0; i < clrs; ++i)
+    tmp[count[((unsigned char *)&(achv[i].acolor))[component]]++] = achv[i];
+  memcpy(achv, tmp, clrs * sizeof(struct acolorhist_item));
 }
 
-static int alphacompare(const void *ch1, const void *ch2) {
-  return (int)PAM_GETA(((acolorhist_vector)ch1)->acolor) -
-         (int)PAM_GETA(((acolorhist_vector)ch2)->acolor);
-}
+/*
+** Stable sort of the boxes by decreasing pixel count. Only the box just split
+** and the new one are out of place, so an insertion sort is enough.
+*/
+static void sortboxes(box_vector bv, int boxes) {
+  int i, j;
 
-static int sumcompare(const void *b1, const void *b2) {
-  return ((box_vector)b2)->sum - ((box_vector)b1)->sum;
+  for (i = 1; i < boxes; ++i) {
+    struct box b = bv[i];
+    for (j = i; j > 0 && bv[j - 1].sum < b.sum; --j)
+      bv[j] = bv[j - 1];
+    bv[j] = b;
+  }
 }
 
 /*===========================================================================*/
@@ -586,140 +726,83 @@ static int sumcompare(const void *b1, const void *b2) {
     0x7fffffff) %                                                              \
    HASH_SIZE)
 
+static int histordercompare(const void *i1, const void *i2) {
+  const struct acolortable_item *a = (const struct acolortable_item *)i1;
+  const struct acolortable_item *b = (const struct acolortable_item *)i2;
+  if (a->hash != b->hash)
+    return a->hash < b->hash ? -1 : 1;
+  return b->order - a->order;
+}
+
+/*
+** Count the colors of the image, or return NULL if there are more than
+** maxacolors of them. The colors are returned in the order the former
+** chained hash table listed them in (by pam_hashapixel(), then latest seen
+** first), which the median cut depends on when breaking ties.
+*/
 static acolorhist_vector pam_computeacolorhist(rgbaPixel **apixels, int cols,
                                                int rows, int maxacolors,
                                                int *acolorsP) {
-  acolorhash_table acht;
+  acolortable acht, item = NULL;
   acolorhist_vector achv;
-
-  acht = pam_computeacolorhash(apixels, cols, rows, maxacolors, acolorsP);
-  if (acht == (acolorhash_table)0)
-    return (acolorhist_vector)0;
-  achv = pam_acolorhashtoacolorhist(acht, maxacolors);
-  pam_freeacolorhash(acht);
-  return achv;
-}
-
-static acolorhash_table pam_computeacolorhash(rgbaPixel **apixels, int cols,
-                                              int rows, int maxacolors,
-                                              int *acolorsP) {
-  acolorhash_table acht;
-  rgbaPixel *pP;
-  acolorhist_list achl;
-  int col, row, hash;
-
-  acht = pam_allocacolorhash();
+  unsigned int tablesize = 64, mask, lastcolor = 0;
+  int col, row, i, j;
+
+  /* keep the table at most half full */
+  while (tablesize < 2 * (unsigned int)maxacolors &&
+         tablesize < 2 * (size_t)cols * rows)
+    tablesize <<= 1;
+  mask = tablesize - 1;
+  acht = (acolortable)msSmallCalloc(tablesize, sizeof(struct acolortable_item));
   *acolorsP = 0;
 
   /* Go through the entire image, building a hash table of colors. */
-  for (row = 0; row < rows; ++row)
-    for (col = 0, pP = apixels[row]; col < cols; ++col, ++pP) {
-      hash = pam_hashapixel(*pP);
-      for (achl = acht[hash]; achl != (acolorhist_list)0; achl = achl->next)
-        if (PAM_EQUAL(achl->ch.acolor, *pP))
-          break;
-      if (achl != (acolorhist_list)0)
-        ++(achl->ch.value);
-      else {
+  for (row = 0; row < rows; ++row) {
+    const rgbaPixel *pP = apixels[row];
+    for (col = 0; col < cols; ++col, ++pP) {
+      const unsigned int acolor = pam_packapixel(pP);
+      unsigned int slot;
+      if (item && acolor == lastcolor) {
+        ++(item->value);
+        continue;
+      }
+      slot = acolor * 2654435761U;
+      slot = (slot ^ (slot >> 16)) & mask;
+      while (acht[slot].value && acht[slot].acolor != acolor)
+        slot = (slot + 1) & mask;
+      item = &(acht[slot]);
+      if (!item->value) {
         if (++(*acolorsP) > maxacolors) {
-          pam_freeacolorhash(acht);
-          return (acolorhash_table)0;
+          free(acht);
+          return (acolorhist_vector)0;
         }
-        achl = (acolorhist_list)malloc(sizeof(struct acolorhist_list_item));
-        if (achl == 0) {
-          fprintf(stderr, "  out of memory computing hash table\n");
-          exit(7);
-        }
-        achl->ch.acolor = *pP;
-        achl->ch.value = 1;
-        achl->next = acht[hash];
-        acht[hash] = achl;
+        item->acolor = acolor;
+        item->order = *acolorsP;
+        item->hash = pam_hashapixel(*pP);
       }
+      ++(item->value);
+      lastcolor = acolor;
     }
-
-  return acht;
-}
-
-static acolorhash_table pam_allocacolorhash() {
-  acolorhash_table acht;
-  int i;
-
-  acht = (acolorhash_table)malloc(HASH_SIZE * sizeof(acolorhist_list));
-  if (acht == 0) {
-    fprintf(stderr, "  out of memory allocating hash table\n");
-    exit(8);
   }
 
-  for (i = 0; i < HASH_SIZE; ++i)
-    acht[i] = (acolorhist_list)0;
-
-  return acht;
-}
-
-static int pam_addtoacolorhash(acolorhash_table acht, rgbaPixel *acolorP,
-                               int value) {
-  int hash;
-  acolorhist_list achl;
-
-  achl = (acolorhist_list)msSmallMalloc(sizeof(struct acolorhist_list_item));
-
-  hash = pam_hashapixel(*acolorP);
-  achl->ch.acolor = *acolorP;
-  achl->ch.value = value;
-  achl->next = acht[hash];
-  acht[hash] = achl;
-  return 0;
-}
-
-static acolorhist_vector pam_acolorhashtoacolorhist(acolorhash_table acht,
-                                                    int maxacolors) {
-  acolorhist_vector achv;
-  acolorhist_list achl;
-  int i, j;
+  /* Now collate the table into a simple acolorhist array. */
+  for (i = 0, j = 0; i < (int)tablesize; ++i) {
+    if (acht[i].value)
+      acht[j++] = acht[i];
+  }
+  qsort(acht, j, sizeof(struct acolortable_item), histordercompare);
 
-  /* Now collate the hash table into a simple acolorhist array. */
-  achv = (acolorhist_vector)malloc(maxacolors * sizeof(struct acolorhist_item));
   /* (Leave room for expansion by caller.) */
-  if (achv == (acolorhist_vector)0) {
-    fprintf(stderr, "  out of memory generating histogram\n");
-    exit(9);
+  achv = (acolorhist_vector)msSmallMalloc(maxacolors *
+                                          sizeof(struct acolorhist_item));
+  for (i = 0; i < j; ++i) {
+    memcpy(&(achv[i].acolor), &(acht[i].acolor), sizeof(rgbaPixel));
+    achv[i].value = acht[i].value;
   }
-
-  /* Loop through the hash table. */
-  j = 0;
-  for (i = 0; i < HASH_SIZE; ++i)
-    for (achl = acht[i]; achl != (acolorhist_list)0; achl = achl->next) {
-      /* Add the new entry. */
-      achv[j] = achl->ch;
-      ++j;
-    }
+  free(acht);
 
   /* All done. */
   return achv;
 }
 
-static int pam_lookupacolor(acolorhash_table acht, rgbaPixel *acolorP) {
-  int hash;
-  acolorhist_list achl;
-
-  hash = pam_hashapixel(*acolorP);
-  for (achl = acht[hash]; achl != (acolorhist_list)0; achl = achl->next)
-    if (PAM_EQUAL(achl->ch.acolor, *acolorP))
-      return achl->ch.value;
-
-  return -1;
-}
-
 static void pam_freeacolorhist(acolorhist_vector achv) { free((char *)achv); }
-
-static void pam_freeacolorhash(acolorhash_table acht) {
-  int i;
-  acolorhist_list achl, achlnext;
-
-  for (i = 0; i < HASH_SIZE; ++i)
-    for (achl = acht[i]; achl != (acolorhist_list)0; achl = achlnext) {
-      achlnext = achl->next;
-      free((char *)achl);
-    }
-  free((char *)acht);
-}
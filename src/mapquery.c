@@ -80,6 +80,9 @@ int msInitQuery(queryObj *query) {
   query->max_cached_shape_count = 0;
   query->max_cached_shape_ram_amount = 0;
 
+  query->result_callback = NULL;
+  query->result_callback_data = NULL;
+
   return MS_SUCCESS;
 }
 
@@ -204,13 +207,26 @@ static int canCacheShape(mapObj *map, queryCacheObj *queryCache,
   return MS_TRUE;
 }
 
-static int addResult(mapObj *map, resultCacheObj *cache,
-                     queryCacheObj *queryCache, shapeObj *shape) {
+static int addResult(mapObj *map, layerObj *layer, queryCacheObj *queryCache,
+                     shapeObj *shape) {
   int i;
-  int shape_ram_size = (map->query.max_cached_shape_ram_amount > 0)
-                           ? msGetShapeRAMSize(shape)
-                           : 0;
-  int store_shape = canCacheShape(map, queryCache, shape_ram_size);
+  resultCacheObj *cache = layer->resultcache;
+  int shape_ram_size, store_shape;
+
+  if (map->query.result_callback && map->query.mode != MS_QUERY_SINGLE) {
+    /* streamed results are only counted */
+    if (map->query.result_callback(layer, shape,
+                                   map->query.result_callback_data) !=
+        MS_SUCCESS)
+      return MS_FAILURE;
+    cache->numresults++;
+    return MS_SUCCESS;
+  }
+
+  shape_ram_size = (map->query.max_cached_shape_ram_amount > 0)
+                       ? msGetShapeRAMSize(shape)
+                       : 0;
+  store_shape = canCacheShape(map, queryCache, shape_ram_size);
 
   if (cache->numresults == cache->cachesize) { /* just add it to the end */
     if (cache->cachesize == 0)
@@ -744,7 +760,7 @@ int msQueryByIndex(mapObj *map) {
     return (MS_FAILURE);
   }
 
-  addResult(map, lp->resultcache, &queryCache, &shape);
+  addResult(map, lp, &queryCache, &shape);
 
   msFreeShape(&shape);
   /* msLayerClose(lp); */
@@ -1092,7 +1108,7 @@ int msQueryByFilter(mapObj *map) {
       if (map->query.only_cache_result_count)
         lp->resultcache->numresults++;
       else
-        addResult(map, lp->resultcache, &queryCache, &shape);
+        addResult(map, lp, &queryCache, &shape);
       msFreeShape(&shape);
 
       if (map->query.mode ==
@@ -1433,8 +1449,11 @@ int msQueryByRect(mapObj *map) {
         }
         if (map->query.only_cache_result_count)
           lp->resultcache->numresults++;
-        else
-          addResult(map, lp->resultcache, &queryCache, &shape);
+        else if (addResult(map, lp, &queryCache, &shape) != MS_SUCCESS) {
+          msFreeShape(&shape);
+          status = MS_FAILURE;
+          break;
+        }
         --map->query.maxfeatures;
       }
       msFreeShape(&shape);
@@ -1812,7 +1831,7 @@ int msQueryByFeatures(mapObj *map) {
             msFreeShape(&shape);
             continue;
           }
-          addResult(map, lp->resultcache, &queryCache, &shape);
+          addResult(map, lp, &queryCache, &shape);
         }
         msFreeShape(&shape);
 
@@ -2083,10 +2102,10 @@ int msQueryByPoint(mapObj *map) {
         if (map->query.mode == MS_QUERY_SINGLE) {
           cleanupResultCache(lp->resultcache);
           initQueryCache(&queryCache);
-          addResult(map, lp->resultcache, &queryCache, &shape);
+          addResult(map, lp, &queryCache, &shape);
           t = d; /* next one must be closer */
         } else {
-          addResult(map, lp->resultcache, &queryCache, &shape);
+          addResult(map, lp, &queryCache, &shape);
         }
       }
 
@@ -2431,7 +2450,7 @@ int msQueryByShape(mapObj *map) {
           msFreeShape(&shape);
           continue;
         }
-        addResult(map, lp->resultcache, &queryCache, &shape);
+        addResult(map, lp, &queryCache, &shape);
       }
       msFreeShape(&shape);
 
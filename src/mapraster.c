@@ -303,6 +303,30 @@ int msDrawRasterSetupTileLayer(mapObj *map, layerObj *layer,
       tlp->filter.type = layer->filter.type;
     }
 
+    /* a plain shapefile tile index can be served from the tile index */
+    /* cache, without opening the temporary layer */
+    if (!layer->filter.string && tlp->projection.numargs == 0 &&
+        !(is_query && layer->numscaletokens > 0)) {
+      rasterTileIndexCursorObj *cursor =
+          msRasterTileIndexCursorOpen(map, layer);
+      if (cursor) {
+        tlp->layerinfo = cursor;
+        *ptileitemindex = 0;
+        *ptilesrsindex = layer->tilesrs ? 1 : -1;
+        if ((map->projection.numargs > 0) &&
+            (layer->projection.numargs > 0)) {
+          if (msProjectRect(&map->projection, &layer->projection,
+                            psearchrect) != MS_SUCCESS) {
+            msDebug("msDrawRasterLayerLow(%s): unable to reproject map "
+                    "request rectangle into layer projection, canceling.\n",
+                    layer->name);
+            return MS_FAILURE;
+          }
+        }
+        return msRasterTileIndexCursorWhichTiles(cursor, *psearchrect);
+      }
+    }
+
   } else {
     if (msCheckParentPointer(layer->map, "map") == MS_FAILURE)
       return MS_FAILURE;
@@ -379,6 +403,10 @@ int msDrawRasterSetupTileLayer(mapObj *map, layerObj *layer,
 /************************************************************************/
 
 void msDrawRasterCleanupTileLayer(layerObj *tlp, int tilelayerindex) {
+  if (tilelayerindex == -1 && tlp->vtable == NULL && tlp->layerinfo) {
+    msRasterTileIndexCursorClose((rasterTileIndexCursorObj *)tlp->layerinfo);
+    tlp->layerinfo = NULL;
+  }
   msLayerClose(tlp);
   if (tilelayerindex == -1) {
     freeLayer(tlp);
@@ -401,6 +429,27 @@ int msDrawRasterIterateTileIndex(layerObj *layer, layerObj *tlp,
                                  size_t sizeof_tilesrsname) {
   int status;
 
+  if (tlp->vtable == NULL && tlp->layerinfo) { /* tile index cache cursor */
+    const char *location = NULL, *srs = NULL;
+
+    status = msRasterTileIndexCursorNext(
+        (rasterTileIndexCursorObj *)tlp->layerinfo, &location, &srs);
+    if (status == MS_FAILURE || status == MS_DONE) {
+      return status;
+    }
+
+    if (layer->data == NULL || strlen(layer->data) == 0)
+      strlcpy(tilename, location, sizeof_tilename);
+    else
+      snprintf(tilename, sizeof_tilename, "%s/%s", location, layer->data);
+
+    tilesrsname[0] = '\0';
+    if (tilesrsindex >= 0 && srs != NULL)
+      strlcpy(tilesrsname, srs, sizeof_tilesrsname);
+
+    return status;
+  }
+
   status = msLayerNextShape(tlp, ptshp);
   if (status == MS_FAILURE || status == MS_DONE) {
     return status;
@@ -599,6 +648,21 @@ msDrawRasterLayerLowCheckDataset(mapObj *map, layerObj *layer, GDALDatasetH hDS,
   return CDRT_OK;
 }
 
+/************************************************************************/
+/*                 msDrawRasterUseDatasetCache()                        */
+/*                                                                      */
+/*      Whether the datasets of the layer are kept open by the          */
+/*      MS_RASTER_DATASET_CACHE, unless CLOSE_CONNECTION=ALWAYS.        */
+/************************************************************************/
+
+static int msDrawRasterUseDatasetCache(layerObj *layer) {
+  const char *close_connection =
+      msLayerGetProcessingKey(layer, "CLOSE_CONNECTION");
+
+  return msRasterDatasetCacheEnabled() &&
+         (close_connection == NULL || strcasecmp(close_connection, "ALWAYS"));
+}
+
 /************************************************************************/
 /*              msDrawRasterLayerLowOpenDataset()                       */
 /************************************************************************/
@@ -645,10 +709,14 @@ void *msDrawRasterLayerLowOpenDataset(mapObj *map, layerObj *layer,
         msLayerGetProcessingKey(layer, "ALLOWED_GDAL_DRIVERS");
     if (pszAllowedDrivers && !EQUAL(pszAllowedDrivers, "*"))
       papszAllowedDrivers = CSLTokenizeString2(pszAllowedDrivers, ",", 0);
-    GDALDatasetH hDS =
-        GDALOpenEx(*p_decrypted_path, GDAL_OF_RASTER | GDAL_OF_SHARED,
-                   (const char *const *)papszAllowedDrivers,
-                   (const char *const *)connectionoptions, NULL);
+    GDALDatasetH hDS;
+    if (msDrawRasterUseDatasetCache(layer))
+      hDS = msRasterDatasetCacheOpen(*p_decrypted_path, papszAllowedDrivers,
+                                     connectionoptions);
+    else
+      hDS = GDALOpenEx(*p_decrypted_path, GDAL_OF_RASTER | GDAL_OF_SHARED,
+                       (const char *const *)papszAllowedDrivers,
+                       (const char *const *)connectionoptions, NULL);
     CSLDestroy(papszAllowedDrivers);
     CSLDestroy(connectionoptions);
 
@@ -677,6 +745,8 @@ void *msDrawRasterLayerLowOpenDataset(mapObj *map, layerObj *layer,
       }
     }
     return hDS;
+  } else if (msDrawRasterUseDatasetCache(layer)) {
+    return msRasterDatasetCacheOpen(*p_decrypted_path, NULL, NULL);
   } else {
     return GDALOpenShared(*p_decrypted_path, GA_ReadOnly);
   }
@@ -689,6 +759,11 @@ void *msDrawRasterLayerLowOpenDataset(mapObj *map, layerObj *layer,
 void msDrawRasterLayerLowCloseDataset(layerObj *layer, void *hDS) {
   if (hDS) {
     const char *close_connection;
+
+    if (msRasterDatasetCacheRelease((GDALDatasetH)hDS, MS_FALSE)) {
+      msReleaseLock(TLOCK_GDAL);
+      return;
+    }
     close_connection = msLayerGetProcessingKey(layer, "CLOSE_CONNECTION");
 
     if (close_connection == NULL && layer->tileindex == NULL)
@@ -916,7 +991,8 @@ int msDrawRasterLayerLowWithDataset(mapObj *map, layerObj *layer,
     if (msDrawRasterLoadProjection(layer, hDS, filename, tilesrsindex,
                                    tilesrsname) != MS_SUCCESS) {
       if (hDatasetIn == NULL) {
-        GDALClose(hDS);
+        if (!msRasterDatasetCacheRelease(hDS, MS_TRUE))
+          GDALClose(hDS);
         msReleaseLock(TLOCK_GDAL);
       }
       final_status = MS_FAILURE;
@@ -950,7 +1026,8 @@ int msDrawRasterLayerLowWithDataset(mapObj *map, layerObj *layer,
 
     if (status == -1) {
       if (hDatasetIn == NULL) {
-        GDALClose(hDS);
+        if (!msRasterDatasetCacheRelease(hDS, MS_TRUE))
+          GDALClose(hDS);
         msReleaseLock(TLOCK_GDAL);
       }
       final_status = MS_FAILURE;
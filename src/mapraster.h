@@ -57,4 +57,20 @@ int msDrawRasterLoadProjection(layerObj *layer, GDALDatasetH hDS,
                                const char *filename, int tilesrsindex,
                                const char *tilesrsname);
 
+/* per-process caches, see maprastercache.c */
+int msRasterDatasetCacheEnabled(void);
+GDALDatasetH msRasterDatasetCacheOpen(const char *path,
+                                      char **papszAllowedDrivers,
+                                      char **papszOpenOptions);
+int msRasterDatasetCacheRelease(GDALDatasetH hDS, int bDiscard);
+
+typedef struct rasterTileIndexCursorObj rasterTileIndexCursorObj;
+rasterTileIndexCursorObj *msRasterTileIndexCursorOpen(mapObj *map,
+                                                      layerObj *layer);
+int msRasterTileIndexCursorWhichTiles(rasterTileIndexCursorObj *cursor,
+                                      rectObj rect);
+int msRasterTileIndexCursorNext(rasterTileIndexCursorObj *cursor,
+                                const char **location, const char **srs);
+void msRasterTileIndexCursorClose(rasterTileIndexCursorObj *cursor);
+
 #endif /* MAPRASTER_H */
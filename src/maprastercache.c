@@ -0,0 +1,491 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Per-process caches of raster datasets and tile indexes.
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2024 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** Raster layers open every image, or every tile of a tile index, for each
+** request, and read the tile index shapefile again. With many small tiles,
+** as with mosaics of cloud optimized GeoTIFFs served through FastCGI, the
+** opening of the files and the parsing of their headers costs more than
+** the reading of the pixels. Both can be kept from one request to the next:
+**
+** - MS_RASTER_DATASET_CACHE=n keeps up to n GDAL datasets open. A dataset is
+**   found by path and open options, and reopened if the modification time
+**   of the file changed. Idle datasets are closed, least recently used
+**   first, to stay under the limit. The cache is used with the GDAL lock
+**   (TLOCK_GDAL) held, which the raster code holds from the opening of a
+**   dataset until its release anyway.
+**
+** - MS_TILEINDEX_CACHE=n keeps up to n tile index shapefiles in memory: the
+**   bounds of the tiles in a quadtree, and their TILEITEM and TILESRS
+**   values. An index is loaded again when its .shp or .dbf is modified.
+*/
+
+#include "mapserver.h"
+#include "mapthread.h"
+#include "maptree.h"
+
+#include "cpl_conv.h"
+#include "cpl_string.h"
+#include "gdal.h"
+#include "mapraster.h"
+
+/************************************************************************/
+/*                          Dataset cache                               */
+/************************************************************************/
+
+typedef struct {
+  char *key; /* path and open options */
+  unsigned long long hash;
+  GDALDatasetH hDS;
+  time_t mtime;
+  int refcount; /* users of the dataset, it can't be closed before 0 */
+} rasterDatasetEntry;
+
+static rasterDatasetEntry *datasetCache = NULL;
+static msLRUCacheObj datasetCacheLRU; /* size 0 until allocated */
+
+/* modification time of a file, 0 if it is not a file (VRT XML...) */
+static time_t rasterFileMtime(const char *path) {
+  VSIStatBufL stat_buf;
+  if (VSIStatL(path, &stat_buf) != 0)
+    return 0;
+  return stat_buf.st_mtime;
+}
+
+int msRasterDatasetCacheEnabled(void) {
+  return atoi(CPLGetConfigOption("MS_RASTER_DATASET_CACHE", "0")) > 0;
+}
+
+static void rasterDatasetEntryClose(int slot) {
+  rasterDatasetEntry *entry = &datasetCache[slot];
+  GDALClose(entry->hDS);
+  msFree(entry->key);
+  memset(entry, 0, sizeof(*entry));
+  msLRUCacheRelease(&datasetCacheLRU, slot);
+}
+
+/* only the datasets nobody uses can be closed */
+static int rasterDatasetEntryIdle(int slot, void *arg) {
+  (void)arg;
+  return datasetCache[slot].refcount == 0;
+}
+
+/*
+** Returns the dataset for path, opened with the given drivers and options
+** if it is not cached yet. Must be called with the GDAL lock held, the
+** dataset is given back with msRasterDatasetCacheRelease().
+*/
+GDALDatasetH msRasterDatasetCacheOpen(const char *path,
+                                      char **papszAllowedDrivers,
+                                      char **papszOpenOptions) {
+  const int size = atoi(CPLGetConfigOption("MS_RASTER_DATASET_CACHE", "0"));
+  rasterDatasetEntry *entry;
+  GDALDatasetH hDS;
+  unsigned long long hash;
+  char *key;
+  time_t mtime;
+  int i, slot = -1;
+
+  key = msStrdup(path);
+  for (i = 0; papszAllowedDrivers && papszAllowedDrivers[i]; i++) {
+    key = msStringConcatenate(key, "\n");
+    key = msStringConcatenate(key, papszAllowedDrivers[i]);
+  }
+  key = msStringConcatenate(key, "\n");
+  for (i = 0; papszOpenOptions && papszOpenOptions[i]; i++) {
+    key = msStringConcatenate(key, "\n");
+    key = msStringConcatenate(key, papszOpenOptions[i]);
+  }
+  hash = msFNVHashString(MS_HASH_INIT, key, MS_FALSE);
+  mtime = rasterFileMtime(path);
+
+  for (i = 0; i < datasetCacheLRU.size; i++) {
+    entry = &datasetCache[i];
+    if (!entry->key || entry->hash != hash || strcmp(entry->key, key) != 0)
+      continue;
+    if (entry->mtime == mtime) {
+      msFree(key);
+      entry->refcount++;
+      msLRUCacheTouch(&datasetCacheLRU, i);
+      return entry->hDS;
+    }
+    if (entry->refcount == 0 && slot < 0) {
+      /* the file was replaced, the new one takes the place of the old one */
+      slot = i;
+      rasterDatasetEntryClose(i);
+    }
+  }
+
+  hDS = GDALOpenEx(path, GDAL_OF_RASTER,
+                   (const char *const *)papszAllowedDrivers,
+                   (const char *const *)papszOpenOptions, NULL);
+  if (hDS == NULL || size <= 0) {
+    msFree(key);
+    return hDS;
+  }
+
+  if (!datasetCache) {
+    datasetCache =
+        (rasterDatasetEntry *)msSmallCalloc(size, sizeof(rasterDatasetEntry));
+    msLRUCacheInit(&datasetCacheLRU, size);
+  }
+
+  /* a free slot, or the least recently used idle dataset */
+  if (slot < 0) {
+    slot = msLRUCacheSlot(&datasetCacheLRU, rasterDatasetEntryIdle, NULL);
+    if (slot >= 0 && datasetCache[slot].key)
+      rasterDatasetEntryClose(slot);
+  }
+  if (slot < 0) {
+    /* all of the datasets are in use, this one is not kept */
+    msFree(key);
+    return hDS;
+  }
+
+  entry = &datasetCache[slot];
+  entry->key = key;
+  entry->hash = hash;
+  entry->hDS = hDS;
+  entry->mtime = mtime;
+  entry->refcount = 1;
+  msLRUCacheTouch(&datasetCacheLRU, slot);
+  return hDS;
+}
+
+/*
+** Gives back a dataset from msRasterDatasetCacheOpen(). With bDiscard, the
+** dataset is not kept for later use (after an error). Returns MS_FALSE if
+** the dataset is not cached, and must be closed by the caller.
+*/
+int msRasterDatasetCacheRelease(GDALDatasetH hDS, int bDiscard) {
+  int i;
+  for (i = 0; i < datasetCacheLRU.size; i++) {
+    rasterDatasetEntry *entry = &datasetCache[i];
+    if (entry->key && entry->hDS == hDS) {
+      entry->refcount--;
+      if (bDiscard && entry->refcount == 0)
+        rasterDatasetEntryClose(i);
+      return MS_TRUE;
+    }
+  }
+  return MS_FALSE;
+}
+
+void msRasterDatasetCacheCleanup(void) {
+  int i;
+  msAcquireLock(TLOCK_GDAL);
+  for (i = 0; i < datasetCacheLRU.size; i++) {
+    if (datasetCache[i].key)
+      rasterDatasetEntryClose(i);
+  }
+  msFree(datasetCache);
+  datasetCache = NULL;
+  msLRUCacheFree(&datasetCacheLRU);
+  msReleaseLock(TLOCK_GDAL);
+}
+
+/************************************************************************/
+/*                         Tile index cache                             */
+/************************************************************************/
+
+typedef struct {
+  char *path;
+  char *tileitem;
+  char *tilesrs; /* NULL if the layer has no TILESRS */
+  time_t mtime;
+  int refcount;
+
+  int numtiles;
+  rectObj bounds; /* of all of the tiles */
+  rectObj *tilebounds;
+  char **locations; /* TILEITEM values */
+  char **srs;       /* TILESRS values */
+  treeObj *tree;
+} rasterTileIndexObj;
+
+struct rasterTileIndexCursorObj {
+  rasterTileIndexObj *index;
+  rectObj searchrect;
+  ms_bitarray status; /* candidates from the quadtree */
+  int current;
+};
+
+static rasterTileIndexObj **tileIndexCache = NULL;
+static msLRUCacheObj tileIndexCacheLRU; /* size 0 until allocated */
+
+static void rasterTileIndexFree(rasterTileIndexObj *index) {
+  if (!index)
+    return;
+  msFreeCharArray(index->locations, index->numtiles);
+  msFreeCharArray(index->srs, index->numtiles);
+  msFree(index->tilebounds);
+  msDestroyTree(index->tree);
+  msFree(index->path);
+  msFree(index->tileitem);
+  msFree(index->tilesrs);
+  msFree(index);
+}
+
+/* latest modification time of the .shp and .dbf files */
+static time_t rasterTileIndexMtime(const char *path) {
+  char *shp = msStrdup(path);
+  time_t mtime, dbf_mtime;
+
+  mtime = rasterFileMtime(shp);
+  if (mtime == 0) {
+    msFree(shp);
+    shp = msStrdup(CPLResetExtension(path, "shp"));
+    mtime = rasterFileMtime(shp);
+  }
+  dbf_mtime = rasterFileMtime(CPLResetExtension(shp, "dbf"));
+  msFree(shp);
+  if (mtime == 0 || dbf_mtime == 0)
+    return 0;
+  return MS_MAX(mtime, dbf_mtime);
+}
+
+/* reads the tiles of the shapefile, NULL if it can't be read */
+static rasterTileIndexObj *rasterTileIndexLoad(const char *path,
+                                               const char *tileitem,
+                                               const char *tilesrs,
+                                               time_t mtime) {
+  rasterTileIndexObj *index;
+  shapefileObj shpfile;
+  int i, itemindex, srsindex = -1;
+
+  if (msShapefileOpen(&shpfile, "rb", path, MS_FALSE) == -1)
+    return NULL;
+
+  itemindex = msDBFGetItemIndex(shpfile.hDBF, (char *)tileitem);
+  if (tilesrs)
+    srsindex = msDBFGetItemIndex(shpfile.hDBF, (char *)tilesrs);
+  if (itemindex < 0 || (tilesrs && srsindex < 0)) {
+    /* left to the usual path, which reports the missing attribute */
+    msShapefileClose(&shpfile);
+    return NULL;
+  }
+
+  index = (rasterTileIndexObj *)msSmallCalloc(1, sizeof(rasterTileIndexObj));
+  index->path = msStrdup(path);
+  index->tileitem = msStrdup(tileitem);
+  index->tilesrs = tilesrs ? msStrdup(tilesrs) : NULL;
+  index->mtime = mtime;
+  index->numtiles = shpfile.numshapes;
+  index->bounds = shpfile.bounds;
+  index->tilebounds =
+      (rectObj *)msSmallMalloc(sizeof(rectObj) * MS_MAX(1, index->numtiles));
+  index->locations =
+      (char **)msSmallCalloc(MS_MAX(1, index->numtiles), sizeof(char *));
+  if (tilesrs)
+    index->srs =
+        (char **)msSmallCalloc(MS_MAX(1, index->numtiles), sizeof(char *));
+
+  for (i = 0; i < index->numtiles; i++) {
+    if (msSHPReadBounds(shpfile.hSHP, i, &index->tilebounds[i]) !=
+        MS_SUCCESS) {
+      /* null shape, never selected */
+      index->tilebounds[i].minx = index->tilebounds[i].miny = 1;
+      index->tilebounds[i].maxx = index->tilebounds[i].maxy = -1;
+    }
+    index->locations[i] =
+        msStrdup(msDBFReadStringAttribute(shpfile.hDBF, i, itemindex));
+    if (tilesrs)
+      index->srs[i] =
+          msStrdup(msDBFReadStringAttribute(shpfile.hDBF, i, srsindex));
+  }
+
+  index->tree = msCreateTree(&shpfile, 0);
+  msTreeTrim(index->tree);
+  msShapefileClose(&shpfile);
+
+  return index;
+}
+
+static int rasterTileIndexMatches(const rasterTileIndexObj *index,
+                                  const char *path, const char *tileitem,
+                                  const char *tilesrs) {
+  return strcmp(index->path, path) == 0 &&
+         strcasecmp(index->tileitem, tileitem) == 0 &&
+         (index->tilesrs ? tilesrs && strcasecmp(index->tilesrs, tilesrs) == 0
+                         : tilesrs == NULL);
+}
+
+static void rasterTileIndexRelease(rasterTileIndexObj *index) {
+  int unused;
+  msAcquireLock(TLOCK_TILEINDEX);
+  unused = --index->refcount == 0;
+  msReleaseLock(TLOCK_TILEINDEX);
+  if (unused)
+    rasterTileIndexFree(index);
+}
+
+/*
+** Returns a cursor over the tiles of the tile index of layer, from the cache,
+** or NULL if the cache is disabled or doesn't apply to this tile index (the
+** caller reads it as a layer then).
+*/
+rasterTileIndexCursorObj *msRasterTileIndexCursorOpen(mapObj *map,
+                                                      layerObj *layer) {
+  const int size = atoi(CPLGetConfigOption("MS_TILEINDEX_CACHE", "0"));
+  char szPath[MS_MAXPATHLEN];
+  rasterTileIndexObj *index = NULL, *evicted = NULL;
+  rasterTileIndexCursorObj *cursor;
+  time_t mtime;
+  int i, slot = -1;
+
+  if (size <= 0 || !layer->tileindex || !layer->tileitem)
+    return NULL;
+
+  if (!msBuildPath3(szPath, map->mappath, map->shapepath, layer->tileindex))
+    return NULL;
+  if ((mtime = rasterTileIndexMtime(szPath)) == 0) {
+    if (!msBuildPath(szPath, map->mappath, layer->tileindex) ||
+        (mtime = rasterTileIndexMtime(szPath)) == 0)
+      return NULL;
+  }
+
+  msAcquireLock(TLOCK_TILEINDEX);
+  for (i = 0; i < tileIndexCacheLRU.size; i++) {
+    if (tileIndexCache[i] && tileIndexCache[i]->mtime == mtime &&
+        rasterTileIndexMatches(tileIndexCache[i], szPath, layer->tileitem,
+                               layer->tilesrs)) {
+      index = tileIndexCache[i];
+      index->refcount++;
+      msLRUCacheTouch(&tileIndexCacheLRU, i);
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_TILEINDEX);
+
+  if (!index) {
+    index = rasterTileIndexLoad(szPath, layer->tileitem, layer->tilesrs, mtime);
+    if (!index)
+      return NULL;
+    if (layer->debug)
+      msDebug("msRasterTileIndexCursorOpen(%s): loaded %d tiles of %s.\n",
+              layer->name, index->numtiles, szPath);
+    index->refcount = 2; /* held by the cache and by the cursor */
+
+    msAcquireLock(TLOCK_TILEINDEX);
+    if (!tileIndexCache) {
+      tileIndexCache = (rasterTileIndexObj **)msSmallCalloc(
+          size, sizeof(rasterTileIndexObj *));
+      msLRUCacheInit(&tileIndexCacheLRU, size);
+    }
+    /* an older version of the index, or else a free slot or the least
+     * recently used one */
+    for (i = 0; i < tileIndexCacheLRU.size; i++) {
+      if (tileIndexCache[i] &&
+          rasterTileIndexMatches(tileIndexCache[i], szPath, layer->tileitem,
+                                 layer->tilesrs)) {
+        slot = i;
+        break;
+      }
+    }
+    if (slot < 0)
+      slot = msLRUCacheSlot(&tileIndexCacheLRU, NULL, NULL);
+    if (tileIndexCache[slot] && --tileIndexCache[slot]->refcount == 0)
+      evicted = tileIndexCache[slot];
+    tileIndexCache[slot] = index;
+    msLRUCacheTouch(&tileIndexCacheLRU, slot);
+    msReleaseLock(TLOCK_TILEINDEX);
+
+    rasterTileIndexFree(evicted);
+  }
+
+  cursor = (rasterTileIndexCursorObj *)msSmallCalloc(
+      1, sizeof(rasterTileIndexCursorObj));
+  cursor->index = index;
+  cursor->current = -1;
+  return cursor;
+}
+
+/* selects the tiles overlapping rect, MS_DONE if there are none */
+int msRasterTileIndexCursorWhichTiles(rasterTileIndexCursorObj *cursor,
+                                      rectObj rect) {
+  msFree(cursor->status);
+  cursor->status = NULL;
+  cursor->current = -1;
+  cursor->searchrect = rect;
+
+  if (cursor->index->numtiles == 0 ||
+      msRectOverlap(&cursor->index->bounds, &rect) != MS_TRUE)
+    return MS_DONE;
+
+  cursor->status = msSearchTree(cursor->index->tree, rect);
+  if (!cursor->status) {
+    msSetError(MS_MEMERR, NULL, "msRasterTileIndexCursorWhichTiles()");
+    return MS_FAILURE;
+  }
+  return MS_SUCCESS;
+}
+
+/* next selected tile, in the order of the tile index, MS_DONE at the end */
+int msRasterTileIndexCursorNext(rasterTileIndexCursorObj *cursor,
+                                const char **location, const char **srs) {
+  rasterTileIndexObj *index = cursor->index;
+  int i = cursor->current;
+
+  if (!cursor->status)
+    return MS_DONE;
+
+  while ((i = msGetNextBit(cursor->status, i + 1, index->numtiles)) >= 0) {
+    /* the quadtree gives the tiles of the nodes overlapping the rectangle */
+    if (msRectOverlap(&index->tilebounds[i], &cursor->searchrect) == MS_TRUE)
+      break;
+  }
+  cursor->current = i;
+  if (i < 0)
+    return MS_DONE;
+
+  *location = index->locations[i];
+  *srs = index->srs ? index->srs[i] : NULL;
+  return MS_SUCCESS;
+}
+
+void msRasterTileIndexCursorClose(rasterTileIndexCursorObj *cursor) {
+  if (!cursor)
+    return;
+  rasterTileIndexRelease(cursor->index);
+  msFree(cursor->status);
+  msFree(cursor);
+}
+
+void msRasterTileIndexCacheCleanup(void) {
+  int i;
+  msAcquireLock(TLOCK_TILEINDEX);
+  for (i = 0; i < tileIndexCacheLRU.size; i++) {
+    if (tileIndexCache[i] && --tileIndexCache[i]->refcount == 0)
+      rasterTileIndexFree(tileIndexCache[i]);
+  }
+  msFree(tileIndexCache);
+  tileIndexCache = NULL;
+  msLRUCacheFree(&tileIndexCacheLRU);
+  msReleaseLock(TLOCK_TILEINDEX);
+}
@@ -31,10 +31,40 @@
 #include "mapresample.h"
 #include "mapthread.h"
 
+#include "cpl_multiproc.h"
+
 #define SKIP_MASK(x, y)                                                        \
   (mask_rb && !*(mask_rb->data.rgba.a + (y)*mask_rb->data.rgba.row_step +      \
                  (x)*mask_rb->data.rgba.pixel_step))
 
+/* a band of destination rows isn't worth a thread below this height */
+#define RESAMPLE_MIN_BAND_ROWS 32
+
+/*
+** A band of destination rows [nFirstRow, nLastRow) to resample. Every band
+** writes only to its own rows, so the bands can run in parallel as long as
+** each has a transformer of its own: the PROJ objects behind it cannot be
+** used by two threads at once.
+*/
+typedef struct {
+  imageObj *psSrcImage;
+  rasterBufferObj *src_rb;
+  imageObj *psDstImage;
+  rasterBufferObj *dst_rb;
+  rasterBufferObj *mask_rb;
+  int bWrapAtLeftRight;
+  SimpleTransformer pfnTransform;
+  void *pCBData;
+  int nFirstRow, nLastRow;
+  int nFailedPoints, nSetPoints;
+
+  /* transformer owned by the band, set up by msResampleJobInitTransformer() */
+  int bOwnTransformer;
+  projectionContext *psProjContext;
+  projectionObj sSrcProj, sDstProj;
+  void *pTCBData;
+} resampleJobObj;
+
 /************************************************************************/
 /*                          InvGeoTransform()                           */
 /*                                                                      */
@@ -76,17 +106,18 @@ int InvGeoTransform(double *gt_in, double *gt_out)
 /*                      msNearestRasterResample()                       */
 /************************************************************************/
 
-static int msNearestRasterResampler(
-    imageObj *psSrcImage, rasterBufferObj *src_rb, imageObj *psDstImage,
-    rasterBufferObj *dst_rb, SimpleTransformer pfnTransform, void *pCBData,
-    int debug, rasterBufferObj *mask_rb, int bWrapAtLeftRight)
+static void msNearestRasterResampler(void *pJob)
 
 {
+  resampleJobObj *job = (resampleJobObj *)pJob;
+  imageObj *psSrcImage = job->psSrcImage, *psDstImage = job->psDstImage;
+  rasterBufferObj *src_rb = job->src_rb, *dst_rb = job->dst_rb;
+  rasterBufferObj *mask_rb = job->mask_rb;
+  int bWrapAtLeftRight = job->bWrapAtLeftRight;
   double *x, *y;
   int nDstX, nDstY;
   int *panSuccess;
   int nDstXSize = psDstImage->width;
-  int nDstYSize = psDstImage->height;
   int nSrcXSize = psSrcImage->width;
   int nSrcYSize = psSrcImage->height;
   int nFailedPoints = 0, nSetPoints = 0;
@@ -97,13 +128,13 @@ static int msNearestRasterResampler(
   y = (double *)msSmallMalloc(sizeof(double) * nDstXSize);
   panSuccess = (int *)msSmallMalloc(sizeof(int) * nDstXSize);
 
-  for (nDstY = 0; nDstY < nDstYSize; nDstY++) {
+  for (nDstY = job->nFirstRow; nDstY < job->nLastRow; nDstY++) {
     for (nDstX = 0; nDstX < nDstXSize; nDstX++) {
       x[nDstX] = nDstX + 0.5;
       y[nDstX] = nDstY + 0.5;
     }
 
-    pfnTransform(pCBData, nDstXSize, x, y, panSuccess);
+    job->pfnTransform(job->pCBData, nDstXSize, x, y, panSuccess);
 
     for (nDstX = 0; nDstX < nDstXSize; nDstX++) {
       int nSrcX, nSrcY;
@@ -203,16 +234,34 @@ static int msNearestRasterResampler(
   free(x);
   free(y);
 
-  /* -------------------------------------------------------------------- */
-  /*      Some debugging output.                                          */
-  /* -------------------------------------------------------------------- */
-  if (nFailedPoints > 0 && debug) {
-    msDebug("msNearestRasterResampler: "
-            "%d failed to transform, %d actually set.\n",
-            nFailedPoints, nSetPoints);
-  }
+  job->nFailedPoints = nFailedPoints;
+  job->nSetPoints = nSetPoints;
+}
+
+/************************************************************************/
+/*                          msSourceSampleRGBA()                        */
+/*                                                                      */
+/*      Accumulate the pixel at offset rb_off of a RGBA buffer.  The    */
+/*      bilinear and average resamplers call this directly for          */
+/*      plugin renderers, so that the image format is tested once per   */
+/*      output pixel rather than once per source sample.                */
+/************************************************************************/
 
-  return 0;
+static inline void msSourceSampleRGBA(const rgbaArrayObj *rgba, int rb_off,
+                                      double *padfPixelSum, double dfWeight,
+                                      double *pdfWeightSum)
+
+{
+  if (rgba->a == NULL || rgba->a[rb_off] > 1) {
+    padfPixelSum[0] += rgba->r[rb_off] * dfWeight;
+    padfPixelSum[1] += rgba->g[rb_off] * dfWeight;
+    padfPixelSum[2] += rgba->b[rb_off] * dfWeight;
+
+    if (rgba->a == NULL)
+      *pdfWeightSum += dfWeight;
+    else
+      *pdfWeightSum += dfWeight * (rgba->a[rb_off] / 255.0);
+  }
 }
 
 /************************************************************************/
@@ -226,21 +275,10 @@ static void msSourceSample(imageObj *psSrcImage, rasterBufferObj *rb, int iSrcX,
 {
   if (MS_RENDERER_PLUGIN(psSrcImage->format)) {
     rgbaArrayObj *rgba;
-    int rb_off;
     assert(rb && rb->type == MS_BUFFER_BYTE_RGBA);
     rgba = &(rb->data.rgba);
-    rb_off = iSrcX * rgba->pixel_step + iSrcY * rgba->row_step;
-
-    if (rgba->a == NULL || rgba->a[rb_off] > 1) {
-      padfPixelSum[0] += rgba->r[rb_off] * dfWeight;
-      padfPixelSum[1] += rgba->g[rb_off] * dfWeight;
-      padfPixelSum[2] += rgba->b[rb_off] * dfWeight;
-
-      if (rgba->a == NULL)
-        *pdfWeightSum += dfWeight;
-      else
-        *pdfWeightSum += dfWeight * (rgba->a[rb_off] / 255.0);
-    }
+    msSourceSampleRGBA(rgba, iSrcX * rgba->pixel_step + iSrcY * rgba->row_step,
+                       padfPixelSum, dfWeight, pdfWeightSum);
   } else if (MS_RENDERER_RAWDATA(psSrcImage->format)) {
     int band;
     int src_off;
@@ -284,36 +322,43 @@ static void msSourceSample(imageObj *psSrcImage, rasterBufferObj *rb, int iSrcX,
 /*                      msBilinearRasterResample()                      */
 /************************************************************************/
 
-static int msBilinearRasterResampler(
-    imageObj *psSrcImage, rasterBufferObj *src_rb, imageObj *psDstImage,
-    rasterBufferObj *dst_rb, SimpleTransformer pfnTransform, void *pCBData,
-    int debug, rasterBufferObj *mask_rb, int bWrapAtLeftRight)
+static void msBilinearRasterResampler(void *pJob)
 
 {
+  resampleJobObj *job = (resampleJobObj *)pJob;
+  imageObj *psSrcImage = job->psSrcImage, *psDstImage = job->psDstImage;
+  rasterBufferObj *src_rb = job->src_rb, *dst_rb = job->dst_rb;
+  rasterBufferObj *mask_rb = job->mask_rb;
+  int bWrapAtLeftRight = job->bWrapAtLeftRight;
+  const rgbaArrayObj *rgba = NULL;
   double *x, *y;
   int nDstX, nDstY, i;
   int *panSuccess;
   int nDstXSize = psDstImage->width;
-  int nDstYSize = psDstImage->height;
   int nSrcXSize = psSrcImage->width;
   int nSrcYSize = psSrcImage->height;
   int nFailedPoints = 0, nSetPoints = 0;
   double *padfPixelSum;
   int bandCount = MS_MAX(4, psSrcImage->format->bands);
 
+  if (MS_RENDERER_PLUGIN(psSrcImage->format)) {
+    assert(src_rb && src_rb->type == MS_BUFFER_BYTE_RGBA);
+    rgba = &(src_rb->data.rgba);
+  }
+
   padfPixelSum = (double *)msSmallMalloc(sizeof(double) * bandCount);
 
   x = (double *)msSmallMalloc(sizeof(double) * nDstXSize);
   y = (double *)msSmallMalloc(sizeof(double) * nDstXSize);
   panSuccess = (int *)msSmallMalloc(sizeof(int) * nDstXSize);
 
-  for (nDstY = 0; nDstY < nDstYSize; nDstY++) {
+  for (nDstY = job->nFirstRow; nDstY < job->nLastRow; nDstY++) {
     for (nDstX = 0; nDstX < nDstXSize; nDstX++) {
       x[nDstX] = nDstX + 0.5;
       y[nDstX] = nDstY + 0.5;
     }
 
-    pfnTransform(pCBData, nDstXSize, x, y, panSuccess);
+    job->pfnTransform(job->pCBData, nDstXSize, x, y, panSuccess);
 
     for (nDstX = 0; nDstX < nDstXSize; nDstX++) {
       int nSrcX, nSrcY, nSrcX2, nSrcY2;
@@ -358,19 +403,37 @@ static int msBilinearRasterResampler(
 
       memset(padfPixelSum, 0, sizeof(double) * bandCount);
 
-      msSourceSample(psSrcImage, src_rb, nSrcX % nSrcXSize, nSrcY, padfPixelSum,
-                     (1.0 - dfRatioX2) * (1.0 - dfRatioY2), &dfWeightSum);
+      if (rgba) {
+        const int nCol = (nSrcX % nSrcXSize) * rgba->pixel_step;
+        const int nCol2 = (nSrcX2 % nSrcXSize) * rgba->pixel_step;
+        const int nRow = nSrcY * rgba->row_step;
+        const int nRow2 = nSrcY2 * rgba->row_step;
+
+        msSourceSampleRGBA(rgba, nCol + nRow, padfPixelSum,
+                           (1.0 - dfRatioX2) * (1.0 - dfRatioY2),
+                           &dfWeightSum);
+        msSourceSampleRGBA(rgba, nCol2 + nRow, padfPixelSum,
+                           (dfRatioX2) * (1.0 - dfRatioY2), &dfWeightSum);
+        msSourceSampleRGBA(rgba, nCol + nRow2, padfPixelSum,
+                           (1.0 - dfRatioX2) * (dfRatioY2), &dfWeightSum);
+        msSourceSampleRGBA(rgba, nCol2 + nRow2, padfPixelSum,
+                           (dfRatioX2) * (dfRatioY2), &dfWeightSum);
+      } else {
+        msSourceSample(psSrcImage, src_rb, nSrcX % nSrcXSize, nSrcY,
+                       padfPixelSum, (1.0 - dfRatioX2) * (1.0 - dfRatioY2),
+                       &dfWeightSum);
 
-      msSourceSample(psSrcImage, src_rb, nSrcX2 % nSrcXSize, nSrcY,
-                     padfPixelSum, (dfRatioX2) * (1.0 - dfRatioY2),
-                     &dfWeightSum);
+        msSourceSample(psSrcImage, src_rb, nSrcX2 % nSrcXSize, nSrcY,
+                       padfPixelSum, (dfRatioX2) * (1.0 - dfRatioY2),
+                       &dfWeightSum);
 
-      msSourceSample(psSrcImage, src_rb, nSrcX % nSrcXSize, nSrcY2,
-                     padfPixelSum, (1.0 - dfRatioX2) * (dfRatioY2),
-                     &dfWeightSum);
+        msSourceSample(psSrcImage, src_rb, nSrcX % nSrcXSize, nSrcY2,
+                       padfPixelSum, (1.0 - dfRatioX2) * (dfRatioY2),
+                       &dfWeightSum);
 
-      msSourceSample(psSrcImage, src_rb, nSrcX2 % nSrcXSize, nSrcY2,
-                     padfPixelSum, (dfRatioX2) * (dfRatioY2), &dfWeightSum);
+        msSourceSample(psSrcImage, src_rb, nSrcX2 % nSrcXSize, nSrcY2,
+                       padfPixelSum, (dfRatioX2) * (dfRatioY2), &dfWeightSum);
+      }
 
       if (dfWeightSum == 0.0)
         continue;
@@ -429,16 +492,8 @@ static int msBilinearRasterResampler(
   free(x);
   free(y);
 
-  /* -------------------------------------------------------------------- */
-  /*      Some debugging output.                                          */
-  /* -------------------------------------------------------------------- */
-  if (nFailedPoints > 0 && debug) {
-    msDebug("msBilinearRasterResampler: "
-            "%d failed to transform, %d actually set.\n",
-            nFailedPoints, nSetPoints);
-  }
-
-  return 0;
+  job->nFailedPoints = nFailedPoints;
+  job->nSetPoints = nSetPoints;
 }
 
 /************************************************************************/
@@ -454,6 +509,7 @@ static int msAverageSample(imageObj *psSrcImage, rasterBufferObj *src_rb,
   int nXMin, nXMax, nYMin, nYMax, iX, iY;
   double dfWeightSum = 0.0;
   double dfMaxWeight = 0.0;
+  const rgbaArrayObj *rgba = NULL;
 
   nXMin = (int)dfXMin;
   nYMin = (int)dfYMin;
@@ -462,6 +518,11 @@ static int msAverageSample(imageObj *psSrcImage, rasterBufferObj *src_rb,
 
   *pdfAlpha01 = 0.0;
 
+  if (MS_RENDERER_PLUGIN(psSrcImage->format)) {
+    assert(src_rb && src_rb->type == MS_BUFFER_BYTE_RGBA);
+    rgba = &(src_rb->data.rgba);
+  }
+
   for (iY = nYMin; iY < nYMax; iY++) {
     double dfYCellMin, dfYCellMax;
 
@@ -476,8 +537,12 @@ static int msAverageSample(imageObj *psSrcImage, rasterBufferObj *src_rb,
 
       dfWeight = (dfXCellMax - dfXCellMin) * (dfYCellMax - dfYCellMin);
 
-      msSourceSample(psSrcImage, src_rb, iX, iY, padfPixelSum, dfWeight,
-                     &dfWeightSum);
+      if (rgba)
+        msSourceSampleRGBA(rgba, iX * rgba->pixel_step + iY * rgba->row_step,
+                           padfPixelSum, dfWeight, &dfWeightSum);
+      else
+        msSourceSample(psSrcImage, src_rb, iX, iY, padfPixelSum, dfWeight,
+                       &dfWeightSum);
       dfMaxWeight += dfWeight;
     }
   }
@@ -497,18 +562,17 @@ static int msAverageSample(imageObj *psSrcImage, rasterBufferObj *src_rb,
 /*                      msAverageRasterResample()                       */
 /************************************************************************/
 
-static int
-msAverageRasterResampler(imageObj *psSrcImage, rasterBufferObj *src_rb,
-                         imageObj *psDstImage, rasterBufferObj *dst_rb,
-                         SimpleTransformer pfnTransform, void *pCBData,
-                         int debug, rasterBufferObj *mask_rb)
+static void msAverageRasterResampler(void *pJob)
 
 {
+  resampleJobObj *job = (resampleJobObj *)pJob;
+  imageObj *psSrcImage = job->psSrcImage, *psDstImage = job->psDstImage;
+  rasterBufferObj *src_rb = job->src_rb, *dst_rb = job->dst_rb;
+  rasterBufferObj *mask_rb = job->mask_rb;
   double *x1, *y1, *x2, *y2;
   int nDstX, nDstY;
   int *panSuccess1, *panSuccess2;
   int nDstXSize = psDstImage->width;
-  int nDstYSize = psDstImage->height;
   int nFailedPoints = 0, nSetPoints = 0;
   double *padfPixelSum;
 
@@ -523,7 +587,7 @@ msAverageRasterResampler(imageObj *psSrcImage, rasterBufferObj *src_rb,
   panSuccess1 = (int *)msSmallMalloc(sizeof(int) * (nDstXSize + 1));
   panSuccess2 = (int *)msSmallMalloc(sizeof(int) * (nDstXSize + 1));
 
-  for (nDstY = 0; nDstY < nDstYSize; nDstY++) {
+  for (nDstY = job->nFirstRow; nDstY < job->nLastRow; nDstY++) {
     for (nDstX = 0; nDstX <= nDstXSize; nDstX++) {
       x1[nDstX] = nDstX;
       y1[nDstX] = nDstY;
@@ -531,8 +595,8 @@ msAverageRasterResampler(imageObj *psSrcImage, rasterBufferObj *src_rb,
       y2[nDstX] = nDstY + 1;
     }
 
-    pfnTransform(pCBData, nDstXSize + 1, x1, y1, panSuccess1);
-    pfnTransform(pCBData, nDstXSize + 1, x2, y2, panSuccess2);
+    job->pfnTransform(job->pCBData, nDstXSize + 1, x1, y1, panSuccess1);
+    job->pfnTransform(job->pCBData, nDstXSize + 1, x2, y2, panSuccess2);
 
     for (nDstX = 0; nDstX < nDstXSize; nDstX++) {
       double dfXMin, dfYMin, dfXMax, dfYMax;
@@ -615,16 +679,8 @@ msAverageRasterResampler(imageObj *psSrcImage, rasterBufferObj *src_rb,
   free(x2);
   free(y2);
 
-  /* -------------------------------------------------------------------- */
-  /*      Some debugging output.                                          */
-  /* -------------------------------------------------------------------- */
-  if (nFailedPoints > 0 && debug) {
-    msDebug("msAverageRasterResampler: "
-            "%d failed to transform, %d actually set.\n",
-            nFailedPoints, nSetPoints);
-  }
-
-  return 0;
+  job->nFailedPoints = nFailedPoints;
+  job->nSetPoints = nSetPoints;
 }
 
 /************************************************************************/
@@ -1169,6 +1225,161 @@ msTransformMapToSource(int nDstXSize, int nDstYSize, double *adfDstGeoTransform,
   return MS_TRUE;
 }
 
+/************************************************************************/
+/*                    msResampleJobInitTransformer()                    */
+/*                                                                      */
+/*      Give a band a transformer of its own, on copies of the source   */
+/*      and destination projections living in their own projection      */
+/*      context, so that it can run in a separate thread.               */
+/************************************************************************/
+
+static int msResampleJobInitTransformer(resampleJobObj *job,
+                                        projectionObj *psSrcProj,
+                                        double *padfSrcGeoTransform,
+                                        projectionObj *psDstProj,
+                                        double *padfDstGeoTransform,
+                                        double dfMaxError)
+
+{
+  job->bOwnTransformer = MS_TRUE;
+  job->pTCBData = NULL;
+  job->pCBData = NULL;
+  msInitProjection(&(job->sSrcProj));
+  msInitProjection(&(job->sDstProj));
+  job->psProjContext = msProjectionContextGetFromPool();
+  if (job->psProjContext == NULL)
+    return MS_FAILURE;
+  msProjectionSetContext(&(job->sSrcProj), job->psProjContext);
+  msProjectionSetContext(&(job->sDstProj), job->psProjContext);
+
+  if (msCopyProjection(&(job->sSrcProj), psSrcProj) != MS_SUCCESS ||
+      msCopyProjection(&(job->sDstProj), psDstProj) != MS_SUCCESS)
+    return MS_FAILURE;
+
+  job->pTCBData =
+      msInitProjTransformer(&(job->sSrcProj), padfSrcGeoTransform,
+                            &(job->sDstProj), padfDstGeoTransform);
+  if (job->pTCBData == NULL)
+    return MS_FAILURE;
+
+  job->pfnTransform = msApproxTransformer;
+  job->pCBData =
+      msInitApproxTransformer(msProjTransformer, job->pTCBData, dfMaxError);
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                    msResampleJobFreeTransformer()                    */
+/************************************************************************/
+
+static void msResampleJobFreeTransformer(resampleJobObj *job)
+
+{
+  if (!job->bOwnTransformer)
+    return;
+  msFreeApproxTransformer(job->pCBData);
+  msFreeProjTransformer(job->pTCBData);
+  msFreeProjection(&(job->sSrcProj));
+  msFreeProjection(&(job->sDstProj));
+  if (job->psProjContext)
+    msProjectionContextReleaseToPool(job->psProjContext);
+  job->bOwnTransformer = MS_FALSE;
+}
+
+/************************************************************************/
+/*                         msResampleInBands()                          */
+/*                                                                      */
+/*      Run a resampler over the destination image, split in            */
+/*      nThreads bands of rows.  The first band runs in the calling     */
+/*      thread with the transformer of the job, the others each get     */
+/*      their own.  A band whose transformer or thread cannot be        */
+/*      created is resampled in the calling thread once the others      */
+/*      are done, with the shared transformer if need be.  As every     */
+/*      destination row is transformed and written the same way        */
+/*      whatever band it falls in, the result does not depend on the    */
+/*      number of threads.                                              */
+/************************************************************************/
+
+static void msResampleInBands(CPLThreadFunc pfnResampler, resampleJobObj *job,
+                              int nThreads, projectionObj *psSrcProj,
+                              double *padfSrcGeoTransform,
+                              projectionObj *psDstProj,
+                              double *padfDstGeoTransform, double dfMaxError)
+
+{
+  const int nDstXSize = job->psDstImage->width;
+  const int nDstYSize = job->psDstImage->height;
+  resampleJobObj *jobs;
+  CPLJoinableThread **threads;
+  int nRowAlign = 1, t;
+
+  job->nFirstRow = 0;
+  job->nLastRow = nDstYSize;
+  job->nFailedPoints = job->nSetPoints = 0;
+  job->bOwnTransformer = MS_FALSE;
+
+  if (nThreads > nDstYSize / RESAMPLE_MIN_BAND_ROWS)
+    nThreads = nDstYSize / RESAMPLE_MIN_BAND_ROWS;
+  if (nThreads <= 1) {
+    pfnResampler(job);
+    return;
+  }
+
+  /* raw data images flag their pixels in the bits of img_mask: start the */
+  /* bands on a word boundary so that no word is shared by two threads    */
+  while ((nRowAlign * nDstXSize) % MS_ARRAY_BIT != 0)
+    nRowAlign++;
+
+  jobs = (resampleJobObj *)msSmallMalloc(nThreads * sizeof(resampleJobObj));
+  threads = (CPLJoinableThread **)msSmallCalloc(nThreads,
+                                                sizeof(CPLJoinableThread *));
+  for (t = 0; t < nThreads; t++) {
+    jobs[t] = *job;
+    jobs[t].nFirstRow =
+        (int)((size_t)nDstYSize * t / nThreads) / nRowAlign * nRowAlign;
+    jobs[t].nLastRow =
+        t == nThreads - 1
+            ? nDstYSize
+            : (int)((size_t)nDstYSize * (t + 1) / nThreads) / nRowAlign *
+                  nRowAlign;
+  }
+
+  for (t = 1; t < nThreads; t++) {
+    if (msResampleJobInitTransformer(&jobs[t], psSrcProj, padfSrcGeoTransform,
+                                     psDstProj, padfDstGeoTransform,
+                                     dfMaxError) == MS_SUCCESS)
+      threads[t] = CPLCreateJoinableThread(pfnResampler, &jobs[t]);
+  }
+
+  pfnResampler(&jobs[0]);
+
+  for (t = 1; t < nThreads; t++) {
+    if (threads[t])
+      CPLJoinThread(threads[t]);
+  }
+
+  for (t = 1; t < nThreads; t++) {
+    if (!threads[t]) {
+      if (jobs[t].pCBData == NULL) {
+        /* no transformer of its own, the shared one is free by now */
+        msResampleJobFreeTransformer(&jobs[t]);
+        jobs[t].pfnTransform = job->pfnTransform;
+        jobs[t].pCBData = job->pCBData;
+      }
+      pfnResampler(&jobs[t]);
+    }
+    msResampleJobFreeTransformer(&jobs[t]);
+  }
+
+  for (t = 0; t < nThreads; t++) {
+    job->nFailedPoints += jobs[t].nFailedPoints;
+    job->nSetPoints += jobs[t].nSetPoints;
+  }
+
+  free(threads);
+  free(jobs);
+}
+
 /************************************************************************/
 /*                        msResampleGDALToMap()                         */
 /************************************************************************/
@@ -1192,6 +1403,10 @@ int msResampleGDALToMap(mapObj *map, layerObj *layer, imageObj *image,
   rasterBufferObj src_rb, *psrc_rb = NULL, *mask_rb = NULL;
   int bAddPixelMargin = MS_TRUE;
   int bWrapAtLeftRight = MS_FALSE;
+  resampleJobObj sJob;
+  CPLThreadFunc pfnResampler;
+  const char *pszResampler, *pszNumThreads;
+  int nThreads = 1;
 
   const char *resampleMode = CSLFetchNameValue(layer->processing, "RESAMPLE");
 
@@ -1610,18 +1825,45 @@ int msResampleGDALToMap(mapObj *map, layerObj *layer, imageObj *image,
   /* -------------------------------------------------------------------- */
   /*      Perform the resampling.                                         */
   /* -------------------------------------------------------------------- */
-  if (EQUAL(resampleMode, "AVERAGE"))
-    result = msAverageRasterResampler(srcImage, psrc_rb, image, rb,
-                                      msApproxTransformer, pACBData,
-                                      layer->debug, mask_rb);
-  else if (EQUAL(resampleMode, "BILINEAR"))
-    result = msBilinearRasterResampler(srcImage, psrc_rb, image, rb,
-                                       msApproxTransformer, pACBData,
-                                       layer->debug, mask_rb, bWrapAtLeftRight);
-  else
-    result = msNearestRasterResampler(srcImage, psrc_rb, image, rb,
-                                      msApproxTransformer, pACBData,
-                                      layer->debug, mask_rb, bWrapAtLeftRight);
+  if (EQUAL(resampleMode, "AVERAGE")) {
+    pfnResampler = msAverageRasterResampler;
+    pszResampler = "msAverageRasterResampler";
+  } else if (EQUAL(resampleMode, "BILINEAR")) {
+    pfnResampler = msBilinearRasterResampler;
+    pszResampler = "msBilinearRasterResampler";
+  } else {
+    pfnResampler = msNearestRasterResampler;
+    pszResampler = "msNearestRasterResampler";
+  }
+
+  pszNumThreads = msLayerGetProcessingKey(layer, "RESAMPLE_NUM_THREADS");
+  if (pszNumThreads && EQUAL(pszNumThreads, "ALL_CPUS"))
+    nThreads = CPLGetNumCPUs();
+  else if (pszNumThreads)
+    nThreads = atoi(pszNumThreads);
+
+  memset(&sJob, 0, sizeof(sJob));
+  sJob.psSrcImage = srcImage;
+  sJob.src_rb = psrc_rb;
+  sJob.psDstImage = image;
+  sJob.dst_rb = rb;
+  sJob.mask_rb = mask_rb;
+  sJob.bWrapAtLeftRight = bWrapAtLeftRight;
+  sJob.pfnTransform = msApproxTransformer;
+  sJob.pCBData = pACBData;
+
+  msResampleInBands(pfnResampler, &sJob, nThreads, &(layer->projection),
+                    adfSrcGeoTransform, &(map->projection), adfDstGeoTransform,
+                    0.333);
+
+  /* -------------------------------------------------------------------- */
+  /*      Some debugging output.                                          */
+  /* -------------------------------------------------------------------- */
+  if (sJob.nFailedPoints > 0 && layer->debug) {
+    msDebug("%s: "
+            "%d failed to transform, %d actually set.\n",
+            pszResampler, sJob.nFailedPoints, sJob.nSetPoints);
+  }
 
   /* -------------------------------------------------------------------- */
   /*      cleanup                                                         */
@@ -0,0 +1,249 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Packed Hilbert R-tree spatial index for shapefiles (.qrt).
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2024 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** The .qrt file is a 48 byte header followed by the nodes of a packed
+** Hilbert R-tree as written by the FlatGeobuf PackedRTree class. Leaf items
+** carry the shape bounds and the shape index in the offset field, so a
+** search returns exact candidates without reading the .shp bounds again.
+**
+** Header, all values little endian:
+**   0  "QRT" signature and a version byte (1)
+**   4  uint16 node size, 2 bytes reserved
+**   8  int32 number of shapes in the shapefile
+**  12  int32 number of indexed (non null) shapes
+**  16  4 doubles, extent of the indexed shapes
+*/
+
+#include "mapserver.h"
+#include "maptree.h"
+
+#include "flatgeobuf/packedrtree.h"
+
+#include "cpl_port.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace mapserver::FlatGeobuf;
+
+#define MS_RTREE_HEADER_SIZE 48
+#define MS_RTREE_VERSION 1
+
+int msWriteRTree(shapefileObj *shapefile, const char *filename, int nodesize) {
+  std::vector<NodeItem> items;
+  rectObj bounds;
+  int i;
+
+  if (nodesize <= 0)
+    nodesize = MS_RTREE_DEFAULT_NODESIZE;
+  if (nodesize < 2 || nodesize > 65535) {
+    msSetError(MS_MISCERR, "Invalid node size %d.", "msWriteRTree()",
+               nodesize);
+    return MS_FAILURE;
+  }
+
+  try {
+    items.reserve(shapefile->numshapes);
+    for (i = 0; i < shapefile->numshapes; i++) {
+      if (msSHPReadBounds(shapefile->hSHP, i, &bounds) != MS_SUCCESS)
+        continue; /* NULL or empty shape, never part of a search result */
+      items.push_back({bounds.minx, bounds.miny, bounds.maxx, bounds.maxy,
+                       (uint64_t)i});
+    }
+    msResetErrorList(); /* failures above are expected for NULL shapes */
+
+    if (items.empty()) {
+      msSetError(MS_SHPERR, "No shape to index in %s.", "msWriteRTree()",
+                 shapefile->source);
+      return MS_FAILURE;
+    }
+
+    const ms_int32 numitems = (ms_int32)items.size();
+    const NodeItem extent = calcExtent(items);
+    hilbertSort(items);
+    PackedRTree tree(items, extent, (uint16_t)nodesize);
+    std::vector<NodeItem>().swap(items); /* the tree has its own copy */
+
+    /* header */
+    unsigned char header[MS_RTREE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, "QRT", 3);
+    header[3] = MS_RTREE_VERSION;
+    uint16_t nNodeSize = (uint16_t)nodesize;
+    CPL_LSBPTR16(&nNodeSize);
+    memcpy(header + 4, &nNodeSize, 2);
+    ms_int32 nValue = shapefile->numshapes;
+    CPL_LSBPTR32(&nValue);
+    memcpy(header + 8, &nValue, 4);
+    nValue = numitems;
+    CPL_LSBPTR32(&nValue);
+    memcpy(header + 12, &nValue, 4);
+    double adfExtent[4] = {extent.minX, extent.minY, extent.maxX, extent.maxY};
+    for (int k = 0; k < 4; k++) {
+      CPL_LSBPTR64(&adfExtent[k]);
+      memcpy(header + 16 + 8 * k, &adfExtent[k], 8);
+    }
+
+    VSILFILE *fp = VSIFOpenL(filename, "wb");
+    if (!fp) {
+      msSetError(MS_IOERR, "Unable to create %s.", "msWriteRTree()", filename);
+      return MS_FAILURE;
+    }
+
+    bool ok = VSIFWriteL(header, sizeof(header), 1, fp) == 1;
+    tree.streamWrite([fp, &ok](uint8_t *data, size_t size) {
+      if (ok && VSIFWriteL(data, 1, size, fp) != size)
+        ok = false;
+    });
+    if (VSIFCloseL(fp) != 0)
+      ok = false;
+    if (!ok) {
+      msSetError(MS_IOERR, "Failed to write %s.", "msWriteRTree()", filename);
+      return MS_FAILURE;
+    }
+  } catch (const std::exception &e) {
+    msSetError(MS_MEMERR, "Failed to build index: %s", "msWriteRTree()",
+               e.what());
+    return MS_FAILURE;
+  }
+
+  return MS_SUCCESS;
+}
+
+int msSearchDiskRTree(const char *filename, rectObj aoi, int debug,
+                      int numshapes, ms_int32 **ids, int *numids) {
+  VSILFILE *fp;
+  shpMappedFileObj map;
+  unsigned char header[MS_RTREE_HEADER_SIZE];
+  uint16_t nodesize;
+  ms_int32 nValue, numitems;
+  int status = MS_SUCCESS;
+
+  *ids = NULL;
+  *numids = 0;
+
+  fp = VSIFOpenL(filename, "rb");
+  if (!fp) {
+    /* try the upper case extension, like for .qix files */
+    std::string osUpper(filename);
+    const size_t nExtLen = strlen(MS_RTREE_INDEX_EXTENSION);
+    if (osUpper.size() > nExtLen) {
+      for (size_t k = osUpper.size() - nExtLen; k < osUpper.size(); k++)
+        osUpper[k] = (char)toupper(osUpper[k]);
+      fp = VSIFOpenL(osUpper.c_str(), "rb");
+    }
+  }
+  if (!fp)
+    return MS_DONE; /* no index */
+
+  memset(&map, 0, sizeof(map));
+  if (msSHPMapFileEnabled())
+    msSHPMapFile(fp, &map);
+
+  if (map.data) {
+    if (map.size < MS_RTREE_HEADER_SIZE)
+      status = MS_FAILURE;
+    else
+      memcpy(header, map.data, MS_RTREE_HEADER_SIZE);
+  } else if (VSIFSeekL(fp, 0, SEEK_SET) != 0 ||
+             VSIFReadL(header, MS_RTREE_HEADER_SIZE, 1, fp) != 1) {
+    status = MS_FAILURE;
+  }
+
+  if (status == MS_SUCCESS) {
+    memcpy(&nodesize, header + 4, 2);
+    CPL_LSBPTR16(&nodesize);
+    memcpy(&nValue, header + 8, 4);
+    CPL_LSBPTR32(&nValue);
+    memcpy(&numitems, header + 12, 4);
+    CPL_LSBPTR32(&numitems);
+
+    if (memcmp(header, "QRT", 3) != 0 || header[3] != MS_RTREE_VERSION ||
+        nodesize < 2 || numitems <= 0 || numitems > numshapes ||
+        nValue != numshapes)
+      status = MS_FAILURE;
+  }
+
+  if (status == MS_SUCCESS) {
+    try {
+      const NodeItem n{aoi.minx, aoi.miny, aoi.maxx, aoi.maxy, 0};
+      const uint64_t treesize = PackedRTree::size(numitems, nodesize);
+      const auto readNode = [fp, &map, treesize](uint8_t *buf, size_t i,
+                                                 size_t s) {
+        if (i + s > treesize)
+          throw std::runtime_error("Node outside of the index");
+        if (map.data) {
+          if (MS_RTREE_HEADER_SIZE + i + s > map.size)
+            throw std::runtime_error("Truncated index");
+          memcpy(buf, map.data + MS_RTREE_HEADER_SIZE + i, s);
+          return;
+        }
+        if (VSIFSeekL(fp, MS_RTREE_HEADER_SIZE + i, SEEK_SET) != 0)
+          throw std::runtime_error("Unable to seek in file");
+        if (VSIFReadL(buf, 1, s, fp) != s)
+          throw std::runtime_error("Unable to read file");
+      };
+
+      const auto found =
+          PackedRTree::streamSearch(numitems, nodesize, n, readNode);
+
+      /* return the ids in file order */
+      *ids = (ms_int32 *)msSmallMalloc(sizeof(ms_int32) *
+                                       std::max<size_t>(found.size(), 1));
+      for (const auto &item : found) {
+        if (item.offset >= (uint64_t)numshapes)
+          throw std::runtime_error("Invalid shape index");
+        (*ids)[(*numids)++] = (ms_int32)item.offset;
+      }
+      std::sort(*ids, *ids + *numids);
+    } catch (const std::exception &e) {
+      msFree(*ids);
+      *ids = NULL;
+      *numids = 0;
+      status = MS_FAILURE;
+    }
+  }
+
+  msSHPUnmapFile(&map);
+  VSIFCloseL(fp);
+
+  if (status == MS_FAILURE)
+    msSetError(MS_SHPERR, "The spatial index file %s is corrupt.",
+               "msSearchDiskRTree()", filename);
+  else if (debug >= MS_DEBUGLEVEL_VVV)
+    msDebug("msSearchDiskRTree(): %d shapes found in %s\n", *numids,
+            filename);
+
+  return status;
+}
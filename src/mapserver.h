@@ -235,6 +235,8 @@ extern "C" {
 #define MS_TEMPLATE_EXPR "\\.(xml|wml|html|htm|svg|kml|gml|js|tmpl)$"
 
 #define MS_INDEX_EXTENSION ".qix"
+#define MS_RTREE_INDEX_EXTENSION ".qrt"
+#define MS_GENERALIZED_EXTENSION ".shg"
 
 #define MS_QUERY_RESULTS_MAGIC_STRING "MapServer Query Results"
 #define MS_QUERY_PARAMS_MAGIC_STRING "MapServer Query Params"
@@ -1034,6 +1036,9 @@ typedef struct {
   int compiled;
 
   char *native_string; /* RFC 91 */
+
+  /* compiled form of the token list, see mapexpression.c */
+  struct exprProgram *program;
 } expressionObj;
 
 typedef struct {
@@ -1078,7 +1083,10 @@ typedef struct {
   int expand_searchrect;
   int radius;
   float power;
+  int num_threads; /* at most MS_INTERPOLATION_MAX_THREADS */
 } interpolationProcessingParams;
+
+#define MS_INTERPOLATION_MAX_THREADS 64
 #endif
 
 /************************************************************************/
@@ -1205,6 +1213,14 @@ typedef struct {
   int max_cached_shape_ram_amount; /* maximum number of bytes taken by shapes
                                       cached in the total number of
                                       resultCacheObj */
+
+  /* when set, the results of MS_QUERY_MULTIPLE queries are handed to this
+     function as soon as they are found instead of being stored in the
+     resultCacheObj, which only counts them. Returning MS_FAILURE aborts the
+     query. */
+  int (*result_callback)(struct layerObj *layer, shapeObj *shape,
+                         void *userdata);
+  void *result_callback_data;
 } queryObj;
 #endif
 
@@ -1738,6 +1754,11 @@ typedef struct {
   int markercachesize; ///< TODO
   labelCacheMemberObj *labels;
   markerCacheMemberObj *markers;
+#ifndef SWIG
+  struct labelCacheGridObj
+      *markergrid;        /* spatial index over markers, see maplabel.c */
+  int numindexedmarkers; /* number of markers already in markergrid */
+#endif
 } labelCacheSlotObj;
 
 /************************************************************************/
@@ -1757,6 +1778,8 @@ typedef struct {
                */
   labelCacheMemberObj **rendered_text_symbols;
   int num_allocated_rendered_members;
+  struct labelCacheGridObj
+      *rendered_grid; /* spatial index over rendered_text_symbols */
 #endif
 } labelCacheObj;
 
@@ -2127,6 +2150,8 @@ typedef struct {
   char *filter;
   char **processing;
 } originalScaleTokenStrings;
+
+typedef struct msClassIndexObj msClassIndexObj; /* see mapclassindex.c */
 #endif
 
 /**
@@ -2146,6 +2171,9 @@ struct layerObj {
   int project; /* boolean variable, do we need to project this layer or not */
   reprojectionObj *reprojectorLayerToMap;
   reprojectionObj *reprojectorMapToLayer;
+  msArenaObj *arena; /* for the shapes read while drawing, see maparena.c */
+  msClassIndexObj *classindex; /* classes by CLASSITEM value, built by
+                                  msShapeGetNextClass(), see mapclassindex.c */
 
   featureListNodeObjPtr features; /* linked list so we don't need a counter */
   featureListNodeObjPtr currentfeature; /* pointer to the current feature */
@@ -2399,6 +2427,10 @@ void msPopulateTextSymbolForLabelAndString(textSymbolObj *ts, labelObj *l,
 #define MS_RESOLUTION_MAX 1000 /* applies to resolution and defresolution */
 #define MS_RESOLUTION_MIN 10
 
+#ifndef SWIG
+typedef struct msMetricsObj msMetricsObj; /* see mapmetrics.c */
+#endif
+
 /**
 The :ref:`MAP <map>` object
 */
@@ -2420,6 +2452,12 @@ struct mapObj { /* structure for a map */
   queryObj query;
   projectionContext *projContext;
 
+  /* timings and counters of the current request, NULL unless set (and
+   * owned) by the application, see mapmetrics.c */
+  msMetricsObj *metrics;
+
+  char *mapfile; /* full path of the mapfile, NULL if loaded from a string */
+
 #endif /* SWIG */
 
 #ifdef SWIG
@@ -2744,6 +2782,8 @@ void msReplaceFreeableStr(char **ppszStr, char *pszNewStr);
 MS_DLL_EXPORT char **msTokenizeMap(char *filename, int *numtokens);
 MS_DLL_EXPORT int msInitLabelCache(labelCacheObj *cache);
 MS_DLL_EXPORT int msFreeLabelCache(labelCacheObj *cache);
+int msInitLabelCacheSlot(labelCacheSlotObj *cacheslot);
+int msFreeLabelCacheSlot(labelCacheSlotObj *cacheslot);
 MS_DLL_EXPORT int msCheckConnection(
     layerObj *layer); /* connection pooling functions (mapfile.c) */
 MS_DLL_EXPORT void msCloseConnections(mapObj *map);
@@ -3034,10 +3074,17 @@ MS_DLL_EXPORT int msTestLabelCacheCollisions(mapObj *map,
                                              int current_label);
 MS_DLL_EXPORT int msTestLabelCacheLeaderCollision(mapObj *map, pointObj *lp1,
                                                   pointObj *lp2);
+MS_DLL_EXPORT void msFreeLabelCacheGrid(struct labelCacheGridObj *grid);
+MS_DLL_EXPORT void msSetLabelCacheGridLinear(int linear);
 MS_DLL_EXPORT labelCacheMemberObj *
 msGetLabelCacheMember(labelCacheObj *labelcache, int i);
 
 MS_DLL_EXPORT void msFreeShape(shapeObj *shape); /* in mapprimitive.c */
+MS_DLL_EXPORT void *msShapeAllocMemory(shapeObj *shape, size_t size);
+MS_DLL_EXPORT void msShapeFreeMemory(shapeObj *shape, void *ptr);
+MS_DLL_EXPORT void *msShapeReallocMemory(shapeObj *shape, void *ptr,
+                                         size_t oldsize, size_t newsize);
+MS_DLL_EXPORT void msShapeFreeValues(shapeObj *shape);
 int msGetShapeRAMSize(shapeObj *shape);          /* in mapprimitive.c */
 MS_DLL_EXPORT void msFreeLabelPathObj(labelPathObj *path);
 MS_DLL_EXPORT shapeObj *msShapeFromWKT(const char *string);
@@ -3152,6 +3199,59 @@ MS_DLL_EXPORT void msSetAllBits(ms_bitarray array, int index, int value);
 MS_DLL_EXPORT void msFlipBit(ms_bitarray array, int index);
 MS_DLL_EXPORT int msGetNextBit(ms_const_bitarray array, int index, int size);
 
+/* in maparena.c */
+MS_DLL_EXPORT msArenaObj *msArenaCreate(size_t blocksize);
+MS_DLL_EXPORT void msArenaDestroy(msArenaObj *arena);
+MS_DLL_EXPORT void msArenaReset(msArenaObj *arena);
+MS_DLL_EXPORT void *msArenaAlloc(msArenaObj *arena, size_t size);
+MS_DLL_EXPORT char *msArenaStrdup(msArenaObj *arena, const char *s);
+MS_DLL_EXPORT int msArenaOwns(const msArenaObj *arena, const void *ptr);
+
+/* in mapclassindex.c */
+int msClassIndexGetNextClass(layerObj *layer, mapObj *map, shapeObj *shape,
+                             int currentclass, const int *classgroup,
+                             int numclasses, int *classindex);
+void msClassIndexRecheck(msClassIndexObj *index);
+void msClassIndexFree(msClassIndexObj *index);
+
+/* in mapmetrics.c */
+enum MS_METRIC_SPAN {
+  MS_METRIC_LAYER_OPEN,  /* msLayerOpen() */
+  MS_METRIC_WHICHSHAPES, /* msLayerWhichShapes() */
+  MS_METRIC_LAYER_DRAW,  /* msDrawLayer(), includes the two above */
+  MS_METRIC_LABELCACHE,  /* msDrawLabelCache() */
+  MS_METRIC_ENCODE,      /* msSaveImage(), msSaveImageBuffer() */
+  MS_METRIC_NUMSPANS
+};
+enum MS_METRIC_COUNTER {
+  MS_METRIC_FEATURES_FETCHED, /* shapes returned by msLayerNextShape() */
+  MS_METRIC_FEATURES_DRAWN,
+  MS_METRIC_BYTES_WRITTEN,
+  MS_METRIC_CACHE_HITS, /* mapfile cache of mapserv */
+  MS_METRIC_CACHE_MISSES,
+  MS_METRIC_NUMCOUNTERS
+};
+MS_DLL_EXPORT msMetricsObj *msMetricsCreate(void);
+MS_DLL_EXPORT void msMetricsDestroy(msMetricsObj *metrics);
+MS_DLL_EXPORT double msMetricsNow(void);
+MS_DLL_EXPORT void msMetricsAddSpan(msMetricsObj *metrics,
+                                    const layerObj *layer,
+                                    enum MS_METRIC_SPAN span, double start);
+MS_DLL_EXPORT void msMetricsAddCount(msMetricsObj *metrics,
+                                     const layerObj *layer,
+                                     enum MS_METRIC_COUNTER counter,
+                                     double value);
+MS_DLL_EXPORT void msMetricsMerge(msMetricsObj *metrics,
+                                  const msMetricsObj *other);
+MS_DLL_EXPORT char *msMetricsToJSON(const msMetricsObj *metrics,
+                                    const char *request, const char *mapname,
+                                    int status);
+MS_DLL_EXPORT int msMetricsEndRequest(msMetricsObj *metrics,
+                                      const char *request,
+                                      const char *mapname, int status);
+MS_DLL_EXPORT char *msMetricsGetPrometheusText(void);
+MS_DLL_EXPORT void msMetricsCleanup(void);
+
 /* maplayer.c - layerObj  api */
 
 MS_DLL_EXPORT int msLayerInitItemInfo(layerObj *layer);
@@ -3161,6 +3261,7 @@ MS_DLL_EXPORT int msLayerOpen(layerObj *layer); /* in maplayer.c */
 MS_DLL_EXPORT int msLayerApplyScaletokens(layerObj *layer, double scale);
 MS_DLL_EXPORT int msLayerRestoreFromScaletokens(layerObj *layer);
 MS_DLL_EXPORT int msClusterLayerOpen(layerObj *layer); /* in mapcluster.c */
+MS_DLL_EXPORT void msClusterCacheCleanup(void); /* in mapcluster.c */
 MS_DLL_EXPORT int msLayerIsOpen(layerObj *layer);
 MS_DLL_EXPORT void msLayerClose(layerObj *layer);
 MS_DLL_EXPORT void msLayerFreeExpressions(layerObj *layer);
@@ -3204,6 +3305,10 @@ MS_DLL_EXPORT int msLayerSupportsCommonFilters(layerObj *layer);
 MS_DLL_EXPORT const char *msExpressionTokenToString(int token);
 MS_DLL_EXPORT int msTokenizeExpression(expressionObj *expression, char **list,
                                        int *listsize);
+MS_DLL_EXPORT int msCompileExpression(expressionObj *expression);
+MS_DLL_EXPORT void msFreeCompiledExpression(expressionObj *expression);
+MS_DLL_EXPORT int msEvalCompiledExpression(const expressionObj *expression,
+                                           const shapeObj *shape, int *result);
 
 MS_DLL_EXPORT int msLayerSetTimeFilter(layerObj *lp, const char *timestring,
                                        const char *timefield);
@@ -3252,6 +3357,9 @@ reprojectionObj MS_DLL_EXPORT *msLayerGetReprojectorToMap(layerObj *layer,
 
 MS_DLL_EXPORT int msOGRGeometryToShape(OGRGeometryH hGeometry, shapeObj *shape,
                                        OGRwkbGeometryType type);
+MS_DLL_EXPORT int msOGRWkbGeometryToShape(const unsigned char *wkb,
+                                          size_t size, shapeObj *shape,
+                                          int layertype);
 
 MS_DLL_EXPORT int msInitializeVirtualTable(layerObj *layer);
 MS_DLL_EXPORT int msConnectLayer(layerObj *layer, const int connectiontype,
@@ -3284,6 +3392,9 @@ void msRasterLabelLayerUseMapExtentAndProjectionForNextWhichShapes(
     layerObj *layer, mapObj *map);
 rectObj msRasterLabelGetSearchRect(layerObj *layer, mapObj *map);
 
+MS_DLL_EXPORT void msSHPLayerUseGeneralizedForNextWhichShapes(layerObj *layer,
+                                                              int use);
+
 /* ==================================================================== */
 /*      Prototypes for functions in mapdraw.c                           */
 /* ==================================================================== */
@@ -3303,6 +3414,19 @@ MS_DLL_EXPORT int msDrawQueryLayer(mapObj *map, layerObj *layer,
 MS_DLL_EXPORT int msDrawWMSLayer(mapObj *map, layerObj *layer, imageObj *image);
 MS_DLL_EXPORT int msDrawWFSLayer(mapObj *map, layerObj *layer, imageObj *image);
 
+/* ==================================================================== */
+/*      Prototypes for functions in mapdrawparallel.c                   */
+/* ==================================================================== */
+
+typedef struct parallelDrawObj parallelDrawObj;
+parallelDrawObj *msDrawLayersParallelStart(mapObj *map, int querymap);
+void msDrawLayersParallelWait(parallelDrawObj *pd);
+int msDrawLayersParallelHandlesLayer(parallelDrawObj *pd, int layerindex);
+int msDrawLayersParallelMerge(parallelDrawObj *pd, mapObj *map, int layerindex,
+                              imageObj *image);
+void msDrawLayersParallelFree(parallelDrawObj *pd);
+void msDrawParallelCleanup(void);
+
 #define MS_DRAWMODE_FEATURES 0x00001
 #define MS_DRAW_FEATURES(mode) (MS_DRAWMODE_FEATURES & (mode))
 #define MS_DRAWMODE_LABELS 0x00002
@@ -3425,6 +3549,7 @@ MS_DLL_EXPORT int msJoinConnect(layerObj *layer, joinObj *join);
 MS_DLL_EXPORT int msJoinPrepare(joinObj *join, shapeObj *shape);
 MS_DLL_EXPORT int msJoinNext(joinObj *join);
 MS_DLL_EXPORT int msJoinClose(joinObj *join);
+void msJoinCacheCleanup(void);
 
 /*in mapraster.c */
 int msDrawRasterLayerLowCheckIfMustDraw(mapObj *map, layerObj *layer);
@@ -3437,6 +3562,10 @@ int msDrawRasterLayerLowWithDataset(mapObj *map, layerObj *layer,
                                     imageObj *image, rasterBufferObj *rb,
                                     void *hDatasetIn);
 
+/* in maprastercache.c */
+void msRasterDatasetCacheCleanup(void);
+void msRasterTileIndexCacheCleanup(void);
+
 MS_DLL_EXPORT int msDrawRasterLayerLow(mapObj *map, layerObj *layer,
                                        imageObj *image, rasterBufferObj *rb);
 MS_DLL_EXPORT int msGetClass(layerObj *layer, colorObj *color,
@@ -3466,6 +3595,15 @@ MS_DLL_EXPORT int msCleanupInterpolationDataset(mapObj *map, imageObj *image,
                                                 layerObj *layer,
                                                 void *cleanup_ptr);
 
+/* in idw.c */
+MS_DLL_EXPORT void msIdw(float *xyz, int width, int height, int npoints,
+                         interpolationProcessingParams *interpParams,
+                         unsigned char *iValues);
+
+/* in kerneldensity.c */
+MS_DLL_EXPORT void msGaussianBlur(float *values, int width, int height,
+                                  int radius, int num_threads);
+
 /* in mapchart.c */
 MS_DLL_EXPORT int msDrawChartLayer(mapObj *map, layerObj *layer,
                                    imageObj *image);
@@ -3992,16 +4130,28 @@ typedef struct _autobuffer {
 } bufferObj;
 
 /* in mapimageio.c */
-int msQuantizeRasterBuffer(rasterBufferObj *rb, unsigned int *reqcolors,
-                           rgbaPixel *palette, rgbaPixel *forced_palette,
-                           int num_forced_palette_entries,
-                           unsigned int *palette_scaling_maxval);
-int msClassifyRasterBuffer(rasterBufferObj *rb, rasterBufferObj *qrb);
+MS_DLL_EXPORT int msQuantizeRasterBuffer(rasterBufferObj *rb,
+                                         unsigned int *reqcolors,
+                                         rgbaPixel *palette,
+                                         rgbaPixel *forced_palette,
+                                         int num_forced_palette_entries,
+                                         unsigned int *palette_scaling_maxval);
+MS_DLL_EXPORT int msClassifyRasterBuffer(rasterBufferObj *rb,
+                                         rasterBufferObj *qrb);
+MS_DLL_EXPORT int msPaletteCacheGet(const char *key, time_t mtime,
+                                    rgbaPixel *palette,
+                                    unsigned int *num_entries);
+MS_DLL_EXPORT void msPaletteCacheSet(const char *key, time_t mtime,
+                                     const rgbaPixel *palette,
+                                     unsigned int num_entries);
+MS_DLL_EXPORT void msPaletteCacheCleanup(void);
 int msSaveRasterBuffer(mapObj *map, rasterBufferObj *data, FILE *stream,
                        outputFormatObj *format);
-int msSaveRasterBufferToBuffer(rasterBufferObj *data, bufferObj *buffer,
-                               outputFormatObj *format);
-int msLoadMSRasterBufferFromFile(char *path, rasterBufferObj *rb);
+MS_DLL_EXPORT int msSaveRasterBufferToBuffer(rasterBufferObj *data,
+                                             bufferObj *buffer,
+                                             outputFormatObj *format);
+MS_DLL_EXPORT int msLoadMSRasterBufferFromFile(char *path,
+                                               rasterBufferObj *rb);
 
 /* in mapagg.cpp */
 void msApplyBlurringCompositingFilter(rasterBufferObj *rb, unsigned int radius);
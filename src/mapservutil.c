@@ -39,6 +39,8 @@
 
 #include "cpl_conv.h"
 
+#include <sys/stat.h>
+
 /*
 ** Enumerated types, keep the query modes in sequence and at the end of the
 *enumeration (mode enumeration is in maptemplate.h).
@@ -68,6 +70,11 @@ static char *const modeStrings[23] = {"BROWSE",
                                       "MAPLEGEND",
                                       "MAPLEGENDICON"};
 
+/* name of a mode as in the mode parameter, "other" if it is not one */
+const char *msCGIGetModeName(int mode) {
+  return (mode >= 0 && mode < numModes) ? modeStrings[mode] : "other";
+}
+
 static int commonLoadForm(mapservObj *mapserv, mapObj *map);
 
 void msCGIWriteError(mapservObj *mapserv) {
@@ -159,6 +166,133 @@ static void setClassGroup(layerObj *layer, char *classgroup) {
   }
 }
 
+/*
+** Per-process cache of parsed mapfiles, enabled by setting MS_MAPFILE_CACHE
+** to the maximum number of mapfiles to keep. Each entry holds a pristine
+** mapObj as returned by msLoadMap() that is never handed out directly:
+** requests get a copy made with msCopyMap() so that substitutions and CGI
+** map modifications cannot leak from one request to the next. Entries are
+** keyed by mapfile path and invalidated when the file modification time
+** changes (INCLUDEd files are not tracked).
+*/
+typedef struct {
+  char *filename;
+  time_t mtime;
+  const configObj *config;
+  mapObj *map;
+} mapCacheEntryObj;
+
+static mapCacheEntryObj *mapCacheEntries = NULL;
+static msLRUCacheObj mapCacheLRU; /* size 0 until allocated */
+static mapCacheStatsObj mapCacheStats = {0, 0, 0.0, 0.0};
+
+static double elapsedSeconds(const struct mstimeval *start) {
+  struct mstimeval end;
+  msGettimeofday(&end, NULL);
+  return (end.tv_sec + end.tv_usec / 1.0e6) -
+         (start->tv_sec + start->tv_usec / 1.0e6);
+}
+
+static void freeMapCacheEntry(mapCacheEntryObj *entry) {
+  msFree(entry->filename);
+  msFreeMap(entry->map);
+  memset(entry, 0, sizeof(*entry));
+}
+
+const mapCacheStatsObj *msCGIGetMapCacheStats(void) { return &mapCacheStats; }
+
+void msCGIFreeMapCache(void) {
+  int i;
+  for (i = 0; i < mapCacheLRU.size; i++)
+    freeMapCacheEntry(&mapCacheEntries[i]);
+  msFree(mapCacheEntries);
+  mapCacheEntries = NULL;
+  msLRUCacheFree(&mapCacheLRU);
+}
+
+/*
+** Returns a private copy of the map for this request, going through the
+** mapfile cache when it is enabled. Falls back to msLoadMap() otherwise.
+*/
+static mapObj *loadCachedMap(const char *filename, const configObj *config) {
+  const char *cache_size = CPLGetConfigOption("MS_MAPFILE_CACHE", NULL);
+  int max_entries = cache_size ? atoi(cache_size) : 0;
+  mapCacheEntryObj *entry = NULL;
+  struct mstimeval starttime;
+  struct stat stat_buf;
+  mapObj *map;
+  int i, slot = -1;
+
+  if (max_entries <= 0 || stat(filename, &stat_buf) != 0)
+    return msLoadMap(filename, NULL, config);
+
+  if (mapCacheEntries == NULL) {
+    mapCacheEntries = (mapCacheEntryObj *)msSmallCalloc(
+        max_entries, sizeof(mapCacheEntryObj));
+    msLRUCacheInit(&mapCacheLRU, max_entries);
+  }
+
+  for (i = 0; i < mapCacheLRU.size; i++) {
+    if (mapCacheEntries[i].filename &&
+        strcmp(mapCacheEntries[i].filename, filename) == 0 &&
+        mapCacheEntries[i].config == config) {
+      entry = &mapCacheEntries[i];
+      slot = i;
+      break;
+    }
+  }
+
+  if (entry == NULL || entry->mtime != stat_buf.st_mtime) {
+    /* miss or stale entry: parse the mapfile and keep the pristine result */
+    msGettimeofday(&starttime, NULL);
+    map = msLoadMap(filename, NULL, config);
+    if (map == NULL)
+      return NULL;
+    mapCacheStats.misses++;
+    mapCacheStats.parse_time += elapsedSeconds(&starttime);
+
+    if (entry == NULL) {
+      /* a free slot, or the least recently used one */
+      slot = msLRUCacheSlot(&mapCacheLRU, NULL, NULL);
+      entry = &mapCacheEntries[slot];
+    }
+    if (entry->filename)
+      freeMapCacheEntry(entry);
+
+    entry->filename = msStrdup(filename);
+    entry->mtime = stat_buf.st_mtime;
+    entry->config = config;
+    entry->map = map;
+  } else {
+    mapCacheStats.hits++;
+  }
+  msLRUCacheTouch(&mapCacheLRU, slot);
+
+  msGettimeofday(&starttime, NULL);
+  map = msNewMapObj();
+  if (map == NULL)
+    return NULL;
+  if (msCopyMap(map, entry->map) != MS_SUCCESS) {
+    msFreeMap(map);
+    return NULL;
+  }
+  /* msCopyMap() leaves the default LATLON of the new map */
+  msFreeProjection(&map->latlon);
+  if (msInitProjection(&map->latlon) == -1) {
+    msFreeMap(map);
+    return NULL;
+  }
+  msProjectionSetContext(&map->latlon, map->projContext);
+  if (msCopyProjection(&map->latlon, &entry->map->latlon) != MS_SUCCESS) {
+    msFreeMap(map);
+    return NULL;
+  }
+  msApplyMapConfigOptions(map);
+  mapCacheStats.copy_time += elapsedSeconds(&starttime);
+
+  return map;
+}
+
 /*
 ** Extract Map File name from params and load it.
 ** Returns map object or NULL on error.
@@ -245,9 +379,11 @@ mapObj *msCGILoadMap(mapservObj *mapserv, configObj *config) {
   }
 
   /* ok to try to load now */
-  map = msLoadMap(ms_mapfile, NULL, config);
+  map = loadCachedMap(ms_mapfile, config);
   if (!map)
     return NULL;
+  msFree(mapserv->MapFile);
+  mapserv->MapFile = msStrdup(ms_mapfile);
 
   /* handle common parameters */
   if (commonLoadForm(mapserv, map) != MS_SUCCESS) {
@@ -1978,6 +2114,35 @@ int msCGIDispatchQueryRequest(mapservObj *mapserv) {
   return MS_SUCCESS;
 }
 
+static void msCGISendImageHeaders(mapservObj *mapserv) {
+  /*
+   ** Set the Cache control headers if the option is set.
+   */
+  if (mapserv->sendheaders &&
+      msLookupHashTable(&(mapserv->map->web.metadata), "http_max_age")) {
+    msIO_setHeader(
+        "Cache-Control", "max-age=%s",
+        msLookupHashTable(&(mapserv->map->web.metadata), "http_max_age"));
+  }
+
+  if (mapserv->sendheaders) {
+    const char *attachment =
+        msGetOutputFormatOption(mapserv->map->outputformat, "ATTACHMENT", NULL);
+    if (attachment)
+      msIO_setHeader("Content-disposition", "attachment; filename=%s",
+                     attachment);
+
+    if (!strcmp(MS_IMAGE_MIME_TYPE(mapserv->map->outputformat),
+                "application/json")) {
+      msIO_setHeader("Content-Type", "application/json; charset=utf-8");
+    } else {
+      msIO_setHeader("Content-Type", "%s",
+                     MS_IMAGE_MIME_TYPE(mapserv->map->outputformat));
+    }
+    msIO_sendHeaders();
+  }
+}
+
 int msCGIDispatchImageRequest(mapservObj *mapserv) {
   int status;
   imageObj *img = NULL;
@@ -2011,6 +2176,18 @@ int msCGIDispatchImageRequest(mapservObj *mapserv) {
       return MS_SUCCESS;
     }
 
+    if (msTileCacheEnabled(mapserv)) {
+      int size = 0;
+      unsigned char *buffer = msTileCacheDraw(mapserv, &size);
+      if (buffer == NULL)
+        return MS_FAILURE;
+      msCGISendImageHeaders(mapserv);
+      status = msIO_fwrite(buffer, 1, size, stdout) == size ? MS_SUCCESS
+                                                            : MS_FAILURE;
+      free(buffer);
+      return status;
+    }
+
     img = msTileDraw(mapserv);
     break;
   case LEGEND:
@@ -2025,32 +2202,7 @@ int msCGIDispatchImageRequest(mapservObj *mapserv) {
   if (!img)
     return MS_FAILURE;
 
-  /*
-   ** Set the Cache control headers if the option is set.
-   */
-  if (mapserv->sendheaders &&
-      msLookupHashTable(&(mapserv->map->web.metadata), "http_max_age")) {
-    msIO_setHeader(
-        "Cache-Control", "max-age=%s",
-        msLookupHashTable(&(mapserv->map->web.metadata), "http_max_age"));
-  }
-
-  if (mapserv->sendheaders) {
-    const char *attachment =
-        msGetOutputFormatOption(mapserv->map->outputformat, "ATTACHMENT", NULL);
-    if (attachment)
-      msIO_setHeader("Content-disposition", "attachment; filename=%s",
-                     attachment);
-
-    if (!strcmp(MS_IMAGE_MIME_TYPE(mapserv->map->outputformat),
-                "application/json")) {
-      msIO_setHeader("Content-Type", "application/json; charset=utf-8");
-    } else {
-      msIO_setHeader("Content-Type", "%s",
-                     MS_IMAGE_MIME_TYPE(mapserv->map->outputformat));
-    }
-    msIO_sendHeaders();
-  }
+  msCGISendImageHeaders(mapserv);
 
   if (mapserv->Mode == MAP || mapserv->Mode == TILE)
     status = msSaveImage(mapserv->map, img, NULL);
@@ -43,6 +43,8 @@
 #include "mapows.h"
 
 #include <cpl_conv.h>
+#include <cpl_string.h>
+#include <cpl_virtualmem.h>
 #include <ogr_srs_api.h>
 
 /* Only use this macro on 32-bit integers! */
@@ -223,6 +225,9 @@ SHPHandle msSHPOpenVirtualFile(VSILFILE *fpSHP, VSILFILE *fpSHX) {
   psSHP->panParts = NULL;
   psSHP->nBufSize = psSHP->nPartMax = 0;
 
+  memset(&psSHP->sSHPMap, 0, sizeof(shpMappedFileObj));
+  memset(&psSHP->sSHXMap, 0, sizeof(shpMappedFileObj));
+
   psSHP->fpSHP = fpSHP;
   psSHP->fpSHX = fpSHX;
 
@@ -445,7 +450,65 @@ SHPHandle msSHPOpen(const char *pszLayer, const char *pszAccess) {
   free(pszFullname);
   free(pszBasename);
 
-  return msSHPOpenVirtualFile(fpSHP, fpSHX);
+  SHPHandle psSHP = msSHPOpenVirtualFile(fpSHP, fpSHX);
+
+  /* -------------------------------------------------------------------- */
+  /*      Read-only local files can be decoded straight from the page     */
+  /*      cache, files that cannot be mapped are read as usual.           */
+  /* -------------------------------------------------------------------- */
+  if (psSHP && strcmp(pszAccess, "rb") == 0 && msSHPMapFileEnabled()) {
+    msSHPMapFile(psSHP->fpSHX, &psSHP->sSHXMap);
+    msSHPMapFile(psSHP->fpSHP, &psSHP->sSHPMap);
+  }
+
+  return psSHP;
+}
+
+/************************************************************************/
+/*                        msSHPMapFileEnabled()                         */
+/*                                                                      */
+/*      Are shapefiles and their indexes to be memory mapped?           */
+/************************************************************************/
+int msSHPMapFileEnabled(void) {
+  return CPLIsVirtualMemFileMapAvailable() &&
+         CPLTestBool(CPLGetConfigOption("MS_SHAPEFILE_MMAP", "NO"));
+}
+
+/************************************************************************/
+/*                            msSHPMapFile()                            */
+/*                                                                      */
+/*      Map a whole file read-only. Only files on a local filesystem    */
+/*      can be mapped, MS_FAILURE is returned quietly for the others.   */
+/************************************************************************/
+int msSHPMapFile(VSILFILE *fp, shpMappedFileObj *map) {
+  vsi_l_offset nSize;
+
+  memset(map, 0, sizeof(shpMappedFileObj));
+
+  if (VSIFGetNativeFileDescriptorL(fp) == NULL)
+    return MS_FAILURE; /* /vsimem/, /vsicurl/... */
+
+  if (VSIFSeekL(fp, 0, SEEK_END) != 0)
+    return MS_FAILURE;
+  nSize = VSIFTellL(fp);
+  if (nSize == 0 || nSize > (vsi_l_offset)(~(size_t)0))
+    return MS_FAILURE;
+
+  map->mem = CPLVirtualMemFileMapNew(fp, 0, nSize, VIRTUALMEM_READONLY, NULL,
+                                     NULL);
+  if (map->mem == NULL)
+    return MS_FAILURE;
+
+  map->data = (const uchar *)CPLVirtualMemGetAddr(map->mem);
+  map->size = (size_t)nSize;
+
+  return MS_SUCCESS;
+}
+
+void msSHPUnmapFile(shpMappedFileObj *map) {
+  if (map->mem)
+    CPLVirtualMemFree(map->mem);
+  memset(map, 0, sizeof(shpMappedFileObj));
 }
 
 /************************************************************************/
@@ -470,6 +533,9 @@ void msSHPClose(SHPHandle psSHP) {
   free(psSHP->pabyRec);
   free(psSHP->panParts);
 
+  msSHPUnmapFile(&psSHP->sSHPMap);
+  msSHPUnmapFile(&psSHP->sSHXMap);
+
   VSIFCloseL(psSHP->fpSHX);
   VSIFCloseL(psSHP->fpSHP);
 
@@ -1119,6 +1185,41 @@ static uchar *msSHPReadAllocateBuffer(SHPHandle psSHP, int hEntity,
   return psSHP->pabyRec;
 }
 
+/*
+** msSHPReadRecord() - Fetch the nEntitySize bytes (header included) of a
+** record. Mapped files are decoded in place, otherwise the record is read
+** into the record buffer.
+*/
+static const uchar *msSHPReadRecord(SHPHandle psSHP, int hEntity,
+                                    int nEntitySize,
+                                    const char *pszCallingFunction) {
+  const int offset = msSHXReadOffset(psSHP, hEntity);
+
+  if (psSHP->sSHPMap.data) {
+    if (offset <= 0 ||
+        (size_t)offset + nEntitySize > psSHP->sSHPMap.size) {
+      msSetError(MS_IOERR, "record %d lies outside of the .shp file",
+                 pszCallingFunction, hEntity);
+      return NULL;
+    }
+    return psSHP->sSHPMap.data + offset;
+  }
+
+  uchar *pabyRec = msSHPReadAllocateBuffer(psSHP, hEntity, pszCallingFunction);
+  if (pabyRec == NULL)
+    return NULL;
+
+  if (offset <= 0 || 0 != VSIFSeekL(psSHP->fpSHP, offset, 0)) {
+    msSetError(MS_IOERR, "failed to seek offset", pszCallingFunction);
+    return NULL;
+  }
+  if (1 != VSIFReadL(pabyRec, nEntitySize, 1, psSHP->fpSHP)) {
+    msSetError(MS_IOERR, "failed to fread record", pszCallingFunction);
+    return NULL;
+  }
+  return pabyRec;
+}
+
 /*
 ** msSHPReadPoint() - Reads a single point from a POINT shape file.
 */
@@ -1154,22 +1255,13 @@ int msSHPReadPoint(SHPHandle psSHP, int hEntity, pointObj *point) {
     return (MS_FAILURE);
   }
 
-  uchar *pabyRec = msSHPReadAllocateBuffer(psSHP, hEntity, "msSHPReadPoint()");
-  if (pabyRec == NULL) {
-    return MS_FAILURE;
-  }
-
   /* -------------------------------------------------------------------- */
   /*      Read the record.                                                */
   /* -------------------------------------------------------------------- */
-  const int offset = msSHXReadOffset(psSHP, hEntity);
-  if (offset <= 0 || 0 != VSIFSeekL(psSHP->fpSHP, offset, 0)) {
-    msSetError(MS_IOERR, "failed to seek offset", "msSHPReadPoint()");
-    return (MS_FAILURE);
-  }
-  if (1 != VSIFReadL(pabyRec, nEntitySize, 1, psSHP->fpSHP)) {
-    msSetError(MS_IOERR, "failed to fread record", "msSHPReadPoint()");
-    return (MS_FAILURE);
+  const uchar *pabyRec =
+      msSHPReadRecord(psSHP, hEntity, nEntitySize, "msSHPReadPoint()");
+  if (pabyRec == NULL) {
+    return MS_FAILURE;
   }
 
   memcpy(&(point->x), pabyRec + 12, 8);
@@ -1183,6 +1275,30 @@ int msSHPReadPoint(SHPHandle psSHP, int hEntity, pointObj *point) {
   return (MS_SUCCESS);
 }
 
+/*
+** msSHXDecodeRecord() - Decode one 8 byte .shx record into a byte offset and
+** size, invalid values are returned as 0.
+*/
+static void msSHXDecodeRecord(const uchar *pabyRec, int *pnOffset,
+                              int *pnSize) {
+  ms_int32 nOffset, nSize;
+
+  memcpy(&nOffset, pabyRec, 4);
+  memcpy(&nSize, pabyRec + 4, 4);
+
+  /* SHX uses big endian numbers for the offsets, so we have to flip them */
+  /* if we are a little endian machine. */
+  if (!bBigEndian) {
+    nOffset = SWAP_FOUR_BYTES(nOffset);
+    nSize = SWAP_FOUR_BYTES(nSize);
+  }
+
+  /* SHX stores the offsets in 2 byte units, so we double them to get */
+  /* an offset in bytes. */
+  *pnOffset = (nOffset > 0 && nOffset < INT_MAX / 2) ? nOffset * 2 : 0;
+  *pnSize = (nSize > 0 && nSize < INT_MAX / 2) ? nSize * 2 : 0;
+}
+
 /*
 ** msSHXLoadPage()
 **
@@ -1230,33 +1346,9 @@ static bool msSHXLoadPage(SHPHandle psSHP, int shxBufferPage) {
 
   /* Copy the buffer contents out into the working arrays. */
   for (i = 0; i < nShapesToCache; i++) {
-    int tmpOffset, tmpSize;
-
-    memcpy(&tmpOffset, (buffer + (8 * i)), 4);
-    memcpy(&tmpSize, (buffer + (8 * i) + 4), 4);
-
-    /* SHX uses big endian numbers for the offsets, so we have to flip them */
-    /* if we are a little endian machine. */
-    if (!bBigEndian) {
-      tmpOffset = SWAP_FOUR_BYTES(tmpOffset);
-      tmpSize = SWAP_FOUR_BYTES(tmpSize);
-    }
-
-    /* SHX stores the offsets in 2 byte units, so we double them to get */
-    /* an offset in bytes. */
-    if (tmpOffset > 0 && tmpOffset < INT_MAX / 2)
-      tmpOffset = tmpOffset * 2;
-    else
-      tmpOffset = 0;
-
-    if (tmpSize > 0 && tmpSize < INT_MAX / 2)
-      tmpSize = tmpSize * 2;
-    else
-      tmpSize = 0;
-
-    /* Write the answer into the working arrays on the SHPHandle */
-    psSHP->panRecOffset[shxBufferPage * SHX_BUFFER_PAGE + i] = tmpOffset;
-    psSHP->panRecSize[shxBufferPage * SHX_BUFFER_PAGE + i] = tmpSize;
+    msSHXDecodeRecord((uchar *)buffer + 8 * i,
+                      &psSHP->panRecOffset[shxBufferPage * SHX_BUFFER_PAGE + i],
+                      &psSHP->panRecSize[shxBufferPage * SHX_BUFFER_PAGE + i]);
   }
 
   msSetBit(psSHP->panRecLoaded, shxBufferPage, 1);
@@ -1282,30 +1374,8 @@ static int msSHXLoadAll(SHPHandle psSHP) {
     return MS_FAILURE;
   }
   for (i = 0; i < psSHP->nRecords; i++) {
-    ms_int32 nOffset, nLength;
-
-    memcpy(&nOffset, pabyBuf + i * 8, 4);
-    memcpy(&nLength, pabyBuf + i * 8 + 4, 4);
-
-    if (!bBigEndian) {
-      nOffset = SWAP_FOUR_BYTES(nOffset);
-      nLength = SWAP_FOUR_BYTES(nLength);
-    }
-
-    /* SHX stores the offsets in 2 byte units, so we double them to get */
-    /* an offset in bytes. */
-    if (nOffset > 0 && nOffset < INT_MAX / 2)
-      nOffset = nOffset * 2;
-    else
-      nOffset = 0;
-
-    if (nLength > 0 && nLength < INT_MAX / 2)
-      nLength = nLength * 2;
-    else
-      nLength = 0;
-
-    psSHP->panRecOffset[i] = nOffset;
-    psSHP->panRecSize[i] = nLength;
+    msSHXDecodeRecord(pabyBuf + i * 8, &psSHP->panRecOffset[i],
+                      &psSHP->panRecSize[i]);
   }
   free(pabyBuf);
   psSHP->panRecAllLoaded = 1;
@@ -1321,6 +1391,14 @@ static int msSHXReadOffset(SHPHandle psSHP, int hEntity) {
   if (hEntity < 0 || hEntity >= psSHP->nRecords)
     return 0;
 
+  if (psSHP->sSHXMap.data) {
+    int nOffset = 0, nSize = 0;
+    if (100 + 8 * (size_t)hEntity + 8 <= psSHP->sSHXMap.size)
+      msSHXDecodeRecord(psSHP->sSHXMap.data + 100 + 8 * (size_t)hEntity,
+                        &nOffset, &nSize);
+    return nOffset;
+  }
+
   if (!(psSHP->panRecAllLoaded ||
         msGetBit(psSHP->panRecLoaded, shxBufferPage))) {
     msSHXLoadPage(psSHP, shxBufferPage);
@@ -1337,6 +1415,14 @@ static int msSHXReadSize(SHPHandle psSHP, int hEntity) {
   if (hEntity < 0 || hEntity >= psSHP->nRecords)
     return 0;
 
+  if (psSHP->sSHXMap.data) {
+    int nOffset = 0, nSize = 0;
+    if (100 + 8 * (size_t)hEntity + 8 <= psSHP->sSHXMap.size)
+      msSHXDecodeRecord(psSHP->sSHXMap.data + 100 + 8 * (size_t)hEntity,
+                        &nOffset, &nSize);
+    return nSize;
+  }
+
   if (!(psSHP->panRecAllLoaded ||
         msGetBit(psSHP->panRecLoaded, shxBufferPage))) {
     msSHXLoadPage(psSHP, shxBufferPage);
@@ -1360,13 +1446,16 @@ static void ReadRect(rectObj *r, const uchar *src) {
 }
 
 /*
-** msSHPReadShape() - Reads the vertices for one shape from a shape file.
+** msSHPReadShapeEx() - Reads the vertices for one shape from a shape file.
+** The vertices are allocated from arena if it is not NULL, see maparena.c.
 */
-void msSHPReadShape(SHPHandle psSHP, int hEntity, shapeObj *shape) {
+void msSHPReadShapeEx(SHPHandle psSHP, int hEntity, shapeObj *shape,
+                      msArenaObj *arena) {
   int i, j, k;
   int nEntitySize, nRequiredSize;
 
   msInitShape(shape); /* initialize the shape */
+  shape->arena = arena;
 
   /* -------------------------------------------------------------------- */
   /*      Validate the record/entity number.                              */
@@ -1389,23 +1478,12 @@ void msSHPReadShape(SHPHandle psSHP, int hEntity, shapeObj *shape) {
     return;
   }
 
-  uchar *pabyRec = msSHPReadAllocateBuffer(psSHP, hEntity, "msSHPReadShape()");
-  if (pabyRec == NULL) {
-    shape->type = MS_SHAPE_NULL;
-    return;
-  }
-
   /* -------------------------------------------------------------------- */
   /*      Read the record.                                                */
   /* -------------------------------------------------------------------- */
-  const int offset = msSHXReadOffset(psSHP, hEntity);
-  if (offset <= 0 || 0 != VSIFSeekL(psSHP->fpSHP, offset, 0)) {
-    msSetError(MS_IOERR, "failed to seek offset", "msSHPReadShape()");
-    shape->type = MS_SHAPE_NULL;
-    return;
-  }
-  if (1 != VSIFReadL(pabyRec, nEntitySize, 1, psSHP->fpSHP)) {
-    msSetError(MS_IOERR, "failed to fread record", "msSHPReadPoint()");
+  const uchar *pabyRec =
+      msSHPReadRecord(psSHP, hEntity, nEntitySize, "msSHPReadShape()");
+  if (pabyRec == NULL) {
     shape->type = MS_SHAPE_NULL;
     return;
   }
@@ -1501,7 +1579,8 @@ void msSHPReadShape(SHPHandle psSHP, int hEntity, shapeObj *shape) {
     /* -------------------------------------------------------------------- */
     /*      Fill the shape structure.                                       */
     /* -------------------------------------------------------------------- */
-    shape->line = (lineObj *)malloc(sizeof(lineObj) * nParts);
+    shape->line =
+        (lineObj *)msShapeAllocMemory(shape, sizeof(lineObj) * nParts);
     MS_CHECK_ALLOC_NO_RET(shape->line, sizeof(lineObj) * nParts);
 
     shape->numlines = nParts;
@@ -1516,8 +1595,8 @@ void msSHPReadShape(SHPHandle psSHP, int hEntity, shapeObj *shape) {
                    "shape->line[%d].end=%d",
                    "msSHPReadShape()", hEntity, i, psSHP->panParts[i], i, end);
         while (--i >= 0)
-          free(shape->line[i].point);
-        free(shape->line);
+          msShapeFreeMemory(shape, shape->line[i].point);
+        msShapeFreeMemory(shape, shape->line);
         shape->line = NULL;
         shape->numlines = 0;
         shape->type = MS_SHAPE_NULL;
@@ -1525,11 +1604,11 @@ void msSHPReadShape(SHPHandle psSHP, int hEntity, shapeObj *shape) {
       }
 
       shape->line[i].numpoints = end - psSHP->panParts[i];
-      if ((shape->line[i].point = (pointObj *)malloc(
-               sizeof(pointObj) * shape->line[i].numpoints)) == NULL) {
+      if ((shape->line[i].point = (pointObj *)msShapeAllocMemory(
+               shape, sizeof(pointObj) * shape->line[i].numpoints)) == NULL) {
         while (--i >= 0)
-          free(shape->line[i].point);
-        free(shape->line);
+          msShapeFreeMemory(shape, shape->line[i].point);
+        msShapeFreeMemory(shape, shape->line);
         shape->line = NULL;
         shape->numlines = 0;
         shape->type = MS_SHAPE_NULL;
@@ -1620,14 +1699,15 @@ void msSHPReadShape(SHPHandle psSHP, int hEntity, shapeObj *shape) {
     /* -------------------------------------------------------------------- */
     /*      Fill the shape structure.                                       */
     /* -------------------------------------------------------------------- */
-    if ((shape->line = (lineObj *)malloc(sizeof(lineObj))) == NULL) {
+    if ((shape->line = (lineObj *)msShapeAllocMemory(shape, sizeof(lineObj))) ==
+        NULL) {
       shape->type = MS_SHAPE_NULL;
       msSetError(MS_MEMERR, "Out of memory", "msSHPReadShape()");
       return;
     }
 
     if (nPoints < 0 || nPoints > 50 * 1000 * 1000) {
-      free(shape->line);
+      msShapeFreeMemory(shape, shape->line);
       shape->line = NULL;
       shape->numlines = 0;
       shape->type = MS_SHAPE_NULL;
@@ -1641,7 +1721,7 @@ void msSHPReadShape(SHPHandle psSHP, int hEntity, shapeObj *shape) {
         psSHP->nShapeType == SHP_MULTIPOINTM)
       nRequiredSize += 16 + nPoints * 8;
     if (nRequiredSize > nEntitySize) {
-      free(shape->line);
+      msShapeFreeMemory(shape, shape->line);
       shape->line = NULL;
       shape->numlines = 0;
       shape->type = MS_SHAPE_NULL;
@@ -1654,9 +1734,10 @@ void msSHPReadShape(SHPHandle psSHP, int hEntity, shapeObj *shape) {
 
     shape->numlines = 1;
     shape->line[0].numpoints = nPoints;
-    shape->line[0].point = (pointObj *)malloc(nPoints * sizeof(pointObj));
+    shape->line[0].point =
+        (pointObj *)msShapeAllocMemory(shape, nPoints * sizeof(pointObj));
     if (shape->line[0].point == NULL) {
-      free(shape->line);
+      msShapeFreeMemory(shape, shape->line);
       shape->line = NULL;
       shape->numlines = 0;
       shape->type = MS_SHAPE_NULL;
@@ -1716,12 +1797,21 @@ void msSHPReadShape(SHPHandle psSHP, int hEntity, shapeObj *shape) {
     /* -------------------------------------------------------------------- */
     /*      Fill the shape structure.                                       */
     /* -------------------------------------------------------------------- */
-    shape->line = (lineObj *)malloc(sizeof(lineObj));
+    shape->line = (lineObj *)msShapeAllocMemory(shape, sizeof(lineObj));
     MS_CHECK_ALLOC_NO_RET(shape->line, sizeof(lineObj));
 
     shape->numlines = 1;
     shape->line[0].numpoints = 1;
-    shape->line[0].point = (pointObj *)msSmallMalloc(sizeof(pointObj));
+    shape->line[0].point =
+        (pointObj *)msShapeAllocMemory(shape, sizeof(pointObj));
+    if (shape->line[0].point == NULL) {
+      msShapeFreeMemory(shape, shape->line);
+      shape->line = NULL;
+      shape->numlines = 0;
+      shape->type = MS_SHAPE_NULL;
+      msSetError(MS_MEMERR, "Out of memory", "msSHPReadShape()");
+      return;
+    }
 
     memcpy(&(shape->line[0].point[0].x), pabyRec + 12, 8);
     memcpy(&(shape->line[0].point[0].y), pabyRec + 20, 8);
@@ -1769,6 +1859,10 @@ void msSHPReadShape(SHPHandle psSHP, int hEntity, shapeObj *shape) {
   return;
 }
 
+void msSHPReadShape(SHPHandle psSHP, int hEntity, shapeObj *shape) {
+  msSHPReadShapeEx(psSHP, hEntity, shape, NULL);
+}
+
 int msSHPReadBounds(SHPHandle psSHP, int hEntity, rectObj *padBounds) {
   /* -------------------------------------------------------------------- */
   /*      Validate the record/entity number.                              */
@@ -1795,19 +1889,32 @@ int msSHPReadBounds(SHPHandle psSHP, int hEntity, rectObj *padBounds) {
     }
 
     const int offset = msSHXReadOffset(psSHP, hEntity);
-    if (offset <= 0 || offset >= INT_MAX - 12 ||
-        0 != VSIFSeekL(psSHP->fpSHP, offset + 12, 0)) {
-      msSetError(MS_IOERR, "failed to seek offset", "msSHPReadBounds()");
-      return (MS_FAILURE);
-    }
-
-    if (psSHP->nShapeType != SHP_POINT && psSHP->nShapeType != SHP_POINTZ &&
-        psSHP->nShapeType != SHP_POINTM) {
-      if (1 != VSIFReadL(padBounds, sizeof(double) * 4, 1, psSHP->fpSHP)) {
+    const int bIsPoint = psSHP->nShapeType == SHP_POINT ||
+                         psSHP->nShapeType == SHP_POINTZ ||
+                         psSHP->nShapeType == SHP_POINTM;
+    const size_t nBoundsSize = sizeof(double) * (bIsPoint ? 2 : 4);
+
+    if (psSHP->sSHPMap.data) {
+      if (offset <= 0 ||
+          (size_t)offset + 12 + nBoundsSize > psSHP->sSHPMap.size) {
+        msSetError(MS_IOERR, "record %d lies outside of the .shp file",
+                   "msSHPReadBounds()", hEntity);
+        return (MS_FAILURE);
+      }
+      memcpy(padBounds, psSHP->sSHPMap.data + offset + 12, nBoundsSize);
+    } else {
+      if (offset <= 0 || offset >= INT_MAX - 12 ||
+          0 != VSIFSeekL(psSHP->fpSHP, offset + 12, 0)) {
+        msSetError(MS_IOERR, "failed to seek offset", "msSHPReadBounds()");
+        return (MS_FAILURE);
+      }
+      if (1 != VSIFReadL(padBounds, nBoundsSize, 1, psSHP->fpSHP)) {
         msSetError(MS_IOERR, "failed to fread record", "msSHPReadBounds()");
         return (MS_FAILURE);
       }
+    }
 
+    if (!bIsPoint) {
       if (bBigEndian) {
         SwapWord(8, &(padBounds->minx));
         SwapWord(8, &(padBounds->miny));
@@ -1825,11 +1932,6 @@ int msSHPReadBounds(SHPHandle psSHP, int hEntity, rectObj *padBounds) {
       /*      For points we fetch the point, and duplicate it as the          */
       /*      minimum and maximum bound.                                      */
       /* -------------------------------------------------------------------- */
-      if (1 != VSIFReadL(padBounds, sizeof(double) * 2, 1, psSHP->fpSHP)) {
-        msSetError(MS_IOERR, "failed to fread record", "msSHPReadBounds()");
-        return (MS_FAILURE);
-      }
-
       if (bBigEndian) {
         SwapWord(8, &(padBounds->minx));
         SwapWord(8, &(padBounds->miny));
@@ -1851,6 +1953,11 @@ int msShapefileOpenHandle(shapefileObj *shpfile, const char *filename,
 
   /* initialize a few things */
   shpfile->status = NULL;
+  shpfile->hits = NULL;
+  shpfile->numhits = 0;
+  shpfile->hGEN = NULL;
+  shpfile->genlevel = -1;
+  shpfile->usegeneralized = MS_FALSE;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_FALSE;
 
@@ -1984,6 +2091,11 @@ int msShapefileCreate(shapefileObj *shpfile, char *filename, int type) {
 
   /* initialize a few other things */
   shpfile->status = NULL;
+  shpfile->hits = NULL;
+  shpfile->numhits = 0;
+  shpfile->hGEN = NULL;
+  shpfile->genlevel = -1;
+  shpfile->usegeneralized = MS_FALSE;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_TRUE;
 
@@ -1999,6 +2111,8 @@ void msShapefileClose(shapefileObj *shpfile) {
     if (shpfile->hDBF)
       msDBFClose(shpfile->hDBF);
     free(shpfile->status);
+    free(shpfile->hits);
+    msShapefileGeneralizedClose(shpfile);
     shpfile->isopen = MS_FALSE;
   }
 }
@@ -2012,6 +2126,9 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug) {
 
   free(shpfile->status);
   shpfile->status = NULL;
+  free(shpfile->hits);
+  shpfile->hits = NULL;
+  shpfile->numhits = 0;
 
   /* rect and shapefile DON'T overlap... */
   if (msRectOverlap(&shpfile->bounds, &rect) != MS_TRUE)
@@ -2038,20 +2155,34 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug) {
         *s = '\0';
     }
 
-    filename =
-        (char *)malloc(strlen(sourcename) + strlen(MS_INDEX_EXTENSION) + 1);
+    filename = (char *)malloc(strlen(sourcename) +
+                              strlen(MS_RTREE_INDEX_EXTENSION) + 1);
     MS_CHECK_ALLOC(filename,
-                   strlen(sourcename) + strlen(MS_INDEX_EXTENSION) + 1,
+                   strlen(sourcename) + strlen(MS_RTREE_INDEX_EXTENSION) + 1,
                    MS_FAILURE);
 
-    sprintf(filename, "%s%s", sourcename, MS_INDEX_EXTENSION);
+    /* a packed R-tree index gives the exact list of candidates */
+    sprintf(filename, "%s%s", sourcename, MS_RTREE_INDEX_EXTENSION);
+    const int rtree_status =
+        msSearchDiskRTree(filename, rect, debug, shpfile->numshapes,
+                          &shpfile->hits, &shpfile->numhits);
+    if (rtree_status == MS_FAILURE) {
+      free(filename);
+      free(sourcename);
+      return (MS_FAILURE);
+    }
 
-    shpfile->status =
-        msSearchDiskTree(filename, rect, debug, shpfile->numshapes);
+    if (rtree_status == MS_DONE) { /* no .qrt, try the quadtree */
+      sprintf(filename, "%s%s", sourcename, MS_INDEX_EXTENSION);
+      shpfile->status =
+          msSearchDiskTree(filename, rect, debug, shpfile->numshapes);
+    }
     free(filename);
     free(sourcename);
 
-    if (shpfile->status) { /* index  */
+    if (shpfile->hits) {
+      /* the R-tree holds the exact shape bounds, nothing to filter */
+    } else if (shpfile->status) { /* index  */
       msFilterTreeSearch(shpfile, shpfile->status, rect);
     } else { /* no index  */
       shpfile->status = msAllocBitArray(shpfile->numshapes);
@@ -2079,6 +2210,25 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug) {
   return (MS_SUCCESS); /* success */
 }
 
+/* index of the first shape selected by msShapefileWhichShapes() at or after
+ * start, -1 if there is none */
+int msShapefileNextSelected(shapefileObj *shpfile, int start) {
+  if (shpfile->hits) {
+    int lo = 0, hi = shpfile->numhits;
+    while (lo < hi) { /* first hit >= start */
+      const int mid = lo + (hi - lo) / 2;
+      if (shpfile->hits[mid] < start)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return lo < shpfile->numhits ? shpfile->hits[lo] : -1;
+  }
+  if (!shpfile->status || start >= shpfile->numshapes)
+    return -1;
+  return msGetNextBit(shpfile->status, start, shpfile->numshapes);
+}
+
 /* Return the absolute path to the given layer's tileindex file's directory */
 void msTileIndexAbsoluteDir(char *tiFileAbsDir, layerObj *layer) {
   char tiFileAbsPath[MS_MAXPATHLEN];
@@ -2396,41 +2546,39 @@ static int msTiledSHPWhichShapes(layerObj *layer, rectObj rect, int isQuery) {
     msTileIndexAbsoluteDir(tiFileAbsDir, layer);
 
     /* position the source at the FIRST shapefile */
-    for (i = 0; i < tSHP->tileshpfile->numshapes; i++) {
+    for (i = msShapefileNextSelected(tSHP->tileshpfile, 0); i != -1;
+         i = msShapefileNextSelected(tSHP->tileshpfile, i + 1)) {
       rectObj rectTile = rect;
-      if (msGetBit(tSHP->tileshpfile->status, i)) {
-
-        filename = msTiledSHPLoadEntry(layer, i, tilename, sizeof(tilename));
-        if (strlen(filename) == 0)
-          continue; /* check again */
-
-        try_open =
-            msTiledSHPTryOpen(tSHP->shpfile, layer, tiFileAbsDir, filename);
-        if (try_open == MS_DONE)
-          continue;
-        else if (try_open == MS_FAILURE)
-          return (MS_FAILURE);
+      filename = msTiledSHPLoadEntry(layer, i, tilename, sizeof(tilename));
+      if (strlen(filename) == 0)
+        continue; /* check again */
 
-        if (tSHP->sTileProj.numargs > 0) {
-          msProjectRect(&(layer->projection), &(tSHP->sTileProj), &rectTile);
-        }
+      try_open =
+          msTiledSHPTryOpen(tSHP->shpfile, layer, tiFileAbsDir, filename);
+      if (try_open == MS_DONE)
+        continue;
+      else if (try_open == MS_FAILURE)
+        return (MS_FAILURE);
 
-        status = msShapefileWhichShapes(tSHP->shpfile, rectTile, layer->debug);
-        if (status == MS_DONE) {
-          /* Close and continue to next tile */
-          msShapefileClose(tSHP->shpfile);
-          continue;
-        } else if (status != MS_SUCCESS) {
-          msShapefileClose(tSHP->shpfile);
-          return (MS_FAILURE);
-        }
+      if (tSHP->sTileProj.numargs > 0) {
+        msProjectRect(&(layer->projection), &(tSHP->sTileProj), &rectTile);
+      }
 
-        tSHP->tileshpfile->lastshape = i;
-        break;
+      status = msShapefileWhichShapes(tSHP->shpfile, rectTile, layer->debug);
+      if (status == MS_DONE) {
+        /* Close and continue to next tile */
+        msShapefileClose(tSHP->shpfile);
+        continue;
+      } else if (status != MS_SUCCESS) {
+        msShapefileClose(tSHP->shpfile);
+        return (MS_FAILURE);
       }
+
+      tSHP->tileshpfile->lastshape = i;
+      break;
     }
 
-    if (i == tSHP->tileshpfile->numshapes)
+    if (i == -1)
       return (MS_DONE); /* no more tiles */
     else
       return (MS_SUCCESS);
@@ -2460,12 +2608,10 @@ static int msTiledSHPNextShape(layerObj *layer, shapeObj *shape) {
   msTileIndexAbsoluteDir(tiFileAbsDir, layer);
 
   do {
-    i = tSHP->shpfile->lastshape + 1;
-    while (i < tSHP->shpfile->numshapes && !msGetBit(tSHP->shpfile->status, i))
-      i++; /* next "in" shape */
+    /* next "in" shape */
+    i = msShapefileNextSelected(tSHP->shpfile, tSHP->shpfile->lastshape + 1);
 
-    if (i ==
-        tSHP->shpfile->numshapes) {    /* done with this tile, need a new one */
+    if (i == -1) {                     /* done with this tile, need a new one */
       msShapefileClose(tSHP->shpfile); /* clean up */
 
       /* position the source to the NEXT shapefile based on the tileindex */
@@ -2524,47 +2670,46 @@ static int msTiledSHPNextShape(layerObj *layer, shapeObj *shape) {
 
       } else { /* or reference a shapefile directly   */
 
-        for (i = (tSHP->tileshpfile->lastshape + 1);
-             i < tSHP->tileshpfile->numshapes; i++) {
-          if (msGetBit(tSHP->tileshpfile->status, i)) {
-            rectObj rectTile = tSHP->searchrect;
-            int try_open;
-
-            filename =
-                msTiledSHPLoadEntry(layer, i, tilename, sizeof(tilename));
-            if (strlen(filename) == 0)
-              continue; /* check again */
-
-            try_open =
-                msTiledSHPTryOpen(tSHP->shpfile, layer, tiFileAbsDir, filename);
-            if (try_open == MS_DONE)
-              continue;
-            else if (try_open == MS_FAILURE)
-              return (MS_FAILURE);
-
-            if (tSHP->sTileProj.numargs > 0) {
-              msProjectRect(&(layer->projection), &(tSHP->sTileProj),
-                            &rectTile);
-            }
+        for (i = msShapefileNextSelected(tSHP->tileshpfile,
+                                         tSHP->tileshpfile->lastshape + 1);
+             i != -1; i = msShapefileNextSelected(tSHP->tileshpfile, i + 1)) {
+          rectObj rectTile = tSHP->searchrect;
+          int try_open;
 
-            status =
-                msShapefileWhichShapes(tSHP->shpfile, rectTile, layer->debug);
-            if (status == MS_DONE) {
-              /* Close and continue to next tile */
-              msShapefileClose(tSHP->shpfile);
-              continue;
-            } else if (status != MS_SUCCESS) {
-              msShapefileClose(tSHP->shpfile);
-              tSHP->tileshpfile->lastshape = -1;
-              return (MS_FAILURE);
-            }
+          filename =
+              msTiledSHPLoadEntry(layer, i, tilename, sizeof(tilename));
+          if (strlen(filename) == 0)
+            continue; /* check again */
 
-            tSHP->tileshpfile->lastshape = i;
-            break;
+          try_open =
+              msTiledSHPTryOpen(tSHP->shpfile, layer, tiFileAbsDir, filename);
+          if (try_open == MS_DONE)
+            continue;
+          else if (try_open == MS_FAILURE)
+            return (MS_FAILURE);
+
+          if (tSHP->sTileProj.numargs > 0) {
+            msProjectRect(&(layer->projection), &(tSHP->sTileProj),
+                          &rectTile);
           }
+
+          status =
+              msShapefileWhichShapes(tSHP->shpfile, rectTile, layer->debug);
+          if (status == MS_DONE) {
+            /* Close and continue to next tile */
+            msShapefileClose(tSHP->shpfile);
+            continue;
+          } else if (status != MS_SUCCESS) {
+            msShapefileClose(tSHP->shpfile);
+            tSHP->tileshpfile->lastshape = -1;
+            return (MS_FAILURE);
+          }
+
+          tSHP->tileshpfile->lastshape = i;
+          break;
         } /* end for loop */
 
-        if (i == tSHP->tileshpfile->numshapes) {
+        if (i == -1) {
           tSHP->tileshpfile->lastshape = -1;
           return (MS_DONE); /* no more tiles */
         } else
@@ -2574,7 +2719,7 @@ static int msTiledSHPNextShape(layerObj *layer, shapeObj *shape) {
 
     tSHP->shpfile->lastshape = i;
 
-    msSHPReadShape(tSHP->shpfile->hSHP, i, shape);
+    msSHPReadShapeEx(tSHP->shpfile->hSHP, i, shape, layer->arena);
     if (shape->type == MS_SHAPE_NULL) {
       msFreeShape(shape);
       continue; /* skip NULL shapes */
@@ -2592,8 +2737,9 @@ static int msTiledSHPNextShape(layerObj *layer, shapeObj *shape) {
 
     shape->tileindex = tSHP->tileshpfile->lastshape;
     shape->numvalues = layer->numitems;
-    shape->values = msDBFGetValueList(tSHP->shpfile->hDBF, i, layer->iteminfo,
-                                      layer->numitems);
+    shape->values = msDBFGetValueListEx(tSHP->shpfile->hDBF, i,
+                                        layer->iteminfo, layer->numitems,
+                                        layer->arena);
     if (!shape->values)
       shape->numvalues = 0;
 
@@ -2986,8 +3132,34 @@ int msSHPLayerIsOpen(layerObj *layer) {
     return MS_FALSE;
 }
 
+/*
+** Size of a pixel of the map being drawn in the units of the layer, 0 if
+** it isn't known. rect is the search rectangle of the map extent.
+*/
+static double msSHPLayerCellsize(layerObj *layer, rectObj rect) {
+  mapObj *map = layer->map;
+
+  if (!map || map->cellsize <= 0 || map->width <= 0 || map->height <= 0 ||
+      layer->transform != MS_TRUE)
+    return 0;
+  if (layer->project &&
+      msProjectionsDiffer(&map->projection, &layer->projection))
+    return MS_MIN((rect.maxx - rect.minx) / map->width,
+                  (rect.maxy - rect.miny) / map->height);
+  return map->cellsize;
+}
+
+/*
+** Lets the next msSHPLayerWhichShapes() select the shapes of the .shg, for
+** msDrawVectorLayer(): other readers, queries or not, want the exact shapes.
+*/
+void msSHPLayerUseGeneralizedForNextWhichShapes(layerObj *layer, int use) {
+  shapefileObj *shpfile = layer->layerinfo;
+  if (shpfile)
+    shpfile->usegeneralized = use;
+}
+
 int msSHPLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery) {
-  (void)isQuery;
   int status;
   shapefileObj *shpfile;
 
@@ -3004,11 +3176,17 @@ int msSHPLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery) {
     return status;
   }
 
+  /* shapes drawn at a small scale come from the .shg when there is one */
+  shpfile->genlevel = -1;
+  if (shpfile->usegeneralized && !isQuery)
+    shpfile->genlevel = msShapefileGeneralizedLevel(
+        shpfile, msSHPLayerCellsize(layer, rect), layer->debug);
+
   return MS_SUCCESS;
 }
 
 int msSHPLayerNextShape(layerObj *layer, shapeObj *shape) {
-  int i;
+  int i, status;
   shapefileObj *shpfile;
 
   shpfile = layer->layerinfo;
@@ -3019,24 +3197,37 @@ int msSHPLayerNextShape(layerObj *layer, shapeObj *shape) {
     return MS_FAILURE;
   }
 
-  if (!shpfile->status) {
+  if (!shpfile->status && !shpfile->hits) {
     /* probably whichShapes didn't overlap */
     return MS_DONE;
   }
 
-  i = msGetNextBit(shpfile->status, shpfile->lastshape + 1, shpfile->numshapes);
+  i = msShapefileNextSelected(shpfile, shpfile->lastshape + 1);
   shpfile->lastshape = i;
   if (i == -1)
     return (MS_DONE); /* nothing else to read */
 
-  msSHPReadShape(shpfile->hSHP, i, shape);
+  status = MS_DONE;
+  if (shpfile->genlevel >= 0) {
+    status = msShapefileReadGeneralized(shpfile, shpfile->genlevel, i, shape,
+                                        layer->arena);
+    if (status == MS_FAILURE) {
+      /* the error is logged, the shapes come from the .shp from now on */
+      msDebug("msSHPLayerNextShape(): the .shg of layer %s is ignored.\n",
+              layer->name);
+      shpfile->genlevel = -1;
+      status = MS_DONE;
+    }
+  }
+  if (status == MS_DONE)
+    msSHPReadShapeEx(shpfile->hSHP, i, shape, layer->arena);
   if (shape->type == MS_SHAPE_NULL) {
     msFreeShape(shape);
     return msSHPLayerNextShape(layer, shape); /* skip NULL shapes */
   }
   shape->numvalues = layer->numitems;
-  shape->values =
-      msDBFGetValueList(shpfile->hDBF, i, layer->iteminfo, layer->numitems);
+  shape->values = msDBFGetValueListEx(shpfile->hDBF, i, layer->iteminfo,
+                                      layer->numitems, layer->arena);
   if (!shape->values)
     shape->numvalues = 0;
 
@@ -35,6 +35,7 @@
 #include "mapproject.h"
 
 #include "cpl_vsi.h"
+#include "cpl_virtualmem.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -80,6 +81,16 @@ extern "C" {
 #ifndef SWIG
 typedef unsigned char uchar;
 
+/* read-only memory mapping of a whole local file (MS_SHAPEFILE_MMAP) */
+typedef struct {
+  CPLVirtualMem *mem;
+  const uchar *data;
+  size_t size;
+} shpMappedFileObj;
+
+/* pre-generalized shapes of a shapefile, see mapshapegen.c */
+typedef struct shpGeneralizedObj shpGeneralizedObj;
+
 typedef struct {
   VSILFILE *fpSHP;
   VSILFILE *fpSHX;
@@ -106,6 +117,9 @@ typedef struct {
   int nPartMax;
   int *panParts;
 
+  shpMappedFileObj sSHPMap; /* .shp and .shx mappings, data is NULL when */
+  shpMappedFileObj sSHXMap; /* the files are read with VSIFReadL() */
+
 } SHPInfo;
 typedef SHPInfo *SHPHandle;
 #endif
@@ -175,9 +189,14 @@ typedef struct {
   char source[MS_PATH_LENGTH]; /* full path to this file data */
   int lastshape;
   ms_bitarray status;
+  ms_int32 *hits; /* sorted selection from a .qrt index, used instead of */
+  int numhits;    /* status when not NULL */
   int isopen;
   SHPHandle hSHP; /* SHP/SHX file pointer */
   DBFHandle hDBF; /* DBF file pointer */
+  shpGeneralizedObj *hGEN; /* .shg generalized shapes, NULL until looked for */
+  int genlevel; /* .shg level read by msSHPLayerNextShape(), -1 for the .shp */
+  int usegeneralized; /* the next msSHPLayerWhichShapes() is for drawing */
 #endif
 
 } shapefileObj;
@@ -208,9 +227,26 @@ MS_DLL_EXPORT int msShapefileCreate(shapefileObj *shpfile, char *filename,
 MS_DLL_EXPORT void msShapefileClose(shapefileObj *shpfile);
 MS_DLL_EXPORT int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect,
                                          int debug);
+MS_DLL_EXPORT int msShapefileNextSelected(shapefileObj *shpfile, int start);
+
+/* pre-generalized shapes (.shg), see mapshapegen.c */
+#define MS_GENERALIZED_MAX_LEVELS 16
+
+MS_DLL_EXPORT int msWriteGeneralizedShapes(shapefileObj *shapefile,
+                                           const char *filename, int numlevels,
+                                           const double *tolerances);
+MS_DLL_EXPORT int msShapefileGeneralizedLevel(shapefileObj *shpfile,
+                                              double cellsize, int debug);
+MS_DLL_EXPORT int msShapefileReadGeneralized(shapefileObj *shpfile, int level,
+                                             int i, shapeObj *shape,
+                                             msArenaObj *arena);
+MS_DLL_EXPORT void msShapefileGeneralizedClose(shapefileObj *shpfile);
 
 /* SHP/SHX function prototypes */
 MS_DLL_EXPORT SHPHandle msSHPOpenVirtualFile(VSILFILE *fpSHP, VSILFILE *fpSHX);
+MS_DLL_EXPORT int msSHPMapFileEnabled(void);
+MS_DLL_EXPORT int msSHPMapFile(VSILFILE *fp, shpMappedFileObj *map);
+MS_DLL_EXPORT void msSHPUnmapFile(shpMappedFileObj *map);
 MS_DLL_EXPORT SHPHandle msSHPOpen(const char *pszShapeFile,
                                   const char *pszAccess);
 MS_DLL_EXPORT SHPHandle msSHPCreate(const char *pszShapeFile, int nShapeType);
@@ -221,6 +257,8 @@ MS_DLL_EXPORT int msSHPReadBounds(SHPHandle psSHP, int hEntity,
                                   rectObj *padBounds);
 MS_DLL_EXPORT void msSHPReadShape(SHPHandle psSHP, int hEntity,
                                   shapeObj *shape);
+MS_DLL_EXPORT void msSHPReadShapeEx(SHPHandle psSHP, int hEntity,
+                                    shapeObj *shape, msArenaObj *arena);
 MS_DLL_EXPORT int msSHPReadPoint(SHPHandle psSHP, int hEntity, pointObj *point);
 MS_DLL_EXPORT int msSHPWriteShape(SHPHandle psSHP, shapeObj *shape);
 MS_DLL_EXPORT int msSHPWritePoint(SHPHandle psSHP, pointObj *point);
@@ -262,6 +300,9 @@ MS_DLL_EXPORT char **msDBFGetItems(DBFHandle dbffile);
 MS_DLL_EXPORT char **msDBFGetValues(DBFHandle dbffile, int record);
 MS_DLL_EXPORT char **msDBFGetValueList(DBFHandle dbffile, int record,
                                        int *itemindexes, int numitems);
+MS_DLL_EXPORT char **msDBFGetValueListEx(DBFHandle dbffile, int record,
+                                         int *itemindexes, int numitems,
+                                         msArenaObj *arena);
 MS_DLL_EXPORT int *msDBFGetItemIndexes(DBFHandle dbffile, char **items,
                                        int numitems);
 MS_DLL_EXPORT int msDBFGetItemIndex(DBFHandle dbffile, char *name);
@@ -0,0 +1,679 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Pre-generalized shapefile geometry (.shg files).
+ * Author:   MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2024 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** The .shg file holds copies of the lines and polygons of a shapefile
+** simplified (Douglas-Peucker) at a few tolerances. It is written by the
+** shpgen utility. When a shapefile layer is drawn, msSHPLayerNextShape()
+** reads the shapes from the coarsest level whose tolerance is not larger
+** than a pixel instead of the .shp, so small scale maps of detailed data
+** read and transform a fraction of the vertices. Z and M values are not
+** kept. Queries and the other readers of the layer always read the .shp,
+** and so does a drawing once a corrupt record has been met.
+**
+** Layout, all values little endian:
+**   0  "SHG" signature and a version byte (1)
+**   4  int32 number of shapes in the shapefile
+**   8  int32 number of levels
+**  12  int32 shapefile type
+**  16  for each level, by increasing tolerance: the double tolerance and
+**      the uint64 offset of the shape table of the level
+**
+** A shape table has 16 bytes per shape: the uint64 offset of the record,
+** its int32 number of parts and its int32 number of points. A shape without
+** parts is read from the .shp, it is NULL or it isn't simplified at that
+** level. A record is the int32 number of points of each part followed by
+** the x and y doubles of all the points. Levels share identical records.
+*/
+
+#include "mapserver.h"
+
+#include "cpl_conv.h"
+#include "cpl_port.h"
+#include "cpl_vsi.h"
+
+#define MS_GENERALIZED_VERSION 1
+#define MS_GENERALIZED_HEADER_SIZE(numlevels) ((size_t)(16 + 16 * (numlevels)))
+
+struct shpGeneralizedObj {
+  VSILFILE *fp; /* NULL if the shapefile has no usable .shg */
+  shpMappedFileObj map;
+  int numlevels;
+  double tolerance[MS_GENERALIZED_MAX_LEVELS];
+  vsi_l_offset table[MS_GENERALIZED_MAX_LEVELS];
+  uchar *buffer; /* record read with VSIFReadL() */
+  size_t buffersize;
+};
+
+static int msGeneralizedIsLineOrPolygon(int type) {
+  return type == SHP_POLYGON || type == SHP_ARC || type == SHP_POLYGONM ||
+         type == SHP_ARCM || type == SHP_POLYGONZ || type == SHP_ARCZ;
+}
+
+/* name of a file next to the shapefile, with the given extension */
+static char *msGeneralizedSidecarName(const char *source, const char *ext) {
+  char *filename = (char *)msSmallMalloc(strlen(source) + strlen(ext) + 1);
+  char *s;
+
+  strcpy(filename, source);
+  s = strrchr(filename, '.');
+  if (s && (strcasecmp(s, ".shp") == 0 || strcasecmp(s, ".shx") == 0 ||
+            strcasecmp(s, ".dbf") == 0))
+    *s = '\0';
+  strcat(filename, ext);
+  return filename;
+}
+
+static time_t msGeneralizedFileMtime(const char *filename) {
+  VSIStatBufL stat_buf;
+  if (VSIStatL(filename, &stat_buf) != 0)
+    return 0;
+  return stat_buf.st_mtime;
+}
+
+/* reads len bytes at offset, from the mapping or the file */
+static const uchar *msGeneralizedRead(shpGeneralizedObj *gen,
+                                      vsi_l_offset offset, size_t len) {
+  if (gen->map.data) {
+    if (offset > gen->map.size || len > gen->map.size - offset)
+      return NULL;
+    return gen->map.data + offset;
+  }
+
+  if (len > gen->buffersize) {
+    uchar *buffer = (uchar *)realloc(gen->buffer, len);
+    if (!buffer)
+      return NULL;
+    gen->buffer = buffer;
+    gen->buffersize = len;
+  }
+  if (VSIFSeekL(gen->fp, offset, SEEK_SET) != 0 ||
+      VSIFReadL(gen->buffer, 1, len, gen->fp) != len)
+    return NULL;
+  return gen->buffer;
+}
+
+/* opens the .shg of shpfile, a closed object if there is none to use */
+static shpGeneralizedObj *msGeneralizedOpen(shapefileObj *shpfile,
+                                            int debug) {
+  shpGeneralizedObj *gen;
+  char *filename, *shpname;
+  const uchar *header;
+  ms_int32 numshapes, numlevels, type;
+  time_t mtime;
+  int i;
+
+  gen = (shpGeneralizedObj *)msSmallCalloc(1, sizeof(shpGeneralizedObj));
+
+  filename = msGeneralizedSidecarName(shpfile->source, MS_GENERALIZED_EXTENSION);
+  mtime = msGeneralizedFileMtime(filename);
+  if (mtime == 0) {
+    msFree(filename);
+    filename = msGeneralizedSidecarName(shpfile->source, ".SHG");
+    mtime = msGeneralizedFileMtime(filename);
+  }
+  if (mtime == 0) {
+    msFree(filename);
+    return gen; /* no .shg */
+  }
+
+  /* an older .shg doesn't describe the current shapes */
+  shpname = msGeneralizedSidecarName(shpfile->source, ".shp");
+  if (msGeneralizedFileMtime(shpname) > mtime) {
+    if (debug)
+      msDebug("msGeneralizedOpen(): %s is older than the shapefile, "
+              "ignored.\n",
+              filename);
+    msFree(shpname);
+    msFree(filename);
+    return gen;
+  }
+  msFree(shpname);
+
+  gen->fp = VSIFOpenL(filename, "rb");
+  if (!gen->fp) {
+    msFree(filename);
+    return gen;
+  }
+  if (msSHPMapFileEnabled())
+    msSHPMapFile(gen->fp, &gen->map);
+
+  header = msGeneralizedRead(gen, 0, MS_GENERALIZED_HEADER_SIZE(0));
+  if (header) {
+    memcpy(&numshapes, header + 4, 4);
+    CPL_LSBPTR32(&numshapes);
+    memcpy(&numlevels, header + 8, 4);
+    CPL_LSBPTR32(&numlevels);
+    memcpy(&type, header + 12, 4);
+    CPL_LSBPTR32(&type);
+    if (memcmp(header, "SHG", 3) != 0 ||
+        header[3] != MS_GENERALIZED_VERSION ||
+        numshapes != shpfile->numshapes || type != shpfile->type ||
+        numlevels <= 0 || numlevels > MS_GENERALIZED_MAX_LEVELS)
+      header = NULL;
+    else
+      header = msGeneralizedRead(gen, 0, MS_GENERALIZED_HEADER_SIZE(numlevels));
+  }
+  if (!header) {
+    if (debug)
+      msDebug("msGeneralizedOpen(): %s doesn't match the shapefile, "
+              "ignored.\n",
+              filename);
+    msSHPUnmapFile(&gen->map);
+    VSIFCloseL(gen->fp);
+    gen->fp = NULL;
+    msFree(filename);
+    return gen;
+  }
+
+  gen->numlevels = numlevels;
+  for (i = 0; i < numlevels; i++) {
+    GUInt64 offset;
+    memcpy(&gen->tolerance[i], header + 16 + 16 * i, 8);
+    CPL_LSBPTR64(&gen->tolerance[i]);
+    memcpy(&offset, header + 16 + 16 * i + 8, 8);
+    CPL_LSBPTR64(&offset);
+    gen->table[i] = (vsi_l_offset)offset;
+  }
+
+  if (debug >= MS_DEBUGLEVEL_VVV)
+    msDebug("msGeneralizedOpen(): %d levels in %s\n", gen->numlevels,
+            filename);
+  msFree(filename);
+  return gen;
+}
+
+void msShapefileGeneralizedClose(shapefileObj *shpfile) {
+  shpGeneralizedObj *gen = shpfile->hGEN;
+  if (!gen)
+    return;
+  msSHPUnmapFile(&gen->map);
+  if (gen->fp)
+    VSIFCloseL(gen->fp);
+  free(gen->buffer);
+  free(gen);
+  shpfile->hGEN = NULL;
+}
+
+/*
+** Returns the coarsest level of the .shg of shpfile whose tolerance is at
+** most cellsize, or -1 if the .shp is to be read.
+*/
+int msShapefileGeneralizedLevel(shapefileObj *shpfile, double cellsize,
+                                int debug) {
+  int i, level = -1;
+
+  if (cellsize <= 0 || !msGeneralizedIsLineOrPolygon(shpfile->type))
+    return -1;
+
+  if (!shpfile->hGEN)
+    shpfile->hGEN = msGeneralizedOpen(shpfile, debug);
+
+  for (i = 0; i < shpfile->hGEN->numlevels; i++) {
+    if (shpfile->hGEN->tolerance[i] <= cellsize)
+      level = i;
+  }
+  return level;
+}
+
+/*
+** Reads shape i from a level of the .shg: MS_SUCCESS, MS_DONE if the shape
+** has to be read from the .shp, or MS_FAILURE if the file is corrupt. A
+** corrupt file is not used any longer by shpfile.
+*/
+int msShapefileReadGeneralized(shapefileObj *shpfile, int level, int i,
+                               shapeObj *shape, msArenaObj *arena) {
+  shpGeneralizedObj *gen = shpfile->hGEN;
+  const uchar *entry, *record;
+  GUInt64 offset;
+  ms_int32 nParts, nPoints;
+  int j, k, n;
+
+  if (!gen || !gen->fp || level < 0 || level >= gen->numlevels || i < 0 ||
+      i >= shpfile->numshapes)
+    return MS_DONE;
+
+  entry = msGeneralizedRead(gen, gen->table[level] + (vsi_l_offset)i * 16, 16);
+  if (!entry)
+    goto corrupt;
+  memcpy(&offset, entry, 8);
+  CPL_LSBPTR64(&offset);
+  memcpy(&nParts, entry + 8, 4);
+  CPL_LSBPTR32(&nParts);
+  memcpy(&nPoints, entry + 12, 4);
+  CPL_LSBPTR32(&nPoints);
+
+  if (nParts == 0)
+    return MS_DONE;
+  if (nParts < 0 || nPoints < nParts || nPoints > 50 * 1000 * 1000 ||
+      nParts > 10 * 1000 * 1000)
+    goto corrupt;
+
+  record = msGeneralizedRead(gen, (vsi_l_offset)offset,
+                             4 * (size_t)nParts + 16 * (size_t)nPoints);
+  if (!record)
+    goto corrupt;
+
+  msInitShape(shape);
+  shape->arena = arena;
+  shape->line = (lineObj *)msShapeAllocMemory(shape, sizeof(lineObj) * nParts);
+  MS_CHECK_ALLOC(shape->line, sizeof(lineObj) * nParts, MS_FAILURE);
+
+  k = 0; /* overall point counter */
+  for (j = 0; j < nParts; j++) {
+    ms_int32 numpoints;
+    memcpy(&numpoints, record + 4 * j, 4);
+    CPL_LSBPTR32(&numpoints);
+    if (numpoints <= 0 || numpoints > nPoints - k) {
+      msFreeShape(shape);
+      goto corrupt;
+    }
+    shape->line[j].numpoints = numpoints;
+    shape->line[j].point = (pointObj *)msShapeAllocMemory(
+        shape, sizeof(pointObj) * numpoints);
+    if (!shape->line[j].point) {
+      msFreeShape(shape);
+      msSetError(MS_MEMERR, "Out of memory", "msShapefileReadGeneralized()");
+      return MS_FAILURE;
+    }
+    shape->numlines++;
+
+    for (n = 0; n < numpoints; n++, k++) {
+      pointObj *point = &shape->line[j].point[n];
+      memcpy(&point->x, record + 4 * nParts + 16 * k, 8);
+      CPL_LSBPTR64(&point->x);
+      memcpy(&point->y, record + 4 * nParts + 16 * k + 8, 8);
+      CPL_LSBPTR64(&point->y);
+      point->z = 0;
+      point->m = 0;
+    }
+  }
+  if (k != nPoints) {
+    msFreeShape(shape);
+    goto corrupt;
+  }
+
+  if (shpfile->type == SHP_POLYGON || shpfile->type == SHP_POLYGONZ ||
+      shpfile->type == SHP_POLYGONM)
+    shape->type = MS_SHAPE_POLYGON;
+  else
+    shape->type = MS_SHAPE_LINE;
+  msComputeBounds(shape);
+  shape->index = i;
+
+  return MS_SUCCESS;
+
+corrupt:
+  gen->numlevels = 0;
+  msSetError(MS_SHPERR,
+             "The generalized geometry of shape %d of %s is corrupt.",
+             "msShapefileReadGeneralized()", i, shpfile->source);
+  return MS_FAILURE;
+}
+
+/************************************************************************/
+/*                     Writing of the .shg file                         */
+/************************************************************************/
+
+static double msGeneralizedSqDistance(const pointObj *p, const pointObj *a,
+                                      const pointObj *b) {
+  double dx = b->x - a->x, dy = b->y - a->y, t;
+
+  if (dx != 0 || dy != 0) {
+    t = ((p->x - a->x) * dx + (p->y - a->y) * dy) / (dx * dx + dy * dy);
+    if (t > 1) {
+      a = b;
+    } else if (t > 0) {
+      const double x = a->x + t * dx, y = a->y + t * dy;
+      return (p->x - x) * (p->x - x) + (p->y - y) * (p->y - y);
+    }
+  }
+  return (p->x - a->x) * (p->x - a->x) + (p->y - a->y) * (p->y - a->y);
+}
+
+/*
+** Douglas-Peucker: flags in keep[] the points of line to keep for the
+** tolerance, returns their number. stack holds 2 * numpoints ints.
+*/
+static int msGeneralizeLine(const lineObj *line, double tolerance, char *keep,
+                            int *stack) {
+  const double sqTolerance = tolerance * tolerance;
+  int count = 2, top = 0, i;
+
+  memset(keep, 0, line->numpoints);
+  keep[0] = keep[line->numpoints - 1] = 1;
+  if (line->numpoints <= 2)
+    return line->numpoints;
+
+  stack[top++] = 0;
+  stack[top++] = line->numpoints - 1;
+  while (top > 0) {
+    const int last = stack[--top], first = stack[--top];
+    double sqMax = 0;
+    int farthest = -1;
+
+    for (i = first + 1; i < last; i++) {
+      const double d = msGeneralizedSqDistance(
+          &line->point[i], &line->point[first], &line->point[last]);
+      if (d > sqMax) {
+        sqMax = d;
+        farthest = i;
+      }
+    }
+    if (farthest >= 0 && sqMax > sqTolerance) {
+      keep[farthest] = 1;
+      count++;
+      stack[top++] = first;
+      stack[top++] = farthest;
+      stack[top++] = farthest;
+      stack[top++] = last;
+    }
+  }
+  return count;
+}
+
+typedef struct {
+  uchar *data;
+  size_t size, capacity;
+} msGeneralizedBuffer;
+
+static void msGeneralizedAppend(msGeneralizedBuffer *buffer, const void *data,
+                                size_t size) {
+  if (buffer->size + size > buffer->capacity) {
+    buffer->capacity = MS_MAX(buffer->capacity * 2, buffer->size + size);
+    buffer->data = (uchar *)msSmallRealloc(buffer->data, buffer->capacity);
+  }
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+}
+
+/*
+** Encodes the simplification of shape as a record in parts (the part sizes)
+** and points. Rings that collapse are left out, unless all do: the first
+** one is then kept as a triangle. Returns the number of points.
+*/
+static int msGeneralizeShape(const shapeObj *shape, double tolerance,
+                             int isPolygon, msGeneralizedBuffer *parts,
+                             msGeneralizedBuffer *points, char *keep,
+                             int *stack) {
+  const int minpoints = isPolygon ? 4 : 2;
+  int total = 0, i, j;
+
+  parts->size = points->size = 0;
+  for (i = 0; i < shape->numlines; i++) {
+    const lineObj *line = &shape->line[i];
+    ms_int32 count;
+
+    if (line->numpoints < minpoints)
+      continue;
+    count = msGeneralizeLine(line, tolerance, keep, stack);
+    if (count < minpoints)
+      continue;
+
+    total += count;
+    CPL_LSBPTR32(&count);
+    msGeneralizedAppend(parts, &count, 4);
+    for (j = 0; j < line->numpoints; j++) {
+      if (keep[j]) {
+        double xy[2] = {line->point[j].x, line->point[j].y};
+        CPL_LSBPTR64(&xy[0]);
+        CPL_LSBPTR64(&xy[1]);
+        msGeneralizedAppend(points, xy, 16);
+      }
+    }
+  }
+
+  if (total == 0 && isPolygon) {
+    /* keep a trace of the shape: the first point of its first ring, the */
+    /* point farthest from it and the one farthest from both */
+    for (i = 0; i < shape->numlines; i++) {
+      const lineObj *line = &shape->line[i];
+      int triangle[4] = {0, 0, 0, 0};
+      double sqMax = 0;
+      ms_int32 count = 4;
+
+      if (line->numpoints < 4)
+        continue;
+      for (j = 1; j < line->numpoints; j++) {
+        const double d = msGeneralizedSqDistance(
+            &line->point[j], &line->point[0], &line->point[0]);
+        if (d > sqMax) {
+          sqMax = d;
+          triangle[1] = j;
+        }
+      }
+      sqMax = 0;
+      for (j = 1; j < line->numpoints; j++) {
+        const double d = msGeneralizedSqDistance(
+            &line->point[j], &line->point[0], &line->point[triangle[1]]);
+        if (d > sqMax) {
+          sqMax = d;
+          triangle[2] = j;
+        }
+      }
+      if (triangle[2] < triangle[1]) {
+        const int t = triangle[1];
+        triangle[1] = triangle[2];
+        triangle[2] = t;
+      }
+
+      total = 4;
+      CPL_LSBPTR32(&count);
+      msGeneralizedAppend(parts, &count, 4);
+      for (j = 0; j < 4; j++) {
+        double xy[2] = {line->point[triangle[j]].x,
+                        line->point[triangle[j]].y};
+        CPL_LSBPTR64(&xy[0]);
+        CPL_LSBPTR64(&xy[1]);
+        msGeneralizedAppend(points, xy, 16);
+      }
+      break;
+    }
+  }
+
+  return total;
+}
+
+static void msGeneralizedPutEntry(uchar *entry, GUInt64 offset,
+                                  ms_int32 nParts, ms_int32 nPoints) {
+  CPL_LSBPTR64(&offset);
+  memcpy(entry, &offset, 8);
+  CPL_LSBPTR32(&nParts);
+  memcpy(entry + 8, &nParts, 4);
+  CPL_LSBPTR32(&nPoints);
+  memcpy(entry + 12, &nPoints, 4);
+}
+
+/*
+** Writes the .shg file of a line or polygon shapefile, with a level for each
+** of the numlevels tolerances, which must be increasing.
+*/
+int msWriteGeneralizedShapes(shapefileObj *shapefile, const char *filename,
+                             int numlevels, const double *tolerances) {
+  const int isPolygon = shapefile->type == SHP_POLYGON ||
+                        shapefile->type == SHP_POLYGONZ ||
+                        shapefile->type == SHP_POLYGONM;
+  const size_t tablesize = (size_t)shapefile->numshapes * 16;
+  msGeneralizedBuffer parts = {NULL, 0, 0}, points = {NULL, 0, 0};
+  msGeneralizedBuffer previous = {NULL, 0, 0};
+  uchar header[MS_GENERALIZED_HEADER_SIZE(MS_GENERALIZED_MAX_LEVELS)];
+  uchar *tables = NULL;
+  char *keep = NULL;
+  int *stack = NULL;
+  int maxpoints = 0, status = MS_SUCCESS, i, level;
+  GUInt64 position;
+  VSILFILE *fp;
+
+  if (!msGeneralizedIsLineOrPolygon(shapefile->type)) {
+    msSetError(MS_SHPERR, "Only line and polygon shapefiles can be generalized.",
+               "msWriteGeneralizedShapes()");
+    return MS_FAILURE;
+  }
+  if (numlevels <= 0 || numlevels > MS_GENERALIZED_MAX_LEVELS) {
+    msSetError(MS_MISCERR, "Invalid number of levels %d, at most %d.",
+               "msWriteGeneralizedShapes()", numlevels,
+               MS_GENERALIZED_MAX_LEVELS);
+    return MS_FAILURE;
+  }
+  for (level = 0; level < numlevels; level++) {
+    if (!(tolerances[level] > 0) ||
+        (level > 0 && tolerances[level] <= tolerances[level - 1])) {
+      msSetError(MS_MISCERR,
+                 "Tolerances must be positive and increasing.",
+                 "msWriteGeneralizedShapes()");
+      return MS_FAILURE;
+    }
+  }
+
+  fp = VSIFOpenL(filename, "wb");
+  if (!fp) {
+    msSetError(MS_IOERR, "Unable to create %s.", "msWriteGeneralizedShapes()",
+               filename);
+    return MS_FAILURE;
+  }
+
+  /* the header is written last, once the tables are placed */
+  memset(header, 0, sizeof(header));
+  position = MS_GENERALIZED_HEADER_SIZE(numlevels);
+  if (VSIFWriteL(header, 1, (size_t)position, fp) != position)
+    status = MS_FAILURE;
+
+  tables = (uchar *)msSmallCalloc(MS_MAX(1, tablesize), numlevels);
+
+  for (i = 0; i < shapefile->numshapes && status == MS_SUCCESS; i++) {
+    shapeObj shape;
+    GUInt64 previousoffset = 0;
+    ms_int32 previousparts = 0, previouspoints = 0;
+    int numpoints = 0, j;
+
+    msSHPReadShape(shapefile->hSHP, i, &shape);
+    if (shape.type == MS_SHAPE_NULL) {
+      msFreeShape(&shape);
+      continue; /* read from the .shp */
+    }
+
+    for (j = 0; j < shape.numlines; j++)
+      numpoints += shape.line[j].numpoints;
+    for (j = 0; j < shape.numlines; j++) {
+      if (shape.line[j].numpoints > maxpoints) {
+        maxpoints = shape.line[j].numpoints;
+        keep = (char *)msSmallRealloc(keep, maxpoints);
+        stack = (int *)msSmallRealloc(stack, sizeof(int) * 2 * maxpoints);
+      }
+    }
+
+    previous.size = 0;
+    for (level = 0; level < numlevels; level++) {
+      uchar *entry = tables + level * tablesize + (size_t)i * 16;
+      const int count =
+          msGeneralizeShape(&shape, tolerances[level], isPolygon, &parts,
+                            &points, keep, stack);
+      const ms_int32 nParts = (ms_int32)(parts.size / 4);
+
+      if (count == 0 || count >= numpoints)
+        continue; /* nothing gained, read from the .shp */
+
+      if (nParts == previousparts && count == previouspoints &&
+          parts.size + points.size == previous.size &&
+          memcmp(previous.data, parts.data, parts.size) == 0 &&
+          memcmp(previous.data + parts.size, points.data, points.size) == 0) {
+        msGeneralizedPutEntry(entry, previousoffset, nParts, count);
+        continue; /* same as the finer level */
+      }
+
+      if (VSIFWriteL(parts.data, 1, parts.size, fp) != parts.size ||
+          VSIFWriteL(points.data, 1, points.size, fp) != points.size) {
+        status = MS_FAILURE;
+        break;
+      }
+      msGeneralizedPutEntry(entry, position, nParts, count);
+
+      previous.size = 0;
+      msGeneralizedAppend(&previous, parts.data, parts.size);
+      msGeneralizedAppend(&previous, points.data, points.size);
+      previousoffset = position;
+      previousparts = nParts;
+      previouspoints = count;
+      position += parts.size + points.size;
+    }
+    msFreeShape(&shape);
+  }
+  msResetErrorList(); /* corrupt shapes are left to the .shp reader */
+
+  /* the shape tables, then the header */
+  for (level = 0; level < numlevels && status == MS_SUCCESS; level++) {
+    double tolerance = tolerances[level];
+    GUInt64 offset = position;
+
+    if (tablesize > 0 &&
+        VSIFWriteL(tables + level * tablesize, 1, tablesize, fp) != tablesize)
+      status = MS_FAILURE;
+    position += tablesize;
+
+    CPL_LSBPTR64(&tolerance);
+    memcpy(header + 16 + 16 * level, &tolerance, 8);
+    CPL_LSBPTR64(&offset);
+    memcpy(header + 16 + 16 * level + 8, &offset, 8);
+  }
+  if (status == MS_SUCCESS) {
+    ms_int32 nValue;
+
+    memcpy(header, "SHG", 3);
+    header[3] = MS_GENERALIZED_VERSION;
+    nValue = shapefile->numshapes;
+    CPL_LSBPTR32(&nValue);
+    memcpy(header + 4, &nValue, 4);
+    nValue = numlevels;
+    CPL_LSBPTR32(&nValue);
+    memcpy(header + 8, &nValue, 4);
+    nValue = shapefile->type;
+    CPL_LSBPTR32(&nValue);
+    memcpy(header + 12, &nValue, 4);
+    if (VSIFSeekL(fp, 0, SEEK_SET) != 0 ||
+        VSIFWriteL(header, 1, MS_GENERALIZED_HEADER_SIZE(numlevels), fp) !=
+            MS_GENERALIZED_HEADER_SIZE(numlevels))
+      status = MS_FAILURE;
+  }
+  if (VSIFCloseL(fp) != 0)
+    status = MS_FAILURE;
+
+  free(tables);
+  free(keep);
+  free(stack);
+  free(parts.data);
+  free(points.data);
+  free(previous.data);
+
+  if (status != MS_SUCCESS) {
+    msSetError(MS_IOERR, "Failed to write %s.", "msWriteGeneralizedShapes()",
+               filename);
+    VSIUnlink(filename);
+  }
+  return status;
+}
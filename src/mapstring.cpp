@@ -2443,7 +2443,7 @@ int msLayerEncodeShapeAttributes(layerObj *layer, shapeObj *shape) {
       continue; /* silently ignore failed conversions */
     }
     out[bufsize - bufleft] = '\0';
-    msFree(shape->values[i]);
+    msShapeFreeMemory(shape, shape->values[i]);
     shape->values[i] = out;
   }
   iconv_close(cd);
@@ -5030,6 +5030,7 @@ mapservObj *msAllocMapServObj() {
   mapserv->request = msAllocCgiObj();
 
   mapserv->map = NULL;
+  mapserv->MapFile = NULL;
 
   mapserv->NumLayers = 0; /* number of layers specified by a user */
   mapserv->MaxLayers = 0; /* allocated size of Layers[] array */
@@ -5147,6 +5148,7 @@ void msFreeMapServObj(mapservObj *mapserv) {
     msFree(mapserv->QueryFile);
 
     msFree(mapserv->TileCoords);
+    msFree(mapserv->MapFile);
 
     msFree(mapserv);
   }
@@ -107,6 +107,7 @@ typedef struct {
                     */
 
   mapObj *map;
+  char *MapFile; /* path of the mapfile the map was loaded from, if any */
 
   char **Layers;
   char *icon; /* layer:class combination that defines a legend icon */
@@ -143,7 +143,9 @@ static char *const lock_names[] = {
     NULL,           "PARSER",    "GDAL",    "ERROROBJ", "PROJ",
     "TTF",          "POOL",      "SDE",     "ORACLE",   "OWS",
     "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", "OGR",
-    "TIME",         "FRIBIDI",   "WXS",     "GEOS",     NULL};
+    "TIME",         "FRIBIDI",   "WXS",     "GEOS",     "DRAW",
+    "METRICS",      "PALETTE",   "JOIN",    "CLUSTER",  "TILEINDEX",
+    NULL};
 #endif
 
 /************************************************************************/
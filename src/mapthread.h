@@ -69,8 +69,14 @@ void msReleaseLock(int);
 #define TLOCK_FRIBIDI 16
 #define TLOCK_WxS 17
 #define TLOCK_GEOS 18
+#define TLOCK_DRAW 19
+#define TLOCK_METRICS 20
+#define TLOCK_PALETTE 21
+#define TLOCK_JOIN 22
+#define TLOCK_CLUSTER 23
+#define TLOCK_TILEINDEX 24
 
-#define TLOCK_STATIC_MAX 20
+#define TLOCK_STATIC_MAX 25
 #define TLOCK_MAX 100
 
 #ifdef __cplusplus
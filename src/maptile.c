@@ -30,6 +30,21 @@
 #include "maptile.h"
 #include "mapproject.h"
 
+#include "cpl_conv.h"
+#include "cpl_vsi.h"
+
+#include <sys/stat.h>
+#include <time.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/locking.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
 #ifdef USE_TILE_API
 static void msTileResetMetatileLevel(mapObj *map) {
   hashTableObj *meta = &(map->web.metadata);
@@ -123,27 +138,57 @@ static void msTileGetParams(const mapservObj *msObj, tileParams *params) {
  *                            msTileExtractSubTile                      *
  *                                                                      *
  ************************************************************************/
-static imageObj *msTileExtractSubTile(const mapservObj *msObj,
-                                      const imageObj *img) {
-
-  int width, mini, minj;
-  int zoom = 2;
-  imageObj *imgOut = NULL;
-  tileParams params;
-  rendererVTableObj *renderer;
-  rasterBufferObj imgBuffer;
-
+static int msTileGetRasterBuffer(const mapservObj *msObj, const imageObj *img,
+                                 rasterBufferObj *imgBuffer) {
   if (!MS_RENDERER_PLUGIN(msObj->map->outputformat) ||
       msObj->map->outputformat->renderer != img->format->renderer ||
       !MS_MAP_RENDERER(msObj->map)->supports_pixel_buffer) {
     msSetError(MS_MISCERR, "unsupported or mixed renderers",
                "msTileExtractSubTile()");
+    return MS_FAILURE;
+  }
+  return MS_MAP_RENDERER(msObj->map)->getRasterBufferHandle((imageObj *)img,
+                                                           imgBuffer);
+}
+
+/* copy the tile whose top left corner is at (mini, minj) out of a metatile */
+static imageObj *msTileCopySubTile(const mapservObj *msObj,
+                                   const tileParams *params,
+                                   rasterBufferObj *imgBuffer, int mini,
+                                   int minj) {
+  imageObj *imgOut = msImageCreate(
+      params->tile_width, params->tile_height, msObj->map->outputformat, NULL,
+      NULL, msObj->map->resolution, msObj->map->defresolution, NULL);
+
+  if (imgOut == NULL) {
     return NULL;
   }
-  renderer = MS_MAP_RENDERER(msObj->map);
 
-  if (renderer->getRasterBufferHandle((imageObj *)img, &imgBuffer) !=
-      MS_SUCCESS) {
+  if (msObj->map->debug)
+    msDebug("msTileExtractSubTile(): extracting (%d x %d) tile, top corner "
+            "(%d, %d)\n",
+            params->tile_width, params->tile_height, mini, minj);
+
+  if (MS_UNLIKELY(MS_FAILURE ==
+                  MS_MAP_RENDERER(msObj->map)->mergeRasterBuffer(
+                      imgOut, imgBuffer, 1.0, mini, minj, 0, 0,
+                      params->tile_width, params->tile_height))) {
+    msFreeImage(imgOut);
+    return NULL;
+  }
+
+  return imgOut;
+}
+
+static imageObj *msTileExtractSubTile(const mapservObj *msObj,
+                                      const imageObj *img) {
+
+  int width, mini, minj;
+  int zoom = 2;
+  tileParams params;
+  rasterBufferObj imgBuffer;
+
+  if (msTileGetRasterBuffer(msObj, img, &imgBuffer) != MS_SUCCESS) {
     return NULL;
   }
 
@@ -213,27 +258,7 @@ static imageObj *msTileExtractSubTile(const mapservObj *msObj,
     return (NULL); /* Huh? Should have a mode. */
   }
 
-  imgOut = msImageCreate(
-      params.tile_width, params.tile_height, msObj->map->outputformat, NULL,
-      NULL, msObj->map->resolution, msObj->map->defresolution, NULL);
-
-  if (imgOut == NULL) {
-    return NULL;
-  }
-
-  if (msObj->map->debug)
-    msDebug("msTileExtractSubTile(): extracting (%d x %d) tile, top corner "
-            "(%d, %d)\n",
-            params.tile_width, params.tile_height, mini, minj);
-
-  if (MS_UNLIKELY(MS_FAILURE == renderer->mergeRasterBuffer(
-                                    imgOut, &imgBuffer, 1.0, mini, minj, 0, 0,
-                                    params.tile_width, params.tile_height))) {
-    msFreeImage(imgOut);
-    return NULL;
-  }
-
-  return imgOut;
+  return msTileCopySubTile(msObj, &params, &imgBuffer, mini, minj);
 }
 
 /************************************************************************
@@ -546,3 +571,441 @@ imageObj *msTileDraw(mapservObj *msObj) {
   }
   return img;
 }
+
+/************************************************************************
+ *                            Tile cache                                *
+ *                                                                      *
+ *   Rendered tiles are kept on disk when the "tile_cache_path" web     *
+ *   metadata is set, one directory per combination of mapfile, output *
+ *   format, tile settings, layers and runtime substitutions. Metatiles *
+ *   are cut in all of their tiles at once, and a lock file per         *
+ *   metatile makes sure that concurrent processes do not render the    *
+ *   same metatile.                                                     *
+ ************************************************************************/
+
+typedef struct {
+  char dir[MS_MAXPATHLEN]; /* cache directory of this map/style combination */
+  const char *extension;
+  int ttl;          /* in seconds, 0 to keep tiles until the mapfile changes */
+  time_t mapmtime;  /* modification time of the mapfile, 0 if unknown */
+} tileDiskCacheObj;
+
+/*
+** Requests that modify the mapfile through map.* or map_* parameters
+** (msUpdateMapFromURL()) bypass the cache.
+*/
+int msTileCacheEnabled(const mapservObj *msObj) {
+  int i;
+
+  if (msLookupHashTable(&(msObj->map->web.metadata), "tile_cache_path") ==
+      NULL)
+    return MS_FALSE;
+  for (i = 0; i < msObj->request->NumParams; i++) {
+    if (strncasecmp(msObj->request->ParamNames[i], "map_", 4) == 0 ||
+        strncasecmp(msObj->request->ParamNames[i], "map.", 4) == 0)
+      return MS_FALSE;
+  }
+  return MS_TRUE;
+}
+
+static void msTileCacheHash(unsigned long long *hash, const char *str) {
+  *hash = msFNVHashString(*hash, str, MS_FALSE);
+  /* separator, so that "ab"+"c" differs from "a"+"bc" */
+  *hash = msFNVHashBytes(*hash, "\xff", 1);
+}
+
+/* is name a runtime substitution the mapfile validates */
+static int msTileCacheIsSubstitution(const mapObj *map, const char *name) {
+  int i, j;
+
+  if (msLookupHashTable(&(map->web.validation), name))
+    return MS_TRUE;
+  for (i = 0; i < map->numlayers; i++) {
+    const layerObj *lp = GET_LAYER(map, i);
+    if (msLookupHashTable(&(lp->validation), name))
+      return MS_TRUE;
+    for (j = 0; j < lp->numclasses; j++) {
+      if (msLookupHashTable(&(lp->class[j]->validation), name))
+        return MS_TRUE;
+    }
+  }
+  return MS_FALSE;
+}
+
+typedef struct {
+  const char *name, *value;
+} tileCacheParamObj;
+
+static int msTileCacheCompareParams(const void *a, const void *b) {
+  const tileCacheParamObj *pa = (const tileCacheParamObj *)a;
+  const tileCacheParamObj *pb = (const tileCacheParamObj *)b;
+  const int cmp = strcasecmp(pa->name, pb->name);
+  return cmp ? cmp : strcmp(pa->value, pb->value);
+}
+
+/*
+** Everything that can change the rendering of a tile, except for its
+** coordinates: the mapfile, the output format, the tile settings, the
+** layers that are drawn and the request parameters that the tile mode
+** uses (map, layers, mode, tilemode) or that the mapfile declares as
+** runtime substitutions. Other parameters are ignored, so that arbitrary
+** ones cannot make up new cache directories, and the parameters are sorted
+** so that their order does not matter either.
+*/
+static void msTileCacheKey(const mapservObj *msObj, const tileParams *params,
+                           char *key, size_t keysize) {
+  static const char *const names[] = {"map", "layer", "layers", "mode",
+                                      "tilemode"};
+  const mapObj *map = msObj->map;
+  const cgiRequestObj *request = msObj->request;
+  unsigned long long hash = MS_HASH_INIT;
+  tileCacheParamObj *kept;
+  int numkept = 0;
+  char buffer[128];
+  int i, k;
+
+  msTileCacheHash(&hash, msObj->MapFile ? msObj->MapFile : map->name);
+  msTileCacheHash(&hash, map->outputformat->name);
+  msTileCacheHash(&hash, map->outputformat->mimetype);
+  snprintf(buffer, sizeof(buffer), "%d %d %d %d %d", msObj->TileMode,
+           params->tile_width, params->tile_height, params->metatile_level,
+           params->map_edge_buffer);
+  msTileCacheHash(&hash, buffer);
+
+  for (i = 0; i < map->numlayers; i++) {
+    const layerObj *lp =
+        GET_LAYER(map, map->layerorder ? map->layerorder[i] : i);
+    if (lp->status != MS_OFF)
+      msTileCacheHash(&hash, lp->name ? lp->name : "");
+  }
+
+  kept = (tileCacheParamObj *)msSmallMalloc(
+      MS_MAX(request->NumParams, 1) * sizeof(tileCacheParamObj));
+  for (i = 0; i < request->NumParams; i++) {
+    const char *name = request->ParamNames[i];
+    for (k = 0; k < (int)(sizeof(names) / sizeof(names[0])); k++) {
+      if (strcasecmp(name, names[k]) == 0)
+        break;
+    }
+    if (k == (int)(sizeof(names) / sizeof(names[0])) &&
+        !msTileCacheIsSubstitution(map, name))
+      continue;
+    kept[numkept].name = name;
+    kept[numkept++].value = request->ParamValues[i];
+  }
+  qsort(kept, numkept, sizeof(tileCacheParamObj), msTileCacheCompareParams);
+  for (i = 0; i < numkept; i++) {
+    msTileCacheHash(&hash, kept[i].name);
+    msTileCacheHash(&hash, kept[i].value);
+  }
+  msFree(kept);
+
+  snprintf(key, keysize, "%016llx", hash);
+}
+
+/*
+** Name, relative to the cache directory, of the tile at position (i, j)
+** in the metatile of the request. With i < 0 the position of the requested
+** tile is returned in i and j instead and the name is the one of the lock
+** file of the metatile.
+*/
+static int msTileCacheName(const mapservObj *msObj, const tileParams *params,
+                           int *i, int *j, char *name, size_t namesize) {
+  const int level = params->metatile_level;
+
+  if (msObj->TileMode == TILE_GMAP) {
+    int x, y, zoom;
+    if (msTileGetGMapCoords(msObj->TileCoords, &x, &y, &zoom) != MS_SUCCESS)
+      return MS_FAILURE;
+    if (*i < 0) {
+      *i = x & ((1 << level) - 1);
+      *j = y & ((1 << level) - 1);
+      snprintf(name, namesize, "lock/%d-%d-%d.lock", zoom, x >> level,
+               y >> level);
+    } else {
+      snprintf(name, namesize, "%d/%d/%d", zoom, ((x >> level) << level) + *i,
+               ((y >> level) << level) + *j);
+    }
+  } else if (msObj->TileMode == TILE_VE) {
+    const int prefixlen = (int)strlen(msObj->TileCoords) - level;
+    char quadkey[64];
+    int n;
+    if (prefixlen < 0 || prefixlen + level >= (int)sizeof(quadkey))
+      return MS_FAILURE;
+    memcpy(quadkey, msObj->TileCoords, prefixlen);
+    if (*i < 0) {
+      *i = *j = 0;
+      for (n = prefixlen; n < prefixlen + level; n++) {
+        const char c = msObj->TileCoords[n];
+        *i = *i * 2 + (c == '1' || c == '3');
+        *j = *j * 2 + (c == '2' || c == '3');
+      }
+      quadkey[prefixlen] = '\0';
+      snprintf(name, namesize, "lock/ve%s.lock", quadkey);
+    } else {
+      for (n = 0; n < level; n++) {
+        const int bit = level - 1 - n;
+        quadkey[prefixlen + n] =
+            (char)('0' + ((*i >> bit) & 1) + 2 * ((*j >> bit) & 1));
+      }
+      quadkey[prefixlen + level] = '\0';
+      snprintf(name, namesize, "ve/%s", quadkey);
+    }
+  } else {
+    return MS_FAILURE; /* Huh? Should have a mode. */
+  }
+  return MS_SUCCESS;
+}
+
+static int msTileCacheIsFresh(const tileDiskCacheObj *cache, const char *path) {
+  VSIStatBufL stat_buf;
+
+  if (VSIStatL(path, &stat_buf) != 0)
+    return MS_FALSE;
+  if (cache->mapmtime != 0 && stat_buf.st_mtime < cache->mapmtime)
+    return MS_FALSE;
+  if (cache->ttl > 0 && time(NULL) - stat_buf.st_mtime >= cache->ttl)
+    return MS_FALSE;
+  return MS_TRUE;
+}
+
+static unsigned char *msTileCacheRead(const char *path, int *size_ptr) {
+  unsigned char *data;
+  VSIStatBufL stat_buf;
+  FILE *fp;
+
+  if (VSIStatL(path, &stat_buf) != 0 || stat_buf.st_size > INT_MAX)
+    return NULL;
+  fp = fopen(path, "rb");
+  if (fp == NULL)
+    return NULL;
+  *size_ptr = (int)stat_buf.st_size;
+  data = (unsigned char *)msSmallMalloc(MS_MAX(*size_ptr, 1));
+  if ((int)fread(data, 1, *size_ptr, fp) != *size_ptr) {
+    free(data);
+    data = NULL;
+  }
+  fclose(fp);
+  return data;
+}
+
+/* write to a temporary file first so that readers never see partial tiles */
+static int msTileCacheWrite(const char *path, const unsigned char *data,
+                            int size) {
+  char tmppath[MS_MAXPATHLEN];
+  FILE *fp;
+  int ok;
+
+  VSIMkdirRecursive(CPLGetPath(path), 0755);
+  snprintf(tmppath, sizeof(tmppath), "%s.%d.tmp", path, (int)getpid());
+  fp = fopen(tmppath, "wb");
+  if (fp == NULL)
+    return MS_FAILURE;
+  ok = (int)fwrite(data, 1, size, fp) == size;
+  if (fclose(fp) != 0)
+    ok = MS_FALSE;
+#ifdef _WIN32
+  if (ok)
+    remove(path); /* rename() does not replace files on Windows */
+#endif
+  if (!ok || rename(tmppath, path) != 0) {
+    remove(tmppath);
+    return MS_FAILURE;
+  }
+  return MS_SUCCESS;
+}
+
+/* blocks until no other process holds the lock, returns -1 on failure */
+static int msTileCacheLock(const char *path) {
+  int fd;
+
+  VSIMkdirRecursive(CPLGetPath(path), 0755);
+#ifdef _WIN32
+  fd = _open(path, _O_RDWR | _O_CREAT, _S_IREAD | _S_IWRITE);
+  if (fd >= 0 && _locking(fd, _LK_LOCK, 1) != 0) {
+    _close(fd);
+    fd = -1;
+  }
+#else
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd >= 0 && flock(fd, LOCK_EX) != 0) {
+    close(fd);
+    fd = -1;
+  }
+#endif
+  return fd;
+}
+
+/* releases the lock and removes the lock file */
+static void msTileCacheUnlock(int fd, const char *path) {
+  if (fd < 0)
+    return;
+#ifdef _WIN32
+  _lseek(fd, 0, SEEK_SET);
+  _locking(fd, _LK_UNLCK, 1);
+  _close(fd);
+  remove(path); /* fails while another process has it open, that is fine */
+#else
+  /* a process already waiting on the removed file gets the lock next and
+   * finds the tiles written */
+  unlink(path);
+  flock(fd, LOCK_UN);
+  close(fd);
+#endif
+}
+
+/*
+** Render the metatile of the request, store all of its tiles and return the
+** encoded requested tile at position (ri, rj).
+*/
+static unsigned char *msTileCacheRender(mapservObj *msObj,
+                                        const tileParams *params,
+                                        const tileDiskCacheObj *cache, int ri,
+                                        int rj, int *size_ptr) {
+  const int n = 1 << params->metatile_level;
+  const int subtiles = params->metatile_level > 0 || params->map_edge_buffer > 0;
+  unsigned char *requested = NULL;
+  rasterBufferObj imgBuffer;
+  imageObj *img;
+  int i, j;
+
+  img = msDrawMap(msObj->map, MS_FALSE);
+  if (img == NULL)
+    return NULL;
+  if (subtiles && msTileGetRasterBuffer(msObj, img, &imgBuffer) != MS_SUCCESS) {
+    msFreeImage(img);
+    return NULL;
+  }
+
+  for (j = 0; j < n; j++) {
+    for (i = 0; i < n; i++) {
+      char name[MS_MAXPATHLEN], path[MS_MAXPATHLEN];
+      imageObj *tile = img;
+      unsigned char *data;
+      int size = 0;
+
+      if (subtiles) {
+        tile = msTileCopySubTile(
+            msObj, params, &imgBuffer,
+            params->map_edge_buffer + i * params->tile_width,
+            params->map_edge_buffer + j * params->tile_height);
+        if (tile == NULL)
+          break;
+      }
+      data = msSaveImageBuffer(tile, &size, msObj->map->outputformat);
+      if (tile != img)
+        msFreeImage(tile);
+      if (data == NULL)
+        break;
+
+      if (msTileCacheName(msObj, params, &i, &j, name, sizeof(name)) ==
+          MS_SUCCESS) {
+        snprintf(path, sizeof(path), "%s/%s.%s", cache->dir, name,
+                 cache->extension);
+        if (msTileCacheWrite(path, data, size) != MS_SUCCESS &&
+            msObj->map->debug)
+          msDebug("msTileCacheRender(): failed to write %s\n", path);
+      }
+
+      if (i == ri && j == rj) {
+        requested = data;
+        *size_ptr = size;
+      } else {
+        free(data);
+      }
+    }
+    if (i < n)
+      break; /* failure, the error is already set */
+  }
+
+  msFreeImage(img);
+  if (j < n) {
+    free(requested);
+    return NULL;
+  }
+  return requested;
+}
+
+/************************************************************************
+ *                            msTileCacheDraw                           *
+ *                                                                      *
+ *   Return the encoded tile of the request, from the tile cache when   *
+ *   it holds a fresh copy or rendered (with the rest of its metatile) *
+ *   otherwise. Call msTileSetExtent() first.                           *
+ ************************************************************************/
+unsigned char *msTileCacheDraw(mapservObj *msObj, int *size_ptr) {
+  mapObj *map = msObj->map;
+  tileDiskCacheObj cache;
+  tileParams params;
+  char key[32], name[MS_MAXPATHLEN], tilepath[MS_MAXPATHLEN];
+  char lockpath[MS_MAXPATHLEN];
+  const char *value;
+  unsigned char *data;
+  int i = -1, j = -1, lockfd;
+
+  *size_ptr = 0;
+  msTileGetParams(msObj, &params);
+
+  memset(&cache, 0, sizeof(cache));
+  value = msLookupHashTable(&(map->web.metadata), "tile_cache_path");
+  if (value == NULL || msBuildPath(cache.dir, map->mappath, value) == NULL) {
+    msSetError(MS_WEBERR, "Invalid tile_cache_path.", "msTileCacheDraw()");
+    return NULL;
+  }
+  if ((value = msLookupHashTable(&(map->web.metadata), "tile_cache_ttl")))
+    cache.ttl = atoi(value);
+  if (msObj->MapFile) {
+    struct stat stat_buf;
+    if (stat(msObj->MapFile, &stat_buf) == 0)
+      cache.mapmtime = stat_buf.st_mtime;
+  }
+  cache.extension = map->outputformat->extension
+                        ? map->outputformat->extension
+                        : "tile";
+
+  msTileCacheKey(msObj, &params, key, sizeof(key));
+  if (strlen(cache.dir) + strlen(key) + 2 > sizeof(cache.dir)) {
+    msSetError(MS_WEBERR, "tile_cache_path is too long.", "msTileCacheDraw()");
+    return NULL;
+  }
+  strcat(cache.dir, "/");
+  strcat(cache.dir, key);
+
+  if (msTileCacheName(msObj, &params, &i, &j, name, sizeof(name)) !=
+      MS_SUCCESS) {
+    msSetError(MS_WEBERR, "Invalid tile coordinates.", "msTileCacheDraw()");
+    return NULL;
+  }
+  snprintf(lockpath, sizeof(lockpath), "%s/%s", cache.dir, name);
+  if (msTileCacheName(msObj, &params, &i, &j, name, sizeof(name)) !=
+      MS_SUCCESS) {
+    msSetError(MS_WEBERR, "Invalid tile coordinates.", "msTileCacheDraw()");
+    return NULL;
+  }
+  snprintf(tilepath, sizeof(tilepath), "%s/%s.%s", cache.dir, name,
+           cache.extension);
+
+  if (msTileCacheIsFresh(&cache, tilepath) &&
+      (data = msTileCacheRead(tilepath, size_ptr)) != NULL) {
+    if (map->debug)
+      msDebug("msTileCacheDraw(): %s served from the cache\n", tilepath);
+    return data;
+  }
+
+  /* only one process renders a given metatile, the others wait for it */
+  lockfd = msTileCacheLock(lockpath);
+  if (lockfd < 0 && map->debug)
+    msDebug("msTileCacheDraw(): unable to lock %s\n", lockpath);
+
+  if (msTileCacheIsFresh(&cache, tilepath) &&
+      (data = msTileCacheRead(tilepath, size_ptr)) != NULL) {
+    if (map->debug)
+      msDebug("msTileCacheDraw(): %s rendered by another process\n",
+              tilepath);
+  } else {
+    data = msTileCacheRender(msObj, &params, &cache, i, j, size_ptr);
+  }
+
+  msTileCacheUnlock(lockfd, lockpath);
+  return data;
+}
@@ -40,10 +40,20 @@
 
 enum tileModes { TILE_GMAP, TILE_VE };
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 MS_DLL_EXPORT int msTileSetup(mapservObj *msObj);
 MS_DLL_EXPORT int msTileSetExtent(mapservObj *msObj);
 MS_DLL_EXPORT int msTileSetProjections(mapObj *map);
 MS_DLL_EXPORT imageObj *msTileDraw(mapservObj *msObj);
+MS_DLL_EXPORT int msTileCacheEnabled(const mapservObj *msObj);
+MS_DLL_EXPORT unsigned char *msTileCacheDraw(mapservObj *msObj, int *size_ptr);
+
+#ifdef __cplusplus
+}
+#endif
 
 typedef struct {
   int metatile_level;  /* In zoom levels above tile request: best bet is 0, 1 or
@@ -96,6 +96,37 @@ static treeNodeObj *treeNodeCreate(rectObj rect) {
   return node;
 }
 
+/* read size bytes from the index, returns 1 on success like fread(...,1,fp) */
+static int diskTreeRead(SHPTreeHandle disktree, void *buf, size_t size) {
+  if (disktree->map.data) {
+    if (size > disktree->map.size - disktree->mappos)
+      return 0;
+    memcpy(buf, disktree->map.data + disktree->mappos, size);
+    disktree->mappos += size;
+    return 1;
+  }
+  return fread(buf, size, 1, disktree->fp) == 1;
+}
+
+/* skip offset bytes forward in the index, returns 0 on success like fseek */
+static int diskTreeSkip(SHPTreeHandle disktree, long offset) {
+  if (disktree->map.data) {
+    if (offset < 0 ||
+        (size_t)offset > disktree->map.size - disktree->mappos)
+      return -1;
+    disktree->mappos += offset;
+    return 0;
+  }
+  return fseek(disktree->fp, offset, SEEK_CUR);
+}
+
+/* current read position in the index, whether it is mapped or not */
+long msSHPDiskTreeTell(SHPTreeHandle disktree) {
+  if (disktree->map.data)
+    return (long)disktree->mappos;
+  return ftell(disktree->fp);
+}
+
 SHPTreeHandle msSHPDiskTreeOpen(const char *pszTree, int debug) {
   char *pszFullname, *pszBasename;
   SHPTreeHandle psTree;
@@ -106,7 +137,7 @@ SHPTreeHandle msSHPDiskTreeOpen(const char *pszTree, int debug) {
   /* -------------------------------------------------------------------- */
   /*  Initialize the info structure.              */
   /* -------------------------------------------------------------------- */
-  psTree = (SHPTreeHandle)msSmallMalloc(sizeof(SHPTreeInfo));
+  psTree = (SHPTreeHandle)msSmallCalloc(1, sizeof(SHPTreeInfo));
 
   /* -------------------------------------------------------------------- */
   /*  Compute the base (layer) name.  If there is any extension     */
@@ -128,23 +159,38 @@ SHPTreeHandle msSHPDiskTreeOpen(const char *pszTree, int debug) {
   /*  a PC to Unix with upper case filenames won't work!        */
   /* -------------------------------------------------------------------- */
   pszFullname = (char *)msSmallMalloc(strlen(pszBasename) + 5);
-  sprintf(pszFullname, "%s%s", pszBasename, MS_INDEX_EXTENSION);
-  psTree->fp = fopen(pszFullname, "rb");
-  if (psTree->fp == NULL) {
-    sprintf(pszFullname, "%s.QIX", pszBasename);
+  if (msSHPMapFileEnabled()) {
+    sprintf(pszFullname, "%s%s", pszBasename, MS_INDEX_EXTENSION);
+    psTree->vsifp = VSIFOpenL(pszFullname, "rb");
+    if (psTree->vsifp == NULL) {
+      sprintf(pszFullname, "%s.QIX", pszBasename);
+      psTree->vsifp = VSIFOpenL(pszFullname, "rb");
+    }
+    if (psTree->vsifp &&
+        msSHPMapFile(psTree->vsifp, &psTree->map) != MS_SUCCESS) {
+      VSIFCloseL(psTree->vsifp);
+      psTree->vsifp = NULL;
+    }
+  }
+  if (psTree->vsifp == NULL) {
+    sprintf(pszFullname, "%s%s", pszBasename, MS_INDEX_EXTENSION);
     psTree->fp = fopen(pszFullname, "rb");
+    if (psTree->fp == NULL) {
+      sprintf(pszFullname, "%s.QIX", pszBasename);
+      psTree->fp = fopen(pszFullname, "rb");
+    }
   }
 
   msFree(pszBasename); /* don't need these any more */
   msFree(pszFullname);
 
-  if (psTree->fp == NULL) {
+  if (psTree->fp == NULL && psTree->vsifp == NULL) {
     msFree(psTree);
     return (NULL);
   }
 
-  if (fread(pabyBuf, 8, 1, psTree->fp) != 1) {
-    msFree(psTree);
+  if (!diskTreeRead(psTree, pabyBuf, 8)) {
+    msSHPDiskTreeClose(psTree);
     return (NULL);
   }
 
@@ -183,8 +229,8 @@ SHPTreeHandle msSHPDiskTreeOpen(const char *pszTree, int debug) {
     memcpy(&psTree->version, pabyBuf + 4, 1);
     memcpy(&psTree->flags, pabyBuf + 5, 3);
 
-    if (fread(pabyBuf, 8, 1, psTree->fp) != 1) {
-      msFree(psTree);
+    if (!diskTreeRead(psTree, pabyBuf, 8)) {
+      msSHPDiskTreeClose(psTree);
       return (NULL);
     }
   }
@@ -201,7 +247,12 @@ SHPTreeHandle msSHPDiskTreeOpen(const char *pszTree, int debug) {
 }
 
 void msSHPDiskTreeClose(SHPTreeHandle disktree) {
-  fclose(disktree->fp);
+  if (disktree->vsifp) {
+    msSHPUnmapFile(&disktree->map);
+    VSIFCloseL(disktree->vsifp);
+  } else {
+    fclose(disktree->fp);
+  }
   free(disktree);
 }
 
@@ -470,12 +521,12 @@ static void searchDiskTreeNode(SHPTreeHandle disktree, rectObj aoi,
 
   int *ids = NULL;
 
-  if (fread(&offset, 4, 1, disktree->fp) != 1)
+  if (!diskTreeRead(disktree, &offset, 4))
     goto error;
   if (disktree->needswap)
     SwapWord(4, &offset);
 
-  if (fread(&rect, sizeof(rectObj), 1, disktree->fp) != 1)
+  if (!diskTreeRead(disktree, &rect, sizeof(rectObj)))
     goto error;
   if (disktree->needswap)
     SwapWord(8, &rect.minx);
@@ -486,7 +537,7 @@ static void searchDiskTreeNode(SHPTreeHandle disktree, rectObj aoi,
   if (disktree->needswap)
     SwapWord(8, &rect.maxy);
 
-  if (fread(&numshapes, 4, 1, disktree->fp) != 1)
+  if (!diskTreeRead(disktree, &numshapes, 4))
     goto error;
   if (disktree->needswap)
     SwapWord(4, &numshapes);
@@ -495,14 +546,26 @@ static void searchDiskTreeNode(SHPTreeHandle disktree, rectObj aoi,
 
   if (!msRectOverlap(&rect, &aoi)) { /* skip rest of this node and sub-nodes */
     offset += numshapes * sizeof(ms_int32) + sizeof(ms_int32);
-    if (fseek(disktree->fp, offset, SEEK_CUR) < 0)
+    if (diskTreeSkip(disktree, offset) < 0)
       goto error;
     return;
   }
-  if (numshapes > 0) {
+  if (numshapes > 0 && disktree->map.data) {
+    /* decode the ids in place */
+    const uchar *pabyIds = disktree->map.data + disktree->mappos;
+    if (diskTreeSkip(disktree, numshapes * sizeof(ms_int32)) < 0)
+      goto error;
+    for (i = 0; i < numshapes; i++) {
+      ms_int32 id;
+      memcpy(&id, pabyIds + i * sizeof(ms_int32), sizeof(ms_int32));
+      if (disktree->needswap)
+        SwapWord(4, &id);
+      msSetBit(status, id, 1);
+    }
+  } else if (numshapes > 0) {
     ids = (int *)msSmallMalloc(numshapes * sizeof(ms_int32));
 
-    if (fread(ids, numshapes * sizeof(ms_int32), 1, disktree->fp) != 1)
+    if (!diskTreeRead(disktree, ids, numshapes * sizeof(ms_int32)))
       goto error;
     if (disktree->needswap) {
       for (i = 0; i < numshapes; i++) {
@@ -517,7 +580,7 @@ static void searchDiskTreeNode(SHPTreeHandle disktree, rectObj aoi,
     ids = NULL;
   }
 
-  if (fread(&numsubnodes, 4, 1, disktree->fp) != 1)
+  if (!diskTreeRead(disktree, &numsubnodes, 4))
     goto error;
   if (disktree->needswap)
     SwapWord(4, &numsubnodes);
@@ -582,7 +645,7 @@ treeNodeObj *readTreeNode(SHPTreeHandle disktree) {
   node = (treeNodeObj *)msSmallMalloc(sizeof(treeNodeObj));
   node->ids = NULL;
 
-  res = fread(&offset, 4, 1, disktree->fp);
+  res = diskTreeRead(disktree, &offset, 4);
   if (!res) {
     free(node);
     return NULL;
@@ -591,7 +654,7 @@ treeNodeObj *readTreeNode(SHPTreeHandle disktree) {
   if (disktree->needswap)
     SwapWord(4, &offset);
 
-  res = fread(&node->rect, sizeof(rectObj), 1, disktree->fp);
+  res = diskTreeRead(disktree, &node->rect, sizeof(rectObj));
   if (!res) {
     free(node);
     return NULL;
@@ -605,7 +668,7 @@ treeNodeObj *readTreeNode(SHPTreeHandle disktree) {
   if (disktree->needswap)
     SwapWord(8, &node->rect.maxy);
 
-  res = fread(&node->numshapes, 4, 1, disktree->fp);
+  res = diskTreeRead(disktree, &node->numshapes, 4);
   if (!res) {
     free(node);
     return NULL;
@@ -618,7 +681,7 @@ treeNodeObj *readTreeNode(SHPTreeHandle disktree) {
   }
   if (node->numshapes > 0) {
     node->ids = (ms_int32 *)msSmallMalloc(sizeof(ms_int32) * node->numshapes);
-    res = fread(node->ids, node->numshapes * 4, 1, disktree->fp);
+    res = diskTreeRead(disktree, node->ids, node->numshapes * 4);
     if (!res) {
       free(node->ids);
       free(node);
@@ -630,7 +693,7 @@ treeNodeObj *readTreeNode(SHPTreeHandle disktree) {
       SwapWord(4, &node->ids[i]);
   }
 
-  res = fread(&node->numsubnodes, 4, 1, disktree->fp);
+  res = diskTreeRead(disktree, &node->numsubnodes, 4);
   if (!res) {
     free(node->ids);
     free(node);
@@ -743,7 +806,7 @@ int msWriteTree(treeObj *tree, char *filename, int B_order) {
   char pabyBuf[32];
   char *pszBasename, *pszFullname;
 
-  disktree = (SHPTreeHandle)malloc(sizeof(SHPTreeInfo));
+  disktree = (SHPTreeHandle)calloc(1, sizeof(SHPTreeInfo));
   MS_CHECK_ALLOC(disktree, sizeof(SHPTreeInfo), MS_FALSE);
 
   /* -------------------------------------------------------------------- */
@@ -57,6 +57,9 @@ typedef struct {
 
 typedef struct {
   FILE *fp;
+  VSILFILE *vsifp;      /* used instead of fp when the index is mapped */
+  shpMappedFileObj map; /* mapped index, data is NULL when reading fp */
+  size_t mappos;
   char signature[3];
   char LSB_order;
   char needswap;
@@ -76,6 +79,7 @@ typedef SHPTreeInfo *SHPTreeHandle;
 
 MS_DLL_EXPORT SHPTreeHandle msSHPDiskTreeOpen(const char *pszTree, int debug);
 MS_DLL_EXPORT void msSHPDiskTreeClose(SHPTreeHandle disktree);
+MS_DLL_EXPORT long msSHPDiskTreeTell(SHPTreeHandle disktree);
 MS_DLL_EXPORT treeNodeObj *readTreeNode(SHPTreeHandle disktree);
 
 MS_DLL_EXPORT treeObj *msCreateTree(shapefileObj *shapefile, int maxdepth);
@@ -92,6 +96,15 @@ MS_DLL_EXPORT int msWriteTree(treeObj *tree, char *filename, int LSB_order);
 MS_DLL_EXPORT void msFilterTreeSearch(shapefileObj *shp, ms_bitarray status,
                                       rectObj search_rect);
 
+/* packed Hilbert R-tree index, see maprtree.cpp */
+#define MS_RTREE_DEFAULT_NODESIZE 16
+
+MS_DLL_EXPORT int msWriteRTree(shapefileObj *shapefile, const char *filename,
+                               int nodesize);
+MS_DLL_EXPORT int msSearchDiskRTree(const char *filename, rectObj aoi,
+                                    int debug, int numshapes, ms_int32 **ids,
+                                    int *numids);
+
 #ifdef __cplusplus
 }
 #endif
@@ -692,6 +692,10 @@ int msEvalExpression(layerObj *layer, shapeObj *shape,
     int status;
     parseObj p;
 
+    if (expression->program &&
+        msEvalCompiledExpression(expression, shape, &status) == MS_SUCCESS)
+      return status;
+
     p.shape = shape;
     p.expr = expression;
     p.expr->curtoken = p.expr->tokens; /* reset */
@@ -796,6 +800,11 @@ int msShapeGetNextClass(int currentclass, layerObj *layer, mapObj *map,
     if (classgroup == NULL || numclasses <= 0)
       numclasses = layer->numclasses;
 
+    /* layers with many classes are looked up by value, see mapclassindex.c */
+    if (msClassIndexGetNextClass(layer, map, shape, currentclass, classgroup,
+                                 numclasses, &iclass))
+      return iclass;
+
     for (i = currentclass + 1; i < numclasses; i++) {
       if (classgroup)
         iclass = classgroup[i];
@@ -1086,10 +1095,15 @@ int msSaveImage(mapObj *map, imageObj *img, const char *filename) {
   int nReturnVal = MS_FAILURE;
   char szPath[MS_MAXPATHLEN];
   struct mstimeval starttime = {0}, endtime = {0};
+  mapObj *metricsmap = map ? map : (img ? img->map : NULL);
+  msMetricsObj *metrics = metricsmap ? metricsmap->metrics : NULL;
+  double metricsstart = 0;
 
   if (map && map->debug >= MS_DEBUGLEVEL_TUNING) {
     msGettimeofday(&starttime, NULL);
   }
+  if (metrics)
+    metricsstart = msMetricsNow();
 
   if (img) {
     if (MS_DRIVER_GDAL(img->format)) {
@@ -1149,6 +1163,8 @@ int msSaveImage(mapObj *map, imageObj *img, const char *filename) {
             (endtime.tv_sec + endtime.tv_usec / 1.0e6) -
                 (starttime.tv_sec + starttime.tv_usec / 1.0e6));
   }
+  if (metrics)
+    msMetricsAddSpan(metrics, NULL, MS_METRIC_ENCODE, metricsstart);
 
   return nReturnVal;
 }
@@ -1163,8 +1179,9 @@ int msSaveImage(mapObj *map, imageObj *img, const char *filename) {
 ** The function returns NULL if the output format is not supported.
 */
 
-unsigned char *msSaveImageBuffer(imageObj *image, int *size_ptr,
-                                 outputFormatObj *format) {
+static unsigned char *msSaveImageBufferInternal(imageObj *image,
+                                                int *size_ptr,
+                                                outputFormatObj *format) {
   *size_ptr = 0;
   if (MS_RENDERER_PLUGIN(image->format)) {
     rasterBufferObj data;
@@ -1193,6 +1210,21 @@ unsigned char *msSaveImageBuffer(imageObj *image, int *size_ptr,
   return NULL;
 }
 
+unsigned char *msSaveImageBuffer(imageObj *image, int *size_ptr,
+                                 outputFormatObj *format) {
+  msMetricsObj *metrics = image->map ? image->map->metrics : NULL;
+  double starttime;
+  unsigned char *buffer;
+
+  if (!metrics)
+    return msSaveImageBufferInternal(image, size_ptr, format);
+
+  starttime = msMetricsNow();
+  buffer = msSaveImageBufferInternal(image, size_ptr, format);
+  msMetricsAddSpan(metrics, NULL, MS_METRIC_ENCODE, starttime);
+  return buffer;
+}
+
 /**
  * Generic function to free the imageObj
  */
@@ -2138,6 +2170,7 @@ int msSetup() {
 #endif
 void msCleanup() {
   msForceTmpFileBase(NULL);
+  msDrawParallelCleanup();
   msConnPoolFinalCleanup();
   /* Lexer string parsing variable */
   if (msyystring_buffer != NULL) {
@@ -2178,6 +2211,14 @@ void msCleanup() {
 
   msFontCacheCleanup();
 
+  msPaletteCacheCleanup();
+
+  msJoinCacheCleanup();
+
+  msClusterCacheCleanup();
+
+  msRasterTileIndexCacheCleanup();
+
   msTimeCleanup();
 
   msIO_Cleanup();
@@ -894,8 +894,12 @@ int *msDBFGetItemIndexes(DBFHandle dbffile, char **items, int numitems) {
   return (itemindexes);
 }
 
-char **msDBFGetValueList(DBFHandle dbffile, int record, int *itemindexes,
-                         int numitems) {
+/*
+** The values and the array are allocated from arena if it is not NULL, see
+** maparena.c.
+*/
+char **msDBFGetValueListEx(DBFHandle dbffile, int record, int *itemindexes,
+                           int numitems, msArenaObj *arena) {
   const char *value;
   char **values = NULL;
   int i;
@@ -903,17 +907,26 @@ char **msDBFGetValueList(DBFHandle dbffile, int record, int *itemindexes,
   if (numitems == 0)
     return (NULL);
 
-  values = (char **)malloc(sizeof(char *) * numitems);
+  if (arena)
+    values = (char **)msArenaAlloc(arena, sizeof(char *) * numitems);
+  else
+    values = (char **)malloc(sizeof(char *) * numitems);
   MS_CHECK_ALLOC(values, sizeof(char *) * numitems, NULL);
 
   for (i = 0; i < numitems; i++) {
     value = msDBFReadStringAttribute(dbffile, record, itemindexes[i]);
     if (value == NULL) {
-      free(values);
+      if (!arena)
+        msFreeCharArray(values, i);
       return NULL; /* Error already reported by msDBFReadStringAttribute() */
     }
-    values[i] = msStrdup(value);
+    values[i] = arena ? msArenaStrdup(arena, value) : msStrdup(value);
   }
 
   return (values);
 }
+
+char **msDBFGetValueList(DBFHandle dbffile, int record, int *itemindexes,
+                         int numitems) {
+  return msDBFGetValueListEx(dbffile, record, itemindexes, numitems, NULL);
+}
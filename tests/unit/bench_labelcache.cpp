@@ -0,0 +1,172 @@
+/*
+ * Micro-benchmark of the label cache collision tests, comparing the grid
+ * index of the rendered labels and markers with the scan of all of them
+ * selected by msSetLabelCacheGridLinear().
+ *
+ * Usage: bench_labelcache [num_labels num_markers width height iterations]
+ */
+
+#include "../../src/mapserver.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/* candidate labels, a fraction of them with a leader line */
+struct Candidate {
+  rectObj bbox;
+  bool leader;
+  pointObj lp[2];
+};
+
+/* runs the placement loop of msDrawLabelCache() on the candidates, returns
+ * the indices of the labels that were placed */
+static std::vector<int> placeLabels(mapObj *map,
+                                    const std::vector<Candidate> &candidates,
+                                    const std::vector<rectObj> &markers) {
+  std::vector<int> placed;
+  const int numLabels = candidates.size();
+  labelObj label;
+  initLabel(&label);
+  label.partials = MS_TRUE;
+
+  msFreeLabelCache(&map->labelcache);
+  msInitLabelCache(&map->labelcache);
+  labelCacheSlotObj *slot = &map->labelcache.slots[0];
+  slot->markers = (markerCacheMemberObj *)msSmallRealloc(
+      slot->markers, markers.size() * sizeof(markerCacheMemberObj));
+  slot->markercachesize = markers.size();
+  for (const rectObj &bounds : markers) {
+    slot->markers[slot->nummarkers].id = slot->nummarkers;
+    slot->markers[slot->nummarkers++].bounds = bounds;
+  }
+
+  std::vector<textPathObj> paths(numLabels);
+  std::vector<textSymbolObj> symbols(numLabels);
+  std::vector<textSymbolObj *> symbolptrs(numLabels);
+  std::vector<labelCacheMemberObj> members(numLabels);
+  std::vector<lineObj> leaders(numLabels);
+  std::vector<pointObj> leaderpoints(2 * numLabels);
+  std::vector<rectObj> leaderbboxes(numLabels);
+  for (int i = 0; i < numLabels; i++) {
+    const Candidate &c = candidates[i];
+    memset(&paths[i], 0, sizeof(textPathObj));
+    paths[i].bounds.bbox = c.bbox;
+    memset(&symbols[i], 0, sizeof(textSymbolObj));
+    symbols[i].label = &label;
+    symbols[i].textpath = &paths[i];
+    symbolptrs[i] = &symbols[i];
+    memset(&members[i], 0, sizeof(labelCacheMemberObj));
+    members[i].numtextsymbols = 1;
+    members[i].textsymbols = &symbolptrs[i];
+    members[i].bbox = c.bbox;
+
+    label_bounds lb = paths[i].bounds;
+    if (!msTestLabelCacheCollisions(map, &members[i], &lb, 0, -1))
+      continue;
+    if (c.leader) {
+      leaderpoints[2 * i] = c.lp[0];
+      leaderpoints[2 * i + 1] = c.lp[1];
+      if (!msTestLabelCacheLeaderCollision(map, &leaderpoints[2 * i],
+                                           &leaderpoints[2 * i + 1]))
+        continue;
+      leaders[i].numpoints = 2;
+      leaders[i].point = &leaderpoints[2 * i];
+      leaderbboxes[i].minx = MS_MIN(c.lp[0].x, c.lp[1].x);
+      leaderbboxes[i].maxx = MS_MAX(c.lp[0].x, c.lp[1].x);
+      leaderbboxes[i].miny = MS_MIN(c.lp[0].y, c.lp[1].y);
+      leaderbboxes[i].maxy = MS_MAX(c.lp[0].y, c.lp[1].y);
+      members[i].leaderline = &leaders[i];
+      members[i].leaderbbox = &leaderbboxes[i];
+    }
+    insertRenderedLabelMember(map, &members[i]);
+    placed.push_back(i);
+  }
+
+  /* the members live in the vectors above, only drop the references */
+  msFreeLabelCache(&map->labelcache);
+  msInitLabelCache(&map->labelcache);
+  freeLabel(&label);
+  return placed;
+}
+
+template <class F> static double timeIt(int iterations, F f) {
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++)
+    f();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() * 1000.0 / iterations;
+}
+
+int main(int argc, char **argv) {
+  const int numLabels = argc > 1 ? atoi(argv[1]) : 20000;
+  const int numMarkers = argc > 2 ? atoi(argv[2]) : 5000;
+  const int width = argc > 3 ? atoi(argv[3]) : 4096;
+  const int height = argc > 4 ? atoi(argv[4]) : 4096;
+  const int iterations = argc > 5 ? atoi(argv[5]) : 3;
+
+  if (numLabels <= 0 || numMarkers < 0 || width <= 0 || height <= 0 ||
+      iterations <= 0) {
+    fprintf(stderr,
+            "Usage: %s [num_labels num_markers width height iterations]\n",
+            argv[0]);
+    return 1;
+  }
+
+  const std::string mapfile = "MAP SIZE " + std::to_string(width) + " " +
+                              std::to_string(height) + " EXTENT 0 0 " +
+                              std::to_string(width) + " " +
+                              std::to_string(height) + " END";
+  std::vector<char> buffer(mapfile.begin(), mapfile.end());
+  buffer.push_back('\0');
+  mapObj *map = msLoadMapFromString(buffer.data(), NULL, NULL);
+  if (!map) {
+    msWriteError(stderr);
+    return 1;
+  }
+
+  /* labels of a typical size, scattered over and slightly around the image */
+  srand(1);
+  std::vector<Candidate> candidates(numLabels);
+  for (int i = 0; i < numLabels; i++) {
+    Candidate &c = candidates[i];
+    c.bbox.minx = rand() % (width + 80) - 40;
+    c.bbox.miny = rand() % (height + 80) - 40;
+    c.bbox.maxx = c.bbox.minx + 40 + rand() % 100;
+    c.bbox.maxy = c.bbox.miny + 14;
+    c.leader = i % 5 == 0;
+    c.lp[0].x = (c.bbox.minx + c.bbox.maxx) / 2;
+    c.lp[0].y = c.bbox.miny;
+    c.lp[1].x = c.lp[0].x + rand() % 60 - 30;
+    c.lp[1].y = c.lp[0].y - 20 - rand() % 40;
+  }
+  std::vector<rectObj> markers(numMarkers);
+  for (rectObj &r : markers) {
+    r.minx = rand() % (width + 80) - 40;
+    r.miny = rand() % (height + 80) - 40;
+    r.maxx = r.minx + 8;
+    r.maxy = r.miny + 8;
+  }
+
+  std::vector<int> linear, grid;
+  msSetLabelCacheGridLinear(MS_TRUE);
+  const double linearMs = timeIt(
+      iterations, [&] { linear = placeLabels(map, candidates, markers); });
+  msSetLabelCacheGridLinear(MS_FALSE);
+  const double gridMs = timeIt(
+      iterations, [&] { grid = placeLabels(map, candidates, markers); });
+  msFreeMap(map);
+
+  printf("%dx%d, %d labels, %d markers, %d placed\n", width, height,
+         numLabels, numMarkers, (int)grid.size());
+  printf("linear scan:    %9.2f ms\n", linearMs);
+  printf("collision grid: %9.2f ms (x%.1f)\n", gridMs, linearMs / gridMs);
+  if (grid != linear) {
+    fprintf(stderr, "placement differs between the grid and the scan\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Benchmark of the raster resamplers of mapresample.c: draws a synthetic UTM
+ * RGB raster into a web mercator map with one thread and with several, and
+ * checks that both images are identical.
+ *
+ * Usage: bench_resample [size nearest|bilinear|average num_threads iterations]
+ */
+
+#include "../../src/mapserver.h"
+
+#include "cpl_vsi.h"
+#include "gdal.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/* 10 m pixels of UTM zone 31N, north of Paris */
+static const double kSrcGeoTransform[6] = {400000, 10, 0, 5500000, 0, -10};
+
+static bool createSource(const char *filename, int size) {
+  GDALAllRegister();
+  GDALDriverH hDriver = GDALGetDriverByName("GTiff");
+  if (!hDriver)
+    return false;
+  GDALDatasetH hDS =
+      GDALCreate(hDriver, filename, size, size, 3, GDT_Byte, NULL);
+  if (!hDS)
+    return false;
+  GDALSetGeoTransform(hDS, const_cast<double *>(kSrcGeoTransform));
+
+  /* smooth gradients with some noise, so that every kernel has work to do */
+  std::vector<unsigned char> line(size);
+  bool ok = true;
+  srand(1);
+  for (int band = 1; band <= 3 && ok; band++) {
+    GDALRasterBandH hBand = GDALGetRasterBand(hDS, band);
+    for (int y = 0; y < size && ok; y++) {
+      for (int x = 0; x < size; x++)
+        line[x] = (unsigned char)((x * band + y * (4 - band)) / 16 +
+                                  rand() % 32);
+      ok = GDALRasterIO(hBand, GF_Write, 0, y, size, 1, line.data(), size, 1,
+                        GDT_Byte, 0, 0) == CE_None;
+    }
+  }
+  GDALClose(hDS);
+  return ok;
+}
+
+static mapObj *loadMap(const char *filename, int size, const char *resample,
+                       int num_threads) {
+  std::string mapfile =
+      "MAP SIZE " + std::to_string(size) + " " + std::to_string(size) +
+      " EXTENT 0 0 1 1 IMAGETYPE png"
+      " PROJECTION \"init=epsg:3857\" END"
+      " LAYER NAME \"utm\" TYPE RASTER STATUS DEFAULT"
+      " DATA \"" +
+      filename +
+      "\""
+      " PROJECTION \"init=epsg:32631\" END"
+      " PROCESSING \"RESAMPLE=" +
+      resample +
+      "\""
+      " PROCESSING \"RESAMPLE_NUM_THREADS=" +
+      std::to_string(num_threads) +
+      "\""
+      " END END";
+  std::vector<char> buffer(mapfile.begin(), mapfile.end());
+  buffer.push_back('\0');
+  mapObj *map = msLoadMapFromString(buffer.data(), NULL, NULL);
+  if (!map)
+    return NULL;
+
+  /* the central part of the raster, in the map projection */
+  const double srcExtent = kSrcGeoTransform[1] * size;
+  rectObj rect;
+  rect.minx = kSrcGeoTransform[0] + srcExtent * 0.1;
+  rect.maxx = kSrcGeoTransform[0] + srcExtent * 0.9;
+  rect.miny = kSrcGeoTransform[3] - srcExtent * 0.9;
+  rect.maxy = kSrcGeoTransform[3] - srcExtent * 0.1;
+  if (msProjectRect(&(GET_LAYER(map, 0)->projection), &(map->projection),
+                    &rect) != MS_SUCCESS ||
+      msMapSetExtent(map, rect.minx, rect.miny, rect.maxx, rect.maxy) !=
+          MS_SUCCESS) {
+    msFreeMap(map);
+    return NULL;
+  }
+  return map;
+}
+
+/* draws the map iterations times, returns the last image encoded */
+static double timeDraw(mapObj *map, int iterations,
+                       std::vector<unsigned char> &encoded) {
+  double total = 0;
+  for (int i = 0; i < iterations; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    imageObj *image = msDrawMap(map, MS_FALSE);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (!image)
+      return -1;
+    total += elapsed.count();
+    if (i == iterations - 1) {
+      int size = 0;
+      unsigned char *data = msSaveImageBuffer(image, &size, image->format);
+      encoded.assign(data, data + size);
+      msFree(data);
+    }
+    msFreeImage(image);
+  }
+  return total * 1000.0 / iterations;
+}
+
+int main(int argc, char **argv) {
+  const int size = argc > 1 ? atoi(argv[1]) : 4096;
+  const char *resample = argc > 2 ? argv[2] : "bilinear";
+  const int num_threads = argc > 3 ? atoi(argv[3]) : 4;
+  const int iterations = argc > 4 ? atoi(argv[4]) : 3;
+  const char *filename = "/vsimem/bench_resample.tif";
+
+  if (size < 64 || num_threads <= 0 || iterations <= 0 ||
+      (strcasecmp(resample, "nearest") && strcasecmp(resample, "bilinear") &&
+       strcasecmp(resample, "average"))) {
+    fprintf(stderr,
+            "Usage: %s [size nearest|bilinear|average num_threads "
+            "iterations]\n",
+            argv[0]);
+    return 1;
+  }
+
+  if (!createSource(filename, size)) {
+    fprintf(stderr, "cannot create %s\n", filename);
+    return 1;
+  }
+
+  mapObj *serialMap = loadMap(filename, size, resample, 1);
+  mapObj *threadedMap = loadMap(filename, size, resample, num_threads);
+  if (!serialMap || !threadedMap) {
+    msWriteError(stderr);
+    return 1;
+  }
+
+  std::vector<unsigned char> serial, threaded;
+  const double serialMs = timeDraw(serialMap, iterations, serial);
+  const double threadedMs = timeDraw(threadedMap, iterations, threaded);
+  if (serialMs < 0 || threadedMs < 0) {
+    msWriteError(stderr);
+    return 1;
+  }
+
+  printf("%dx%d %s, UTM 31N to web mercator\n", size, size, resample);
+  printf("1 thread:    %9.2f ms\n", serialMs);
+  printf("%d thread(s): %9.2f ms (x%.1f)\n", num_threads, threadedMs,
+         serialMs / threadedMs);
+  printf("images %s\n", serial == threaded ? "identical" : "DIFFER");
+
+  msFreeMap(serialMap);
+  msFreeMap(threadedMap);
+  VSIUnlink(filename);
+  msCleanup();
+  return serial == threaded ? 0 : 1;
+}
@@ -1,5 +1,18 @@
 #include "../../src/mapserver.h"
 #include "../../src/maperror.h"
+#include "../../src/apps/mapserv.h"
+
+#include "cpl_conv.h"
+#include "cpl_string.h"
+#include "gdal.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <utime.h>
 
 /* ----------------------------------------------------------------------- */
 
@@ -145,8 +158,1636 @@ static void testToString() {
 
 /* ----------------------------------------------------------------------- */
 
+static void testCompiledExpression() {
+  const char *const expressions[] = {
+      "([POP] > 10)",
+      "([POP] * 2 = 24 AND \"[NAME]\" = \"foo\")",
+      "(\"[NAME]\" IN \"bar,foo\")",
+      "(\"[NAME]\" ~* \"^FO\")",
+      "(NOT ([POP] < 5) OR [POP] ^ 2 > 1000)",
+      "(length(\"[NAME]\") = 3)"};
+  char *values[] = {(char *)"12", (char *)"foo"};
+  shapeObj shape;
+  msInitShape(&shape);
+  shape.values = values;
+  shape.numvalues = 2;
+
+  for (const char *str : expressions) {
+    expressionObj exp;
+    msInitExpression(&exp);
+    EXPECT_TRUE(msLoadExpressionString(&exp, str) == MS_SUCCESS);
+
+    char *items[8] = {msStrdup("POP"), msStrdup("NAME")};
+    int numitems = 2;
+    EXPECT_TRUE(msTokenizeExpression(&exp, items, &numitems) == MS_SUCCESS);
+    EXPECT_TRUE(numitems == 2);
+    EXPECT_TRUE(msCompileExpression(&exp) == MS_SUCCESS);
+
+    int compiled = -1;
+    EXPECT_TRUE(msEvalCompiledExpression(&exp, &shape, &compiled) ==
+                MS_SUCCESS);
+    EXPECT_TRUE(compiled == MS_TRUE);
+
+    /* the parser must agree with the compiled program */
+    msFreeCompiledExpression(&exp);
+    EXPECT_TRUE(msEvalExpression(NULL, &shape, &exp, -1) == compiled);
+
+    msFreeExpression(&exp);
+    msFree(items[0]);
+    msFree(items[1]);
+  }
+  shape.values = NULL;
+  shape.numvalues = 0;
+  msFreeShape(&shape);
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void testGaussianBlur() {
+  const int width = 41, height = 37, radius = 6;
+  std::vector<float> single(width * height), threaded(width * height);
+
+  /* an impulse next to the border, so that part of the kernel falls out */
+  single[2 * width + 3] = 100;
+  single[20 * width + 20] = 100;
+  threaded = single;
+  msGaussianBlur(single.data(), width, height, radius, 1);
+  msGaussianBlur(threaded.data(), width, height, radius, 4);
+
+  EXPECT_TRUE(single[2 * width + 3] > 0);
+  EXPECT_TRUE(single[0] > 0);
+  EXPECT_TRUE(single[(height - 1) * width + width - 1] == 0);
+  /* the blur of the centered impulse is symmetric */
+  EXPECT_TRUE(std::fabs(single[(20 - 4) * width + 20] -
+                        single[(20 + 4) * width + 20]) < 1e-6);
+  EXPECT_TRUE(std::fabs(single[20 * width + 20 - 5] -
+                        single[(20 - 5) * width + 20]) < 1e-6);
+  EXPECT_TRUE(single == threaded);
+
+  /* a zero radius leaves the values untouched */
+  std::vector<float> untouched(width * height, 1.0f);
+  msGaussianBlur(untouched.data(), width, height, 0, 1);
+  EXPECT_TRUE(untouched[0] == 1.0f);
+}
+
+static void testIdw() {
+  const int width = 60, height = 50, npoints = 200;
+  std::vector<float> xyz(npoints * 3);
+  srand(1);
+  for (int i = 0; i < npoints; i++) {
+    xyz[i * 3] = rand() % (width * 10) / 10.0f;
+    xyz[i * 3 + 1] = rand() % (height * 10) / 10.0f;
+    xyz[i * 3 + 2] = rand() % 256;
+  }
+
+  const float powers[] = {2.0f, 1.5f};
+  for (float power : powers) {
+    interpolationProcessingParams params;
+    memset(&params, 0, sizeof(params));
+    params.radius = 10;
+    params.power = power;
+    params.num_threads = 1;
+    std::vector<unsigned char> single(width * height), threaded(width * height);
+    msIdw(xyz.data(), width, height, npoints, &params, single.data());
+    params.num_threads = 4;
+    msIdw(xyz.data(), width, height, npoints, &params, threaded.data());
+    EXPECT_TRUE(single == threaded);
+
+    /* the buckets must find the samples a scan of all of them finds */
+    bool same = true;
+    for (int j = 0; j < height; j++) {
+      for (int i = 0; i < width; i++) {
+        double den = 0.000000001, num = 0;
+        for (int p = 0; p < npoints * 3; p += 3) {
+          double d = (xyz[p] - i) * (xyz[p] - i) +
+                     (xyz[p + 1] - j) * (xyz[p + 1] - j);
+          if (params.radius * params.radius > d) {
+            double w = 1.0 / (pow(d, power) + 0.000000001);
+            num += w * xyz[p + 2];
+            den += w;
+          }
+        }
+        const unsigned char expected = num / den;
+        if (abs(single[j * width + i] - expected) > 1)
+          same = false;
+      }
+    }
+    EXPECT_TRUE(same);
+  }
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void testProjectPoints() {
+  projectionObj wgs84, webmerc;
+  msInitProjection(&wgs84);
+  msInitProjection(&webmerc);
+  EXPECT_TRUE(msLoadProjectionStringEPSG(&wgs84, "EPSG:4326") == 0);
+  EXPECT_TRUE(msLoadProjectionStringEPSG(&webmerc, "EPSG:3857") == 0);
+
+  const pointObj input[] = {{2.35, 48.85, 0, 0}, {-179.999, -60, 0, 0},
+                            {190, 10, 0, 0},     {0, 90, 0, 0},
+                            {180, 85.05, 0, 0}};
+  const int npoints = (int)(sizeof(input) / sizeof(input[0]));
+
+  reprojectionObj *reprojector = msProjectCreateReprojector(&wgs84, &webmerc);
+  EXPECT_TRUE(reprojector != NULL);
+  if (reprojector) {
+    EXPECT_TRUE(reprojector->fastPath == FAST_PATH_LONLAT_TO_GMERC);
+
+    /* the analytic web mercator must match PROJ */
+    std::vector<pointObj> fast(input, input + npoints), slow = fast;
+    std::vector<int> fastStatus(npoints), slowStatus(npoints);
+    EXPECT_TRUE(msProjectPointsEx(reprojector, npoints, fast.data(),
+                                  fastStatus.data()) == MS_FAILURE);
+    reprojector->fastPath = FAST_PATH_NONE;
+    msProjectPointsEx(reprojector, npoints, slow.data(), slowStatus.data());
+    for (int i = 0; i < npoints; i++) {
+      EXPECT_TRUE(fastStatus[i] == slowStatus[i]);
+      if (fastStatus[i] == MS_SUCCESS) {
+        EXPECT_TRUE(std::fabs(fast[i].x - slow[i].x) < 1e-6);
+        EXPECT_TRUE(std::fabs(fast[i].y - slow[i].y) < 1e-6);
+      }
+    }
+    EXPECT_TRUE(fastStatus[3] == MS_FAILURE); /* the pole */
+
+    /* a whole shape gives the same results as point by point */
+    shapeObj shape;
+    lineObj line = {3, const_cast<pointObj *>(input)};
+    msInitShape(&shape);
+    shape.type = MS_SHAPE_LINE;
+    msAddLine(&shape, &line);
+    msProjectShapeEx(reprojector, &shape);
+    EXPECT_TRUE(shape.numlines == 1 && shape.line[0].numpoints == 3);
+    for (int i = 0; i < shape.line[0].numpoints && i < 3; i++) {
+      pointObj point = input[i];
+      msProjectPointEx(reprojector, &point);
+      EXPECT_TRUE(shape.line[0].point[i].x == point.x);
+      EXPECT_TRUE(shape.line[0].point[i].y == point.y);
+    }
+    msFreeShape(&shape);
+    msProjectDestroyReprojector(reprojector);
+  }
+
+  msFreeProjection(&wgs84);
+  msFreeProjection(&webmerc);
+}
+
+/* ----------------------------------------------------------------------- */
+
+static void testApproxReprojection() {
+  projectionObj wgs84, utm;
+  msInitProjection(&wgs84);
+  msInitProjection(&utm);
+  EXPECT_TRUE(msLoadProjectionStringEPSG(&wgs84, "EPSG:4326") == 0);
+  EXPECT_TRUE(msLoadProjectionStringEPSG(&utm, "EPSG:32631") == 0);
+
+  reprojectionObj *reprojector = msProjectCreateReprojector(&wgs84, &utm);
+  EXPECT_TRUE(reprojector != NULL);
+  if (reprojector) {
+    /* a 1000 pixels wide map, with a tolerance of half a pixel */
+    const rectObj extent = {0, 40, 6, 50};
+    const double tolerance = 0.5 * 500000 / 1000;
+    EXPECT_TRUE(msProjectInitApproxGrid(reprojector, extent, tolerance) ==
+                MS_SUCCESS);
+
+    std::vector<pointObj> approx(1000), exact;
+    srand(1);
+    for (auto &point : approx) {
+      point.x = extent.minx + (extent.maxx - extent.minx) * rand() / RAND_MAX;
+      point.y = extent.miny + (extent.maxy - extent.miny) * rand() / RAND_MAX;
+      point.z = point.m = 0;
+    }
+    approx.push_back({10, 45, 0, 0}); /* outside of the grid */
+    exact = approx;
+
+    msProjectPointsEx(reprojector, (int)approx.size(), approx.data(), NULL);
+    msProjectFreeApproxGrid(reprojector);
+    msProjectPointsEx(reprojector, (int)exact.size(), exact.data(), NULL);
+
+    double maxerror = 0;
+    for (size_t i = 0; i < approx.size(); i++)
+      maxerror = std::max(maxerror, std::hypot(approx[i].x - exact[i].x,
+                                               approx[i].y - exact[i].y));
+    EXPECT_TRUE(maxerror <= tolerance);
+    EXPECT_TRUE(approx.back().x == exact.back().x &&
+                approx.back().y == exact.back().y);
+
+    msProjectDestroyReprojector(reprojector);
+  }
+
+  msFreeProjection(&wgs84);
+  msFreeProjection(&utm);
+}
+
+static void testArena() {
+  msArenaObj *arena = msArenaCreate(256);
+
+  /* a shape whose parts live in the arena, grown past them */
+  shapeObj shape;
+  msInitShape(&shape);
+  shape.arena = arena;
+  shape.type = MS_SHAPE_LINE;
+  shape.numlines = 1;
+  shape.line = (lineObj *)msShapeAllocMemory(&shape, sizeof(lineObj));
+  shape.line[0].numpoints = 100; /* larger than the first block */
+  shape.line[0].point =
+      (pointObj *)msShapeAllocMemory(&shape, 100 * sizeof(pointObj));
+  for (int i = 0; i < 100; i++) {
+    shape.line[0].point[i].x = i;
+    shape.line[0].point[i].y = -i;
+  }
+  EXPECT_TRUE(msArenaOwns(arena, shape.line));
+  EXPECT_TRUE(msArenaOwns(arena, shape.line[0].point));
+
+  shape.numvalues = 1;
+  shape.values = (char **)msShapeAllocMemory(&shape, sizeof(char *));
+  shape.values[0] = msArenaStrdup(arena, "value");
+
+  lineObj line = {1, shape.line[0].point};
+  msAddLine(&shape, &line);
+  EXPECT_TRUE(shape.numlines == 2);
+  EXPECT_TRUE(!msArenaOwns(arena, shape.line));
+  EXPECT_TRUE(shape.line[0].point[99].y == -99);
+
+  shapeObj copy;
+  msInitShape(&copy);
+  msCopyShape(&shape, &copy);
+  EXPECT_TRUE(copy.arena == NULL);
+  EXPECT_TRUE(!msArenaOwns(arena, copy.values[0]));
+  EXPECT_STREQ(copy.values[0], "value");
+
+  /* frees what was moved to the heap, leaves the arena alone */
+  msFreeShape(&shape);
+  EXPECT_TRUE(shape.arena == NULL);
+  msArenaReset(arena);
+  EXPECT_TRUE(msArenaAlloc(arena, 16) != NULL);
+
+  msFreeShape(&copy);
+  msArenaDestroy(arena);
+}
+
+static void testMetrics() {
+  msMetricsObj *metrics = msMetricsCreate();
+  layerObj layer;
+  memset(&layer, 0, sizeof(layer));
+  layer.index = 2;
+  layer.name = (char *)"roads";
+
+  msMetricsAddCount(metrics, &layer, MS_METRIC_FEATURES_DRAWN, 3);
+  msMetricsAddCount(metrics, NULL, MS_METRIC_BYTES_WRITTEN, 1024);
+
+  /* what a worker thread of mapdrawparallel.c recorded */
+  msMetricsObj *worker = msMetricsCreate();
+  msMetricsAddCount(worker, &layer, MS_METRIC_FEATURES_DRAWN, 2);
+  msMetricsMerge(metrics, worker);
+  msMetricsDestroy(worker);
+
+  char *json = msMetricsToJSON(metrics, "WMS GetMap", "test", MS_SUCCESS);
+  EXPECT_TRUE(strstr(json, "\"request\":\"WMS GetMap\"") != NULL);
+  EXPECT_TRUE(strstr(json, "\"status\":\"ok\"") != NULL);
+  EXPECT_TRUE(strstr(json, "\"bytes_written\":1024") != NULL);
+  EXPECT_TRUE(strstr(json, "\"layers\":[{\"name\":\"roads\"") != NULL);
+  EXPECT_TRUE(strstr(json, "\"features_drawn\":5") != NULL);
+  EXPECT_TRUE(strchr(json, '\n') == NULL);
+  msFree(json);
+  msMetricsDestroy(metrics);
+}
+
+static void testQuantization() {
+  /* vertical stripes of 80 colors, on 16 rows */
+  const unsigned width = 80, height = 16;
+  std::vector<unsigned char> pixels(width * height * 4);
+  for (unsigned y = 0; y < height; y++) {
+    for (unsigned x = 0; x < width; x++) {
+      unsigned char *p = &pixels[(y * width + x) * 4];
+      p[0] = (unsigned char)(x / 2 * 6);
+      p[1] = (unsigned char)(255 - x / 2 * 6);
+      p[2] = (unsigned char)(x % 2 * 200);
+      p[3] = 255;
+    }
+  }
+  rasterBufferObj rb;
+  memset(&rb, 0, sizeof(rb));
+  rb.type = MS_BUFFER_BYTE_RGBA;
+  rb.width = width;
+  rb.height = height;
+  rb.data.rgba.pixels = pixels.data();
+  rb.data.rgba.pixel_step = 4;
+  rb.data.rgba.row_step = width * 4;
+
+  rgbaPixel palette[256];
+  unsigned int numcolors = 16, maxval;
+  EXPECT_TRUE(msQuantizeRasterBuffer(&rb, &numcolors, palette, NULL, 0,
+                                     &maxval) == MS_SUCCESS);
+  EXPECT_TRUE(numcolors == 16);
+  EXPECT_TRUE(maxval == 255);
+
+  /* every pixel gets the first of its nearest palette entries */
+  std::vector<unsigned char> indexes(width * height);
+  rasterBufferObj qrb;
+  memset(&qrb, 0, sizeof(qrb));
+  qrb.type = MS_BUFFER_BYTE_PALETTE;
+  qrb.width = width;
+  qrb.height = height;
+  qrb.data.palette.pixels = indexes.data();
+  qrb.data.palette.palette = palette;
+  qrb.data.palette.num_entries = numcolors;
+  EXPECT_TRUE(msClassifyRasterBuffer(&rb, &qrb) == MS_SUCCESS);
+  bool nearest = true;
+  for (unsigned i = 0; i < width * height; i++) {
+    const rgbaPixel *p = (const rgbaPixel *)&pixels[i * 4];
+    int best = -1, bestdist = 0;
+    for (unsigned j = 0; j < numcolors; j++) {
+      const int dr = p->r - palette[j].r, dg = p->g - palette[j].g,
+                db = p->b - palette[j].b, da = p->a - palette[j].a;
+      const int dist = dr * dr + dg * dg + db * db + da * da;
+      if (best < 0 || dist < bestdist) {
+        best = j;
+        bestdist = dist;
+      }
+    }
+    nearest = nearest && indexes[i] == best;
+  }
+  EXPECT_TRUE(nearest);
+
+  /* palettes kept for QUANTIZE_REUSE_PALETTE */
+  rgbaPixel cached[256];
+  unsigned int numcached = 0;
+  const char *key = "test.map|png8|16|roads";
+  EXPECT_TRUE(!msPaletteCacheGet(key, 1000, cached, &numcached));
+  msPaletteCacheSet(key, 1000, palette, numcolors);
+  EXPECT_TRUE(msPaletteCacheGet(key, 1000, cached, &numcached));
+  EXPECT_TRUE(numcached == numcolors);
+  EXPECT_TRUE(memcmp(cached, palette, numcolors * sizeof(rgbaPixel)) == 0);
+  EXPECT_TRUE(
+      !msPaletteCacheGet("test.map|png8|16|water", 1000, cached, &numcached));
+  /* the mapfile was modified since */
+  EXPECT_TRUE(!msPaletteCacheGet(key, 2000, cached, &numcached));
+  msPaletteCacheSet(key, 2000, palette, 2);
+  EXPECT_TRUE(msPaletteCacheGet(key, 2000, cached, &numcached));
+  EXPECT_TRUE(numcached == 2);
+  EXPECT_TRUE(!msPaletteCacheGet(key, 1000, cached, &numcached));
+  /* a full cache evicts the least recently used palette */
+  for (int i = 0; i < 31; i++) {
+    const std::string other = "test.map|png8|16|layer" + std::to_string(i);
+    msPaletteCacheSet(other.c_str(), 2000, palette, 2);
+  }
+  EXPECT_TRUE(msPaletteCacheGet(key, 2000, cached, &numcached));
+  msPaletteCacheSet("test.map|png8|16|new", 2000, palette, 2);
+  EXPECT_TRUE(msPaletteCacheGet(key, 2000, cached, &numcached));
+  EXPECT_TRUE(!msPaletteCacheGet("test.map|png8|16|layer0", 2000, cached,
+                                 &numcached));
+  EXPECT_TRUE(msPaletteCacheGet("test.map|png8|16|layer1", 2000, cached,
+                                &numcached));
+  msPaletteCacheCleanup();
+  EXPECT_TRUE(!msPaletteCacheGet(key, 2000, cached, &numcached));
+}
+
+/* writes rb as PNG with the given PNG_THREADS and PNG_FILTER, and reads it
+ * back into out */
+static bool encodeDecodePNG(rasterBufferObj *rb, const char *threads,
+                            const char *filter,
+                            std::vector<unsigned char> &out) {
+  outputFormatObj *format =
+      msCreateDefaultOutputFormat(NULL, "AGG/PNG", "png", NULL);
+  if (!format)
+    return false;
+  msSetOutputFormatOption(format, "PNG_THREADS", threads);
+  msSetOutputFormatOption(format, "PNG_FILTER", filter);
+  bufferObj buffer = {NULL, 0, 0, 0};
+  const int status = msSaveRasterBufferToBuffer(rb, &buffer, format);
+  msFreeOutputFormat(format);
+  if (status != MS_SUCCESS)
+    return false;
+
+  char filename[] = "test_png_encoding.png";
+  FILE *fp = fopen(filename, "wb");
+  bool ok = fp && fwrite(buffer.data, 1, buffer.size, fp) == buffer.size;
+  if (fp)
+    fclose(fp);
+  msBufferFree(&buffer);
+
+  rasterBufferObj decoded;
+  memset(&decoded, 0, sizeof(decoded));
+  ok = ok && msLoadMSRasterBufferFromFile(filename, &decoded) == MS_SUCCESS;
+  remove(filename);
+  if (!ok)
+    return false;
+  out.assign(decoded.data.rgba.pixels,
+             decoded.data.rgba.pixels +
+                 decoded.height * decoded.data.rgba.row_step);
+  msFree(decoded.data.rgba.pixels);
+  return true;
+}
+
+static void testPNGEncoding() {
+  /* tall enough for 3 stripes of the PNG_THREADS encoder */
+  const unsigned width = 100, height = 200;
+  std::vector<unsigned char> pixels(width * height * 4);
+  for (unsigned y = 0; y < height; y++) {
+    for (unsigned x = 0; x < width; x++) {
+      unsigned char *p = &pixels[(y * width + x) * 4];
+      p[3] = (x / 10 + y / 10) % 3 ? 255 : 0;
+      p[0] = (unsigned char)(x * 2 + y) & p[3];
+      p[1] = (unsigned char)(y * 3) & p[3];
+      p[2] = (unsigned char)(x * y) & p[3];
+    }
+  }
+  rasterBufferObj rb;
+  memset(&rb, 0, sizeof(rb));
+  rb.type = MS_BUFFER_BYTE_RGBA;
+  rb.width = width;
+  rb.height = height;
+  rb.data.rgba.pixels = pixels.data();
+  /* in the BGRA order msLoadMSRasterBufferFromFile() reads PNGs into */
+  rb.data.rgba.b = &pixels[0];
+  rb.data.rgba.g = &pixels[1];
+  rb.data.rgba.r = &pixels[2];
+  rb.data.rgba.a = &pixels[3];
+  rb.data.rgba.pixel_step = 4;
+  rb.data.rgba.row_step = width * 4;
+
+  /* the striped encoder produces the same image as libpng, whatever the */
+  /* filter */
+  const char *filters[] = {"NONE", "SUB", "UP", "AVERAGE", "PAETH",
+                           "ADAPTIVE"};
+  for (const char *filter : filters) {
+    std::vector<unsigned char> serial, striped;
+    EXPECT_TRUE(encodeDecodePNG(&rb, "1", filter, serial));
+    EXPECT_TRUE(encodeDecodePNG(&rb, "3", filter, striped));
+    EXPECT_TRUE(serial == pixels);
+    EXPECT_TRUE(striped == pixels);
+  }
+}
+
+static void testClassIndex() {
+  /* enough classes for the index, with a regex, a list, a case insensitive
+   * string and a catch all among them */
+  std::string mapfile = "MAP LAYER NAME \"landuse\" TYPE POLYGON"
+                        " CLASSITEM \"landuse\""
+                        " CLASS EXPRESSION \"forest\" END"
+                        " CLASS EXPRESSION /^wat/ END"
+                        " CLASS EXPRESSION \"water\" END"
+                        " CLASS EXPRESSION {meadow,park,garden} END";
+  for (int i = 4; i < 10; i++)
+    mapfile += " CLASS EXPRESSION \"v" + std::to_string(i) + "\" END";
+  mapfile += " CLASS EXPRESSION \"Forest\"i END"
+             " CLASS END"
+             " END END";
+  std::vector<char> buffer(mapfile.begin(), mapfile.end());
+  buffer.push_back('\0');
+  mapObj *map = msLoadMapFromString(buffer.data(), NULL, NULL);
+  EXPECT_TRUE(map != NULL);
+  if (!map)
+    return;
+  layerObj *layer = GET_LAYER(map, 0);
+  layer->numitems = 1;
+  layer->classitemindex = 0;
+
+  shapeObj shape;
+  msInitShape(&shape);
+  shape.type = MS_SHAPE_POINT;
+  shape.numvalues = 1;
+  const struct {
+    const char *value;
+    int classindex;
+  } cases[] = {{"forest", 0}, {"water", 1}, {"watershed", 1}, {"park", 3},
+               {"v7", 7},     {"FOREST", 10}, {"urban", 11}};
+  for (const auto &c : cases) {
+    char *value = const_cast<char *>(c.value);
+    shape.values = &value;
+    EXPECT_TRUE(msShapeGetClass(layer, map, &shape, NULL, -1) ==
+                c.classindex);
+  }
+
+  /* the following matches are found in order too */
+  char *value = const_cast<char *>("forest");
+  shape.values = &value;
+  EXPECT_TRUE(msShapeGetNextClass(0, layer, map, &shape, NULL, -1) == 10);
+  EXPECT_TRUE(msShapeGetNextClass(10, layer, map, &shape, NULL, -1) == 11);
+  EXPECT_TRUE(msShapeGetNextClass(11, layer, map, &shape, NULL, -1) == -1);
+
+  /* and so are classes of a group */
+  int classgroup[] = {2, 4, 5, 6, 7, 8, 9, 11};
+  value = const_cast<char *>("water");
+  EXPECT_TRUE(msShapeGetClass(layer, map, &shape, classgroup, 8) == 2);
+
+  /* a class group with other classes at the same address */
+  int othergroup[] = {0, 4, 5, 6, 7, 8, 9, 11};
+  memcpy(classgroup, othergroup, sizeof(classgroup));
+  msClassIndexRecheck(layer->classindex); /* as msLayerWhichShapes() does */
+  EXPECT_TRUE(msShapeGetClass(layer, map, &shape, classgroup, 8) == 11);
+
+  /* an edited expression */
+  value = const_cast<char *>("v7");
+  EXPECT_TRUE(msShapeGetClass(layer, map, &shape, NULL, -1) == 7);
+  msLoadExpressionString(&(layer->_class[7]->expression), "v77");
+  msClassIndexRecheck(layer->classindex);
+  EXPECT_TRUE(msShapeGetClass(layer, map, &shape, NULL, -1) == 11);
+  value = const_cast<char *>("v77");
+  EXPECT_TRUE(msShapeGetClass(layer, map, &shape, NULL, -1) == 7);
+
+  shape.values = NULL;
+  shape.numvalues = 0;
+  layer->numitems = 0;
+  msFreeMap(map);
+}
+
+static bool sameShapes(const shapeObj *a, const shapeObj *b) {
+  if (a->type != b->type || a->numlines != b->numlines)
+    return false;
+  for (int i = 0; i < a->numlines; i++) {
+    if (a->line[i].numpoints != b->line[i].numpoints)
+      return false;
+    for (int j = 0; j < a->line[i].numpoints; j++) {
+      const pointObj *p = &a->line[i].point[j], *q = &b->line[i].point[j];
+      if (p->x != q->x || p->y != q->y || p->z != q->z)
+        return false;
+    }
+  }
+  return a->numlines == 0 ||
+         (a->bounds.minx == b->bounds.minx && a->bounds.miny == b->bounds.miny &&
+          a->bounds.maxx == b->bounds.maxx && a->bounds.maxy == b->bounds.maxy);
+}
+
+static void testOGRWkbDecoder() {
+#if GDAL_VERSION_MAJOR > 3 ||                                                  \
+    (GDAL_VERSION_MAJOR == 3 && GDAL_VERSION_MINOR >= 6)
+  /* the decoder of the record batches must give the shapes of an
+   * OGRGeometry, in both byte orders and for both flavours of 3D types */
+  const char *wkts[] = {
+      "POINT (1 2)",
+      "POINT Z (1 2 3)",
+      "LINESTRING (0 0,1 1,2 0)",
+      "LINESTRING (5 5)",
+      "POLYGON ((0 0,10 0,10 10,0 10,0 0),(2 2,3 2,3 3,2 2))",
+      "POLYGON Z ((0 0 1,10 0 2,10 10 3,0 0 1))",
+      "MULTIPOINT ((1 2),(3 4),(-5 6))",
+      "MULTILINESTRING ((0 0,1 1),(2 2,3 3,4 2))",
+      "MULTIPOLYGON (((0 0,1 0,1 1,0 0)),((5 5,6 5,6 6,5 6,5 5)))",
+      "GEOMETRYCOLLECTION (POINT (7 7),LINESTRING (0 0,1 1),"
+      "POLYGON ((0 0,1 0,1 1,0 0)))",
+      "GEOMETRYCOLLECTION (MULTIPOINT ((1 1)),"
+      "GEOMETRYCOLLECTION (LINESTRING (2 2,3 3)))",
+      "LINESTRING EMPTY",
+      "POLYGON EMPTY",
+      "MULTIPOINT EMPTY",
+      "MULTILINESTRING EMPTY",
+      "MULTIPOLYGON EMPTY",
+      "GEOMETRYCOLLECTION EMPTY",
+  };
+  const struct {
+    int layertype;
+    OGRwkbGeometryType type;
+  } layers[] = {{MS_LAYER_POINT, wkbPoint},
+                {MS_LAYER_LINE, wkbLineString},
+                {MS_LAYER_POLYGON, wkbPolygon}};
+
+  for (const char *wkt : wkts) {
+    OGRGeometryH hGeom = NULL;
+    char *pszWkt = const_cast<char *>(wkt);
+    EXPECT_TRUE(OGR_G_CreateFromWkt(&pszWkt, NULL, &hGeom) == OGRERR_NONE);
+    if (!hGeom)
+      continue;
+    std::vector<unsigned char> wkb(OGR_G_WkbSize(hGeom));
+    for (int variant = 0; variant < 3; variant++) {
+      if (variant == 0)
+        OGR_G_ExportToWkb(hGeom, wkbNDR, wkb.data());
+      else if (variant == 1)
+        OGR_G_ExportToWkb(hGeom, wkbXDR, wkb.data());
+      else
+        OGR_G_ExportToIsoWkb(hGeom, wkbNDR, wkb.data());
+      for (const auto &layer : layers) {
+        shapeObj expected, decoded;
+        msInitShape(&expected);
+        msInitShape(&decoded);
+        EXPECT_TRUE(msOGRGeometryToShape(hGeom, &expected, layer.type) ==
+                    MS_SUCCESS);
+        const bool ok =
+            msOGRWkbGeometryToShape(wkb.data(), wkb.size(), &decoded,
+                                    layer.layertype) == MS_SUCCESS;
+        EXPECT_TRUE(ok);
+        if (ok && !sameShapes(&expected, &decoded)) {
+          fprintf(stderr, "%s decoded differently for layer type %d\n", wkt,
+                  layer.layertype);
+          gTestRetCode = 1;
+        }
+        msFreeShape(&expected);
+        msFreeShape(&decoded);
+      }
+    }
+    OGR_G_DestroyGeometry(hGeom);
+  }
+
+  /* POINT EMPTY (NaN coordinates) in a point layer, curves and truncated
+   * or unknown WKB are left to OGR */
+  const unsigned char pointEmpty[] = {1, 1, 0, 0, 0,    /* NDR point */
+                                      0, 0, 0, 0, 0, 0, 0xf8, 0x7f,
+                                      0, 0, 0, 0, 0, 0, 0xf8, 0x7f};
+  const unsigned char circularString[] = {1, 8, 0, 0, 0, 0, 0, 0, 0};
+  const unsigned char truncated[] = {1, 2, 0, 0, 0, 3, 0, 0, 0, 0, 0};
+  const unsigned char badOrder[] = {2, 1, 0, 0, 0};
+  const struct {
+    const unsigned char *wkb;
+    size_t size;
+    size_t numlayers;
+  } unsupported[] = {{pointEmpty, sizeof(pointEmpty), 1},
+                     {circularString, sizeof(circularString), 3},
+                     {truncated, sizeof(truncated), 3},
+                     {badOrder, sizeof(badOrder), 3}};
+  for (const auto &u : unsupported) {
+    for (size_t i = 0; i < u.numlayers; i++) {
+      shapeObj shape;
+      msInitShape(&shape);
+      EXPECT_TRUE(msOGRWkbGeometryToShape(u.wkb, u.size, &shape,
+                                          layers[i].layertype) == MS_FAILURE);
+      msFreeShape(&shape);
+    }
+  }
+  msResetErrorList();
+#endif
+}
+
+static void testCSVJoin() {
+  const char *filename = "test_join.csv";
+  FILE *fp = fopen(filename, "w");
+  EXPECT_TRUE(fp != NULL);
+  if (!fp)
+    return;
+  fputs("1,first\n2,second\n1,third\n3,fourth\n", fp);
+  fclose(fp);
+
+  char mapfile[] = "MAP LAYER NAME \"points\" TYPE POINT END END";
+  mapObj *map = msLoadMapFromString(mapfile, NULL, NULL);
+  EXPECT_TRUE(map != NULL);
+  if (!map) {
+    remove(filename);
+    return;
+  }
+  layerObj *layer = GET_LAYER(map, 0);
+  char *items[] = {const_cast<char *>("id")};
+  layer->items = items;
+  layer->numitems = 1;
+
+  joinObj join;
+  memset(&join, 0, sizeof(join));
+  join.connectiontype = MS_DB_CSV;
+  join.table = const_cast<char *>(filename);
+  join.from = const_cast<char *>("id");
+  join.to = const_cast<char *>("1");
+  EXPECT_TRUE(msJoinConnect(layer, &join) == MS_SUCCESS);
+  EXPECT_TRUE(join.numitems == 2);
+
+  /* one-to-many, in the order of the table */
+  shapeObj shape;
+  msInitShape(&shape);
+  char *value = const_cast<char *>("1");
+  shape.values = &value;
+  shape.numvalues = 1;
+  EXPECT_TRUE(msJoinPrepare(&join, &shape) == MS_SUCCESS);
+  EXPECT_TRUE(msJoinNext(&join) == MS_SUCCESS);
+  EXPECT_STREQ(join.values[1], "first");
+  EXPECT_TRUE(msJoinNext(&join) == MS_SUCCESS);
+  EXPECT_STREQ(join.values[1], "third");
+  EXPECT_TRUE(msJoinNext(&join) == MS_DONE);
+  EXPECT_STREQ(join.values[1], "");
+
+  value = const_cast<char *>("3");
+  EXPECT_TRUE(msJoinPrepare(&join, &shape) == MS_SUCCESS);
+  EXPECT_TRUE(msJoinNext(&join) == MS_SUCCESS);
+  EXPECT_STREQ(join.values[1], "fourth");
+
+  value = const_cast<char *>("4");
+  EXPECT_TRUE(msJoinPrepare(&join, &shape) == MS_SUCCESS);
+  EXPECT_TRUE(msJoinNext(&join) == MS_DONE);
+
+  msJoinClose(&join);
+  msFreeCharArray(join.values, join.numitems);
+  msFreeCharArray(join.items, join.numitems);
+  shape.values = NULL;
+  shape.numvalues = 0;
+  layer->items = NULL;
+  layer->numitems = 0;
+  msFreeMap(map);
+  remove(filename);
+}
+
+/* ids alternate between 1 and 2, starting at 1 + shift */
+static void writeJoinTable(const char *dbfname, const char *const *names,
+                           int n, int shift) {
+  DBFHandle hDBF = msDBFCreate(dbfname);
+  EXPECT_TRUE(hDBF != NULL);
+  if (!hDBF)
+    return;
+  msDBFAddField(hDBF, "id", FTInteger, 5, 0);
+  msDBFAddField(hDBF, "name", FTString, 16, 0);
+  for (int i = 0; i < n; i++) {
+    msDBFWriteIntegerAttribute(hDBF, i, 0, (i + shift) % 2 + 1);
+    msDBFWriteStringAttribute(hDBF, i, 1, names[i]);
+  }
+  msDBFClose(hDBF);
+}
+
+/* the names joined to id 1, none if the join fails */
+static std::vector<std::string> dbfJoinNames(layerObj *layer,
+                                             const char *table) {
+  std::vector<std::string> names;
+  joinObj join;
+  memset(&join, 0, sizeof(join));
+  join.connectiontype = MS_DB_XBASE;
+  join.table = const_cast<char *>(table);
+  join.from = const_cast<char *>("id");
+  join.to = const_cast<char *>("id");
+  EXPECT_TRUE(msJoinConnect(layer, &join) == MS_SUCCESS);
+  if (join.numitems == 2) {
+    shapeObj shape;
+    msInitShape(&shape);
+    char *value = const_cast<char *>("1");
+    shape.values = &value;
+    shape.numvalues = 1;
+    EXPECT_TRUE(msJoinPrepare(&join, &shape) == MS_SUCCESS);
+    while (msJoinNext(&join) == MS_SUCCESS)
+      names.push_back(join.values[1]);
+  }
+  msJoinClose(&join);
+  msFreeCharArray(join.values, join.numitems);
+  msFreeCharArray(join.items, join.numitems);
+  return names;
+}
+
+static void testDBFJoin() {
+  const char *first[] = {"first", "second", "third"};
+  const char *edited[] = {"uno", "dos", "tres", "cuatro"};
+  writeJoinTable("test_join.dbf", first, 3, 0);
+
+  char mapfile[] = "MAP LAYER NAME \"points\" TYPE POINT END END";
+  mapObj *map = msLoadMapFromString(mapfile, NULL, NULL);
+  EXPECT_TRUE(map != NULL);
+  if (!map) {
+    remove("test_join.dbf");
+    return;
+  }
+  layerObj *layer = GET_LAYER(map, 0);
+  char *items[] = {const_cast<char *>("id")};
+  layer->items = items;
+  layer->numitems = 1;
+
+  const std::vector<std::string> expected = {"first", "third"};
+  EXPECT_TRUE(dbfJoinNames(layer, "test_join.dbf") == expected);
+
+  /* the index of the keys is cached for the .dbf msDBFOpen() opens for a
+   * .shp, along with its mtime, size and record count: a table rewritten
+   * within the same second is reindexed as long as its size changes, and so
+   * is a table with a new mtime */
+  CPLSetConfigOption("MS_JOIN_CACHE", "4");
+  struct stat stat_buf;
+  EXPECT_TRUE(stat("test_join.dbf", &stat_buf) == 0);
+  EXPECT_TRUE(dbfJoinNames(layer, "test_join.shp") == expected);
+  writeJoinTable("test_join.dbf", edited, 4, 1);
+  struct utimbuf times;
+  times.actime = stat_buf.st_atime;
+  times.modtime = stat_buf.st_mtime;
+  EXPECT_TRUE(utime("test_join.dbf", &times) == 0);
+  const std::vector<std::string> resized = {"dos", "cuatro"};
+  EXPECT_TRUE(dbfJoinNames(layer, "test_join.shp") == resized);
+  writeJoinTable("test_join.dbf", edited, 3, 1);
+  times.modtime = stat_buf.st_mtime + 10;
+  EXPECT_TRUE(utime("test_join.dbf", &times) == 0);
+  const std::vector<std::string> reloaded = {"dos"};
+  EXPECT_TRUE(dbfJoinNames(layer, "test_join.shp") == reloaded);
+  CPLSetConfigOption("MS_JOIN_CACHE", NULL);
+  msJoinCacheCleanup();
+
+  layer->items = NULL;
+  layer->numitems = 0;
+  msFreeMap(map);
+  remove("test_join.dbf");
+}
+
+static void testGridCluster() {
+  /* 20 pixel grid cells, three of them hold points */
+  char mapfile[] = "MAP EXTENT 0 0 99 99 SIZE 100 100"
+                   " LAYER NAME \"points\" TYPE POINT STATUS ON"
+                   " PROCESSING \"CLUSTER_ALGORITHM=GRID\""
+                   " CLUSTER MAXDISTANCE 10 REGION \"rectangle\" END"
+                   " FEATURE POINTS 1 1 END END FEATURE POINTS 2 2 END END"
+                   " FEATURE POINTS 50 50 END END FEATURE POINTS 3 3 END END"
+                   " FEATURE POINTS 90 10 END END FEATURE POINTS 55 55 END END"
+                   " END END";
+  mapObj *map = msLoadMapFromString(mapfile, NULL, NULL);
+  EXPECT_TRUE(map != NULL);
+  if (!map)
+    return;
+  layerObj *layer = GET_LAYER(map, 0);
+  EXPECT_TRUE(msLayerOpen(layer) == MS_SUCCESS);
+  EXPECT_TRUE(msLayerWhichItems(layer, MS_TRUE, NULL) == MS_SUCCESS);
+  EXPECT_TRUE(msLayerWhichShapes(layer, map->extent, MS_FALSE) == MS_SUCCESS);
+
+  /* the clusters come in the order of their first point */
+  const struct {
+    const char *count;
+    const char *basefid;
+    double x, y;
+  } expected[] = {{"3", "0", 2, 2}, {"2", "2", 52.5, 52.5}, {"1", "4", 90, 10}};
+  shapeObj shape;
+  msInitShape(&shape);
+  int n = 0;
+  while (msLayerNextShape(layer, &shape) == MS_SUCCESS) {
+    if (n < 3) {
+      EXPECT_STREQ(shape.values[0], expected[n].count);
+      EXPECT_STREQ(shape.values[2], expected[n].basefid);
+      EXPECT_TRUE(shape.line[0].point[0].x == expected[n].x);
+      EXPECT_TRUE(shape.line[0].point[0].y == expected[n].y);
+    }
+    ++n;
+    msFreeShape(&shape);
+  }
+  EXPECT_TRUE(n == 3);
+  msLayerClose(layer);
+
+  /* the left half of the map cuts the cell of 50 50 and 55 55, which is
+   * clustered whole all the same */
+  map->width = 50;
+  map->extent.maxx = 49;
+  EXPECT_TRUE(msLayerOpen(layer) == MS_SUCCESS);
+  EXPECT_TRUE(msLayerWhichItems(layer, MS_TRUE, NULL) == MS_SUCCESS);
+  EXPECT_TRUE(msLayerWhichShapes(layer, map->extent, MS_FALSE) == MS_SUCCESS);
+  n = 0;
+  while (msLayerNextShape(layer, &shape) == MS_SUCCESS) {
+    if (n < 2) {
+      EXPECT_STREQ(shape.values[0], expected[n].count);
+      EXPECT_TRUE(shape.line[0].point[0].x == expected[n].x);
+    }
+    ++n;
+    msFreeShape(&shape);
+  }
+  EXPECT_TRUE(n == 2);
+
+  msLayerClose(layer);
+  msFreeMap(map);
+}
+
+static void testGeneralizedShapes() {
+  const char *shpname = "test_generalized.shp";
+  shapefileObj shapefile;
+  EXPECT_TRUE(msShapefileCreate(&shapefile, const_cast<char *>(shpname),
+                                SHP_ARC) == 0);
+
+  /* a sine wave with 1000 vertices */
+  shapeObj shape;
+  msInitShape(&shape);
+  shape.type = MS_SHAPE_LINE;
+  std::vector<pointObj> points(1000);
+  for (size_t i = 0; i < points.size(); i++) {
+    points[i].x = i * 0.01;
+    points[i].y = sin(i * 0.01);
+    points[i].z = points[i].m = 0;
+  }
+  lineObj line = {(int)points.size(), points.data()};
+  shape.line = &line;
+  shape.numlines = 1;
+  EXPECT_TRUE(msSHPWriteShape(shapefile.hSHP, &shape) == 0);
+  msShapefileClose(&shapefile);
+
+  DBFHandle hDBF = msDBFCreate("test_generalized.dbf");
+  msDBFAddField(hDBF, "id", FTInteger, 5, 0);
+  msDBFWriteIntegerAttribute(hDBF, 0, 0, 1);
+  msDBFClose(hDBF);
+
+  EXPECT_TRUE(msShapefileOpen(&shapefile, "rb", shpname, MS_TRUE) == 0);
+  const double tolerances[] = {0.001, 0.1};
+  EXPECT_TRUE(msWriteGeneralizedShapes(&shapefile, "test_generalized.shg", 2,
+                                       tolerances) == MS_SUCCESS);
+
+  /* the coarsest level within a pixel, none for pixels finer than all */
+  EXPECT_TRUE(msShapefileGeneralizedLevel(&shapefile, 0.0001, 0) == -1);
+  EXPECT_TRUE(msShapefileGeneralizedLevel(&shapefile, 0.01, 0) == 0);
+  EXPECT_TRUE(msShapefileGeneralizedLevel(&shapefile, 1, 0) == 1);
+
+  int previous = (int)points.size();
+  for (int level = 0; level < 2; level++) {
+    shapeObj generalized;
+    EXPECT_TRUE(msShapefileReadGeneralized(&shapefile, level, 0, &generalized,
+                                           NULL) == MS_SUCCESS);
+    EXPECT_TRUE(generalized.type == MS_SHAPE_LINE);
+    EXPECT_TRUE(generalized.numlines == 1);
+    if (generalized.numlines == 1) {
+      const lineObj *simple = &generalized.line[0];
+      EXPECT_TRUE(simple->numpoints >= 2 && simple->numpoints < previous);
+      previous = simple->numpoints;
+      /* end points are kept, and the shape stays within the tolerance */
+      EXPECT_TRUE(simple->point[0].x == points[0].x);
+      EXPECT_TRUE(simple->point[simple->numpoints - 1].x == points.back().x);
+      double maxDistance = 0;
+      for (const auto &p : points) {
+        double distance = HUGE_VAL;
+        for (int j = 0; j + 1 < simple->numpoints; j++) {
+          const pointObj *a = &simple->point[j], *b = &simple->point[j + 1];
+          const double dx = b->x - a->x, dy = b->y - a->y;
+          const double t = std::max(
+              0.0, std::min(1.0, ((p.x - a->x) * dx + (p.y - a->y) * dy) /
+                                     (dx * dx + dy * dy)));
+          distance = std::min(distance, std::hypot(a->x + t * dx - p.x,
+                                                   a->y + t * dy - p.y));
+        }
+        maxDistance = std::max(maxDistance, distance);
+      }
+      EXPECT_TRUE(maxDistance <= tolerances[level]);
+    }
+    msFreeShape(&generalized);
+  }
+  msShapefileClose(&shapefile);
+
+  /* only drawing reads the .shg, and a truncated one is left for the .shp */
+  char mapfile[] = "MAP EXTENT 0 -5 10 5 SIZE 100 100"
+                   " LAYER NAME \"wave\" TYPE LINE STATUS ON"
+                   "  DATA \"test_generalized\" END"
+                   " END";
+  mapObj *map = msLoadMapFromString(mapfile, NULL, NULL);
+  EXPECT_TRUE(map != NULL);
+  if (map) {
+    map->cellsize = 0.1;
+    layerObj *layer = GET_LAYER(map, 0);
+    for (int pass = 0; pass < 3; pass++) {
+      const bool drawing = pass != 1;
+      if (pass == 2) {
+        FILE *fp = fopen("test_generalized.shg", "rb");
+        std::vector<char> bytes(64);
+        EXPECT_TRUE(fp && fread(bytes.data(), 1, bytes.size(), fp) == 64);
+        if (fp)
+          fclose(fp);
+        fp = fopen("test_generalized.shg", "wb");
+        EXPECT_TRUE(fp && fwrite(bytes.data(), 1, bytes.size(), fp) == 64);
+        if (fp)
+          fclose(fp);
+      }
+      EXPECT_TRUE(msLayerOpen(layer) == MS_SUCCESS);
+      EXPECT_TRUE(msLayerWhichItems(layer, MS_FALSE, NULL) == MS_SUCCESS);
+      msSHPLayerUseGeneralizedForNextWhichShapes(layer, drawing);
+      EXPECT_TRUE(msLayerWhichShapes(layer, map->extent, MS_FALSE) ==
+                  MS_SUCCESS);
+      msSHPLayerUseGeneralizedForNextWhichShapes(layer, MS_FALSE);
+      msInitShape(&shape);
+      EXPECT_TRUE(msLayerNextShape(layer, &shape) == MS_SUCCESS);
+      EXPECT_TRUE(shape.numlines == 1);
+      if (shape.numlines == 1) {
+        if (pass == 0)
+          EXPECT_TRUE(shape.line[0].numpoints < (int)points.size());
+        else
+          EXPECT_TRUE(shape.line[0].numpoints == (int)points.size());
+      }
+      msFreeShape(&shape);
+      msLayerClose(layer);
+    }
+    msResetErrorList();
+    msFreeMap(map);
+  }
+
+  remove(shpname);
+  remove("test_generalized.shx");
+  remove("test_generalized.dbf");
+  remove("test_generalized.shg");
+}
+
+/* places random labels and markers through the label cache collision tests,
+ * returns the indices of the labels that could be placed */
+static std::vector<int> placeLabels(int numLabels, int numMarkers) {
+  std::vector<int> placed;
+  char mapfile[] = "MAP SIZE 1024 1024 EXTENT 0 0 1024 1024 END";
+  mapObj *map = msLoadMapFromString(mapfile, NULL, NULL);
+  EXPECT_TRUE(map != NULL);
+  if (!map)
+    return placed;
+
+  labelObj label;
+  initLabel(&label);
+  label.partials = MS_TRUE; /* keep the labels crossing the image border */
+
+  srand(1);
+  labelCacheSlotObj *slot = &map->labelcache.slots[0];
+  slot->markers = (markerCacheMemberObj *)msSmallRealloc(
+      slot->markers, numMarkers * sizeof(markerCacheMemberObj));
+  slot->markercachesize = numMarkers;
+  for (int i = 0; i < numMarkers; i++) {
+    markerCacheMemberObj *marker = &slot->markers[slot->nummarkers++];
+    marker->id = i;
+    marker->bounds.minx = rand() % 1100 - 40;
+    marker->bounds.miny = rand() % 1100 - 40;
+    marker->bounds.maxx = marker->bounds.minx + 8;
+    marker->bounds.maxy = marker->bounds.miny + 8;
+  }
+
+  std::vector<textPathObj> paths(numLabels);
+  std::vector<textSymbolObj> symbols(numLabels);
+  std::vector<textSymbolObj *> symbolptrs(numLabels);
+  std::vector<labelCacheMemberObj> members(numLabels);
+  std::vector<lineObj> leaders(numLabels);
+  std::vector<pointObj> leaderpoints(2 * numLabels);
+  std::vector<rectObj> leaderbboxes(numLabels);
+  for (int i = 0; i < numLabels; i++) {
+    rectObj bbox;
+    bbox.minx = rand() % 1100 - 40;
+    bbox.miny = rand() % 1100 - 40;
+    bbox.maxx = bbox.minx + 40 + rand() % 100;
+    bbox.maxy = bbox.miny + 14;
+
+    memset(&paths[i], 0, sizeof(textPathObj));
+    paths[i].bounds.poly = NULL;
+    paths[i].bounds.bbox = bbox;
+    memset(&symbols[i], 0, sizeof(textSymbolObj));
+    symbols[i].label = &label;
+    symbols[i].textpath = &paths[i];
+    symbolptrs[i] = &symbols[i];
+    memset(&members[i], 0, sizeof(labelCacheMemberObj));
+    members[i].numtextsymbols = 1;
+    members[i].textsymbols = &symbolptrs[i];
+    members[i].bbox = bbox;
+
+    label_bounds lb = paths[i].bounds;
+    if (!msTestLabelCacheCollisions(map, &members[i], &lb, 0, -1))
+      continue;
+
+    /* some labels are offset from their anchor by a leader line */
+    if (i % 5 == 0) {
+      pointObj *lp = &leaderpoints[2 * i];
+      lp[0].x = (bbox.minx + bbox.maxx) / 2;
+      lp[0].y = bbox.miny;
+      lp[1].x = lp[0].x + rand() % 60 - 30;
+      lp[1].y = lp[0].y - 20 - rand() % 40;
+      if (!msTestLabelCacheLeaderCollision(map, &lp[0], &lp[1]))
+        continue;
+      leaders[i].numpoints = 2;
+      leaders[i].point = lp;
+      leaderbboxes[i].minx = MS_MIN(lp[0].x, lp[1].x);
+      leaderbboxes[i].maxx = MS_MAX(lp[0].x, lp[1].x);
+      leaderbboxes[i].miny = MS_MIN(lp[0].y, lp[1].y);
+      leaderbboxes[i].maxy = MS_MAX(lp[0].y, lp[1].y);
+      members[i].leaderline = &leaders[i];
+      members[i].leaderbbox = &leaderbboxes[i];
+    }
+    insertRenderedLabelMember(map, &members[i]);
+    placed.push_back(i);
+  }
+
+  freeLabel(&label);
+  msFreeMap(map);
+  return placed;
+}
+
+static void testLabelCacheGrid() {
+  /* the collision grid must place exactly the labels a scan of all the
+   * rendered labels and markers does */
+  msSetLabelCacheGridLinear(MS_TRUE);
+  std::vector<int> linear = placeLabels(3000, 500);
+  msSetLabelCacheGridLinear(MS_FALSE);
+  std::vector<int> grid = placeLabels(3000, 500);
+  EXPECT_TRUE(!linear.empty() && linear.size() < 3000);
+  EXPECT_TRUE(grid == linear);
+}
+
+static std::vector<unsigned char> drawMap(mapObj *map) {
+  std::vector<unsigned char> bytes;
+  imageObj *image = msDrawMap(map, MS_FALSE);
+  EXPECT_TRUE(image != NULL);
+  if (!image)
+    return bytes;
+  int size = 0;
+  unsigned char *buffer = msSaveImageBuffer(image, &size, image->format);
+  EXPECT_TRUE(buffer != NULL);
+  if (buffer)
+    bytes.assign(buffer, buffer + size);
+  msFree(buffer);
+  msFreeImage(image);
+  return bytes;
+}
+
+static void testParallelDraw() {
+  /* overlapping layers, whose own features do not overlap, must be composited
+   * exactly as if drawn in sequence */
+  char mapfile[] =
+      "MAP SIZE 300 200 EXTENT 0 0 300 200 IMAGETYPE png24"
+      " OUTPUTFORMAT NAME png24 DRIVER AGG/PNG IMAGEMODE RGB END"
+      " SYMBOL NAME \"circle\" TYPE ELLIPSE POINTS 1 1 END FILLED TRUE END"
+      " LAYER NAME \"polygons\" TYPE POLYGON STATUS ON"
+      "  FEATURE POINTS 10 10 150 20 120 150 10 10 END END"
+      "  FEATURE POINTS 170 30 290 30 250 190 170 30 END END"
+      "  CLASS STYLE COLOR 0 120 200 END END END"
+      " LAYER NAME \"lines\" TYPE LINE STATUS ON"
+      "  FEATURE POINTS 0 100 300 110 END END"
+      "  FEATURE POINTS 20 190 280 150 END END"
+      "  CLASS STYLE COLOR 200 30 30 WIDTH 3.5 OPACITY 60 END END END"
+      " LAYER NAME \"points\" TYPE POINT STATUS ON"
+      "  FEATURE POINTS 60 60 END END"
+      "  FEATURE POINTS 200 100 END END"
+      "  CLASS STYLE SYMBOL \"circle\" SIZE 21 COLOR 20 180 20 END END END"
+      " END";
+  mapObj *map = msLoadMapFromString(mapfile, NULL, NULL);
+  EXPECT_TRUE(map != NULL);
+  if (!map)
+    return;
+
+  std::vector<unsigned char> serial = drawMap(map);
+  EXPECT_TRUE(!serial.empty());
+  CPLSetConfigOption("MS_DRAW_THREADS", "4");
+  /* twice, the second map reusing the threads of the first */
+  EXPECT_TRUE(drawMap(map) == serial);
+  EXPECT_TRUE(drawMap(map) == serial);
+  CPLSetConfigOption("MS_DRAW_THREADS", NULL);
+  msFreeMap(map);
+}
+
+/* a 4x4 GeoTIFF over 0 0 4 4 filled with value, written aside and renamed
+ * over path: a dataset kept open still reads the previous file */
+static void writeTestRaster(const char *path, int value) {
+  const std::string tmpname = std::string(path) + ".tmp.tif";
+  GDALDriverH hDriver = GDALGetDriverByName("GTiff");
+  EXPECT_TRUE(hDriver != NULL);
+  if (!hDriver)
+    return;
+  GDALDatasetH hDS =
+      GDALCreate(hDriver, tmpname.c_str(), 4, 4, 1, GDT_Byte, NULL);
+  EXPECT_TRUE(hDS != NULL);
+  if (!hDS)
+    return;
+  double geotransform[6] = {0, 1, 0, 4, 0, -1};
+  GDALSetGeoTransform(hDS, geotransform);
+  EXPECT_TRUE(GDALFillRaster(GDALGetRasterBand(hDS, 1), value, 0) == CE_None);
+  GDALClose(hDS);
+  EXPECT_TRUE(rename(tmpname.c_str(), path) == 0);
+}
+
+/* a tile index of a single tile over 0 0 4 4 */
+static void writeTestTileIndex(const char *shpname, const char *location) {
+  shapefileObj shapefile;
+  EXPECT_TRUE(msShapefileCreate(&shapefile, const_cast<char *>(shpname),
+                                SHP_POLYGON) == 0);
+  pointObj points[5] = {{0, 0, 0, 0}, {4, 0, 0, 0}, {4, 4, 0, 0},
+                        {0, 4, 0, 0}, {0, 0, 0, 0}};
+  lineObj line = {5, points};
+  shapeObj shape;
+  msInitShape(&shape);
+  shape.type = MS_SHAPE_POLYGON;
+  shape.numlines = 1;
+  shape.line = &line;
+  EXPECT_TRUE(msSHPWriteShape(shapefile.hSHP, &shape) == 0);
+  msShapefileClose(&shapefile);
+
+  std::string dbfname(shpname);
+  dbfname.replace(dbfname.size() - 4, 4, ".dbf");
+  DBFHandle hDBF = msDBFCreate(dbfname.c_str());
+  msDBFAddField(hDBF, "location", FTString, 64, 0);
+  msDBFWriteStringAttribute(hDBF, 0, 0, location);
+  msDBFClose(hDBF);
+}
+
+static void setMtime(const char *path, time_t mtime) {
+  struct utimbuf times;
+  times.actime = mtime;
+  times.modtime = mtime;
+  EXPECT_TRUE(utime(path, &times) == 0);
+}
+
+static void testRasterCache() {
+  msGDALInitialize();
+  writeTestRaster("test_cache_a.tif", 10);
+  writeTestRaster("test_cache_b.tif", 200);
+  struct stat stat_buf;
+  EXPECT_TRUE(stat("test_cache_a.tif", &stat_buf) == 0);
+  const time_t mtime = stat_buf.st_mtime;
+
+  char mapfile[] = "MAP SIZE 4 4 EXTENT 0 0 4 4 IMAGETYPE png24"
+                   " OUTPUTFORMAT NAME png24 DRIVER AGG/PNG IMAGEMODE RGB END"
+                   " LAYER NAME \"raster\" TYPE RASTER STATUS ON"
+                   "  DATA \"test_cache_a.tif\" END"
+                   " END";
+  mapObj *map = msLoadMapFromString(mapfile, NULL, NULL);
+  EXPECT_TRUE(map != NULL);
+  if (!map)
+    return;
+  layerObj *layer = GET_LAYER(map, 0);
+
+  /* a file replaced behind the same mtime is still read from the dataset
+   * kept open by the first draw, a new mtime reopens it */
+  CPLSetConfigOption("MS_RASTER_DATASET_CACHE", "1");
+  const std::vector<unsigned char> dark = drawMap(map);
+  EXPECT_TRUE(!dark.empty());
+  writeTestRaster("test_cache_a.tif", 200);
+  setMtime("test_cache_a.tif", mtime);
+  EXPECT_TRUE(drawMap(map) == dark);
+  setMtime("test_cache_a.tif", mtime + 10);
+  const std::vector<unsigned char> light = drawMap(map);
+  EXPECT_TRUE(!light.empty() && light != dark);
+
+  /* a single dataset is kept open, drawing b closes a */
+  writeTestRaster("test_cache_a.tif", 10);
+  setMtime("test_cache_a.tif", mtime + 10);
+  msFree(layer->data);
+  layer->data = msStrdup("test_cache_b.tif");
+  EXPECT_TRUE(drawMap(map) == light);
+  msFree(layer->data);
+  layer->data = msStrdup("test_cache_a.tif");
+  EXPECT_TRUE(drawMap(map) == dark);
+  CPLSetConfigOption("MS_RASTER_DATASET_CACHE", NULL);
+  msRasterDatasetCacheCleanup();
+
+  /* the same for the tiles of a tile index */
+  const char *tileindex[] = {"test_cache_index.shp", "test_cache_index.shx",
+                             "test_cache_index.dbf"};
+  writeTestTileIndex(tileindex[0], "test_cache_a.tif");
+  msFree(layer->data);
+  layer->data = NULL;
+  layer->tileindex = msStrdup(tileindex[0]);
+  layer->tileitem = msStrdup("location");
+  CPLSetConfigOption("MS_TILEINDEX_CACHE", "1");
+  EXPECT_TRUE(drawMap(map) == dark);
+  writeTestTileIndex(tileindex[0], "test_cache_b.tif");
+  for (const char *filename : tileindex)
+    setMtime(filename, mtime);
+  EXPECT_TRUE(drawMap(map) == dark);
+  for (const char *filename : tileindex)
+    setMtime(filename, mtime + 10);
+  EXPECT_TRUE(drawMap(map) == light);
+  CPLSetConfigOption("MS_TILEINDEX_CACHE", NULL);
+  msRasterTileIndexCacheCleanup();
+
+  msFreeMap(map);
+  for (const char *filename : tileindex)
+    remove(filename);
+  remove("test_cache_a.tif");
+  remove("test_cache_b.tif");
+}
+
+static void writeMapfile(const char *path, const char *name) {
+  FILE *fp = fopen(path, "w");
+  EXPECT_TRUE(fp != NULL);
+  if (fp) {
+    fprintf(fp, "MAP NAME \"%s\" SIZE 10 10 EXTENT 0 0 10 10 END\n", name);
+    fclose(fp);
+  }
+}
+
+static mapObj *loadCachedMapfile(mapservObj *mapserv, const char *path) {
+  CPLSetConfigOption("MS_MAPFILE", path);
+  return msCGILoadMap(mapserv, NULL);
+}
+
+static void testMapfileCache() {
+  writeMapfile("test_cache_a.map", "a");
+  writeMapfile("test_cache_b.map", "b");
+  writeMapfile("test_cache_c.map", "c");
+  struct stat stat_buf;
+  EXPECT_TRUE(stat("test_cache_a.map", &stat_buf) == 0);
+
+  CPLSetConfigOption("MS_MAPFILE_CACHE", "2");
+  mapservObj *mapserv = msAllocMapServObj();
+  const mapCacheStatsObj *stats = msCGIGetMapCacheStats();
+  const int hits = stats->hits;
+  const int misses = stats->misses;
+
+  /* a miss parses the mapfile, a hit hands out a private copy of it */
+  mapObj *map = loadCachedMapfile(mapserv, "test_cache_a.map");
+  EXPECT_TRUE(map != NULL);
+  if (map) {
+    EXPECT_STREQ(map->name, "a");
+    msFree(map->name);
+    map->name = msStrdup("modified");
+    msFreeMap(map);
+  }
+  EXPECT_TRUE(stats->misses == misses + 1);
+  map = loadCachedMapfile(mapserv, "test_cache_a.map");
+  EXPECT_TRUE(map != NULL);
+  if (map) {
+    EXPECT_STREQ(map->name, "a");
+    EXPECT_TRUE(map->latlon.numargs > 0 && map->latlon.proj != NULL);
+    msFreeMap(map);
+  }
+  EXPECT_TRUE(stats->hits == hits + 1);
+
+  /* a new mtime reparses the mapfile */
+  writeMapfile("test_cache_a.map", "a2");
+  setMtime("test_cache_a.map", stat_buf.st_mtime + 10);
+  map = loadCachedMapfile(mapserv, "test_cache_a.map");
+  EXPECT_TRUE(map != NULL);
+  if (map) {
+    EXPECT_STREQ(map->name, "a2");
+    msFreeMap(map);
+  }
+  EXPECT_TRUE(stats->misses == misses + 2);
+
+  /* with two entries, c evicts a, the least recently used one */
+  map = loadCachedMapfile(mapserv, "test_cache_b.map");
+  msFreeMap(map);
+  map = loadCachedMapfile(mapserv, "test_cache_c.map");
+  msFreeMap(map);
+  map = loadCachedMapfile(mapserv, "test_cache_b.map");
+  msFreeMap(map);
+  EXPECT_TRUE(stats->misses == misses + 4);
+  EXPECT_TRUE(stats->hits == hits + 2);
+  map = loadCachedMapfile(mapserv, "test_cache_a.map");
+  msFreeMap(map);
+  EXPECT_TRUE(stats->misses == misses + 5);
+
+  msCGIFreeMapCache();
+  msFreeMapServObj(mapserv);
+  CPLSetConfigOption("MS_MAPFILE_CACHE", NULL);
+  CPLSetConfigOption("MS_MAPFILE", NULL);
+  remove("test_cache_a.map");
+  remove("test_cache_b.map");
+  remove("test_cache_c.map");
+}
+
+/* writes a point shapefile with a pseudo random scatter of points over
+ * [0,100]x[0,100], and returns them */
+static std::vector<pointObj> writeTestPoints(const char *shpname, int n) {
+  std::vector<pointObj> points(n);
+  shapefileObj shapefile;
+  EXPECT_TRUE(msShapefileCreate(&shapefile, const_cast<char *>(shpname),
+                                SHP_POINT) == 0);
+  std::string dbfname(shpname);
+  dbfname.replace(dbfname.size() - 4, 4, ".dbf");
+  DBFHandle hDBF = msDBFCreate(dbfname.c_str());
+  msDBFAddField(hDBF, "id", FTInteger, 5, 0);
+  srand(1);
+  for (int i = 0; i < n; i++) {
+    points[i].x = rand() % 10001 / 100.0;
+    points[i].y = rand() % 10001 / 100.0;
+    points[i].z = points[i].m = 0;
+    EXPECT_TRUE(msSHPWritePoint(shapefile.hSHP, &points[i]) == i);
+    msDBFWriteIntegerAttribute(hDBF, i, 0, i);
+  }
+  msShapefileClose(&shapefile);
+  msDBFClose(hDBF);
+  return points;
+}
+
+static void testDiskTree() {
+  const int numshapes = 500;
+  std::vector<pointObj> points = writeTestPoints("test_tree.shp", numshapes);
+
+  shapefileObj shapefile;
+  EXPECT_TRUE(msShapefileOpen(&shapefile, "rb", "test_tree.shp", MS_TRUE) ==
+              0);
+  treeObj *tree = msCreateTree(&shapefile, 0);
+  msTreeTrim(tree);
+  EXPECT_TRUE(msWriteTree(tree, const_cast<char *>("test_tree.qix"),
+                          MS_NEW_LSB_ORDER) == MS_TRUE);
+  msDestroyTree(tree);
+  msShapefileClose(&shapefile);
+
+  long filesize = 0;
+  FILE *fp = fopen("test_tree.qix", "rb");
+  if (fp) {
+    fseek(fp, 0, SEEK_END);
+    filesize = ftell(fp);
+    fclose(fp);
+  }
+
+  /* the index must read the same, whether it is memory mapped or not */
+  rectObj aoi = {20, 30, 45, 60};
+  for (const char *mmap : {"NO", "YES"}) {
+    CPLSetConfigOption("MS_SHAPEFILE_MMAP", mmap);
+    SHPTreeHandle qix = msSHPDiskTreeOpen("test_tree.qix", 0);
+    EXPECT_TRUE(qix != NULL);
+    if (!qix)
+      continue;
+    EXPECT_TRUE(qix->nShapes == numshapes);
+
+    /* the nodes are stored one after the other, each shape in one of them */
+    int count = 0;
+    treeNodeObj *node;
+    while ((node = readTreeNode(qix)) != NULL) {
+      count += node->numshapes;
+      msFree(node->ids);
+      msFree(node);
+    }
+    EXPECT_TRUE(count == numshapes);
+    EXPECT_TRUE(msSHPDiskTreeTell(qix) == filesize);
+    msSHPDiskTreeClose(qix);
+
+    /* the search returns a superset of the points within the rectangle */
+    ms_bitarray status =
+        msSearchDiskTree("test_tree.qix", aoi, 0, numshapes);
+    EXPECT_TRUE(status != NULL);
+    if (!status)
+      continue;
+    for (int i = 0; i < numshapes; i++) {
+      if (msPointInRect(&points[i], &aoi))
+        EXPECT_TRUE(msGetBit(status, i));
+    }
+    msFree(status);
+  }
+  CPLSetConfigOption("MS_SHAPEFILE_MMAP", NULL);
+
+  remove("test_tree.shp");
+  remove("test_tree.shx");
+  remove("test_tree.dbf");
+  remove("test_tree.qix");
+}
+
+/* shapes selected by msShapefileWhichShapes() */
+static std::vector<int> selectedShapes(shapefileObj *shapefile, rectObj rect) {
+  std::vector<int> selected;
+  if (msShapefileWhichShapes(shapefile, rect, 0) != MS_SUCCESS)
+    return selected;
+  for (int i = msShapefileNextSelected(shapefile, 0); i >= 0;
+       i = msShapefileNextSelected(shapefile, i + 1))
+    selected.push_back(i);
+  return selected;
+}
+
+static void testRTree() {
+  const int numshapes = 1000;
+  std::vector<pointObj> points = writeTestPoints("test_rtree.shp", numshapes);
+
+  shapefileObj shapefile;
+  EXPECT_TRUE(msShapefileOpen(&shapefile, "rb", "test_rtree.shp", MS_TRUE) ==
+              0);
+  EXPECT_TRUE(msWriteRTree(&shapefile, "test_rtree.qrt",
+                           MS_RTREE_DEFAULT_NODESIZE) == MS_SUCCESS);
+  treeObj *tree = msCreateTree(&shapefile, 0);
+  msTreeTrim(tree);
+  EXPECT_TRUE(msWriteTree(tree, const_cast<char *>("test_rtree.qix"),
+                          MS_NEW_LSB_ORDER) == MS_TRUE);
+  msDestroyTree(tree);
+
+  const rectObj rects[] = {{20, 30, 45, 60},
+                           {0, 0, 1, 1},
+                           {50.5, 50.5, 50.6, 50.6},
+                           {-10, 40, 110, 42}};
+  for (const char *mmap : {"NO", "YES"}) {
+    CPLSetConfigOption("MS_SHAPEFILE_MMAP", mmap);
+    for (const rectObj &rect : rects) {
+      std::vector<int> expected;
+      for (int i = 0; i < numshapes; i++) {
+        if (msPointInRect(&points[i], &rect))
+          expected.push_back(i);
+      }
+
+      /* the R-tree gives the exact matches, in file order */
+      ms_int32 *ids = NULL;
+      int numids = 0;
+      EXPECT_TRUE(msSearchDiskRTree("test_rtree.qrt", rect, 0, numshapes, &ids,
+                                    &numids) == MS_SUCCESS);
+      EXPECT_TRUE(std::vector<int>(ids, ids + numids) == expected);
+      msFree(ids);
+
+      /* and so must the shapefile selection through the .qrt, the filtered
+       * .qix and a full scan */
+      EXPECT_TRUE(selectedShapes(&shapefile, rect) == expected);
+      rename("test_rtree.qrt", "test_rtree.qrt.bak");
+      EXPECT_TRUE(selectedShapes(&shapefile, rect) == expected);
+      rename("test_rtree.qix", "test_rtree.qix.bak");
+      EXPECT_TRUE(selectedShapes(&shapefile, rect) == expected);
+      rename("test_rtree.qrt.bak", "test_rtree.qrt");
+      rename("test_rtree.qix.bak", "test_rtree.qix");
+    }
+  }
+  CPLSetConfigOption("MS_SHAPEFILE_MMAP", NULL);
+  msShapefileClose(&shapefile);
+
+  remove("test_rtree.shp");
+  remove("test_rtree.shx");
+  remove("test_rtree.dbf");
+  remove("test_rtree.qrt");
+  remove("test_rtree.qix");
+}
+
+/* serves tile "0 0 0" of a request with the given parameters through the
+ * tile cache, returns the encoded tile */
+static std::string
+drawCachedTile(const std::vector<std::pair<const char *, const char *>> &params) {
+  char mapfile[] =
+      "MAP NAME \"tilecache\" SIZE 256 256 EXTENT -180 -90 180 90"
+      " IMAGETYPE png PROJECTION \"+proj=longlat +datum=WGS84\" END"
+      " WEB METADATA \"tile_cache_path\" \"test_tilecache\" END"
+      "  VALIDATION \"color\" \"^[0-9]+$\" END END"
+      " LAYER NAME \"box\" TYPE POLYGON STATUS DEFAULT"
+      "  FEATURE POINTS -90 -45 90 -45 90 45 -90 45 -90 -45 END END"
+      "  CLASS STYLE COLOR 255 0 0 END END END"
+      " END";
+  std::string tile;
+  mapservObj *msObj = msAllocMapServObj();
+  msObj->map = msLoadMapFromString(mapfile, NULL, NULL);
+  for (const auto &param : params) {
+    cgiRequestObj *request = msObj->request;
+    request->ParamNames[request->NumParams] = msStrdup(param.first);
+    request->ParamValues[request->NumParams++] = msStrdup(param.second);
+  }
+  msObj->TileMode = TILE_GMAP;
+  msObj->TileCoords = msStrdup("0 0 0");
+  if (msObj->map && msTileSetup(msObj) == MS_SUCCESS &&
+      msTileSetExtent(msObj) == MS_SUCCESS) {
+    int size = 0;
+    unsigned char *data = msTileCacheDraw(msObj, &size);
+    if (data)
+      tile.assign(reinterpret_cast<char *>(data), size);
+    msFree(data);
+  }
+  msFreeMapServObj(msObj);
+  return tile;
+}
+
+/* the cache directories, one per cache key */
+static std::vector<std::string> tileCacheDirs(const char *path) {
+  std::vector<std::string> dirs;
+  char **entries = VSIReadDir(path);
+  for (int i = 0; entries && entries[i]; i++) {
+    if (strcmp(entries[i], ".") != 0 && strcmp(entries[i], "..") != 0)
+      dirs.push_back(entries[i]);
+  }
+  CSLDestroy(entries);
+  return dirs;
+}
+
+static void testTileCache() {
+  VSIRmdirRecursive("test_tilecache");
+
+  const std::string tile = drawCachedTile({{"mode", "tile"},
+                                           {"tilemode", "gmap"},
+                                           {"tile", "0 0 0"},
+                                           {"layers", "box"}});
+  EXPECT_TRUE(tile.size() > 8 && tile.compare(1, 3, "PNG") == 0);
+  std::vector<std::string> dirs = tileCacheDirs("test_tilecache");
+  EXPECT_TRUE(dirs.size() == 1);
+  if (dirs.size() != 1)
+    return;
+
+  /* the lock of the metatile is gone once its tiles are written */
+  EXPECT_TRUE(
+      tileCacheDirs(("test_tilecache/" + dirs[0] + "/lock").c_str()).empty());
+
+  /* mark the cached tile to tell the cache hits from renderings */
+  const std::string cached = "test_tilecache/" + dirs[0] + "/0/0/0.png";
+  FILE *fp = fopen(cached.c_str(), "wb");
+  EXPECT_TRUE(fp != NULL);
+  if (fp) {
+    fputs("cached", fp);
+    fclose(fp);
+  }
+
+  /* the order of the parameters and the ones the tile mode does not use
+   * make no difference */
+  EXPECT_TRUE(drawCachedTile({{"layers", "box"},
+                              {"foo", "bar"},
+                              {"tile", "0 0 0"},
+                              {"tilemode", "gmap"},
+                              {"_", "1234567"},
+                              {"mode", "tile"}}) == "cached");
+  EXPECT_TRUE(tileCacheDirs("test_tilecache").size() == 1);
+
+  /* a runtime substitution does */
+  EXPECT_TRUE(drawCachedTile({{"mode", "tile"},
+                              {"tilemode", "gmap"},
+                              {"tile", "0 0 0"},
+                              {"layers", "box"},
+                              {"color", "12"}}) == tile);
+  EXPECT_TRUE(tileCacheDirs("test_tilecache").size() == 2);
+
+  /* requests modifying the mapfile are not cached */
+  char mapfile[] =
+      "MAP WEB METADATA \"tile_cache_path\" \"test_tilecache\" END END END";
+  mapservObj *msObj = msAllocMapServObj();
+  msObj->map = msLoadMapFromString(mapfile, NULL, NULL);
+  EXPECT_TRUE(msObj->map != NULL);
+  if (msObj->map) {
+    cgiRequestObj *request = msObj->request;
+    request->ParamNames[request->NumParams] = msStrdup("mode");
+    request->ParamValues[request->NumParams++] = msStrdup("tile");
+    EXPECT_TRUE(msTileCacheEnabled(msObj));
+    request->ParamNames[request->NumParams] = msStrdup("map.imagecolor");
+    request->ParamValues[request->NumParams++] = msStrdup("0 0 255");
+    EXPECT_TRUE(!msTileCacheEnabled(msObj));
+  }
+  msFreeMapServObj(msObj);
+
+  VSIRmdirRecursive("test_tilecache");
+}
+
 int main() {
   testRedactCredentials();
   testToString();
+  testCompiledExpression();
+  testGaussianBlur();
+  testIdw();
+  testProjectPoints();
+  testApproxReprojection();
+  testArena();
+  testMetrics();
+  testQuantization();
+  testPNGEncoding();
+  testClassIndex();
+  testCSVJoin();
+  testDBFJoin();
+  testGridCluster();
+  testGeneralizedShapes();
+  testLabelCacheGrid();
+  testParallelDraw();
+  testRasterCache();
+  testMapfileCache();
+  testDiskTree();
+  testRTree();
+  testTileCache();
+  testOGRWkbDecoder();
   return gTestRetCode;
 }